@@ -3,10 +3,13 @@
  * local heaps.
  *
  * The types id:s declared here are used in many test cases, as well as in the
- * microbenchmarks. They are defined in the test_type_info.c testcase, it is
+ * microbenchmarks and by type_gen. They are defined in basic_types.c, it is
  * recommended that a set of useful types are identified and placed in a more
  * logical place before this system is put into production use.
  *
+ * The ids are listed once, in BASIC_TYPES, in the order of their values.
+ * Tools that need the names of the types expand the same list.
+ *
  * @file basic_types.h
  * @author Martin Hagelin
  * @date Decmber, 2014
@@ -16,20 +19,58 @@
 #ifndef __BASIC_TYPES_H__
 #define __BASIC_TYPES_H__
 
+/**
+ * @brief The basic types, in the order of their ids. X(name) is expanded once
+ *        for every type.
+ */
+#define BASIC_TYPES(X) \
+    X(CHAR_TYPE_ID) \
+    X(LONG_TYPE_ID) \
+    X(CHAR_REF_TYPE_ID) \
+    X(COMPOSITE_TYPE_1_ID) \
+    X(COMPOSITE_TYPE_2_ID) \
+    X(LIST_GLOBAL_REF_TYPE_ID) \
+    X(LIST_LOCAL_REF_TYPE_ID) \
+    X(LIST_TYPE_ID) \
+    X(BTREE_LOCAL_REF_TYPE_ID) \
+    X(BTREE_TYPE_ID) \
+    X(OTREE_LOCAL_REF_TYPE_ID) \
+    X(OTREE_TYPE_ID) \
+    X(REFERENCE_TABLE_ENTRY) \
+    X(LONG_COLUMN_TYPE_ID) \
+    X(PAIR_TYPE_ID) \
+    X(WIDE_TYPE_ID) \
+    X(WIDE_COLORED_TYPE_ID) \
+    X(KV_TYPE_ID) \
+    X(KV_TREE_TYPE_ID) \
+    X(GROUPED_LIST_TYPE_ID)
+
+#define BASIC_TYPE_ENUM(name) name,
+
 typedef enum type_ids {
-    CHAR_TYPE_ID = 0,
-    LONG_TYPE_ID = 1,
-    CHAR_REF_TYPE_ID = 2,
-    COMPOSITE_TYPE_1_ID = 3,
-    COMPOSITE_TYPE_2_ID = 4,
-    LIST_GLOBAL_REF_TYPE_ID = 5,
-    LIST_LOCAL_REF_TYPE_ID = 6,
-    LIST_TYPE_ID = 7,
-    BTREE_LOCAL_REF_TYPE_ID = 8,
-    BTREE_TYPE_ID = 9,
-    OTREE_LOCAL_REF_TYPE_ID = 10,
-    OTREE_TYPE_ID = 11,
-    REFERENCE_TABLE_ENTRY = 12
+    BASIC_TYPES(BASIC_TYPE_ENUM)
+    BASIC_TYPE_COUNT
 } TYPE_ID;
 
+#undef BASIC_TYPE_ENUM
+
+struct type_info;
+
+/**
+ * @brief Registers the basic types with init_type_table().
+ *
+ * @return 0 on success.
+ */
+int
+add_basic_types(void);
+
+/**
+ * @brief Gets the description that a basic type is registered with.
+ *
+ * @param type_id One of the basic types.
+ * @return The type_info of the type, or NULL if there is no such type.
+ */
+const struct type_info*
+basic_type_info(TYPE_ID type_id);
+
 #endif
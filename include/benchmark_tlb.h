@@ -0,0 +1,31 @@
+/** 
+ * @brief Counts data TLB misses around a piece of benchmarked code.
+ *
+ * Uses the perf_event_open interface of linux. When hardware counters are not
+ * available, for instance in virtual machines or under a strict
+ * perf_event_paranoid setting, the counters report -1.
+ *
+ * @file benchmark_tlb.h
+ */
+
+#ifndef __BENCHMARK_TLB_H__
+#define __BENCHMARK_TLB_H__
+
+/**
+ * @brief Opens and starts a counter of dTLB read misses in the calling thread.
+ *
+ * @return A counter to pass to tlb_counter_stop(), -1 if none could be opened.
+ */
+int
+tlb_counter_start(void);
+
+/**
+ * @brief Stops and closes a counter opened with tlb_counter_start().
+ *
+ * @param counter The counter to stop.
+ * @return The number of misses counted, -1 if the counter was not available.
+ */
+long long
+tlb_counter_stop(int counter);
+
+#endif
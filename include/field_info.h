@@ -3,8 +3,9 @@
  *
  * The information in this file is not part of the public interface and may
  * change at any time. It may however be of interest to anyone wanting to
- * extend or modify the local-heaps system. Some work remains, the
- * representation could for instance be more compact.
+ * extend or modify the local-heaps system. The type table keeps the full
+ * description of each type, while the accessors work from the compact type
+ * descriptors derived from it.
  *
  * @file field_info.h
  * @author Martin Hagelin
@@ -32,6 +33,8 @@ typedef struct field_offset {
     uint16_t    type_id;
     size_t      field_size;     /* Size of field in bytes */
     size_t      offset;         /* Offset into object, in bytes */
+    size_t      group_size;     /* Size of its interleaved group, or 0 */
+    size_t      group_offset;   /* Offset into its interleaved group */
 } *Field_offsets;
 
 /**
@@ -43,11 +46,94 @@ typedef struct field_offset {
 typedef struct type_offsets {
     uint16_t            type_class;
     uint16_t            referee_type_id;
+    uint16_t            sub_pool_shift; /* log2 of the objects per subpool */
+    uint16_t            cache_colored;  /* Field arrays and pools staggered */
     size_t              type_size;
     size_t              field_count;
     struct field_offset *field_offsets;
 } *Type_table;
 
+/**
+ * @brief field_descriptor.stride_shift of fields whose size is not a power of
+ *        two, and that are not in an interleaved group.
+ */
+#define FIELD_SIZE_NOT_POW2 0xff
+
+/**
+ * @brief The largest field a type can have, in bytes.
+ */
+#define MAX_FIELD_SIZE (((size_t) 1 << 24) - 1)
+
+/**
+ * @brief Where a field of a type is found within a subpool.
+ *
+ * The stride is the distance between the field of one object and the next.
+ * It is the size of the field, or the size of the interleaved group that the
+ * field is in, which is always a power of two.
+ */
+typedef struct field_descriptor {
+    uint32_t    offset;             /* Of the field of object 0, in bytes */
+    uint32_t    size         : 24;  /* Size of the field, in bytes */
+    uint32_t    stride_shift : 8;   /* log2 of stride, or FIELD_SIZE_NOT_POW2 */
+} field_descriptor;
+
+/**
+ * @brief Everything needed to find the fields of an object of a type, with
+ *        the subpool shift already applied to the offsets.
+ *
+ * For colored types the offsets include the color of each field, and the
+ * subpool size a page of padding.
+ *
+ * The header takes 24 bytes and each field 8, so the descriptor of a type with
+ * up to five fields fits in a cache line, and up to thirteen in two.
+ * Descriptors are built by init_type_table() and are read only.
+ */
+typedef struct type_descriptor {
+    size_t              sub_pool_size;  /* Size of a subpool, in bytes */
+    uint32_t            type_size;      /* Size of an object, in bytes */
+    uint32_t            field_count;
+    uint16_t            type_id;
+    uint16_t            sub_pool_shift; /* log2 of the objects per subpool */
+    uint16_t            local_ref_count;/* Local references the type starts with */
+    uint8_t             type_class;
+    uint8_t             pool_color_mask;/* POOL_COLORS - 1 if colored, or 0 */
+    field_descriptor    fields[];
+} type_descriptor;
+
+/**
+ * @brief The descriptors of all types, in one array indexed by type id.
+ *
+ * Every descriptor takes 1 << type_descriptor_shift bytes, a whole number of
+ * cache lines large enough for the type with the most fields, and starts on a
+ * cache line. Use TYPE_DESCRIPTOR_OF_ID() or get_type_descriptor() to look one
+ * up.
+ */
+extern const char *type_descriptors;
+
+/**
+ * @brief log2 of the distance between two descriptors in type_descriptors.
+ */
+extern unsigned type_descriptor_shift;
+
+/**
+ * @brief Gets the descriptor of a type, without a bounds check.
+ *
+ * @param id The id of a type in the current type table.
+ * @return A pointer to the type_descriptor of the type.
+ */
+#define TYPE_DESCRIPTOR_OF_ID(id) \
+    ((const type_descriptor*) (type_descriptors + \
+                               ((size_t) (id) << type_descriptor_shift)))
+
+/**
+ * @brief Gets the descriptor of a type, for use with the inline accessors.
+ *
+ * @param type_id The id of a type in the current type table.
+ * @return The descriptor of the type, or NULL if there is no such type.
+ */
+const type_descriptor*
+get_type_descriptor(uint16_t type_id);
+
 #ifndef __RELEASE__
 /* 
  * Two functions declared in type_info.c that are NOT part of the public
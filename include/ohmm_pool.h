@@ -0,0 +1,411 @@
+/**
+ * @brief A typed C++ view of pools, with the field layout known at compile
+ *        time.
+ *
+ * init_type_table() works out the offsets of every field when the program
+ * starts, and the C accessors look them up in the type table. In C++ the
+ * fields of a type can be listed as template arguments instead, and the same
+ * offsets follow as constant expressions:
+ *
+ *     typedef ohmm::pool<ohmm::local_ref, ohmm::local_ref,
+ *                        uint64_t, uint64_t> btree;
+ *
+ *     btree tree(BTREE_TYPE_ID);
+ *     global_reference node = tree.alloc();
+ *     btree::set<2>(node, key);
+ *     global_reference left = btree::get<0>(node);
+ *
+ * Accesses compile to a load or a store at a constant offset in the subpool.
+ * The pools themselves are created and grown by the C library, so the type
+ * still has to be registered with init_type_table(). Its fields are listed
+ * flattened, in the order fill_in_offsets() lays them out, and describes()
+ * checks that the two agree. References are the ordinary 64 bit global
+ * references, and can be handed to and from C code freely.
+ *
+ * Fields are trivially copyable types, ohmm::local_ref for a local reference
+ * to an object in the same pool, or ohmm::global_ref for a global reference.
+ *
+ * @file ohmm_pool.h
+ * @author Martin Hagelin
+ * @date March, 2015
+ */
+
+#ifndef __OHMM_POOL_H__
+#define __OHMM_POOL_H__
+
+#ifndef __cplusplus
+#error "ohmm_pool.h is a C++ header, C code can use pool_inline.h instead"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+extern "C" {
+#include "pool.h"
+#include "type_info.h"
+#include "field_info.h"
+}
+
+namespace ohmm {
+
+/**
+ * @brief Marks a field that holds a local reference to an object in the same
+ *        pool.
+ */
+struct local_ref {};
+
+/**
+ * @brief Marks a field that holds a global reference.
+ */
+struct global_ref {};
+
+/**
+ * @brief How a field of type T is stored, and what it reads as.
+ */
+template <typename T>
+struct field_traits {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "fields are copied as plain memory");
+
+    typedef T                   storage_type;
+    typedef T                   value_type;
+    static constexpr size_t     size = sizeof(T);
+    static constexpr bool       is_local_ref = false;
+};
+
+template <>
+struct field_traits<local_ref> {
+    typedef uint16_t            storage_type;
+    typedef global_reference    value_type;
+    static constexpr size_t     size = sizeof(uint16_t);
+    static constexpr bool       is_local_ref = true;
+};
+
+template <>
+struct field_traits<global_ref> {
+    typedef global_reference    storage_type;
+    typedef global_reference    value_type;
+    static constexpr size_t     size = sizeof(global_reference);
+    static constexpr bool       is_local_ref = false;
+};
+
+namespace detail {
+
+/* The size of an object, and the number of local references it holds */
+template <typename... Fields>
+struct layout;
+
+template <>
+struct layout<> {
+    static constexpr size_t size = 0;
+    static constexpr size_t local_ref_count = 0;
+};
+
+template <typename Head, typename... Tail>
+struct layout<Head, Tail...> {
+    static constexpr size_t size = field_traits<Head>::size +
+                                   layout<Tail...>::size;
+    static constexpr size_t local_ref_count =
+        (field_traits<Head>::is_local_ref ? 1 : 0) +
+        layout<Tail...>::local_ref_count;
+};
+
+/* The type of field I, and its offset into an object */
+template <size_t I, typename... Fields>
+struct nth_field;
+
+template <typename Head, typename... Tail>
+struct nth_field<0, Head, Tail...> {
+    typedef Head                type;
+    static constexpr size_t     offset = 0;
+};
+
+template <size_t I, typename Head, typename... Tail>
+struct nth_field<I, Head, Tail...> {
+    static_assert(I <= sizeof...(Tail), "no such field");
+
+    typedef typename nth_field<I - 1, Tail...>::type type;
+    static constexpr size_t offset = field_traits<Head>::size +
+                                     nth_field<I - 1, Tail...>::offset;
+};
+
+/*
+ * The parts of a global reference, see reference_struct in pool_private.h.
+ * The index of an object is split into a 16 bit subpool id and a 12 bit
+ * index, whatever the subpool shift of its type.
+ */
+constexpr unsigned  SUB_POOL_ID_SHIFT = 16;
+constexpr unsigned  POOL_ID_SHIFT = 32;
+constexpr unsigned  INDEX_SHIFT = 48;
+constexpr unsigned  INDEX_BITS = 12;
+constexpr uint64_t  IS_EXTENDED_BIT = (uint64_t) 1 << 61;
+
+inline size_t
+index_of(global_reference ref)
+{
+    return ((ref >> SUB_POOL_ID_SHIFT) & 0xffff) << INDEX_BITS |
+           ((ref >> INDEX_SHIFT) & ((1u << INDEX_BITS) - 1));
+}
+
+inline global_reference
+with_index(global_reference ref, size_t idx)
+{
+    const uint64_t mask = (uint64_t) 0xffff << SUB_POOL_ID_SHIFT |
+                          (uint64_t) ((1u << INDEX_BITS) - 1) << INDEX_SHIFT;
+
+    return (ref & ~mask) |
+           (uint64_t) (idx >> INDEX_BITS) << SUB_POOL_ID_SHIFT |
+           (uint64_t) (idx & ((1u << INDEX_BITS) - 1)) << INDEX_SHIFT;
+}
+
+/* Local references hold a 13 bit signed distance and a long reference flag */
+constexpr uint16_t  LOCAL_INDEX_MASK = (1u << 13) - 1;
+constexpr uint16_t  LOCAL_IS_LONG_BIT = 1u << 13;
+
+} /* namespace detail */
+
+/**
+ * @brief A pool of objects whose fields are Fields..., with 1 << Shift objects
+ *        in each subpool.
+ *
+ * An instance owns one pool, and destroys it when it goes out of scope. The
+ * accessors are static, as references carry their pool with them.
+ */
+template <unsigned Shift, typename... Fields>
+class basic_pool {
+    static_assert(sizeof...(Fields) > 0, "a type needs at least one field");
+    static_assert(Shift <= MAX_SUB_POOL_SHIFT, "subpool shift out of range");
+
+    typedef detail::layout<Fields...> layout;
+
+public:
+    static constexpr size_t     field_count = sizeof...(Fields);
+    static constexpr size_t     type_size = layout::size;
+    static constexpr size_t     local_ref_count = layout::local_ref_count;
+    static constexpr unsigned   sub_pool_shift = Shift;
+    static constexpr size_t     sub_pool_length = (size_t) 1 << Shift;
+    static constexpr size_t     sub_pool_size = type_size << Shift;
+
+    /** @brief The type field I was declared with. */
+    template <size_t I>
+    using field = typename detail::nth_field<I, Fields...>::type;
+
+    /** @brief What field I is stored as in memory. */
+    template <size_t I>
+    using storage_type = typename field_traits<field<I>>::storage_type;
+
+    /** @brief What get<I>() returns and set<I>() takes. */
+    template <size_t I>
+    using value_type = typename field_traits<field<I>>::value_type;
+
+    /** @brief The offset of the array of field I in a subpool, in bytes. */
+    template <size_t I>
+    static constexpr size_t
+    offset()
+    {
+        return detail::nth_field<I, Fields...>::offset << Shift;
+    }
+
+    /** @brief The size of field I, in bytes. */
+    template <size_t I>
+    static constexpr size_t
+    size()
+    {
+        return field_traits<field<I>>::size;
+    }
+
+    /**
+     * @brief Creates a pool of objects of a registered type.
+     *
+     * The accessors assume the layout of this class, so no pool is created
+     * for a type that describes() rejects, and valid() is false.
+     *
+     * @param type_id A type that init_type_table() laid out like this class.
+     */
+    explicit basic_pool(uint16_t type_id) :
+        pool_(describes(type_id) ? pool_create(type_id) : NULL_POOL) {}
+
+    basic_pool(basic_pool &&other) : pool_(other.pool_)
+    {
+        other.pool_ = NULL_POOL;
+    }
+
+    basic_pool(const basic_pool&) = delete;
+    basic_pool& operator=(const basic_pool&) = delete;
+
+    ~basic_pool()
+    {
+        if (NULL_POOL != pool_)
+            pool_destroy(&pool_);
+    }
+
+    /** @brief The reference of the pool, for use with the C interface. */
+    pool_reference
+    reference() const
+    {
+        return pool_;
+    }
+
+    /** @brief A pointer to the reference, for C functions that update it. */
+    pool_reference*
+    reference_ptr()
+    {
+        return &pool_;
+    }
+
+    /** @brief False if the pool could not be created. */
+    bool
+    valid() const
+    {
+        return NULL_POOL != pool_;
+    }
+
+    /** @brief Allocates an object, see pool_alloc(). */
+    global_reference
+    alloc()
+    {
+        return pool_alloc(&pool_);
+    }
+
+    /** @brief Grows the pool by n objects, see pool_grow(). */
+    int
+    grow(size_t n)
+    {
+        return pool_grow(&pool_, n);
+    }
+
+    /**
+     * @brief Checks that the type table lays out a type like this class.
+     *
+     * Colored types are never described, as their fields move with the pool,
+     * and neither are types with padded interleaved groups.
+     *
+     * @param type_id The id of a registered type.
+     * @return True if the subpool shift, field sizes and offsets all agree.
+     */
+    static bool
+    describes(uint16_t type_id)
+    {
+        const type_descriptor *desc = get_type_descriptor(type_id);
+        if (NULL == desc || desc->sub_pool_shift != Shift ||
+            desc->pool_color_mask != 0 || desc->type_size != type_size ||
+            desc->field_count != field_count ||
+            desc->sub_pool_size != sub_pool_size)
+            return false;
+
+        size_t offset = 0;
+        for (size_t f = 0 ; f < field_count ; ++f) {
+            if (desc->fields[f].offset != offset << Shift ||
+                desc->fields[f].size != sizes[f])
+                return false;
+            offset += sizes[f];
+        }
+
+        return true;
+    }
+
+    /** @brief The address of field I of the object a reference points to. */
+    template <size_t I>
+    static storage_type<I>*
+    address(global_reference ref)
+    {
+        size_t idx = detail::index_of(ref);
+        uintptr_t pool_start = (uintptr_t) (ref >> detail::POOL_ID_SHIFT &
+                                            0xffff) << 32;
+
+        return (storage_type<I>*) (pool_start +
+                                   (idx >> Shift)*sub_pool_size +
+                                   offset<I>() +
+                                   size<I>()*(idx & (sub_pool_length - 1)));
+    }
+
+    /**
+     * @brief Reads field I of an object.
+     *
+     * Local references are returned as global references, like
+     * get_field_reference() does.
+     */
+    template <size_t I>
+    static value_type<I>
+    get(global_reference ref)
+    {
+        return accessor<I>::get(ref);
+    }
+
+    /**
+     * @brief Writes field I of an object.
+     *
+     * Local references are written with set_field_reference(), which may
+     * have to add an entry to the reference table.
+     *
+     * @return 0 on success.
+     */
+    template <size_t I>
+    static int
+    set(global_reference ref, const value_type<I> &value)
+    {
+        return accessor<I>::set(ref, value);
+    }
+
+private:
+    static constexpr size_t sizes[] = {field_traits<Fields>::size...};
+
+    template <size_t I, bool = field_traits<field<I>>::is_local_ref>
+    struct accessor {
+        static value_type<I>
+        get(global_reference ref)
+        {
+            return *address<I>(ref);
+        }
+
+        static int
+        set(global_reference ref, const value_type<I> &value)
+        {
+            *address<I>(ref) = value;
+            return 0;
+        }
+    };
+
+    template <size_t I>
+    struct accessor<I, true> {
+        static global_reference
+        get(global_reference ref)
+        {
+            uint16_t local = *address<I>(ref);
+            if (0 == local)
+                return NULL_REF;
+
+            /* Long references live in the reference table */
+            if (0 != (local & detail::LOCAL_IS_LONG_BIT) ||
+                0 != (ref & detail::IS_EXTENDED_BIT))
+                return get_field_reference(ref, I);
+
+            /* Sign extend the 13 bit distance */
+            int distance = (int) ((local & detail::LOCAL_INDEX_MASK) ^ 0x1000) -
+                           0x1000;
+            return detail::with_index(ref, detail::index_of(ref) + distance);
+        }
+
+        static int
+        set(global_reference ref, global_reference that)
+        {
+            return set_field_reference(ref, I, that);
+        }
+    };
+
+    pool_reference  pool_;
+};
+
+template <unsigned Shift, typename... Fields>
+constexpr size_t basic_pool<Shift, Fields...>::sizes[];
+
+/**
+ * @brief A pool with the default subpool length.
+ */
+template <typename... Fields>
+using pool = basic_pool<DEFAULT_SUB_POOL_SHIFT, Fields...>;
+
+} /* namespace ohmm */
+
+#endif
@@ -48,11 +48,83 @@ typedef uint64_t pool_reference;
 typedef uint64_t global_reference;
 
 
+/**
+ * @brief The ways in which the address window of a pool can be backed.
+ *
+ * POOL_MAP_EAGER maps each subpool with a separate mmap call as it is needed,
+ * and touching memory past the end of a pool will fault.
+ *
+ * POOL_MAP_RESERVE reserves the entire window of a pool without access rights
+ * when the pool is created. Growing the pool only changes the protection of
+ * already reserved pages, and does so in geometrically larger steps, so the
+ * number of system calls grows logarithmically with the size of the pool.
+ *
+ * POOL_MAP_OVERCOMMIT reserves the entire window readable and writable, and
+ * leaves it to the kernel to provide pages on first touch. Growing the pool
+ * makes no system calls at all.
+ */
+typedef enum pool_map_mode {
+    POOL_MAP_EAGER          = 0,
+    POOL_MAP_RESERVE        = 1,
+    POOL_MAP_OVERCOMMIT     = 2
+} POOL_MAP_MODE;
+
+/**
+ * @brief Selects how the memory of pools created from now on is mapped.
+ *
+ * Pools that already exist keep the mode they were created with. The default
+ * mode is POOL_MAP_EAGER.
+ *
+ * @param mode The mapping mode to use for new pools.
+ * @return The mode that was previously in use.
+ */
+POOL_MAP_MODE
+pool_set_map_mode(POOL_MAP_MODE mode);
+
+/**
+ * @brief The page sizes that the memory of a pool can be backed with.
+ *
+ * POOL_PAGES_SMALL uses ordinary 4 KB pages.
+ *
+ * POOL_PAGES_HUGE asks for transparent huge pages with madvise(MADV_HUGEPAGE),
+ * so that walking the field arrays of wide types does not thrash the TLB. The
+ * kernel falls back to small pages when no huge page is available.
+ *
+ * POOL_PAGES_HUGETLB maps the pool with MAP_HUGETLB. Pages are taken from the
+ * preallocated huge page pool (see /proc/sys/vm/nr_hugepages), and touching
+ * the pool raises SIGBUS once that is exhausted.
+ *
+ * Pools with huge pages always reserve their entire window as one mapping, so
+ * POOL_MAP_EAGER behaves as POOL_MAP_RESERVE for them. Memory is committed and
+ * decommitted in whole, aligned, 2 MB pages.
+ */
+typedef enum pool_page_mode {
+    POOL_PAGES_SMALL        = 0,
+    POOL_PAGES_HUGE         = 1,
+    POOL_PAGES_HUGETLB      = 2
+} POOL_PAGE_MODE;
+
+/**
+ * @brief Selects the page size of pools created from now on.
+ *
+ * Pools that already exist keep the page size they were created with. The
+ * default is POOL_PAGES_SMALL.
+ *
+ * @param mode The page mode to use for new pools.
+ * @return The mode that was previously in use.
+ */
+POOL_PAGE_MODE
+pool_set_page_mode(POOL_PAGE_MODE mode);
+
 /**
  * @brief Creates a new memory pool for objects of type T.
  *
  * It is imperative that the type information for the type requested has been
  * registered before this function is called.
+ * Every pool gets a unique id, and with it an address window of its own. Ids
+ * of destroyed pools are reused, so pools can be created and destroyed any
+ * number of times, but no more than POOL_ID_COUNT - 1 pools may be alive at
+ * the same time.
  *
  * @param type_id The unique identifier of a type T.
  *
@@ -61,11 +133,36 @@ typedef uint64_t global_reference;
 pool_reference
 pool_create(uint16_t type_id);
 
+/**
+ * @brief Creates a pool for objects of type T that may outgrow a single
+ *        address window.
+ *
+ * An ordinary pool holds at most 1 << 28 objects, or fewer if they don't fit
+ * in its 4 GB window. A large pool claims a run of consecutive pool ids up
+ * front, enough for at least capacity objects, and fills their windows one at
+ * a time. Objects in a large pool are used exactly like those in ordinary
+ * pools, and so are iterators, field_map() and field_list_map(). References
+ * to them have their is_extended bit set, and name the window that holds the
+ * object instead of the first window of the pool.
+ *
+ * Large pools can't be shared through pool_alloc_shared(), freed from with
+ * pool_free(), or collected.
+ *
+ * @param type_id The unique identifier of a type T.
+ * @param capacity The largest number of objects the pool will need to hold.
+ *
+ * @return A Pool on success, NULL_POOL if T doesn't fit in a window or no run
+ * of pool ids long enough is free.
+ */
+pool_reference
+pool_create_large(uint16_t type_id, size_t capacity);
+
 /**
  * @brief Destroys (frees) an entire pool.
  *
  * There is no need to shrink or free the individual objects stored in the pool
- * before calling this function.
+ * before calling this function. The id of the pool is released and may be
+ * handed out again by pool_create().
  * As a side effect the given reference is set to NULL_REF.
  *
  * @param pool The pool to free.
@@ -74,9 +171,61 @@ pool_create(uint16_t type_id);
 int
 pool_destroy(pool_reference *pool);
 
+/**
+ * @brief Creates a new pool that is backed by a file.
+ *
+ * The file starts with a small header, followed by the subpools of the pool in
+ * the same layout they have in memory. The file is mapped shared at the
+ * window of the pool, so everything written to the pool ends up in the file.
+ * Any existing file at path is truncated.
+ *
+ * Calling pool_destroy() on a file-backed pool only detaches it, the file
+ * keeps the pool and can be attached again with pool_attach_file(). Slots
+ * freed with pool_free() are not remembered across a detach. Local references
+ * are stored relative to the referring object and survive a detach, but long
+ * local references live in the process-wide reference table and do not.
+ *
+ * @param type_id The unique identifier of a type T.
+ * @param path The file to back the pool with.
+ *
+ * @return A Pool on success, NULL_POOL on failure.
+ */
+pool_reference
+pool_create_file(uint16_t type_id, const char *path);
+
+/**
+ * @brief Attaches a pool from a file created with pool_create_file().
+ *
+ * No data is copied, the file is mapped at the same window as when it was
+ * created, so global references into the pool remain valid. The pool gets the
+ * size it had when it was last synced or detached.
+ *
+ * @param path The file to attach.
+ *
+ * @return The pool on success, NULL_POOL on failure. errno is set to EINVAL
+ *         if the file is not a pool or was written with another type table,
+ *         and to EBUSY if the pool id is in use.
+ */
+pool_reference
+pool_attach_file(const char *path);
+
+/**
+ * @brief Writes the size of a file-backed pool and all its data to the file.
+ *
+ * @param pool The pool to sync.
+ *
+ * @return 0 on success, EINVAL if the pool is not backed by a file.
+ */
+int
+pool_sync(const pool_reference pool);
+
 /**
  * @brief Allocates memory for an additional object in a pool.
  *
+ * Slots that have been released with pool_free() are reused before the pool
+ * is grown. The fields of the returned object are always zeroed, also when
+ * the pool grows back over objects removed with pool_shrink().
+ *
  * @param pool	A pointer to a pool of type T in which to allocate space for
  *              another object.
  *
@@ -86,6 +235,108 @@ pool_destroy(pool_reference *pool);
 global_reference
 pool_alloc(pool_reference *pool);
 
+/**
+ * @brief Allocates n consecutive objects in a pool.
+ *
+ * The objects are placed at the end of the pool, one after another, and the
+ * range can be walked subpool by subpool with a pool_range_cursor. Within one
+ * subpool every field of the range outside of an interleaved group is a plain
+ * array, which makes it possible to fill in a whole field with memcpy. Slots
+ * released with pool_free() are not used, as they would break up the range.
+ *
+ * @param pool A pointer to the pool to allocate the objects in.
+ * @param n The number of objects to allocate.
+ * @param first Where a reference to the first object in the range is written.
+ *
+ * @return 0 on success.
+ */
+int
+pool_alloc_range(pool_reference *pool,
+                 const size_t n,
+                 global_reference *first);
+
+/**
+ * @brief A cursor over a range of consecutive objects in a pool.
+ *
+ * Set next to the first object of the range, and remaining to the number of
+ * objects in it, then call pool_range_next() until it returns 0.
+ */
+typedef struct pool_range_cursor {
+    global_reference    next;       /* First object not yet visited */
+    size_t              remaining;  /* Objects left in the range */
+} pool_range_cursor;
+
+/**
+ * @brief Moves a range cursor forward by one segment.
+ *
+ * A segment is the part of the remaining range that lies in a single subpool.
+ * For every field number f, get_field(*segment, f) points to an array holding
+ * field f of all objects in the segment, in order. Fields in an interleaved
+ * group are strided by the size of the group rather than their own.
+ *
+ * @param cursor The cursor to move forward.
+ * @param segment Where a reference to the first object in the segment is
+ *                written.
+ *
+ * @return The number of objects in the segment, 0 when the range is
+ *         exhausted.
+ */
+size_t
+pool_range_next(pool_range_cursor *cursor, global_reference *segment);
+
+/**
+ * @brief A thread local allocation buffer, for allocating in a shared pool.
+ *
+ * Each thread that allocates in a shared pool keeps its own buffer, zero
+ * initialized before the first allocation. A buffer must only be used with
+ * the pool it was first used with, and must be zeroed again if that pool is
+ * destroyed.
+ */
+typedef struct pool_tlab {
+    pool_range_cursor   range;      /* Claimed objects not yet handed out */
+} pool_tlab;
+
+/**
+ * @brief Allocates an object in a pool that is shared between threads.
+ *
+ * Objects are handed out from the thread's buffer without any
+ * synchronization. When the buffer is empty it is refilled with an atomic
+ * compare-and-swap on the pool reference, which claims the rest of the last
+ * subpool, or else a whole new subpool that the claiming thread maps itself.
+ * The pool reference stays the tail of the pool, so GET_SIZE_OF_POOL counts
+ * every claimed object, including those still waiting in some buffer; such
+ * objects are zeroed and unreferenced, and are dropped by the collector.
+ *
+ * While a pool is shared, all allocations in it must go through this
+ * function, and it must not be shrunk or have objects freed. Slots released
+ * with pool_free() are not reused.
+ *
+ * @param pool A pointer to the shared pool to allocate the object in.
+ * @param tlab The buffer of the calling thread.
+ *
+ * @return A global reference to the allocated memory on success,
+ *         NULL_REF on failure.
+ */
+global_reference
+pool_alloc_shared(pool_reference *pool, pool_tlab *tlab);
+
+/**
+ * @brief Frees a single object, so that its slot can be reused.
+ *
+ * The freed slot is marked in a liveness bitmap kept for the pool, and the
+ * next call to pool_alloc() on the same pool will hand it out again before
+ * any new memory is mapped. Long local references held by the object are
+ * removed, and all of its fields are cleared. It is up to the caller to make
+ * sure that no other object still refers to the freed one.
+ *
+ * @param reference A reference to the object to free.
+ *
+ * @return 0 on success, 2 if the object has already been freed, 1 on
+ * failure or if the object lives in a large pool.
+ */
+int
+pool_free(const global_reference reference);
+
 /**
  * @brief Grows a pool to accommodate num_elements more elements.
  *
@@ -150,6 +401,47 @@ set_field(const global_reference reference,
           const size_t field_nr, 
           const void* data);
 
+/**
+ * @brief Reads the same field of many objects.
+ *
+ * Equivalent to copying get_field(refs[i], field_nr) into the i:th slot of out
+ * for every i, but the fields of later references are prefetched while
+ * earlier ones are copied, so that the cache misses of a batch of random
+ * references overlap rather than follow each other.
+ *
+ * @param refs		References to objects of the same type, none NULL_REF.
+ * @param n		The number of references.
+ * @param field_nr	The field to read.
+ * @param out		An array of n values the size of the field.
+ *
+ * @return 0 on success.
+ */
+int
+get_field_batch(const global_reference *refs,
+                const size_t n,
+                const size_t field_nr,
+                void *out);
+
+/**
+ * @brief Writes the same field of many objects.
+ *
+ * The counterpart of get_field_batch(), equivalent to set_field(refs[i],
+ * field_nr, &in[i]) for every i. If a reference occurs more than once, the
+ * last value for it is the one stored.
+ *
+ * @param refs		References to objects of the same type, none NULL_REF.
+ * @param n		The number of references.
+ * @param field_nr	The field to write, not a local reference.
+ * @param in		An array of n values the size of the field.
+ *
+ * @return 0 on success.
+ */
+int
+set_field_batch(const global_reference *refs,
+                const size_t n,
+                const size_t field_nr,
+                const void *in);
+
 /**
  * @brief Sets a reference field in a pool element.
  *
@@ -194,4 +486,51 @@ get_field_reference(const global_reference this_ref,
  */
 void*
 pool_to_array(const pool_reference pool);
+
+/**
+ * @brief Maps the memory of a pool ahead of its allocations.
+ *
+ * Pools grow one subpool at a time, and the allocation that crosses into a new
+ * subpool pays for mapping it and faulting all of its pages in. With
+ * provisioning turned on, a background thread does that instead: once the
+ * pool has grown watermark objects into its last block, the next block is
+ * mapped and faulted in, so that pool_alloc() finds it ready. A block is a
+ * subpool, or PAGE_SIZE objects if subpools are smaller than that.
+ *
+ * The provisioner only ever runs ahead of the pool owner. Anything that maps
+ * or unmaps memory of the pool waits for the pending request to be done
+ * first, and memory that was mapped ahead is released with the pool.
+ *
+ * @param pool The pool to provision.
+ * @param watermark The number of objects into a block at which the next one
+ *        is mapped, at most the size of a block. 0 turns provisioning off.
+ *
+ * @return 0 on success, 1 if the background thread could not be started.
+ */
+int
+pool_set_provisioning(const pool_reference pool, size_t watermark);
+
+/*
+ * The helper functions below are not exported except in debug mode, and are
+ * included here only for testing and benchmarking.
+ */
+#ifndef __RELEASE__
+
+/**
+ * @brief Internal helper that returns the number of mmap, mprotect and munmap
+ * calls made by local-heaps so far.
+ */
+size_t
+pool_syscall_count(void);
+
+/**
+ * @brief Internal helper that limits the number of objects in each window of
+ * a large pool to 1 << shift, so that tests can cross windows cheaply.
+ *
+ * @return The previous limit.
+ */
+unsigned
+pool_set_max_window_shift(unsigned shift);
+#endif
+
 #endif
@@ -0,0 +1,135 @@
+/**
+ * @brief Inline versions of the field accessors declared in pool.h.
+ *
+ * get_field(), set_field() and get_field_reference() are called through the
+ * PLT of libpalloc.so, and look the type of the reference up in the type table
+ * every time. The accessors declared here take a type descriptor that the
+ * caller fetches once per type with get_type_descriptor(), and are expanded
+ * at the call site. They behave exactly like their out-of-line counterparts.
+ *
+ * Like pool_private.h, this header exposes the layout of references and pools,
+ * and code that includes it has to be rebuilt when that layout changes.
+ *
+ * @file pool_inline.h
+ * @author Martin Hagelin
+ * @date March, 2015
+ */
+
+#ifndef __POOL_INLINE_H__
+#define __POOL_INLINE_H__
+
+#include <stdint.h>
+#include <string.h>
+
+#include "pool.h"
+#include "field_info.h"
+#include "pool_private.h"
+
+/**
+ * @brief Gets the address of a field of an object, like GET_FIELD_ADDR.
+ *
+ * @param desc The descriptor of the type of the object.
+ * @param reference A reference to the object.
+ * @param field_nr The number of the field.
+ * @return The address of the field, in the form of an integer.
+ */
+static inline uintptr_t
+get_field_addr_inline(const type_descriptor *desc,
+                      const global_reference reference,
+                      const size_t field_nr)
+{
+    reference_struct ref = {.raw_val = reference};
+    size_t idx = GET_GLOBAL_INDEX_OF_REF(ref);
+    size_t mask = ((size_t) 1 << desc->sub_pool_shift) - 1;
+
+    return GET_POOL_ADDR(ref) +
+           (((uintptr_t) ref.pool_id & desc->pool_color_mask) <<
+            CACHE_LINE_SHIFT) +
+           (idx >> desc->sub_pool_shift)*desc->sub_pool_size +
+           desc->fields[field_nr].offset +
+           SCALE_BY_FIELD_STRIDE(desc->fields[field_nr], idx & mask);
+}
+
+/**
+ * @brief Inline version of get_field().
+ *
+ * @param desc The descriptor of the type of the object.
+ * @param reference A reference to the object.
+ * @param field_nr The number of the field.
+ * @return A pointer to the field.
+ */
+static inline void*
+get_field_inline(const type_descriptor *desc,
+                 const global_reference reference,
+                 const size_t field_nr)
+{
+    return (void*) get_field_addr_inline(desc, reference, field_nr);
+}
+
+/**
+ * @brief Inline version of set_field().
+ *
+ * @param desc The descriptor of the type of the object.
+ * @param reference A reference to the object.
+ * @param field_nr The number of the field.
+ * @param data A pointer to the data to copy into the field.
+ */
+static inline void
+set_field_inline(const type_descriptor *desc,
+                 const global_reference reference,
+                 const size_t field_nr,
+                 const void *data)
+{
+    void *f_ptr = get_field_inline(desc, reference, field_nr);
+
+    switch (desc->fields[field_nr].size) {
+        case 1: *((char*)f_ptr) = *((const char*)data);
+                break;
+        case 2: *((uint16_t*)f_ptr) = *((const uint16_t*)data);
+                break;
+        case 4: *((uint32_t*)f_ptr) = *((const uint32_t*)data);
+                break;
+        case 8: *((uint64_t*)f_ptr) = *((const uint64_t*)data);
+                break;
+
+        default:
+                memcpy(f_ptr, data, desc->fields[field_nr].size);
+                break;
+    }
+}
+
+/**
+ * @brief Inline version of get_field_reference().
+ *
+ * Short references within an ordinary pool are resolved in place. Long
+ * references, and references between the windows of a large pool, are left to
+ * get_field_reference().
+ *
+ * @param desc The descriptor of the type of the object.
+ * @param this_ref A reference to the object that holds the field.
+ * @param field_nr The number of the field.
+ * @return The reference held by the field, or NULL_REF.
+ */
+static inline global_reference
+get_field_reference_inline(const type_descriptor *desc,
+                           const global_reference this_ref,
+                           const size_t field_nr)
+{
+    reference_struct this = {.raw_val = this_ref};
+    local_reference_struct that_local_ref =
+        {.raw_val = *(uint16_t*) get_field_inline(desc, this_ref, field_nr)};
+
+    if (0 == that_local_ref.raw_val)
+        return NULL_REF;
+
+    if (that_local_ref.is_long_ref || this.is_extended)
+        return get_field_reference(this_ref, field_nr);
+
+    size_t that_index = GET_GLOBAL_INDEX_OF_REF(this) + that_local_ref.index;
+    this.sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(that_index);
+    this.index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(that_index);
+
+    return this.raw_val;
+}
+
+#endif
@@ -22,11 +22,100 @@
 
 typedef void (*map_function_type) (void*, void*);
 
+/* The most fields field_zip_map reads */
+#define FIELD_ZIP_MAX_INPUTS 8
+
+typedef void (*zip_function_type) (void**, void*);
+
+/**
+ * @brief Element types understood by the built-in operations of field_op_map.
+ *
+ * Integers are two's complement. Arithmetic on them wraps, and comparisons
+ * and conversions treat them as signed.
+ */
+typedef enum {
+    FIELD_INT8,
+    FIELD_INT16,
+    FIELD_INT32,
+    FIELD_INT64,
+    FIELD_FLOAT,
+    FIELD_DOUBLE,
+    FIELD_ELEM_TYPE_COUNT
+} field_elem_type;
+
+/**
+ * @brief The built-in operations of field_op_map, with a the source element
+ *        and b the result.
+ */
+typedef enum {
+    FIELD_OP_ADD,       /* b = a + x */
+    FIELD_OP_MUL,       /* b = a * x */
+    FIELD_OP_FMA,       /* b = a * x + y */
+    FIELD_OP_SQUARE,    /* b = a * a */
+    FIELD_OP_LT,        /* b = a < x, as 1 or 0 */
+    FIELD_OP_EQ,        /* b = a == x, as 1 or 0 */
+    FIELD_OP_GT,        /* b = a > x, as 1 or 0 */
+    FIELD_OP_IN_RANGE,  /* b = x <= a < y, as 1 or 0 */
+    FIELD_OP_CONVERT,   /* b = a, converted to the element type of b */
+    FIELD_OP_COUNT
+} field_op_code;
+
+/**
+ * @brief An operand of a built-in operation, i for integer element types and
+ *        d for floating point ones.
+ */
+typedef union field_scalar {
+    int64_t     i;
+    double      d;
+} field_scalar;
+
+/**
+ * @brief A built-in operation for field_op_map.
+ *
+ * Only FIELD_OP_CONVERT may have a dst_type other than src_type.
+ */
+typedef struct field_op {
+    field_op_code   code;
+    field_elem_type src_type;
+    field_elem_type dst_type;
+    field_scalar    x;
+    field_scalar    y;
+} field_op;
+
+/**
+ * @brief The aggregates field_reduce can compute, with a the elements.
+ */
+typedef enum {
+    FIELD_REDUCE_SUM,       /* The sum of a, as an int64 or a double */
+    FIELD_REDUCE_MIN,       /* The smallest a */
+    FIELD_REDUCE_MAX,       /* The largest a */
+    FIELD_REDUCE_COUNT,     /* The number of a with lo <= a < hi */
+    FIELD_REDUCE_HISTOGRAM, /* COUNT, and the number in each of bins bins */
+    FIELD_REDUCE_CODE_COUNT
+} field_reduce_code;
+
+/**
+ * @brief An aggregate for field_reduce.
+ *
+ * The range [lo, hi) of a histogram is split into bins bins of equal width,
+ * rounded up for integers so that the last bin may be narrower. Elements
+ * outside the range are not counted.
+ */
+typedef struct field_reduce_op {
+    field_reduce_code   code;
+    field_elem_type     type;
+    field_scalar        lo;
+    field_scalar        hi;
+    size_t              bins;
+    uint64_t            *histogram; /* bins counters, cleared first */
+} field_reduce_op;
+
 /**
  * @brief Applies a function to a specific field of every element in a pool.
  *
  * At the moment this function assumes a compact pool.
  * (No deletions can have been made since the last compactation).
+ * field_map_live() works on pools that have had elements freed.
  *
  * @param A A pool containing elements of type a, where a has a field number
  * field_no of type b.
@@ -45,6 +134,297 @@ field_map(const pool_reference A,
           size_t field_no,
           map_function_type f);
 
+/**
+ * @brief Applies a function to a specific field of every live element in a
+ *        pool, which may have had elements freed.
+ *
+ * Does the same as field_map(), but skips the slots that have been freed with
+ * pool_free() and not yet handed out again. The liveness bitmap of A is read
+ * a word of 64 elements at a time, so that runs with nothing freed in them are
+ * mapped as fast as in field_map(). The slots of B that match freed slots of
+ * A are left cleared. Elements are visited in the order of the pool, not that
+ * of any list through them.
+ *
+ * @param A A pool containing elements of type a, where a has a field number
+ * field_no of type b.
+ *
+ * @param B A pointer to an empty pool of type b.
+ *
+ * @param f A function a -> b, as for field_map().
+ *
+ * @returns 0 on success.
+ */
+int
+field_map_live(const pool_reference A,
+               pool_reference *B,
+               size_t field_no,
+               map_function_type f);
+
+/**
+ * @brief Applies a function to a specific field of every element in a pool,
+ *        on several threads.
+ *
+ * Does the same as field_map(), but splits the pool into runs of whole
+ * subpools, which the caller and a set of worker threads map in parallel. The
+ * workers are started when first needed, one per online CPU but the caller,
+ * and are kept for later calls. Calls from several threads take turns.
+ *
+ * f is called concurrently, and in no particular order.
+ *
+ * @param A A pool containing elements of type a, where a has a field number
+ * field_no of type b.
+ *
+ * @param B A pointer to an empty pool of type b.
+ *
+ * @param f A function a -> b, as for field_map().
+ *
+ * @returns 0 on success.
+ */
+int
+field_map_parallel(const pool_reference A,
+                   pool_reference *B,
+                   size_t field_no,
+                   map_function_type f);
+
+/**
+ * @brief Sets the number of threads a parallel map uses, the caller
+ *        included.
+ *
+ * Workers are started as needed, even beyond the number of CPUs.
+ *
+ * @param threads The number of threads, or 0 for one per online CPU, which is
+ *                the default.
+ * @return The previous limit.
+ */
+unsigned
+map_set_thread_count(unsigned threads);
+
+/**
+ * @brief Applies a built-in operation to a specific field of every element in
+ *        a pool.
+ *
+ * Does the same as field_map() with a function doing op, but runs a vector
+ * loop over the field array of each subpool instead of calling a function for
+ * every element. The loops are built for AVX-512, AVX2 and plain x86-64, and
+ * the best one the CPU supports is picked when the library is loaded. Fields
+ * in interleaved groups are not contiguous and are done one at a time.
+ *
+ * At the moment this function assumes a compact pool.
+ *
+ * @param A A pool containing elements with a field number field_no, whose size
+ * is that of op->src_type.
+ *
+ * @param B A pointer to an empty pool of a type whose first field has the
+ * size of op->dst_type.
+ *
+ * @param field_no The field of A to read.
+ *
+ * @param op The operation to apply.
+ *
+ * @returns 0 on success, 1 if op does not match the fields or B could not
+ * grow.
+ */
+int
+field_op_map(const pool_reference A,
+             pool_reference *B,
+             size_t field_no,
+             const field_op *op);
+
+/**
+ * @brief Applies a built-in operation to a specific field of every live
+ *        element in a pool, which may have had elements freed.
+ *
+ * Does the same as field_op_map(), and then clears the slots of B that match
+ * slots of A freed with pool_free(), as field_map_live() leaves them.
+ *
+ * @param A A pool containing elements with a field number field_no, whose size
+ * is that of op->src_type.
+ *
+ * @param B A pointer to an empty pool of a type whose first field has the
+ * size of op->dst_type.
+ *
+ * @param field_no The field of A to read.
+ *
+ * @param op The operation to apply.
+ *
+ * @returns 0 on success, 1 if op does not match the fields or B could not
+ * grow.
+ */
+int
+field_op_map_live(const pool_reference A,
+                  pool_reference *B,
+                  size_t field_no,
+                  const field_op *op);
+
+/**
+ * @brief Applies a function to several fields of every element in a pool,
+ *        and writes the result to a field of the same element or of the
+ *        element with the same index in another pool.
+ *
+ * The field arrays of each subpool are walked together, so that c = a * b
+ * takes one pass over A and no pool for a * b. B may be A itself. Otherwise
+ * it is grown to the size of A if it is shorter, and its other fields are
+ * left as they are.
+ *
+ * At the moment this function assumes a compact pool.
+ *
+ * @param A A pool containing elements with the fields field_nos.
+ *
+ * @param field_nos The input field numbers of A, in the order f gets them.
+ *
+ * @param inputs The number of input fields, at most FIELD_ZIP_MAX_INPUTS.
+ *
+ * @param B A pointer to A, or to a pool with a field number dst_field_no.
+ *
+ * @param dst_field_no The field of B to write.
+ *
+ * @param f A function given an array of pointers to the input fields of an
+ * element as the first argument, and a pointer to the field to write as the
+ * second.
+ *
+ * @returns 0 on success, 1 if a field does not exist or B could not grow.
+ */
+int
+field_zip_map(const pool_reference A,
+              const size_t *field_nos,
+              size_t inputs,
+              pool_reference *B,
+              size_t dst_field_no,
+              zip_function_type f);
+
+/**
+ * @brief Applies a built-in operation to several fields of every element in a
+ *        pool, and writes the result to a field as field_zip_map() does.
+ *
+ * The inputs take the place of the operands: with a, b and c the fields
+ * field_nos[0], [1] and [2], FIELD_OP_ADD gives a + b, FIELD_OP_MUL a * b,
+ * FIELD_OP_FMA a * b + c, FIELD_OP_SQUARE a * a, the comparisons a < b,
+ * a == b and a > b, and FIELD_OP_IN_RANGE b <= a < c. x and y are not used,
+ * and FIELD_OP_CONVERT is not supported. The loops are picked as for
+ * field_op_map(), and the result may overwrite one of the inputs.
+ *
+ * At the moment this function assumes a compact pool.
+ *
+ * @param A A pool containing elements with the fields field_nos, whose sizes
+ * are that of op->src_type.
+ *
+ * @param field_nos The input field numbers of A, as many as op reads.
+ *
+ * @param B A pointer to A, or to a pool with a field number dst_field_no
+ * whose size is that of op->src_type.
+ *
+ * @param dst_field_no The field of B to write.
+ *
+ * @param op The operation to apply, with dst_type equal to src_type.
+ *
+ * @returns 0 on success, 1 if op does not match the fields, a field does not
+ * exist or B could not grow.
+ */
+int
+field_zip_op_map(const pool_reference A,
+                 const size_t *field_nos,
+                 pool_reference *B,
+                 size_t dst_field_no,
+                 const field_op *op);
+
+/**
+ * @brief Computes an aggregate of a specific field of every element in a
+ *        pool.
+ *
+ * The field arrays of each subpool are reduced with vector loops, picked as
+ * for field_op_map(), on the threads of field_map_parallel(). The partial
+ * results are combined in the order of the pool, so that sums of floating
+ * point fields do not depend on the number of threads. The sum of an integer
+ * field wraps, and is in result->i, that of a floating point field is in
+ * result->d. Counts are in result->i. The minimum of an empty pool is the
+ * largest value of the type, and its maximum the smallest.
+ *
+ * At the moment this function assumes a compact pool.
+ *
+ * @param A A pool containing elements with a field number field_no, whose size
+ * is that of op->type.
+ *
+ * @param field_no The field of A to read.
+ *
+ * @param op The aggregate to compute.
+ *
+ * @param result Where the aggregate is written.
+ *
+ * @returns 0 on success, 1 if op does not match the field or memory ran out.
+ */
+int
+field_reduce(const pool_reference A,
+             size_t field_no,
+             const field_reduce_op *op,
+             field_scalar *result);
+
+/**
+ * @brief Computes an aggregate of a specific field of every element in a list.
+ *
+ * Does the same as field_reduce(), for the nodes of a list in any pool, in
+ * the way field_list_map() does a map. The values are gathered into a buffer
+ * that the vector loops then reduce.
+ *
+ * @param A A reference to the head of a list where each node has a field
+ * number field_no, whose size is that of op->type.
+ *
+ * @param field_no The field of the nodes to read.
+ *
+ * @param op The aggregate to compute.
+ *
+ * @param result Where the aggregate is written.
+ *
+ * @returns 0 on success, 1 if op does not match the field.
+ */
+int
+field_list_reduce(const global_reference A,
+                  size_t field_no,
+                  const field_reduce_op *op,
+                  field_scalar *result);
+
+/**
+ * @brief Finds the elements of a pool whose field satisfies a predicate, and
+ *        optionally copies them to another pool.
+ *
+ * The field arrays of each subpool are tested with vector loops, picked as
+ * for field_op_map(), on the threads of field_map_parallel(). The result is a
+ * selection bitmap with bit i % 64 of word i / 64 set if element i of A is
+ * selected, and so one run of words per subpool. The selected elements can
+ * then be copied, with all their fields and in the order of A, to the end of
+ * a pool B of the same type. Copies would move elements away from the
+ * objects their local references point to, so types with local reference
+ * fields can only be filtered without B.
+ *
+ * At the moment this function assumes a compact pool.
+ *
+ * @param A A pool containing elements with a field number field_no, whose size
+ * is that of predicate->src_type.
+ *
+ * @param field_no The field of A to test.
+ *
+ * @param predicate A field_op with code FIELD_OP_LT, FIELD_OP_EQ, FIELD_OP_GT
+ * or FIELD_OP_IN_RANGE. Elements for which it gives 1 are selected.
+ *
+ * @param selection Where the bitmap is written, one word for every 64
+ * elements of A, or NULL.
+ *
+ * @param B A pointer to a pool of the type of A that the selected elements
+ * are appended to, or NULL.
+ *
+ * @param selected Where the number of selected elements is written, or NULL.
+ *
+ * @returns 0 on success, 1 if the predicate does not match the field, B is
+ * of another type or given for a type with local references, or memory ran
+ * out.
+ */
+int
+field_filter(const pool_reference A,
+             size_t field_no,
+             const field_op *predicate,
+             uint64_t *selection,
+             pool_reference *B,
+             size_t *selected);
+
 /**
  * @brief Applies a function to a specific field of every element in a list.
  *
@@ -53,6 +433,11 @@ field_map(const pool_reference A,
  * But if the pool really IS compact, then it is MUCH better to use a function
  * like field_map instead, as it's much more efficient.
  *
+ * Runs of nodes that each link to the next element of the pool, as lists do
+ * after a collection, are found by comparing their links a block at a time,
+ * and mapped as slices of the field arrays. The results are appended to B in
+ * the order of the list.
+ *
  * @param A A reference to the head of a list where each node is an object that
  * has a field numbe rfield_no of type a.
  *
@@ -70,4 +455,68 @@ field_list_map(const global_reference A,
 	           size_t field_no,
 	           map_function_type f);
 
+/**
+ * @brief Applies a built-in operation to a specific field of every element in
+ *        a list.
+ *
+ * Does the same as field_list_map() with a function doing op. The runs of
+ * nodes that follow each other in the pool are done with the vector loops of
+ * field_op_map(), so that a list laid out by a collection maps about as fast
+ * as an array.
+ *
+ * @param A A reference to the head of a list where each node has a field
+ * number field_no, whose size is that of op->src_type.
+ *
+ * @param B A pointer to a pool of a type whose first field has the size of
+ * op->dst_type. The results are appended to it.
+ *
+ * @param field_no The field of the nodes to read.
+ *
+ * @param op The operation to apply.
+ *
+ * @returns 0 on success, 1 if op does not match the fields or B could not
+ * grow.
+ */
+int
+field_list_op_map(const global_reference A,
+                  pool_reference *B,
+                  size_t field_no,
+                  const field_op *op);
+
+/**
+ * @brief Applies a function to a specific field of every element in a list,
+ *        on several threads.
+ *
+ * Does the same as field_list_map(), but first ranks the list in parallel,
+ * so that long fragmented lists are not walked by one thread. Every 512th
+ * element of the pool starts a segment, and the threads of
+ * field_map_parallel() follow the links of each, long references included,
+ * until they reach a node another segment has claimed. The list is then
+ * followed from segment to segment, and the segments it passes through are
+ * mapped in parallel, each node to its place in B. Elements of the pool that
+ * are not on the list are walked but not mapped.
+ *
+ * f is called concurrently, and in no particular order. The ranking takes
+ * eight bytes per element of the pool the list is in.
+ *
+ * @param P The pool the list is in.
+ *
+ * @param A A reference to the head of a list in P where each node has a field
+ * number field_no of type a.
+ *
+ * @param B A pointer to a pool of type b. The results are appended to it in
+ * the order of the list.
+ *
+ * @param f A function a -> b, as for field_list_map().
+ *
+ * @returns 0 on success, 1 if A is not in P, memory ran out, B could not grow
+ * or the list has a cycle.
+ */
+int
+field_list_map_parallel(const pool_reference P,
+                        const global_reference A,
+                        pool_reference *B,
+                        size_t field_no,
+                        map_function_type f);
+
 #endif
@@ -18,9 +18,18 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include "field_info.h"
+
 /**
  * @brief The page size on the current architecture, it is uses synonymously
  * with the length of a sub-pool.
+ *
+ * References split the index of an object into a 16 bit sub_pool_id and a 12
+ * bit index, so pools are allocated PAGE_SIZE objects at a time. That split is
+ * only an encoding, the layout in memory is decided by the subpool shift of
+ * each type: a subpool holds 1 << shift objects, and each field is an array
+ * of that length. Use the GET_SUB_POOL_* macros for anything that touches
+ * memory, and PAGE_SIZE only for the fields of references.
  */
 #define PAGE_SIZE ((size_t) 1 << 12)
 
@@ -32,6 +41,14 @@
  * mappings than linux does.
  */
 #define POOL_START ((void*) (1LLU << 32))
+/**
+ * @brief The number of pool ids that fit between address 0 and POOL_STOP.
+ *
+ * Id 0 is reserved for NULL_POOL, so the usable ids are 1 to
+ * POOL_ID_COUNT - 1.
+ */
+#define POOL_ID_COUNT ((size_t) 0x7001)
+
 /**
  * @brief A very platform specific address where local-heaps will stop to
  * allocate pools.
@@ -39,7 +56,41 @@
  * Change this if the operating system you're using sets up very different
  * memory mappings than linux does.
  */
-#define POOL_STOP  ((void*) (0x7001 << 32 ))
+#define POOL_STOP  ((void*) (POOL_ID_COUNT << 32))
+
+/**
+ * @brief The size of the address window that belongs to each pool id.
+ */
+#define POOL_WINDOW_SIZE ((size_t) 1 << 32)
+
+/**
+ * @brief The size of a small page, the commit granularity of most pools.
+ */
+#define SMALL_PAGE_SIZE ((size_t) 1 << 12)
+
+/**
+ * @brief The size of a huge page, and the commit granularity of pools that are
+ *        backed by huge pages.
+ */
+#define HUGE_PAGE_SIZE ((size_t) 1 << 21)
+
+/**
+ * @brief log2 of the size of a cache line.
+ */
+#define CACHE_LINE_SHIFT 6
+
+/**
+ * @brief The number of cache line offsets the field arrays of a colored type
+ *        are staggered by, and the number of pool colors.
+ *
+ * Field array k of a colored type starts (k % FIELD_COLORS) cache lines into
+ * its slot, where the fields of an interleaved group share one array. The
+ * subpools of pool p start (p % POOL_COLORS) cache lines into the window.
+ * Together the two stay within the page of padding at the end of each subpool
+ * of a colored type.
+ */
+#define FIELD_COLORS ((size_t) 32)
+#define POOL_COLORS ((size_t) 32)
 
 /**
  * @brief Returns the base address for a pool.
@@ -68,13 +119,81 @@
  */
 #define SUB_POOLS_NEEDED(SIZE) ((!!((SIZE) & ((1 << 12) -1))) + ((SIZE) >> 12))
 
+/**
+ * @brief Gets the descriptor of the type of a reference.
+ *
+ * @param ref A reference to a pool or object of type T.
+ * @return A pointer to the type_descriptor of T.
+ */
+#define GET_TYPE_DESCRIPTOR(ref) TYPE_DESCRIPTOR_OF_ID((ref).type_id)
+
+/**
+ * @brief Gets the number of local references a type starts with.
+ *
+ * @param ref A reference to a pool or object of type T.
+ * @return The number of leading fields of T that are local references.
+ */
+#define GET_LOCAL_REF_COUNT(ref) (GET_TYPE_DESCRIPTOR(ref)->local_ref_count)
+
 /**
  * @brief Gets the size of a subpool in bytes.
  *
  * @param ref A reference to a pool or object of type T.
  * @return The size of a subpool in a T-pool.
  */
-#define GET_SUB_POOL_SIZE(ref) (type_table[(ref).type_id].type_size * PAGE_SIZE)
+#define GET_SUB_POOL_SIZE(ref) (GET_TYPE_DESCRIPTOR(ref)->sub_pool_size)
+
+/**
+ * @brief Gets the offset at which the data of a pool starts in its window.
+ *
+ * The offset is 0 unless the type is colored, see FIELD_COLORS.
+ *
+ * @param ref A reference to a pool or object of type T.
+ * @param id The pool id of the window, which differs from that of ref for the
+ *           windows of a large pool.
+ * @return The color of the window, in bytes.
+ */
+#define GET_POOL_COLOR(ref, id) \
+    (((uintptr_t) (id) & GET_TYPE_DESCRIPTOR(ref)->pool_color_mask) << \
+     CACHE_LINE_SHIFT)
+
+/**
+ * @brief Gets the log2 of the number of objects in a subpool.
+ *
+ * @param ref A reference to a pool or object of type T.
+ * @return The subpool shift of T.
+ */
+#define GET_SUB_POOL_SHIFT(ref) (GET_TYPE_DESCRIPTOR(ref)->sub_pool_shift)
+
+/**
+ * @brief Gets the subpool in memory that holds an object.
+ *
+ * @param ref A reference to a pool or object of type T.
+ * @param idx The absolute index of an object O in a T-pool.
+ * @return The number of the subpool that O resides in.
+ */
+#define GET_SUB_POOL_OF_INDEX(ref, idx) ((idx) >> GET_SUB_POOL_SHIFT(ref))
+
+/**
+ * @brief Gets the position of an object in the field arrays of its subpool.
+ *
+ * @param ref A reference to a pool or object of type T.
+ * @param idx The absolute index of an object O in a T-pool.
+ * @return The index of O, counted from the top of the subpool it resides in.
+ */
+#define GET_INDEX_IN_SUB_POOL(ref, idx) \
+    ((idx) & (((size_t) 1 << GET_SUB_POOL_SHIFT(ref)) - 1))
+
+/**
+ * @brief The number of subpools in memory needed to hold the first n objects.
+ *
+ * @param ref A reference to a pool or object of type T.
+ * @param n A number of objects.
+ * @return The number of subpools in memory that objects 0 to n - 1 occupy.
+ */
+#define GET_SUB_POOLS_FOR(ref, n) \
+    (((n) + ((size_t) 1 << GET_SUB_POOL_SHIFT(ref)) - 1) >> \
+     GET_SUB_POOL_SHIFT(ref))
 
 /**
  * @brief The absolute index of an object, counting from the top of the pool.
@@ -83,6 +202,67 @@
  */
 #define GET_GLOBAL_INDEX_OF_REF(ref) ((ref).sub_pool_id*PAGE_SIZE + (ref).index)
 
+/**
+ * @brief The largest number of objects a reference can address in one window.
+ */
+#define MAX_WINDOW_SHIFT 28
+
+/**
+ * @brief The pool id of the first window of the large pool that a reference
+ *        belongs to.
+ *
+ * A large pool is a run of consecutive windows. References into it have
+ * is_extended set, and their pool_id names the window that holds the object
+ * rather than the pool. A reference to the pool itself names the window that
+ * holds the end of the pool.
+ *
+ * @param ref A reference to a large pool or an object in one.
+ * @return The pool id of the first window of the pool.
+ */
+#define GET_EXTENT_BASE(ref) (pool_meta_table[(ref).pool_id].extent_base)
+
+/**
+ * @brief Gets the log2 of the number of objects in each window of a large pool.
+ *
+ * @param ref A reference to a large pool or an object in one.
+ * @return The window shift of the pool.
+ */
+#define GET_WINDOW_SHIFT(ref) (pool_meta_table[(ref).pool_id].window_shift)
+
+/**
+ * @brief Gets the window that holds an object, given its absolute index.
+ *
+ * @param ref A reference to a pool or an object in a pool.
+ * @param idx The absolute index of an object O, counted across all windows.
+ * @return The pool id of the window that O resides in.
+ */
+#define GET_WINDOW_OF_INDEX(ref, idx) \
+    ((ref).is_extended ? \
+     GET_EXTENT_BASE(ref) + ((idx) >> GET_WINDOW_SHIFT(ref)) : (ref).pool_id)
+
+/**
+ * @brief Gets the index of an object within the window that holds it.
+ *
+ * @param ref A reference to a pool or an object in a pool.
+ * @param idx The absolute index of an object O, counted across all windows.
+ * @return The index of O, counted from the top of its window.
+ */
+#define GET_INDEX_IN_WINDOW(ref, idx) \
+    ((ref).is_extended ? \
+     (idx) & (((size_t) 1 << GET_WINDOW_SHIFT(ref)) - 1) : (idx))
+
+/**
+ * @brief The absolute index of an object, counted across all the windows of a
+ *        pool. The same as GET_GLOBAL_INDEX_OF_REF for ordinary pools.
+ *
+ * @param ref A reference to object number N in a pool.
+ * @return N.
+ */
+#define GET_LARGE_INDEX_OF_REF(ref) \
+    (((ref).is_extended ? \
+      (size_t) ((ref).pool_id - GET_EXTENT_BASE(ref)) << GET_WINDOW_SHIFT(ref) : \
+      0) + GET_GLOBAL_INDEX_OF_REF(ref))
+
 /**
  * @brief The number of objects in a pool.
  * @param pool Reference to a pool.
@@ -91,16 +271,29 @@
 #define GET_SIZE_OF_POOL(pool) ((pool).sub_pool_id*PAGE_SIZE + (pool).index + \
                                ((pool).full && (pool).index == 0? PAGE_SIZE: 0))
 
+/**
+ * @brief The number of objects in a pool, counted across all its windows. The
+ *        same as GET_SIZE_OF_POOL for ordinary pools.
+ * @param pool Reference to a pool.
+ * @return The number of objects allocated in pool (including garbage).
+ */
+#define GET_SIZE_OF_LARGE_POOL(pool) \
+    (((pool).is_extended ? \
+      (size_t) ((pool).pool_id - GET_EXTENT_BASE(pool)) << \
+      GET_WINDOW_SHIFT(pool) : 0) + GET_SIZE_OF_POOL(pool))
+
 /**
  * @brief Given a reference (or pool), and a defined type table:
  * Get the offset from the start of a subpool where the field_nr fields start.
  *
  * @param ref A global reference to an object in a pool.
  * @param field_nr The specific field number to access.
- * @return The offset into a subpool where field number field_nr resides.
+ * @return The offset into a subpool of field number field_nr of the first
+ *         object in it.
  */
 #define GET_FIELD_OFFSET(ref, field_nr) \
-    (type_table[(ref).type_id].field_offsets[field_nr].offset * PAGE_SIZE)
+    (GET_TYPE_DESCRIPTOR(ref)->fields[field_nr].offset)
+
 /**
  * @brief Gets the size of a given field in bytes.
  *
@@ -109,10 +302,67 @@
  * @return The size, in bytes, of field number field_nr.
  */
 #define GET_FIELD_SIZE(ref, field_nr) \
-    (type_table[(ref).type_id].field_offsets[field_nr].field_size)
+    (GET_TYPE_DESCRIPTOR(ref)->fields[field_nr].size)
+
+/**
+ * @brief Multiplies a number by the stride of a field, with a shift if the
+ *        stride is a power of two.
+ *
+ * @param field A field_descriptor.
+ * @param n The number to scale.
+ * @return The distance between the field of an object and that of the object
+ *         n places further on in the same subpool.
+ */
+#define SCALE_BY_FIELD_STRIDE(field, n) \
+    (FIELD_SIZE_NOT_POW2 == (field).stride_shift ? \
+     (size_t) (n)*(field).size : (size_t) (n) << (field).stride_shift)
 
 /**
- * @brief Gets the subpool given an absolute index.
+ * @brief Gets the address of a field of an object, given its absolute index.
+ *
+ * @param ref A reference to a pool or an object in a pool.
+ * @param idx The absolute index of the object.
+ * @param field_nr The number of the field.
+ * @return The address of the field, in the form of an integer.
+ */
+#define GET_FIELD_ADDR_OF_INDEX(ref, idx, field_nr) \
+    (GET_POOL_ADDR(ref) + GET_POOL_COLOR(ref, (ref).pool_id) + \
+     GET_SUB_POOL_SIZE(ref)*GET_SUB_POOL_OF_INDEX(ref, idx) + \
+     GET_FIELD_OFFSET(ref, field_nr) + \
+     SCALE_BY_FIELD_STRIDE(GET_TYPE_DESCRIPTOR(ref)->fields[field_nr], \
+                         GET_INDEX_IN_SUB_POOL(ref, idx)))
+
+/**
+ * @brief Gets the address of a field of the object a reference points to.
+ *
+ * @param ref A reference to an object in a pool.
+ * @param field_nr The number of the field.
+ * @return The address of the field, in the form of an integer.
+ */
+#define GET_FIELD_ADDR(ref, field_nr) \
+    GET_FIELD_ADDR_OF_INDEX(ref, GET_GLOBAL_INDEX_OF_REF(ref), field_nr)
+
+/**
+ * @brief Gets the address of a field of an object, given its absolute index
+ *        counted across all the windows of a pool.
+ *
+ * @param ref A reference to a pool or an object in a pool.
+ * @param idx The absolute index of the object.
+ * @param field_nr The number of the field.
+ * @return The address of the field, in the form of an integer.
+ */
+#define GET_FIELD_ADDR_OF_LARGE_INDEX(ref, idx, field_nr) \
+    (POOL_IDX_TO_ADDR(GET_WINDOW_OF_INDEX(ref, idx)) + \
+     GET_POOL_COLOR(ref, GET_WINDOW_OF_INDEX(ref, idx)) + \
+     GET_SUB_POOL_SIZE(ref)* \
+     GET_SUB_POOL_OF_INDEX(ref, GET_INDEX_IN_WINDOW(ref, idx)) + \
+     GET_FIELD_OFFSET(ref, field_nr) + \
+     SCALE_BY_FIELD_STRIDE(GET_TYPE_DESCRIPTOR(ref)->fields[field_nr], \
+                         GET_INDEX_IN_SUB_POOL(ref, \
+                                               GET_INDEX_IN_WINDOW(ref, idx))))
+
+/**
+ * @brief Gets the sub_pool_id of a reference, given an absolute index.
  *
  * @param idx The absolute index of an object O, counted from the top of the pool
  *            it resides in.
@@ -121,7 +371,7 @@
 #define GLOBAL_INDEX_TO_SUBPOOL_ID(idx) ((idx) >> 12)
 
 /**
- * @brief Gets the index into a subpool.
+ * @brief Gets the index field of a reference, given an absolute index.
  *
  * @param idx The absolute index of an object O, counted from the top of the
  *            pool it resides in.
@@ -130,6 +380,11 @@
  */
 #define GLOBAL_INDEX_TO_SUBPOOL_OFFSET(idx) ((idx) & ((1 << 12) - 1))
 
+/**
+ * @brief The number of 64 bit words in the liveness bitmap of one subpool.
+ */
+#define LIVENESS_WORDS_PER_SUBPOOL (PAGE_SIZE >> 6)
+
 /**
  * @brief A "magic" absolute index that represents a non existing object.
  *
@@ -321,6 +576,71 @@ typedef struct complex_iterator {
 } complex_iterator_struct;
 
 
+/**
+ * @brief Identifies the files behind file-backed pools, and their format.
+ */
+#define POOL_FILE_MAGIC 0x4c4f4f504d4d484fllu     /* "OHMMPOOL" */
+#define POOL_FILE_VERSION 1
+
+/**
+ * @brief The first page of the file behind a file-backed pool.
+ *
+ * The subpools of the pool follow the page, in the same layout as in memory.
+ */
+
+typedef struct pool_file_header {
+    uint64_t        magic;
+    uint64_t        version;
+    uint64_t        fingerprint;    /* type_table_fingerprint() of the writer */
+    uint64_t        pool;           /* The pool reference when last synced */
+} pool_file_header;
+
+/**
+ * @brief Book keeping for a single pool, kept in a table indexed by pool id.
+ *
+ * The mapping and page modes are recorded when the pool is created, as
+ * growing, shrinking and destroying the pool has to be done differently in
+ * each mode. The window is committed in multiples of page_size bytes.
+ * File-backed pools are committed like RESERVE pools, except that the file is
+ * grown and truncated instead of the protection being changed.
+ *
+ * Nothing is allocated for a pool until the first of its elements is freed.
+ * The liveness bitmap holds one bit per element, LIVENESS_WORDS_PER_SUBPOOL
+ * words per subpool, and a set bit marks a slot that has been handed back
+ * with pool_free(). The free slot index is a stack of absolute indexes that
+ * pool_alloc() pops before it grows the pool. Entries on the stack are not
+ * removed when the pool is shrunk, they are validated against the bitmap when
+ * they are popped instead.
+ *
+ * Every window of a large pool has its own entry, which records where the pool
+ * starts, how many windows it spans and how many objects each of them holds.
+ * The entries of ordinary pools have all three set to 0.
+ *
+ * The provision fields are counted in objects. Past provision_at the owner
+ * posts a request for the next block to the background provisioner, which
+ * maps and faults it in and then raises provisioned to the end of it.
+ */
+typedef struct pool_meta {
+    unsigned    map_mode;       /* POOL_MAP_MODE the pool was created with */
+    unsigned    page_mode;      /* POOL_PAGE_MODE the pool was created with */
+    size_t      page_size;      /* Granularity of commits, in bytes */
+    size_t      committed;      /* Bytes made accessible, RESERVE mode */
+    size_t      size;           /* Objects in the pool, 0 once destroyed */
+    struct pool_file_header *header;    /* Mapped file header, or NULL */
+    int         fd;             /* Backing file, if there is a header */
+    uint64_t    liveness;       /* Pool of longs, used as a bitmap */
+    uint64_t    free_slots;     /* Pool of longs, used as a stack */
+    size_t      free_depth;     /* Number of entries on the stack */
+    size_t      free_count;     /* Number of set bits in liveness */
+    uint16_t    extent_base;    /* First window of a large pool */
+    uint16_t    extent_windows; /* Number of windows of a large pool */
+    unsigned    window_shift;   /* Log2 of the objects in each window */
+    size_t      provision_watermark; /* Offset in a block that posts, or 0 */
+    size_t      provision_at;   /* Size at which the next request is posted */
+    uint64_t    provision_state;    /* Ticket and phase of the last request */
+    size_t      provisioned;    /* Objects mapped ahead of time, up to here */
+} pool_meta_struct;
+
 /**
  * @brief The structure of the numbers used to look up local references  in the
  *        global hash table.
@@ -67,9 +67,10 @@ delete_reference(reference_tag key);
 /**
  * @brief Remove all local reference entries for a certain pool.
  *
- * This function can be called when freeing a pool that contains a lot of
- * expanded local references. Please be aware that doing this is potentially
- * very expensive.  
+ * This function is called when a pool is destroyed, so that a pool that
+ * later gets the same pool id doesn't inherit its expanded local references.
+ * Please be aware that doing this is potentially very expensive when the
+ * table holds any entries at all.
  *
  * @param pool The pool for which all local reference expansions should be
  *             cleared.
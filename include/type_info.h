@@ -49,16 +49,49 @@ typedef enum type_class {
  */
 typedef struct type_info const *Type_info;
 
+/**
+ * @brief The number of objects in a subpool is 1 << DEFAULT_SUB_POOL_SHIFT,
+ *        unless a type asks for another shift.
+ */
+#define DEFAULT_SUB_POOL_SHIFT 12
+
+/**
+ * @brief The largest subpool shift a type can ask for.
+ */
+#define MAX_SUB_POOL_SHIFT 20
+
 /**
  * @brief Contains information about the layout of a data type.
  *
  * The type_id should be unique integer assigned by the compiler.
  * the ids MUST be consecutive as they are designed to be used
  * as indexes to a type table.
+ *
+ * sub_pool_shift sets the number of objects per subpool of pools of the type
+ * to 1 << sub_pool_shift, and 0 selects DEFAULT_SUB_POOL_SHIFT. Narrow types
+ * benefit from long field arrays, while wide types may want smaller subpools.
+ * A subpool must span a whole number of 4 KB pages.
+ *
+ * Field arrays are a multiple of a page long, so the same element of every
+ * field, and of every pool, maps to the same cache set. A type with
+ * cache_colored set starts each field array, and each pool, a different
+ * number of cache lines into its slot instead. Loops that read several fields
+ * or walk several pools in lockstep then no longer evict their own lines,
+ * at the cost of one page per subpool.
+ *
+ * A composite with interleaved set is stored as one group when it is a field
+ * of another composite: the fields of each object are kept together, in an
+ * array of groups, rather than each in an array of its own. Fields that are
+ * read together, like a key and its value, then share a cache line. Groups
+ * are padded to a power of two, so that none straddles two lines. A composite
+ * that is interleaved itself is stored as a single group.
  */
 struct type_info {
    uint16_t             type_id;        /* 16 bits for now */
    TYPE_CLASS           type_class;
+   uint8_t              sub_pool_shift;
+   uint8_t              cache_colored;
+   uint8_t              interleaved;
 
    union {
        uint64_t         referee_type_id;
@@ -81,9 +114,23 @@ struct type_info {
  * @param type_count The number of elements in the type_infos array.
  * @param type_infos An array of all data types that can be dynamically
  *                   allocated by the program.
- * @return 0 on success.
+ * @return 0 on success, EINVAL if a type asks for an invalid subpool shift,
+ *         or is too large to describe.
  */
 int
 init_type_table(int type_count, Type_info type_infos[]);
 
+/**
+ * @brief Returns a fingerprint of the type table.
+ *
+ * The fingerprint is a hash over the sizes, classes and field layouts of all
+ * types, computed by init_type_table(). Two programs with the same
+ * fingerprint lay out their pools in the same way, which is what persistent
+ * pools rely on.
+ *
+ * @return The fingerprint, 0 if no type table has been initialized.
+ */
+uint64_t
+type_table_fingerprint(void);
+
 #endif
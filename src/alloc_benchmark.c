@@ -10,9 +10,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "basic_types.h"
-#include "../test/test_type_info.h"
+#include "basic_types.h"
 //#include "type_info.h"
 #include "pool.h"
 
@@ -20,6 +23,18 @@
 #define U_SEC_TO_SEC(t) (  ((double) (t/1000000)) + \
                            (((double) (t % 1000000)) / 1000000.0) )
 
+/* Three quarters into a block of 4096 longs */
+#define PROVISION_WATERMARK 3072LU
+
+/* Latencies are counted in buckets of powers of two nanoseconds */
+#define LATENCY_BUCKETS 40
+
+struct latency_histogram {
+    unsigned long   buckets[LATENCY_BUCKETS];
+    unsigned long   count;
+    unsigned long   max;
+};
+
 static unsigned long long
 profile_malloc_dynarray(const unsigned long iterations);
 
@@ -32,6 +47,23 @@ profile_palloc_dynarray(const unsigned long iterations);
 static unsigned long long
 profile_palloc_single_chars(const unsigned long iterations);
 
+static unsigned long long
+profile_palloc_map_mode(const unsigned long iterations,
+                        POOL_MAP_MODE mode,
+                        size_t *syscalls);
+
+static unsigned long long
+profile_palloc_shared(const unsigned long iterations, const long threads);
+
+static void
+profile_palloc_latency(const unsigned long iterations,
+                       size_t watermark,
+                       struct latency_histogram *histogram);
+
+static unsigned long
+latency_percentile(const struct latency_histogram *histogram,
+                   double percentile);
+
 
 int
 main(int argc, char *argv[])
@@ -71,6 +103,58 @@ main(int argc, char *argv[])
             "pooled alloc:", U_SEC_TO_SEC(palloc_time),
             "speedup:", U_SEC_TO_SEC(malloc_time) / U_SEC_TO_SEC(palloc_time));
 
+    size_t eager_calls, reserve_calls, overcommit_calls;
+    unsigned long long eager_time =
+        profile_palloc_map_mode(iterations, POOL_MAP_EAGER, &eager_calls);
+    unsigned long long reserve_time =
+        profile_palloc_map_mode(iterations, POOL_MAP_RESERVE, &reserve_calls);
+    unsigned long long overcommit_time =
+        profile_palloc_map_mode(iterations, POOL_MAP_OVERCOMMIT,
+                                &overcommit_calls);
+
+    printf( "\n\nTime for %lu discrete allocations (of longs) per map mode\n"
+            "\t%-22s %2.3lf s %8zu mapping calls\n"
+            "\t%-22s %2.3lf s %8zu mapping calls\n"
+            "\t%-22s %2.3lf s %8zu mapping calls\n",
+            iterations,
+            "eager mmap:", U_SEC_TO_SEC(eager_time), eager_calls,
+            "reserve and commit:", U_SEC_TO_SEC(reserve_time), reserve_calls,
+            "overcommit:", U_SEC_TO_SEC(overcommit_time), overcommit_calls);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned long long single_time = profile_palloc_shared(iterations, 1);
+
+    printf( "\n\nTime for %lu discrete allocations (of longs) in a shared pool\n",
+            iterations);
+    for (long threads = 1 ; threads <= cores ; threads *= 2) {
+        unsigned long long shared_time = threads == 1 ? single_time :
+            profile_palloc_shared(iterations, threads);
+
+        printf( "\t%3ld %-18s %2.3lf s %8.3lf times\n",
+                threads, threads == 1 ? "thread:" : "threads:",
+                U_SEC_TO_SEC(shared_time),
+                U_SEC_TO_SEC(single_time) / U_SEC_TO_SEC(shared_time));
+    }
+
+    struct latency_histogram plain, provisioned;
+    profile_palloc_latency(iterations, 0, &plain);
+    profile_palloc_latency(iterations, PROVISION_WATERMARK, &provisioned);
+
+    printf( "\n\nLatency of %lu discrete allocations (of longs), in ns\n"
+            "\t%-22s %8s %8s %8s %8s %10s\n",
+            iterations, "", "p50", "p99", "p99.9", "p99.99", "max");
+    struct latency_histogram *histograms[] = {&plain, &provisioned};
+    const char *names[] = {"pool_alloc:", "provisioned:"};
+    for (int h = 0 ; h < 2 ; ++h) {
+        printf( "\t%-22s %8lu %8lu %8lu %8lu %10lu\n",
+                names[h],
+                latency_percentile(histograms[h], 0.5),
+                latency_percentile(histograms[h], 0.99),
+                latency_percentile(histograms[h], 0.999),
+                latency_percentile(histograms[h], 0.9999),
+                histograms[h]->max);
+    }
+
 
 	return 0;
 }
@@ -171,3 +255,123 @@ profile_palloc_single_chars(const unsigned long iterations)
     return ((stop.tv_sec - start.tv_sec) * 1000000LLU) +
             stop.tv_usec - start.tv_usec; 
 }
+
+static unsigned long long
+profile_palloc_map_mode(const unsigned long iterations,
+                        POOL_MAP_MODE mode,
+                        size_t *syscalls)
+{
+    struct timeval start;
+    struct timeval stop;
+
+    POOL_MAP_MODE old_mode = pool_set_map_mode(mode);
+    pool_reference long_pool = pool_create(LONG_TYPE_ID);
+    size_t calls = pool_syscall_count();
+
+    gettimeofday(&start, NULL);
+    for (unsigned long i = 0 ; i < iterations ; ++i) {
+        pool_alloc(&long_pool);
+    }
+    gettimeofday(&stop, NULL);
+
+    *syscalls = pool_syscall_count() - calls;
+
+    pool_destroy(&long_pool);
+    pool_set_map_mode(old_mode);
+
+    return ((stop.tv_sec - start.tv_sec) * 1000000LLU) +
+            stop.tv_usec - start.tv_usec; 
+}
+
+struct shared_alloc_args {
+    pool_reference     *pool;
+    unsigned long       iterations;
+};
+
+static void*
+shared_alloc_worker(void *arg)
+{
+    struct shared_alloc_args *args = arg;
+    pool_tlab tlab = {0};
+
+    for (unsigned long i = 0 ; i < args->iterations ; ++i) {
+        pool_alloc_shared(args->pool, &tlab);
+    }
+
+    return NULL;
+}
+
+static unsigned long long
+profile_palloc_shared(const unsigned long iterations, const long threads)
+{
+    struct timeval start;
+    struct timeval stop;
+
+    pool_reference long_pool = pool_create(LONG_TYPE_ID);
+    pthread_t workers[threads];
+    struct shared_alloc_args args = {.pool          = &long_pool,
+                                     .iterations    = iterations / threads };
+
+    gettimeofday(&start, NULL);
+    for (long t = 0 ; t < threads ; ++t) {
+        pthread_create(&workers[t], NULL, shared_alloc_worker, &args);
+    }
+    for (long t = 0 ; t < threads ; ++t) {
+        pthread_join(workers[t], NULL);
+    }
+    gettimeofday(&stop, NULL);
+
+    pool_destroy(&long_pool);
+
+    return ((stop.tv_sec - start.tv_sec) * 1000000LLU) +
+            stop.tv_usec - start.tv_usec; 
+}
+
+static void
+profile_palloc_latency(const unsigned long iterations,
+                       size_t watermark,
+                       struct latency_histogram *histogram)
+{
+    struct timespec start;
+    struct timespec stop;
+
+    pool_reference long_pool = pool_create(LONG_TYPE_ID);
+    if (0 != watermark)
+        pool_set_provisioning(long_pool, watermark);
+
+    *histogram = (struct latency_histogram) {0};
+
+    for (unsigned long i = 0 ; i < iterations ; ++i) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pool_alloc(&long_pool);
+        clock_gettime(CLOCK_MONOTONIC, &stop);
+
+        unsigned long ns = (stop.tv_sec - start.tv_sec) * 1000000000LU +
+                           stop.tv_nsec - start.tv_nsec;
+        int bucket = 0 == ns ? 0 : 64 - __builtin_clzl(ns);
+        bucket = bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+
+        ++histogram->buckets[bucket];
+        ++histogram->count;
+        histogram->max = ns > histogram->max ? ns : histogram->max;
+    }
+
+    pool_destroy(&long_pool);
+}
+
+/* Returns the upper bound of the bucket that holds the given percentile */
+static unsigned long
+latency_percentile(const struct latency_histogram *histogram,
+                   double percentile)
+{
+    unsigned long rank = (unsigned long) (percentile * histogram->count);
+    unsigned long seen = 0;
+
+    for (int b = 0 ; b < LATENCY_BUCKETS ; ++b) {
+        seen += histogram->buckets[b];
+        if (seen > rank)
+            return (1LU << b) - 1;
+    }
+
+    return histogram->max;
+}
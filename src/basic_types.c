@@ -0,0 +1,281 @@
+/**
+ * @brief Defines the basic types of basic_types.h, and registers them.
+ *
+ * The tests, the benchmarks and type_gen all work with these types. They
+ * live outside of the library, so that a program with types of its own can
+ * link its own add_basic_types() instead.
+ *
+ * @file basic_types.c
+ * @author Martin Hagelin
+ * @date December, 2014
+ *
+ */
+
+#include "basic_types.h"
+#include "type_info.h"
+#include "pool_private.h"
+
+
+static const struct type_info ti_primitive_0 = {
+    .type_id = CHAR_TYPE_ID,
+    .type_class = PRIMITIVE_TYPE,
+    .primitive_size = 1
+};
+
+static const struct type_info ti_primitive_1 = {
+    .type_id = LONG_TYPE_ID,
+    .type_class = PRIMITIVE_TYPE,
+    .primitive_size = 8
+};
+
+static const struct type_info ti_global_ref_0 = {
+    .type_id = CHAR_REF_TYPE_ID,
+    .type_class = GLOBAL_REF_TYPE,
+    .referee_type_id = CHAR_TYPE_ID 
+};
+
+static const struct composite_container_0 {
+    const struct type_info ti_composite_0;
+    Type_info        fields[4];
+} container_0 = {
+    .ti_composite_0 = { 
+        .type_id = COMPOSITE_TYPE_1_ID ,
+        .type_class = COMPOSITE_TYPE,
+        .field_count= 4},
+    .fields = { 
+        &ti_primitive_0,
+        &ti_primitive_0,
+        &ti_primitive_0,
+        &ti_primitive_1 }
+};
+
+static const struct composite_container_1 {
+    const struct type_info ti_composite_1;
+    Type_info        fields[3];
+} container_1 = {
+    .ti_composite_1 = { 
+        .type_id = COMPOSITE_TYPE_2_ID,
+        .type_class = COMPOSITE_TYPE,
+        .field_count= 3},
+    .fields = { 
+        &ti_primitive_1,
+        &container_0.ti_composite_0,
+        &container_0.ti_composite_0 }
+};
+
+static const struct type_info ti_list_global_ref = {
+    .type_id = LIST_GLOBAL_REF_TYPE_ID,
+    .type_class = GLOBAL_REF_TYPE,
+    .referee_type_id = LIST_TYPE_ID
+};
+
+static const struct type_info ti_list_local_ref = {
+    .type_id = LIST_LOCAL_REF_TYPE_ID,
+    .type_class = LOCAL_REF_TYPE,
+    .referee_type_id = LIST_TYPE_ID
+};
+
+static const struct list_container {
+    const struct type_info ti_list;
+    Type_info    fields[3];
+} list_container = {
+    .ti_list = {
+        .type_id = LIST_TYPE_ID,
+        .type_class = COMPOSITE_TYPE,
+        .field_count = 3 },
+    .fields = {
+        &ti_list_local_ref,
+        &ti_primitive_1,
+        &ti_primitive_1,
+    }
+};
+
+static const struct type_info ti_btree_local_ref = {
+    .type_id = BTREE_LOCAL_REF_TYPE_ID,
+    .type_class = LOCAL_REF_TYPE,
+    .referee_type_id = BTREE_TYPE_ID
+};
+
+static const struct btree_container {
+    const struct type_info ti_btree;
+    Type_info    fields[4];
+} btree_container = {
+    .ti_btree = {
+        .type_id = BTREE_TYPE_ID,
+        .type_class = COMPOSITE_TYPE,
+        .field_count = 4 },
+    .fields = {
+        &ti_btree_local_ref,
+        &ti_btree_local_ref,
+	&ti_primitive_1,
+        &ti_primitive_1 }
+};
+
+static const struct type_info ti_otree_local_ref = {
+    .type_id = OTREE_LOCAL_REF_TYPE_ID,
+    .type_class = LOCAL_REF_TYPE,
+    .referee_type_id = OTREE_TYPE_ID
+};
+
+static const struct otree_container {
+    const struct type_info ti_otree;
+    Type_info fields[10];
+} otree_container = {
+    .ti_otree = {
+        .type_id = OTREE_TYPE_ID,
+        .type_class = COMPOSITE_TYPE,
+        .field_count = 10 },
+    .fields = {
+        &ti_otree_local_ref,
+        &ti_otree_local_ref,
+        &ti_otree_local_ref,
+        &ti_otree_local_ref,
+        &ti_otree_local_ref,
+        &ti_otree_local_ref,
+        &ti_otree_local_ref,
+        &ti_otree_local_ref,
+        &ti_primitive_1, 
+        &ti_primitive_1 }
+};
+
+static const struct type_info ti_reference_table_entry = {
+    .type_id = REFERENCE_TABLE_ENTRY,
+    .type_class = PRIMITIVE_TYPE,
+    .primitive_size = 16
+};
+
+/* A long with 64K objects per subpool */
+static const struct type_info ti_long_column = {
+    .type_id = LONG_COLUMN_TYPE_ID,
+    .type_class = PRIMITIVE_TYPE,
+    .sub_pool_shift = 16,
+    .primitive_size = 8
+};
+
+/* Two longs with 512 objects per subpool */
+static const struct pair_container {
+    const struct type_info ti_pair;
+    Type_info    fields[2];
+} pair_container = {
+    .ti_pair = {
+        .type_id = PAIR_TYPE_ID,
+        .type_class = COMPOSITE_TYPE,
+        .sub_pool_shift = 9,
+        .field_count = 2 },
+    .fields = {
+        &ti_primitive_1,
+        &ti_primitive_1 }
+};
+
+/* Eight longs, with field arrays that all start on a page */
+static const struct wide_container {
+    const struct type_info ti_wide;
+    Type_info    fields[8];
+} wide_container = {
+    .ti_wide = {
+        .type_id = WIDE_TYPE_ID,
+        .type_class = COMPOSITE_TYPE,
+        .field_count = 8 },
+    .fields = {
+        &ti_primitive_1, &ti_primitive_1, &ti_primitive_1, &ti_primitive_1,
+        &ti_primitive_1, &ti_primitive_1, &ti_primitive_1, &ti_primitive_1 }
+};
+
+/* The same eight longs, colored */
+static const struct wide_colored_container {
+    const struct type_info ti_wide_colored;
+    Type_info    fields[8];
+} wide_colored_container = {
+    .ti_wide_colored = {
+        .type_id = WIDE_COLORED_TYPE_ID,
+        .type_class = COMPOSITE_TYPE,
+        .cache_colored = 1,
+        .field_count = 8 },
+    .fields = {
+        &ti_primitive_1, &ti_primitive_1, &ti_primitive_1, &ti_primitive_1,
+        &ti_primitive_1, &ti_primitive_1, &ti_primitive_1, &ti_primitive_1 }
+};
+
+/* A key and its value, kept together */
+static const struct kv_container {
+    const struct type_info ti_kv;
+    Type_info    fields[2];
+} kv_container = {
+    .ti_kv = {
+        .type_id = KV_TYPE_ID,
+        .type_class = COMPOSITE_TYPE,
+        .interleaved = 1,
+        .field_count = 2 },
+    .fields = {
+        &ti_primitive_1,
+        &ti_primitive_1 }
+};
+
+/* A binary tree with its key and value in one group */
+static const struct kv_tree_container {
+    const struct type_info ti_kv_tree;
+    Type_info    fields[3];
+} kv_tree_container = {
+    .ti_kv_tree = {
+        .type_id = KV_TREE_TYPE_ID,
+        .type_class = COMPOSITE_TYPE,
+        .field_count = 3 },
+    .fields = {
+        &ti_btree_local_ref,
+        &ti_btree_local_ref,
+        &kv_container.ti_kv }
+};
+
+/* A list with every node in one group, padded from 18 to 32 bytes */
+static const struct grouped_list_container {
+    const struct type_info ti_grouped_list;
+    Type_info    fields[3];
+} grouped_list_container = {
+    .ti_grouped_list = {
+        .type_id = GROUPED_LIST_TYPE_ID,
+        .type_class = COMPOSITE_TYPE,
+        .interleaved = 1,
+        .field_count = 3 },
+    .fields = {
+        &ti_list_local_ref,
+        &ti_primitive_1,
+        &ti_primitive_1 }
+};
+
+static Type_info basic_type_infos[] = {
+    [CHAR_TYPE_ID]              = &ti_primitive_0,
+    [LONG_TYPE_ID]              = &ti_primitive_1,
+    [CHAR_REF_TYPE_ID]          = &ti_global_ref_0,
+    [COMPOSITE_TYPE_1_ID]       = &container_0.ti_composite_0,
+    [COMPOSITE_TYPE_2_ID]       = &container_1.ti_composite_1,
+    [LIST_GLOBAL_REF_TYPE_ID]   = &ti_list_global_ref,
+    [LIST_LOCAL_REF_TYPE_ID]    = &ti_list_local_ref,
+    [LIST_TYPE_ID]              = &list_container.ti_list,
+    [BTREE_LOCAL_REF_TYPE_ID]   = &ti_btree_local_ref,
+    [BTREE_TYPE_ID]             = &btree_container.ti_btree,
+    [OTREE_LOCAL_REF_TYPE_ID]   = &ti_otree_local_ref,
+    [OTREE_TYPE_ID]             = &otree_container.ti_otree,
+    [REFERENCE_TABLE_ENTRY]     = &ti_reference_table_entry,
+    [LONG_COLUMN_TYPE_ID]       = &ti_long_column,
+    [PAIR_TYPE_ID]              = &pair_container.ti_pair,
+    [WIDE_TYPE_ID]              = &wide_container.ti_wide,
+    [WIDE_COLORED_TYPE_ID]      = &wide_colored_container.ti_wide_colored,
+    [KV_TYPE_ID]                = &kv_container.ti_kv,
+    [KV_TREE_TYPE_ID]           = &kv_tree_container.ti_kv_tree,
+    [GROUPED_LIST_TYPE_ID]      = &grouped_list_container.ti_grouped_list
+};
+
+_Static_assert(sizeof(basic_type_infos) / sizeof(Type_info) == BASIC_TYPE_COUNT,
+               "every basic type needs a definition");
+
+int
+add_basic_types(void)
+{
+    return init_type_table(BASIC_TYPE_COUNT, basic_type_infos);
+}
+
+const struct type_info*
+basic_type_info(TYPE_ID type_id)
+{
+    return type_id < BASIC_TYPE_COUNT ? basic_type_infos[type_id] : NULL;
+}
@@ -24,14 +24,21 @@
 
 #include "linked_list.h"
 #include "pool.h"
+#include "pool_iterator.h"
+#include "pool_inline.h"
+#include "basic_types.h"
+#include "benchmark_tlb.h"
 #include "basic_types.h"
-#include "../test/test_type_info.h"
 
 #include "benchmark_stl_tree.h"
 
 struct time_measurements {
 	unsigned long long	insert;
 	unsigned long long	lookup;
+	long long		lookup_tlb_misses;
+	unsigned long long	lookup_inline;
+	unsigned long long	probe;
+	unsigned long long	probe_batch;
 };
 
 char other_data[BIGGER_THAN_L3];
@@ -45,8 +52,30 @@ insert(pool_reference *pool, global_reference root, uint64_t key, uint64_t value
 uint64_t*
 lookup(global_reference root, uint64_t key);
 
+uint64_t*
+lookup_inline(const type_descriptor *desc, global_reference root, uint64_t key);
+
+uint64_t*
+lookup_inline(const type_descriptor *desc, global_reference root, uint64_t key)
+{
+    if (NULL_REF == root)
+        return NULL;
+
+    uint64_t *k = get_field_inline(desc, root, 2);
+    if (*k  < key) {
+        return lookup_inline(desc, get_field_reference_inline(desc, root, 0), key);
+    } else if(*k > key) {
+        return lookup_inline(desc, get_field_reference_inline(desc, root, 1), key);
+    } else {
+        return get_field_inline(desc, root, 3);
+    }
+}
+
 uint64_t
-profile_bintree(struct time_measurements *tm, size_t size, size_t lookup_size);
+profile_bintree(struct time_measurements *tm,
+                size_t size,
+                size_t lookup_size,
+                POOL_PAGE_MODE page_mode);
 
 static int
 print_usage(char *program_name)
@@ -77,9 +106,11 @@ main(int argc, char *argv[])
     }
 
     struct time_measurements pt;
+    struct time_measurements ht;
     struct time_measurements st;
 
-    profile_bintree(&pt, size, lookup_size);
+    profile_bintree(&pt, size, lookup_size, POOL_PAGES_SMALL);
+    profile_bintree(&ht, size, lookup_size, POOL_PAGES_HUGE);
     profile_stl_tree(&st, size, lookup_size);
 
     printf( "\n\nTime to insert and lookup elements in binary tree\n"
@@ -96,6 +127,31 @@ main(int argc, char *argv[])
            ,"std::map lookup: ", U_SEC_TO_SEC(st.lookup)
     );
 
+    printf( "Pooled lookup with small and huge pages\n"
+            "\t%-32s %2.3lf s %12lld dTLB misses\n"
+            "\t%-32s %2.3lf s %12lld dTLB misses\n"
+           ,"Small pages, lookup: ", U_SEC_TO_SEC(pt.lookup), pt.lookup_tlb_misses
+           ,"Huge pages, lookup: ", U_SEC_TO_SEC(ht.lookup), ht.lookup_tlb_misses
+    );
+
+    printf( "\nPooled lookup through the library and with inline accessors\n"
+            "\t%-32s %2.3lf s\n"
+            "\t%-32s %2.3lf s\n"
+            "\t%-32s %2.3lf times\n"
+           ,"get_field, lookup: ", U_SEC_TO_SEC(pt.lookup)
+           ,"get_field_inline, lookup: ", U_SEC_TO_SEC(pt.lookup_inline)
+           ,"speedup: ", U_SEC_TO_SEC(pt.lookup) / U_SEC_TO_SEC(pt.lookup_inline)
+    );
+
+    printf( "\nReading the values of random nodes one at a time and in a batch\n"
+            "\t%-32s %2.3lf s\n"
+            "\t%-32s %2.3lf s\n"
+            "\t%-32s %2.3lf times\n"
+           ,"get_field, probe: ", U_SEC_TO_SEC(pt.probe)
+           ,"get_field_batch, probe: ", U_SEC_TO_SEC(pt.probe_batch)
+           ,"speedup: ", U_SEC_TO_SEC(pt.probe) / U_SEC_TO_SEC(pt.probe_batch)
+    );
+
 }
 
 
@@ -148,7 +204,10 @@ lookup(global_reference root, uint64_t key)
 }
 
 uint64_t
-profile_bintree(struct time_measurements *tm, size_t size, size_t lookup_size)
+profile_bintree(struct time_measurements *tm,
+                size_t size,
+                size_t lookup_size,
+                POOL_PAGE_MODE page_mode)
 {
 	uint64_t lookup_keys[lookup_size];
 
@@ -157,7 +216,9 @@ profile_bintree(struct time_measurements *tm, size_t size, size_t lookup_size)
     struct timeval stop;
 
     int64_t root_val = RAND_MAX / 2;
+    POOL_PAGE_MODE old_mode = pool_set_page_mode(page_mode);
     pool_reference tree_pool = pool_create(BTREE_TYPE_ID);
+    pool_set_page_mode(old_mode);
     global_reference root = pool_alloc(&tree_pool);
     set_field(root, 2, &root_val);
 
@@ -179,14 +240,60 @@ profile_bintree(struct time_measurements *tm, size_t size, size_t lookup_size)
     flush_cash();
 
     uint64_t sum = 0;
+    int counter = tlb_counter_start();
     gettimeofday(&start, NULL);
     for (size_t i = 0 ; i < lookup_size ; ++i) {
          sum += *lookup(root, lookup_keys[i]);
     }
     gettimeofday(&stop, NULL);
+    tm->lookup_tlb_misses = tlb_counter_stop(counter);
 
     tm->lookup = SS_TO_USEC(start, stop);
 
+    flush_cash();
+
+    const type_descriptor *desc = get_type_descriptor(BTREE_TYPE_ID);
+    gettimeofday(&start, NULL);
+    for (size_t i = 0 ; i < lookup_size ; ++i) {
+         sum -= *lookup_inline(desc, root, lookup_keys[i]);
+    }
+    gettimeofday(&stop, NULL);
+
+    tm->lookup_inline = SS_TO_USEC(start, stop);
+
+    /*
+     * The first size nodes are all allocated, as the keys are drawn from far
+     * more values than are inserted.
+     */
+    global_reference *probe_refs = malloc(lookup_size*sizeof(global_reference));
+    uint64_t *probe_values = malloc(lookup_size*sizeof(uint64_t));
+    for (size_t i = 0 ; i < lookup_size ; ++i)
+        probe_refs[i] = pool_get_ref(tree_pool, (size_t) random() % size);
+
+    flush_cash();
+
+    gettimeofday(&start, NULL);
+    for (size_t i = 0 ; i < lookup_size ; ++i) {
+         sum += *(uint64_t*) get_field(probe_refs[i], 3);
+    }
+    gettimeofday(&stop, NULL);
+
+    tm->probe = SS_TO_USEC(start, stop);
+
+    flush_cash();
+
+    gettimeofday(&start, NULL);
+    get_field_batch(probe_refs, lookup_size, 3, probe_values);
+    for (size_t i = 0 ; i < lookup_size ; ++i) {
+         sum -= probe_values[i];
+    }
+    gettimeofday(&stop, NULL);
+
+    tm->probe_batch = SS_TO_USEC(start, stop);
+
+    free(probe_refs);
+    free(probe_values);
+
     pool_destroy(&tree_pool);
 
     return sum;
@@ -0,0 +1,47 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "benchmark_tlb.h"
+
+int
+tlb_counter_start(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+
+    attr.type           = PERF_TYPE_HW_CACHE;
+    attr.size           = sizeof(attr);
+    attr.config         = PERF_COUNT_HW_CACHE_DTLB |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+
+    int counter = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (counter < 0)
+        return -1;
+
+    ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+
+    return counter;
+}
+
+long long
+tlb_counter_stop(int counter)
+{
+    if (counter < 0)
+        return -1;
+
+    long long misses;
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    if (sizeof(misses) != read(counter, &misses, sizeof(misses)))
+        misses = -1;
+
+    close(counter);
+    return misses;
+}
@@ -35,7 +35,7 @@ copy_data_fields(void *dst_spool,
                  void *src_spool,
                  size_t dst_idx,
                  size_t src_idx,
-                 Field_offsets field_offsets,
+                 const field_descriptor *fields,
                  size_t n);
 
 static size_t
@@ -84,21 +84,18 @@ int
 collect_pool(pool_reference *pool)
 {
     pool_struct src = { .raw_val = *pool };
+
+    /* Large pools would have to be collected into a large pool */
+    if (src.is_extended)
+        return 1;
+
     pool_reference dst = pool_create(src.type_id);
 
     if (NULL_POOL == dst)
         return 1;   /* TODO Better return codes */
 
-    size_t field_count = type_table[src.type_id].field_count;
-    size_t num_refs = 0;
-    for (size_t i = 0 ; i < field_count ; ++i ) {
-        uint16_t field_id = type_table[src.type_id].field_offsets[i].type_id;
-
-        if (LOCAL_REF_TYPE != type_table[field_id].type_class) 
-            break;
-
-        num_refs++;
-    }
+    size_t field_count = GET_TYPE_DESCRIPTOR(src)->field_count;
+    size_t num_refs = GET_LOCAL_REF_COUNT(src);
 
     if (num_refs == 1) {
         while (root_stack_size > 0) {
@@ -175,28 +172,30 @@ copy_data_fields(void *dst_spool,
                  void *src_spool,
                  size_t dst_idx,
                  size_t src_idx,
-                 Field_offsets field_offsets,
+                 const field_descriptor *fields,
                  size_t n)
 {
     for (size_t i = 0 ; i <  n ; ++i) {
-        size_t field_size = field_offsets[i].field_size;
-        void *dst = ((char*)dst_spool) + field_offsets[i].offset*PAGE_SIZE;
-        void *src = ((char*)src_spool) + field_offsets[i].offset*PAGE_SIZE;
+        size_t field_size = fields[i].size;
+
+        /* Fields in an interleaved group are strided by the group */
+        void *dst = ((char*)dst_spool) + fields[i].offset +
+                    SCALE_BY_FIELD_STRIDE(fields[i], dst_idx);
+        void *src = ((char*)src_spool) + fields[i].offset +
+                    SCALE_BY_FIELD_STRIDE(fields[i], src_idx);
 
         switch(field_size) {
-            case 1: ((char*)dst)[dst_idx] = ((char*)src)[src_idx];
+            case 1: *(char*)dst = *(char*)src;
                     break;
-            case 2: ((uint16_t*)dst)[dst_idx] = ((uint16_t*)src)[src_idx];
+            case 2: *(uint16_t*)dst = *(uint16_t*)src;
                     break;
-            case 4: ((uint32_t*)dst)[dst_idx] = ((uint32_t*)src)[src_idx];
+            case 4: *(uint32_t*)dst = *(uint32_t*)src;
                     break;
-            case 8: ((uint64_t*)dst)[dst_idx] = ((uint64_t*)src)[src_idx];
+            case 8: *(uint64_t*)dst = *(uint64_t*)src;
                     break;
 
             default:
-                    memcpy(((char*)dst) + field_size*dst_idx,
-                           ((char*)src) + field_size*src_idx,
-                           field_size);
+                    memcpy(dst, src, field_size);
                     break;
         }
     }
@@ -211,8 +210,6 @@ move_list(pool_reference *dst_pool,
           pool_reference *src_pool,
           size_t src_idx)
 {
-    extern Type_table type_table;
-
     pool_struct src = { .raw_val = *src_pool};
 
     char *src_base = pool_to_array(*src_pool);
@@ -222,8 +219,8 @@ move_list(pool_reference *dst_pool,
     if (head_ref.raw_val == NULL_REF)
         return OUT_OF_MEM;
 
-    Field_offsets field_offsets = type_table[src.type_id].field_offsets;
-    size_t field_count = type_table[src.type_id].field_count;
+    const type_descriptor *desc = GET_TYPE_DESCRIPTOR(src);
+    size_t field_count = desc->field_count;
     size_t spool_size = GET_SUB_POOL_SIZE(src);
     size_t start_idx = GET_GLOBAL_INDEX_OF_REF(head_ref);
 
@@ -231,14 +228,18 @@ move_list(pool_reference *dst_pool,
 
     while (src_idx != REF_NOT_FOUND) {
 
-        char *src_spool = src_base + GLOBAL_INDEX_TO_SUBPOOL_ID(src_idx)*spool_size;
-        char *dst_spool = dst_base + GLOBAL_INDEX_TO_SUBPOOL_ID(dst_idx)*spool_size;
-        size_t src_sp_idx = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(src_idx);
-        size_t dst_sp_idx = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(dst_idx);
+        char *src_spool = src_base + GET_SUB_POOL_OF_INDEX(src, src_idx)*spool_size;
+        char *dst_spool = dst_base + GET_SUB_POOL_OF_INDEX(src, dst_idx)*spool_size;
+        size_t src_sp_idx = GET_INDEX_IN_SUB_POOL(src, src_idx);
+        size_t dst_sp_idx = GET_INDEX_IN_SUB_POOL(src, dst_idx);
         size_t next_idx = REF_NOT_FOUND;
 
-        local_reference_struct next = {
-            .raw_val = *((uint16_t*) src_spool + src_sp_idx) };
+        uint16_t *src_next = (uint16_t*) (src_spool + desc->fields[0].offset +
+                              SCALE_BY_FIELD_STRIDE(desc->fields[0], src_sp_idx));
+        uint16_t *dst_next = (uint16_t*) (dst_spool + desc->fields[0].offset +
+                              SCALE_BY_FIELD_STRIDE(desc->fields[0], dst_sp_idx));
+
+        local_reference_struct next = {.raw_val = *src_next};
 
         if (next.is_long_ref) {
             reference_tag tag = {
@@ -254,13 +255,13 @@ move_list(pool_reference *dst_pool,
             next_idx = src_idx + next.index;
         }
 
-        ((uint16_t*)dst_spool)[dst_sp_idx] = next_idx == REF_NOT_FOUND ? 0 : ONE_STEP;
+        *dst_next = next_idx == REF_NOT_FOUND ? 0 : ONE_STEP;
 
         copy_data_fields(dst_spool,
                          src_spool,
                          dst_sp_idx,
                          src_sp_idx,
-                         &field_offsets[1],
+                         &desc->fields[1],
                          field_count -1);
 
         if (next_idx != REF_NOT_FOUND) {
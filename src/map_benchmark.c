@@ -15,16 +15,26 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include "linked_list.h"
 #include "pool.h"
 #include "pool_map.h"
 #include "pool_iterator.h"
 #include "basic_types.h"
-#include "../test/test_type_info.h"
+#include "benchmark_tlb.h"
+#include "basic_types.h"
 
 #define DEFAULT_LENGTH 200000
 #define DEFAULT_FRAGMENTATION 0.5
+
+/* Two pools of eight longs this long fit in L2, so aliasing is what shows */
+#define MULTI_FIELD_LENGTH 16384
+#define MULTI_FIELD_REPEATS 1000
+/* Long enough that a parallel map is bound by memory bandwidth */
+#define PARALLEL_LENGTH 10000000
+/* Objects of eight longs, so that this does not fit in L3 */
+#define ZIP_LENGTH 2000000
 #define U_SEC_TO_SEC(t) (  ((double) (t/1000000)) + \
                            (((double) (t % 1000000)) / 1000000.0) )
 
@@ -44,11 +54,39 @@ static unsigned long long
 profile_simple_list_map(const unsigned long size, double fragmentation);
 
 static unsigned long long
-profile_pooled_list_map(const unsigned long size, double fragmentation);
+profile_pooled_list_map(const unsigned long size,
+                        double fragmentation,
+                        POOL_PAGE_MODE page_mode,
+                        const field_op *op,
+                        long long *tlb_misses);
 
 static unsigned long long
 profile_array_map(const unsigned long size);
 
+static unsigned long long
+profile_multi_field_map(const unsigned long size, uint16_t type_id);
+
+static unsigned long long
+profile_parallel_map(const unsigned long size, unsigned threads);
+
+static unsigned long long
+profile_sum(const unsigned long size, int reduce);
+
+static unsigned long long
+profile_filter(const unsigned long size, int filter);
+
+static unsigned long long
+profile_zip(const unsigned long size, int zip);
+
+static unsigned long long
+profile_live_map(const unsigned long size, int live);
+
+static unsigned long long
+profile_compact_list_map(const unsigned long size, int list);
+
+static unsigned long long
+profile_list_rank(const unsigned long size, int parallel);
+
 void
 flush_cash(void);
 
@@ -84,9 +122,39 @@ main(int argc, char *argv[])
             "Framentation probability: %lf\n",
             size, fragmentation);
 
-    uint64_t pooled_time = profile_pooled_list_map(size, fragmentation);
+    long long small_misses, huge_misses, op_misses;
+    uint64_t pooled_time = profile_pooled_list_map(size, fragmentation,
+                                                   POOL_PAGES_SMALL, NULL,
+                                                   &small_misses);
+    uint64_t huge_time = profile_pooled_list_map(size, fragmentation,
+                                                 POOL_PAGES_HUGE, NULL,
+                                                 &huge_misses);
+    const field_op square_op = {.code = FIELD_OP_SQUARE,
+                                .src_type = FIELD_INT64,
+                                .dst_type = FIELD_INT64};
+    uint64_t op_time = profile_pooled_list_map(size, fragmentation,
+                                               POOL_PAGES_SMALL, &square_op,
+                                               &op_misses);
     uint64_t list_time = profile_simple_list_map(size, fragmentation);
     uint64_t array_time = profile_array_map(size);
+    uint64_t wide_time = profile_multi_field_map(MULTI_FIELD_LENGTH,
+                                                 WIDE_TYPE_ID);
+    uint64_t colored_time = profile_multi_field_map(MULTI_FIELD_LENGTH,
+                                                    WIDE_COLORED_TYPE_ID);
+    uint64_t serial_time = profile_parallel_map(PARALLEL_LENGTH, 1);
+    uint64_t parallel_time = profile_parallel_map(PARALLEL_LENGTH, 0);
+    uint64_t map_sum_time = profile_sum(PARALLEL_LENGTH, 0);
+    uint64_t reduce_sum_time = profile_sum(PARALLEL_LENGTH, 1);
+    uint64_t loop_filter_time = profile_filter(PARALLEL_LENGTH, 0);
+    uint64_t field_filter_time = profile_filter(PARALLEL_LENGTH, 1);
+    uint64_t two_pass_time = profile_zip(ZIP_LENGTH, 0);
+    uint64_t zip_time = profile_zip(ZIP_LENGTH, 1);
+    uint64_t walk_time = profile_live_map(ZIP_LENGTH, 0);
+    uint64_t live_time = profile_live_map(ZIP_LENGTH, 1);
+    uint64_t pool_op_time = profile_compact_list_map(ZIP_LENGTH, 0);
+    uint64_t list_op_time = profile_compact_list_map(ZIP_LENGTH, 1);
+    uint64_t list_serial_time = profile_list_rank(ZIP_LENGTH, 0);
+    uint64_t list_parallel_time = profile_list_rank(ZIP_LENGTH, 1);
 
     printf( "\n\nTime needed to map over a list %lu elements long\n"
             "\t%-22s %2.3lf s\n"
@@ -103,11 +171,108 @@ main(int argc, char *argv[])
             "speedup vs array:",
             U_SEC_TO_SEC(array_time) / U_SEC_TO_SEC(pooled_time));
 
+    printf( "\n\nPooled list map with small and huge pages\n"
+            "\t%-22s %2.3lf s %12lld dTLB misses\n"
+            "\t%-22s %2.3lf s %12lld dTLB misses\n"
+            "\t%-22s %2.3lf times\n",
+            "small pages:", U_SEC_TO_SEC(pooled_time), small_misses,
+            "huge pages:", U_SEC_TO_SEC(huge_time), huge_misses,
+            "speedup:", U_SEC_TO_SEC(pooled_time) / U_SEC_TO_SEC(huge_time));
+
+    printf( "\n\nPooled list map with a function and a built-in operation\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf times\n",
+            "function pointer:", U_SEC_TO_SEC(pooled_time),
+            "built-in square:", U_SEC_TO_SEC(op_time),
+            "speedup:", U_SEC_TO_SEC(pooled_time) / U_SEC_TO_SEC(op_time));
+
+    printf( "\n\nSumming eight fields of %d objects into another pool, %d times\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf times\n",
+            MULTI_FIELD_LENGTH, MULTI_FIELD_REPEATS,
+            "aligned fields:", U_SEC_TO_SEC(wide_time),
+            "colored fields:", U_SEC_TO_SEC(colored_time),
+            "speedup:", U_SEC_TO_SEC(wide_time) / U_SEC_TO_SEC(colored_time));
+
+    printf( "\n\nParallel map over a pool of %d elements, on %ld CPUs\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf times\n",
+            PARALLEL_LENGTH, sysconf(_SC_NPROCESSORS_ONLN),
+            "one thread:", U_SEC_TO_SEC(serial_time),
+            "all CPUs:", U_SEC_TO_SEC(parallel_time),
+            "speedup:", U_SEC_TO_SEC(serial_time) / U_SEC_TO_SEC(parallel_time));
+
+    printf( "\n\nSumming the squares of a pool of %d elements\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf times\n",
+            PARALLEL_LENGTH,
+            "map and loop:", U_SEC_TO_SEC(map_sum_time),
+            "map and reduce:", U_SEC_TO_SEC(reduce_sum_time),
+            "speedup:", U_SEC_TO_SEC(map_sum_time) / U_SEC_TO_SEC(reduce_sum_time));
+
+    printf( "\n\nSelecting a quarter of a pool of %d elements into another\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf times\n",
+            PARALLEL_LENGTH,
+            "branching loop:", U_SEC_TO_SEC(loop_filter_time),
+            "field filter:", U_SEC_TO_SEC(field_filter_time),
+            "speedup:", U_SEC_TO_SEC(loop_filter_time) / U_SEC_TO_SEC(field_filter_time));
+
+    printf( "\n\nMultiplying two fields of %d objects into a third\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf times\n",
+            ZIP_LENGTH,
+            "copy and multiply:", U_SEC_TO_SEC(two_pass_time),
+            "zip in place:", U_SEC_TO_SEC(zip_time),
+            "speedup:", U_SEC_TO_SEC(two_pass_time) / U_SEC_TO_SEC(zip_time));
+
+    printf( "\n\nMapping over a list of %d elements with every fourth freed\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf times\n",
+            ZIP_LENGTH,
+            "list walk:", U_SEC_TO_SEC(walk_time),
+            "liveness bitmap:", U_SEC_TO_SEC(live_time),
+            "speedup:", U_SEC_TO_SEC(walk_time) / U_SEC_TO_SEC(live_time));
+
+    printf( "\n\nSquaring a list of %d elements laid out in order\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf times\n",
+            ZIP_LENGTH,
+            "pool op map:", U_SEC_TO_SEC(pool_op_time),
+            "list op map:", U_SEC_TO_SEC(list_op_time),
+            "slowdown:", U_SEC_TO_SEC(list_op_time) / U_SEC_TO_SEC(pool_op_time));
+
+    printf( "\n\nMapping over a scattered list of %d elements, on %ld CPUs\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf s\n"
+            "\t%-22s %2.3lf times\n",
+            ZIP_LENGTH, sysconf(_SC_NPROCESSORS_ONLN),
+            "serial walk:", U_SEC_TO_SEC(list_serial_time),
+            "parallel ranking:", U_SEC_TO_SEC(list_parallel_time),
+            "speedup:",
+            U_SEC_TO_SEC(list_serial_time) / U_SEC_TO_SEC(list_parallel_time));
+
     return 0;
 }
 
+/*
+ * Maps square over the values of a list, with field_map, or with field_op_map
+ * and op if it is not NULL.
+ */
 static unsigned long long
-profile_pooled_list_map(const unsigned long size, double fragmentation)
+profile_pooled_list_map(const unsigned long size,
+                        double fragmentation,
+                        POOL_PAGE_MODE page_mode,
+                        const field_op *op,
+                        long long *tlb_misses)
 {
     srandom(0xdeadbeef);
     struct timeval start;
@@ -116,8 +281,10 @@ profile_pooled_list_map(const unsigned long size, double fragmentation)
     int64_t frag_threshold = RAND_MAX*fragmentation;
     Node head_unrelated_alloc = new_unrelated(NULL, 2.0);
 
+    POOL_PAGE_MODE old_mode = pool_set_page_mode(page_mode);
     pool_reference list_pool = pool_create(LIST_TYPE_ID);
     pool_reference result_pool = pool_create(LONG_TYPE_ID);
+    pool_set_page_mode(old_mode);
     global_reference head = pool_alloc(&list_pool);
     pool_iterator itr = iterator_new(&list_pool, &head);
 
@@ -135,9 +302,14 @@ profile_pooled_list_map(const unsigned long size, double fragmentation)
 
     flush_cash();
 
+    int counter = tlb_counter_start();
     gettimeofday(&start, NULL);
-    field_map(list_pool, &result_pool, 1, square);
+    if (op)
+        field_op_map(list_pool, &result_pool, 1, op);
+    else
+        field_map(list_pool, &result_pool, 1, square);
     gettimeofday(&stop, NULL);
+    *tlb_misses = tlb_counter_stop(counter);
 
     pool_destroy(&list_pool);
     pool_destroy(&result_pool);
@@ -205,6 +377,388 @@ profile_array_map(const unsigned long size)
             stop.tv_usec - start.tv_usec; 
 }
 
+/*
+ * Reads all eight fields of every object in one pool, and writes their sum to
+ * the first field of the same object in another. With uncolored types the
+ * nine streams start on the same cache set in every subpool.
+ */
+static unsigned long long
+profile_multi_field_map(const unsigned long size, uint16_t type_id)
+{
+    struct timeval start;
+    struct timeval stop;
+
+    pool_reference src_pool = pool_create(type_id);
+    pool_reference dst_pool = pool_create(type_id);
+    pool_grow(&src_pool, size);
+    pool_grow(&dst_pool, size);
+
+    for (size_t i = 0 ; i < size ; ++i) {
+        global_reference ref = pool_get_ref(src_pool, i);
+        for (uint64_t f = 0 ; f < 8 ; ++f) {
+            uint64_t value = i + f;
+            set_field(ref, f, &value);
+        }
+    }
+
+    flush_cash();
+
+    gettimeofday(&start, NULL);
+    for (int repeat = 0 ; repeat < MULTI_FIELD_REPEATS ; ++repeat) {
+        for (size_t run = 0 ; run < size ; run += 4096) {
+            size_t length = size - run < 4096 ? size - run : 4096;
+            global_reference src = pool_get_ref(src_pool, run);
+            uint64_t *fields[8];
+            for (size_t f = 0 ; f < 8 ; ++f)
+                fields[f] = get_field(src, f);
+            uint64_t *sum = get_field(pool_get_ref(dst_pool, run), 0);
+
+            for (size_t i = 0 ; i < length ; ++i)
+                sum[i] = fields[0][i] + fields[1][i] + fields[2][i] +
+                         fields[3][i] + fields[4][i] + fields[5][i] +
+                         fields[6][i] + fields[7][i];
+        }
+    }
+    gettimeofday(&stop, NULL);
+
+    pool_destroy(&src_pool);
+    pool_destroy(&dst_pool);
+
+    return ((stop.tv_sec - start.tv_sec) * 1000000LLU) +
+            stop.tv_usec - start.tv_usec; 
+}
+
+/*
+ * Squares a pool of longs into another with field_map_parallel, on the given
+ * number of threads, or on all CPUs if it is 0.
+ */
+static unsigned long long
+profile_parallel_map(const unsigned long size, unsigned threads)
+{
+    struct timeval start;
+    struct timeval stop;
+
+    pool_reference src_pool = pool_create(LONG_TYPE_ID);
+    pool_reference result_pool = pool_create(LONG_TYPE_ID);
+    pool_grow(&src_pool, size);
+
+    uint64_t *values = pool_to_array(src_pool);
+    for (size_t i = 0 ; i < size ; ++i)
+        values[i] = i;
+
+    unsigned old_threads = map_set_thread_count(threads);
+    flush_cash();
+
+    gettimeofday(&start, NULL);
+    field_map_parallel(src_pool, &result_pool, 0, square);
+    gettimeofday(&stop, NULL);
+
+    map_set_thread_count(old_threads);
+    pool_destroy(&src_pool);
+    pool_destroy(&result_pool);
+
+    return ((stop.tv_sec - start.tv_sec) * 1000000LLU) +
+            stop.tv_usec - start.tv_usec; 
+}
+
+/*
+ * Squares a pool of longs into another and sums the squares, with a loop over
+ * the result or with field_reduce.
+ */
+static unsigned long long
+profile_sum(const unsigned long size, int reduce)
+{
+    struct timeval start;
+    struct timeval stop;
+
+    pool_reference src_pool = pool_create(LONG_TYPE_ID);
+    pool_reference result_pool = pool_create(LONG_TYPE_ID);
+    pool_grow(&src_pool, size);
+
+    uint64_t *values = pool_to_array(src_pool);
+    for (size_t i = 0 ; i < size ; ++i)
+        values[i] = i;
+
+    const field_op square_op = {.code = FIELD_OP_SQUARE,
+                                .src_type = FIELD_INT64,
+                                .dst_type = FIELD_INT64};
+    const field_reduce_op sum_op = {.code = FIELD_REDUCE_SUM,
+                                    .type = FIELD_INT64};
+    field_scalar sum = {.i = 0};
+
+    flush_cash();
+
+    gettimeofday(&start, NULL);
+    field_op_map(src_pool, &result_pool, 0, &square_op);
+    if (reduce) {
+        field_reduce(result_pool, 0, &sum_op, &sum);
+    } else {
+        uint64_t *squares = pool_to_array(result_pool);
+        for (size_t i = 0 ; i < size ; ++i)
+            sum.i += squares[i];
+    }
+    gettimeofday(&stop, NULL);
+
+    printf("Sum of squares: %ld\n", sum.i);
+
+    pool_destroy(&src_pool);
+    pool_destroy(&result_pool);
+
+    return ((stop.tv_sec - start.tv_sec) * 1000000LLU) +
+            stop.tv_usec - start.tv_usec; 
+}
+
+/*
+ * Copies the elements of a pool of pseudo random longs below a quarter of
+ * their range into another pool, with a loop over the values or with
+ * field_filter.
+ */
+static unsigned long long
+profile_filter(const unsigned long size, int filter)
+{
+    struct timeval start;
+    struct timeval stop;
+
+    pool_reference src_pool = pool_create(LONG_TYPE_ID);
+    pool_reference result_pool = pool_create(LONG_TYPE_ID);
+    pool_grow(&src_pool, size);
+
+    srand(1);
+    uint64_t *values = pool_to_array(src_pool);
+    for (size_t i = 0 ; i < size ; ++i)
+        values[i] = rand();
+
+    const field_op below_op = {.code = FIELD_OP_LT,
+                               .src_type = FIELD_INT64,
+                               .x.i = RAND_MAX / 4};
+    size_t selected = 0;
+
+    flush_cash();
+
+    gettimeofday(&start, NULL);
+    if (filter) {
+        field_filter(src_pool, 0, &below_op, NULL, &result_pool, &selected);
+    } else {
+        for (size_t i = 0 ; i < size ; ++i) {
+            if (values[i] < RAND_MAX / 4) {
+                global_reference ref = pool_alloc(&result_pool);
+                set_field(ref, 0, &values[i]);
+                ++selected;
+            }
+        }
+    }
+    gettimeofday(&stop, NULL);
+
+    printf("Selected: %zu\n", selected);
+
+    pool_destroy(&src_pool);
+    pool_destroy(&result_pool);
+
+    return ((stop.tv_sec - start.tv_sec) * 1000000LLU) +
+            stop.tv_usec - start.tv_usec;
+}
+
+/*
+ * Multiplies two fields of a pool of wide objects into a third, by copying
+ * the first to another pool with field_op_map and multiplying that with the
+ * second, or in one pass with field_zip_op_map.
+ */
+static unsigned long long
+profile_zip(const unsigned long size, int zip)
+{
+    struct timeval start;
+    struct timeval stop;
+
+    pool_reference src_pool = pool_create(WIDE_TYPE_ID);
+    pool_reference copy_pool = pool_create(LONG_TYPE_ID);
+    pool_grow(&src_pool, size);
+
+    for (size_t i = 0 ; i < size ; ++i) {
+        global_reference ref = pool_get_ref(src_pool, i);
+        uint64_t values[2] = {i, i + 1};
+        set_field(ref, 0, &values[0]);
+        set_field(ref, 1, &values[1]);
+    }
+
+    const field_op copy_op = {.code = FIELD_OP_CONVERT,
+                              .src_type = FIELD_INT64,
+                              .dst_type = FIELD_INT64};
+    const field_op mul_op = {.code = FIELD_OP_MUL,
+                             .src_type = FIELD_INT64,
+                             .dst_type = FIELD_INT64};
+    const size_t fields[2] = {0, 1};
+
+    flush_cash();
+
+    gettimeofday(&start, NULL);
+    if (zip) {
+        field_zip_op_map(src_pool, fields, &src_pool, 2, &mul_op);
+    } else {
+        field_op_map(src_pool, &copy_pool, 0, &copy_op);
+        const uint64_t *copies = pool_to_array(copy_pool);
+        for (size_t run = 0 ; run < size ; run += 4096) {
+            size_t length = size - run < 4096 ? size - run : 4096;
+            global_reference src = pool_get_ref(src_pool, run);
+            const uint64_t *b = get_field(src, 1);
+            uint64_t *c = get_field(src, 2);
+            for (size_t i = 0 ; i < length ; ++i)
+                c[i] = copies[run + i] * b[i];
+        }
+    }
+    gettimeofday(&stop, NULL);
+
+    printf("Last product: %lu\n",
+           *(uint64_t*) get_field(pool_get_ref(src_pool, size - 1), 2));
+
+    pool_destroy(&src_pool);
+    pool_destroy(&copy_pool);
+
+    return ((stop.tv_sec - start.tv_sec) * 1000000LLU) +
+            stop.tv_usec - start.tv_usec;
+}
+
+/*
+ * Squares the values of a list from which every fourth node has been unlinked
+ * and freed, by walking it with field_list_map or with field_map_live.
+ */
+static unsigned long long
+profile_live_map(const unsigned long size, int live)
+{
+    struct timeval start;
+    struct timeval stop;
+
+    pool_reference list_pool = pool_create(LIST_TYPE_ID);
+    pool_reference result_pool = pool_create(LONG_TYPE_ID);
+    global_reference *refs = malloc(size*sizeof(global_reference));
+
+    refs[0] = pool_alloc(&list_pool);
+    pool_iterator itr = iterator_new(&list_pool, &refs[0]);
+    for (size_t i = 1 ; i < size ; ++i) {
+        refs[i] = pool_alloc(&list_pool);
+        iterator_list_insert(itr, refs[i]);
+        itr = iterator_next(list_pool, itr);
+        iterator_set_field(itr, 1, &i);
+    }
+
+    for (size_t i = 3 ; i < size ; i += 4) {
+        iterator_list_remove(iterator_from_reference(refs[i - 1]));
+        pool_free(refs[i]);
+    }
+
+    flush_cash();
+
+    gettimeofday(&start, NULL);
+    if (live)
+        field_map_live(list_pool, &result_pool, 1, square);
+    else
+        field_list_map(refs[0], &result_pool, 1, square);
+    gettimeofday(&stop, NULL);
+
+    free(refs);
+    pool_destroy(&list_pool);
+    pool_destroy(&result_pool);
+
+    return ((stop.tv_sec - start.tv_sec) * 1000000LLU) +
+            stop.tv_usec - start.tv_usec;
+}
+
+/*
+ * Squares the values of a list whose nodes follow each other in the pool, as
+ * after a collection, with field_op_map over the pool or with
+ * field_list_op_map along the list.
+ */
+static unsigned long long
+profile_compact_list_map(const unsigned long size, int list)
+{
+    struct timeval start;
+    struct timeval stop;
+
+    pool_reference list_pool = pool_create(LIST_TYPE_ID);
+    pool_reference result_pool = pool_create(LONG_TYPE_ID);
+
+    global_reference head = pool_alloc(&list_pool);
+    pool_iterator itr = iterator_new(&list_pool, &head);
+    for (size_t i = 1 ; i < size ; ++i) {
+        iterator_list_insert(itr, pool_alloc(&list_pool));
+        itr = iterator_next(list_pool, itr);
+        iterator_set_field(itr, 1, &i);
+    }
+
+    const field_op square_op = {.code = FIELD_OP_SQUARE,
+                                .src_type = FIELD_INT64,
+                                .dst_type = FIELD_INT64};
+
+    flush_cash();
+
+    gettimeofday(&start, NULL);
+    if (list)
+        field_list_op_map(head, &result_pool, 1, &square_op);
+    else
+        field_op_map(list_pool, &result_pool, 1, &square_op);
+    gettimeofday(&stop, NULL);
+
+    pool_destroy(&list_pool);
+    pool_destroy(&result_pool);
+
+    return ((stop.tv_sec - start.tv_sec) * 1000000LLU) +
+            stop.tv_usec - start.tv_usec;
+}
+
+/*
+ * The element of a pool of size elements that is node k of a list shuffled
+ * within blocks of 4096. 1597 is prime, so it shuffles the short last block
+ * too.
+ */
+static size_t
+shuffled_index(size_t k, size_t size)
+{
+    size_t block = k - k % 4096;
+    size_t length = size - block < 4096 ? size - block : 4096;
+    return block + (k % 4096)*1597 % length;
+}
+
+/*
+ * Squares the values of a list whose nodes are shuffled within each block of
+ * 4096, so that no two follow each other in the pool, with field_list_map or
+ * with field_list_map_parallel.
+ */
+static unsigned long long
+profile_list_rank(const unsigned long size, int parallel)
+{
+    struct timeval start;
+    struct timeval stop;
+
+    pool_reference list_pool = pool_create(LIST_TYPE_ID);
+    pool_reference result_pool = pool_create(LONG_TYPE_ID);
+    global_reference *refs = malloc(size*sizeof(global_reference));
+    for (size_t i = 0 ; i < size ; ++i)
+        refs[i] = pool_alloc(&list_pool);
+
+    for (size_t k = 0 ; k < size ; ++k) {
+        global_reference node = refs[shuffled_index(k, size)];
+        set_field(node, 1, &k);
+        if (k + 1 < size)
+            set_field_reference(node, 0, refs[shuffled_index(k + 1, size)]);
+    }
+    global_reference head = refs[shuffled_index(0, size)];
+
+    flush_cash();
+
+    gettimeofday(&start, NULL);
+    if (parallel)
+        field_list_map_parallel(list_pool, head, &result_pool, 1, square);
+    else
+        field_list_map(head, &result_pool, 1, square);
+    gettimeofday(&stop, NULL);
+
+    free(refs);
+    pool_destroy(&list_pool);
+    pool_destroy(&result_pool);
+
+    return ((stop.tv_sec - start.tv_sec) * 1000000LLU) +
+            stop.tv_usec - start.tv_usec;
+}
+
 uint64_t*
 array_field_map(Node src,
                 size_t length,
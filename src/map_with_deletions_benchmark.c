@@ -24,7 +24,7 @@
 #include "pool_iterator.h"
 #include "gc.h"
 #include "basic_types.h"
-#include "../test/test_type_info.h"
+#include "basic_types.h"
 
 #define DEFAULT_LENGTH 200000
 #define DEFAULT_DELETE_PROBABILITY 0.5
@@ -236,8 +236,10 @@ profile_pooled_list_map(struct time_measurements *tm, const unsigned long length
     itr = iterator_new(&list_pool, &head);
     while (itr != ITERATOR_END) {
         if (random() < del_threshold) {
+            global_reference victim = get_field_reference(itr, 0);
             if (0 != iterator_list_remove(itr))
                 break;
+            pool_free(victim);
         } else {
             itr = iterator_next(list_pool, itr);
         }
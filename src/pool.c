@@ -8,6 +8,12 @@
  */
 
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "basic_types.h"
 #include "pool.h"
 #include "type_info.h"
 #include "field_info.h"
@@ -15,34 +21,206 @@
 #include "pool_private.h"
 
 Type_table type_table;
-static volatile uint16_t NEXT_FREE_POOL_IDX = 1u;
+struct pool_meta pool_meta_table[1 << 16];
+
+/*
+ * One bit per pool id, a set bit marks an id that is in use. Id 0 is NULL_POOL
+ * and the tail of the last word lies past POOL_STOP, so those bits start out
+ * set and are never cleared.
+ */
+#define POOL_ID_WORDS ((POOL_ID_COUNT + 63) / 64)
+static uint64_t pool_id_map[POOL_ID_WORDS] = {
+    [0] = 1u,
+    [POOL_ID_WORDS - 1] = POOL_ID_COUNT % 64 ? ~0llu << (POOL_ID_COUNT % 64) : 0
+};
+
+/* The word where the search for a free id starts */
+static size_t pool_id_hint;
+
+/* Mapping and page modes for new pools, and the number of mapping calls made */
+static POOL_MAP_MODE pool_map_mode = POOL_MAP_EAGER;
+static POOL_PAGE_MODE pool_page_mode = POOL_PAGES_SMALL;
+static size_t pool_syscalls;
+
+/* The most objects, as a power of two, that a window of a large pool holds */
+static unsigned pool_max_window_shift = MAX_WINDOW_SHIFT;
+
+/* Helpers that set up and tear down the window of a single pool id */
+static int
+pool_create_window(const struct pool_reference *ref);
+
+static int
+pool_destroy_window(const struct pool_reference *ref);
+
+/* Helpers that grow and shrink the windows of a pool one at a time */
+static global_reference
+pool_add_elements(pool_reference *pool, const size_t num_elements);
+
+static global_reference
+pool_add_to_window(pool_reference *pool, const size_t num_elements);
+
+static int
+pool_shrink_large(pool_reference *pool, const size_t num_elements);
+
+static int
+pool_shrink_clear(const struct pool_reference *p_ref, size_t old_size);
+
+static void
+pool_clear_range(const struct pool_reference *p_ref, size_t from, size_t to);
+
+/*
+ * Helpers that map and unmap the subpools holding objects from to to - 1,
+ * according to the mode of a pool. pool_commit skips whatever the provisioner
+ * has already mapped, pool_commit_range maps all of it.
+ */
+static int
+pool_commit(const struct pool_reference *p_ref, size_t from, size_t to);
+
+static int
+pool_commit_range(const struct pool_reference *p_ref, size_t from, size_t to);
+
+static int
+pool_decommit(const struct pool_reference *p_ref, size_t from, size_t to);
+
+static int
+pool_map_flags(const struct pool_meta *meta);
+
+#define ROUND_UP_TO_PAGE(X, PAGE) (((X) + (PAGE) - 1) & ~((PAGE) - 1))
+
+/*
+ * How many references ahead get_field_batch() and set_field_batch()
+ * prefetch, about the number of misses a core can have in flight.
+ */
+#define FIELD_BATCH_DISTANCE 32
+
+/* __builtin_prefetch() wants its read or write argument as a constant */
+#define FIELD_BATCH_PREFETCH(addr, store) \
+    ((store) ? __builtin_prefetch((void*) (addr), 1, 0) : \
+               __builtin_prefetch((void*) (addr), 0, 0))
+
+/* Helpers for the pool id bitmap */
+static uint16_t
+pool_id_claim(void);
+
+static uint16_t
+pool_id_claim_run(size_t n);
+
+static bool
+pool_id_claim_at(uint16_t pool_id);
+
+static void
+pool_id_release(uint16_t pool_id);
+
+/* Helpers that map and unmap the file behind a file-backed pool */
+static int
+pool_map_file(const struct pool_reference *p_ref, int fd, size_t committed);
+
+static void
+pool_unmap_file(struct pool_meta *meta, const pool_reference pool);
+
+/* Helpers for the liveness bitmap and the free slot index */
+static int
+liveness_reserve(struct pool_meta *meta, size_t sub_pool_id);
+
+static void
+liveness_clear_range(struct pool_meta *meta, size_t from, size_t to);
+
+static void
+liveness_release(struct pool_meta *meta);
+
+static global_reference
+pool_reuse_slot(pool_reference *pool);
+
+/* Claims a chunk of a shared pool for a thread local allocation buffer */
+static int
+pool_claim(pool_reference *pool, pool_range_cursor *range);
+
+/*
+ * The background provisioner. Owners of a pool post at most one request at a
+ * time, for the block right after the mapped part of the pool, and wait for it
+ * to be done before they map or unmap anything themselves. A request that the
+ * provisioner has not started on is taken back instead of waited for.
+ *
+ * The state of a pool is a ticket, bumped by every request, and the phase of
+ * the request with that ticket. Requests carry the state they were posted
+ * with, so that the provisioner skips those that were taken back. Owners wait
+ * for a running request on the done condition, which the provisioner
+ * broadcasts whenever it finishes one.
+ */
+#define PROVISION_QUEUE_LENGTH 64
+
+/* Nice value of the provisioner, below the owners but never starved */
+#define PROVISIONER_NICE 10
+
+#define PROVISION_IDLE      0u
+#define PROVISION_POSTED    1u
+#define PROVISION_RUNNING   2u
+#define PROVISION_TICKET    4u
+#define PROVISION_PHASE(state) ((state) & (PROVISION_TICKET - 1))
+#define PROVISION_STATE(state, phase) \
+    (((state) & ~(uint64_t) (PROVISION_TICKET - 1)) | (phase))
+
+struct provision_request {
+    struct pool_reference   pool;
+    size_t                  from;
+    size_t                  to;
+    uint64_t                state;
+};
+
+static struct {
+    pthread_mutex_t             lock;
+    pthread_cond_t              wake;
+    pthread_cond_t              done;
+    pthread_once_t              once;
+    bool                        running;
+    size_t                      head;
+    size_t                      tail;
+    struct provision_request    queue[PROVISION_QUEUE_LENGTH];
+} provisioner = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT
+};
+
+static void
+provisioner_start(void);
+
+static void*
+provisioner_main(void *arg);
+
+static void
+provision_post(const struct pool_reference *p_ref);
+
+static void
+provision_wait(struct pool_meta *meta);
+
+static inline void
+provision_check(const struct pool_reference *p_ref)
+{
+    struct pool_meta *meta = &pool_meta_table[p_ref->pool_id];
+    if (0 != meta->provision_at && GET_SIZE_OF_POOL(*p_ref) >= meta->provision_at)
+        provision_post(p_ref);
+}
+
+POOL_MAP_MODE
+pool_set_map_mode(POOL_MAP_MODE mode)
+{
+    return __atomic_exchange_n(&pool_map_mode, mode, __ATOMIC_RELAXED);
+}
+
+POOL_PAGE_MODE
+pool_set_page_mode(POOL_PAGE_MODE mode)
+{
+    return __atomic_exchange_n(&pool_page_mode, mode, __ATOMIC_RELAXED);
+}
 
 pool_reference
 pool_create(uint16_t type_id)
 {
-    size_t   pool_size  = type_table[type_id].type_size * PAGE_SIZE;
-    uint16_t pool_idx   = NEXT_FREE_POOL_IDX;
+    uint16_t pool_idx   = pool_id_claim();
 
-    bool write_success;
-    do {
-        write_success = __atomic_compare_exchange_n(
-                &NEXT_FREE_POOL_IDX,
-                &pool_idx,
-                pool_idx + 1,
-                false,
-                __ATOMIC_RELAXED,
-                __ATOMIC_RELAXED);
-
-    } while (! write_success );
-
-    void *addr_hint     = (void*) POOL_IDX_TO_ADDR(pool_idx);
-    void *mapped_addr   = mmap( addr_hint,
-                                pool_size,
-                                PROT_READ | PROT_WRITE,
-                                MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED,
-                                0, 0);
-
-    if (addr_hint != mapped_addr)
+    if (0 == pool_idx)
         return NULL_POOL;
 
     struct pool_reference ref = {.type_id       = type_id,
@@ -50,42 +228,380 @@ pool_create(uint16_t type_id)
                                  .sub_pool_id   = 0,
                                  .raw_index     = 0 };
 
+    if (0 != pool_create_window(&ref)) {
+        pool_id_release(pool_idx);
+        return NULL_POOL;
+    }
+
     return ref.raw_val;
 }
 
+pool_reference
+pool_create_large(uint16_t type_id, size_t capacity)
+{
+    /*
+     * Each window holds a power of two objects, as many as fit in it and can
+     * be addressed by the 16 bit sub_pool_id. Windows end on a block of
+     * PAGE_SIZE objects and on a subpool, so that neither straddles two.
+     */
+    unsigned shift = __atomic_load_n(&pool_max_window_shift, __ATOMIC_RELAXED);
+    const type_descriptor *desc = TYPE_DESCRIPTOR_OF_ID(type_id);
+    unsigned sub_pool_shift = desc->sub_pool_shift;
+    while (shift > sub_pool_shift &&
+           (desc->sub_pool_size << (shift - sub_pool_shift)) > POOL_WINDOW_SIZE)
+        shift--;
+
+    if (((size_t) 1 << shift) < PAGE_SIZE || shift < sub_pool_shift ||
+        (desc->sub_pool_size << (shift - sub_pool_shift)) > POOL_WINDOW_SIZE)
+        return NULL_POOL;
+
+    size_t windows = (capacity + ((size_t) 1 << shift) - 1) >> shift;
+    windows = windows > 0 ? windows : 1;
+    if (windows >= POOL_ID_COUNT)
+        return NULL_POOL;
+
+    uint16_t base = pool_id_claim_run(windows);
+    if (0 == base)
+        return NULL_POOL;
+
+    struct pool_reference ref = {.type_id       = type_id,
+                                 .pool_id       = base,
+                                 .sub_pool_id   = 0,
+                                 .raw_index     = 0,
+                                 .is_extended   = 1 };
+
+    for (size_t w = 0 ; w < windows ; ++w) {
+        struct pool_reference window = ref;
+        window.pool_id = base + w;
+
+        if (0 != pool_create_window(&window)) {
+            /* The windows set up so far still hold their first block */
+            for (size_t i = 0 ; i < w ; ++i) {
+                window.pool_id = base + i;
+                pool_destroy_window(&window);
+            }
+            for (size_t i = w ; i < windows ; ++i)
+                pool_id_release(base + i);
+            return NULL_POOL;
+        }
+
+        struct pool_meta *meta = &pool_meta_table[window.pool_id];
+        meta->extent_base = base;
+        meta->extent_windows = windows;
+        meta->window_shift = shift;
+    }
+
+    return ref.raw_val;
+}
+
+static int
+pool_create_window(const struct pool_reference *ref)
+{
+    uint16_t pool_idx = ref->pool_id;
+    struct pool_meta *meta = &pool_meta_table[pool_idx];
+    meta->map_mode = __atomic_load_n(&pool_map_mode, __ATOMIC_RELAXED);
+    meta->page_mode = __atomic_load_n(&pool_page_mode, __ATOMIC_RELAXED);
+    meta->page_size = SMALL_PAGE_SIZE;
+    meta->committed = 0;
+    meta->size = 0;
+    meta->header = NULL;
+    meta->fd = -1;
+
+    /* Huge pages need the window to be a single mapping */
+    if (POOL_PAGES_SMALL != meta->page_mode) {
+        meta->page_size = HUGE_PAGE_SIZE;
+        if (POOL_MAP_EAGER == meta->map_mode)
+            meta->map_mode = POOL_MAP_RESERVE;
+    }
+
+    if (POOL_MAP_EAGER != meta->map_mode) {
+        int prot = meta->map_mode == POOL_MAP_RESERVE ?
+                   PROT_NONE : PROT_READ | PROT_WRITE;
+        void *addr_hint     = (void*) POOL_IDX_TO_ADDR(pool_idx);
+
+        __atomic_fetch_add(&pool_syscalls, 1, __ATOMIC_RELAXED);
+        void *mapped_addr   = mmap( addr_hint,
+                                    POOL_WINDOW_SIZE,
+                                    prot,
+                                    pool_map_flags(meta),
+                                    0, 0);
+
+        if (addr_hint != mapped_addr)
+            return 1;
+
+        /* Without THP support the pool simply keeps its small pages */
+        if (POOL_PAGES_HUGE == meta->page_mode) {
+            __atomic_fetch_add(&pool_syscalls, 1, __ATOMIC_RELAXED);
+            (void) madvise(addr_hint, POOL_WINDOW_SIZE, MADV_HUGEPAGE);
+        }
+    }
+
+    if (0 != pool_commit(ref, 0, PAGE_SIZE)) {
+        if (POOL_MAP_EAGER != meta->map_mode)
+            munmap((void*) POOL_IDX_TO_ADDR(pool_idx), POOL_WINDOW_SIZE);
+        return 1;
+    }
+
+    return 0;
+}
+
 int
 pool_destroy(pool_reference *pool)
 {
-    /* In future versions it would be advantageous to keep track of unused
-     * pools, perferably through a bit map. So they can be easily reused.
-     * This could be done as a part of garbage collection, and thanks to layout
-     * of the system, "compactation" of heaps could be made with mremap, thus
-     * requireing no copying or memory movement.
-     *
-     * For now the pages are just released however.
+    /*
+     * The pages are released and the pool id is handed back to the id bitmap,
+     * so the id and its address window can be reused by pool_create. Thanks
+     * to the layout of the system, "compactation" of heaps could in the
+     * future be made with mremap, thus requireing no copying or memory
+     * movement.
      */
 
     struct pool_reference *ref = (struct pool_reference*) pool;
-    size_t sub_pool_size = type_table[ref->type_id].type_size * PAGE_SIZE;
 
+    /* Nothing to release, and id 0 must never be handed back */
+    if (0 == ref->pool_id)
+        return 0;
+
+    if (!ref->is_extended) {
+        int err = pool_destroy_window(ref);
+        if (0 != err)
+            return err;
+
+        *pool = NULL_POOL;
+        return 0;
+    }
+
+    /*
+     * The windows before the one that holds the end of a large pool are full,
+     * and those after it only hold their first block.
+     */
+    uint16_t base = GET_EXTENT_BASE(*ref);
+    size_t windows = pool_meta_table[base].extent_windows;
+    size_t capacity = (size_t) 1 << GET_WINDOW_SHIFT(*ref);
+
+    for (size_t w = 0 ; w < windows ; ++w) {
+        struct pool_reference window = *ref;
+        window.pool_id = base + w;
+
+        if (window.pool_id < ref->pool_id) {
+            window.sub_pool_id = capacity/PAGE_SIZE - 1;
+            window.index = 0;
+            window.full = 1;
+        } else if (window.pool_id > ref->pool_id) {
+            window.sub_pool_id = 0;
+            window.index = 0;
+            window.full = 0;
+        }
+
+        int err = pool_destroy_window(&window);
+        if (0 != err)
+            return err;
+    }
+
+    *pool = NULL_POOL;
+    return 0;
+}
+
+static int
+pool_destroy_window(const struct pool_reference *ref)
+{
+    struct pool_meta *meta = &pool_meta_table[ref->pool_id];
+
+    /* A pool that reuses the id must not see the long references of this one */
+    delete_all_for_pool(ref->raw_val);
+
+    /* Blocks mapped ahead of the end of the pool are released as well */
+    provision_wait(meta);
+    size_t mapped = (1 + ref->sub_pool_id)*PAGE_SIZE;
+    mapped = mapped > meta->provisioned ? mapped : meta->provisioned;
+
+    size_t sub_pool_size = GET_SUB_POOL_SIZE(*ref);
+    size_t sub_pools = GET_SUB_POOLS_FOR(*ref, mapped);
 
     uintptr_t pool_start = POOL_IDX_TO_ADDR(ref->pool_id);
-    size_t    pool_size  = (1 + ref->sub_pool_id)*sub_pool_size;
+    size_t    pool_size  = sub_pools*sub_pool_size;
+
+    /* Pools that reserved their window release all of it */
+    if (POOL_MAP_EAGER != pool_meta_table[ref->pool_id].map_mode)
+        pool_size = POOL_WINDOW_SIZE;
 
+    __atomic_fetch_add(&pool_syscalls, 1, __ATOMIC_RELAXED);
     if (0 != munmap((void*) pool_start, pool_size))
         return errno;
 
-    *pool = NULL_POOL;
+    /* The file keeps the pool, only the size has to be recorded */
+    if (NULL != pool_meta_table[ref->pool_id].header)
+        pool_unmap_file(&pool_meta_table[ref->pool_id], ref->raw_val);
+
+    liveness_release(&pool_meta_table[ref->pool_id]);
+
+    meta->size = 0;
+    meta->extent_base = 0;
+    meta->extent_windows = 0;
+    meta->window_shift = 0;
+    meta->provision_watermark = 0;
+    meta->provision_at = 0;
+    meta->provisioned = 0;
+    pool_id_release(ref->pool_id);
+
+    return 0;
+}
+
+pool_reference
+pool_create_file(uint16_t type_id, const char *path)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return NULL_POOL;
+
+    uint16_t pool_idx = pool_id_claim();
+    if (0 == pool_idx || 0 != ftruncate(fd, SMALL_PAGE_SIZE)) {
+        if (0 != pool_idx)
+            pool_id_release(pool_idx);
+        close(fd);
+        return NULL_POOL;
+    }
+
+    struct pool_reference ref = {.type_id       = type_id,
+                                 .pool_id       = pool_idx,
+                                 .sub_pool_id   = 0,
+                                 .raw_index     = 0 };
+
+    if (0 != pool_map_file(&ref, fd, 0)) {
+        pool_id_release(pool_idx);
+        close(fd);
+        return NULL_POOL;
+    }
+
+    struct pool_meta *meta = &pool_meta_table[pool_idx];
+    meta->header->magic         = POOL_FILE_MAGIC;
+    meta->header->version       = POOL_FILE_VERSION;
+    meta->header->fingerprint   = type_table_fingerprint();
+
+    if (0 != pool_commit(&ref, 0, PAGE_SIZE)) {
+        munmap((void*) POOL_IDX_TO_ADDR(pool_idx), POOL_WINDOW_SIZE);
+        pool_unmap_file(meta, NULL_POOL);
+        pool_id_release(pool_idx);
+        return NULL_POOL;
+    }
+
+    meta->header->pool = ref.raw_val;
+    return ref.raw_val;
+}
+
+pool_reference
+pool_attach_file(const char *path)
+{
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return NULL_POOL;
+
+    struct pool_file_header header;
+    struct stat file_stat;
+    int err = EINVAL;
+
+    if (sizeof(header) != pread(fd, &header, sizeof(header), 0) ||
+        0 != fstat(fd, &file_stat) ||
+        file_stat.st_size < (off_t) SMALL_PAGE_SIZE ||
+        POOL_FILE_MAGIC != header.magic ||
+        POOL_FILE_VERSION != header.version ||
+        type_table_fingerprint() != header.fingerprint)
+        goto fail;
+
+    struct pool_reference ref = {.raw_val = header.pool};
+    if (0 == ref.pool_id || ref.pool_id >= POOL_ID_COUNT)
+        goto fail;
+
+    /* The pool has to come back at the same window, or references break */
+    err = EBUSY;
+    if (!pool_id_claim_at(ref.pool_id))
+        goto fail;
+
+    err = pool_map_file(&ref, fd, file_stat.st_size - SMALL_PAGE_SIZE);
+    if (0 != err) {
+        pool_id_release(ref.pool_id);
+        goto fail;
+    }
+
+    return ref.raw_val;
+
+fail:
+    close(fd);
+    errno = err;
+    return NULL_POOL;
+}
+
+int
+pool_sync(const pool_reference pool)
+{
+    struct pool_reference p_ref = {.raw_val = pool};
+    struct pool_meta *meta = &pool_meta_table[p_ref.pool_id];
+
+    if (NULL == meta->header)
+        return EINVAL;
+
+    /* Data first, so that the recorded size never covers unwritten data */
+    if (0 != msync((void*) POOL_IDX_TO_ADDR(p_ref.pool_id),
+                   meta->committed,
+                   MS_SYNC))
+        return errno;
+
+    meta->header->pool = pool;
+    if (0 != msync(meta->header, SMALL_PAGE_SIZE, MS_SYNC))
+        return errno;
 
     return 0;
 }
 
 static global_reference
-pool_add_elements(pool_reference *pool,const size_t num_elements)
+pool_add_elements(pool_reference *pool, const size_t num_elements)
 {
     struct pool_reference *p_ref = (struct pool_reference*) pool;
-    size_t type_size = type_table[p_ref->type_id].type_size;
 
+    if (!p_ref->is_extended) {
+        global_reference ref = pool_add_to_window(pool, num_elements);
+        provision_check(p_ref);
+        return ref;
+    }
+
+    /* Large pools fill their windows in order, and move on when one is full */
+    size_t capacity = (size_t) 1 << GET_WINDOW_SHIFT(*p_ref);
+    size_t last = GET_EXTENT_BASE(*p_ref) +
+                  pool_meta_table[p_ref->pool_id].extent_windows - 1;
+    size_t size = GET_SIZE_OF_POOL(*p_ref);
+
+    if (num_elements > (last - p_ref->pool_id + 1)*capacity - size)
+        return NULL_REF;
+
+    global_reference first = NULL_REF;
+    size_t left = num_elements;
+    do {
+        if (size == capacity && left > 0) {
+            p_ref->pool_id++;
+            p_ref->sub_pool_id = 0;
+            p_ref->index = 0;
+            p_ref->full = 0;
+            size = 0;
+        }
+
+        size_t n = left < capacity - size ? left : capacity - size;
+        global_reference ref = pool_add_to_window(pool, n);
+        if (NULL_REF == ref)
+            return NULL_REF;
+
+        first = NULL_REF == first ? ref : first;
+        left -= n;
+        size += n;
+    } while (left > 0);
+
+    provision_check(p_ref);
+    return first;
+}
+
+static global_reference
+pool_add_to_window(pool_reference *pool, const size_t num_elements)
+{
+    struct pool_reference *p_ref = (struct pool_reference*) pool;
 
     uint16_t space_left_in_pool = p_ref->full ? 0 : PAGE_SIZE - p_ref->index;
     if (num_elements <= space_left_in_pool) {
@@ -93,23 +609,23 @@ pool_add_elements(pool_reference *pool,const size_t num_elements)
         struct global_reference g_ref = {.raw_val = p_ref->raw_val};
         p_ref->index += num_elements;
 	    p_ref->full = p_ref->index == 0 ? 1 : 0;
+        pool_meta_table[p_ref->pool_id].size = GET_SIZE_OF_POOL(*p_ref);
         return g_ref.raw_val;
     }
 
-    uintptr_t new_pool_addr =   POOL_IDX_TO_ADDR(p_ref->pool_id) +
-                                (p_ref->sub_pool_id + 1)*PAGE_SIZE*type_size;
-
     size_t elements_needed = num_elements - space_left_in_pool;
     size_t sub_pools_needed = SUB_POOLS_NEEDED(elements_needed);
-    size_t new_pages_needed = sub_pools_needed*type_size;
 
-    void *mapped_addr = mmap((void*) new_pool_addr,
-                             new_pages_needed*PAGE_SIZE,
-                             PROT_READ | PROT_WRITE,
-                             MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED,
-                             0, 0);
+    /* The subpool id has 16 bits, and the objects have to fit the window */
+    size_t end = (p_ref->sub_pool_id + 1 + sub_pools_needed)*PAGE_SIZE;
+    if (p_ref->sub_pool_id + sub_pools_needed > UINT16_MAX ||
+        GET_SUB_POOLS_FOR(*p_ref, end)*GET_SUB_POOL_SIZE(*p_ref) >
+        POOL_WINDOW_SIZE)
+        return NULL_REF;
 
-    if (mapped_addr != (void*) new_pool_addr)
+    if (0 != pool_commit(p_ref,
+                         (p_ref->sub_pool_id + 1)*PAGE_SIZE,
+                         (p_ref->sub_pool_id + 1 + sub_pools_needed)*PAGE_SIZE))
         return NULL_REF;
 
     struct global_reference g_ref = {.raw_val = p_ref->raw_val };
@@ -118,6 +634,7 @@ pool_add_elements(pool_reference *pool,const size_t num_elements)
     p_ref->sub_pool_id += sub_pools_needed;
     p_ref->index = elements_needed % PAGE_SIZE;
     p_ref->full = ! p_ref->index;
+    pool_meta_table[p_ref->pool_id].size = GET_SIZE_OF_POOL(*p_ref);
 
     return g_ref.raw_val;
 }
@@ -126,10 +643,140 @@ pool_add_elements(pool_reference *pool,const size_t num_elements)
 global_reference
 pool_alloc(pool_reference *pool)
 {
+    struct pool_reference *p_ref = (struct pool_reference*) pool;
+
+    if (pool_meta_table[p_ref->pool_id].free_count > 0) {
+        global_reference ref = pool_reuse_slot(pool);
+        if (NULL_REF != ref)
+            return ref;
+    }
+
     /* Some optimizations could be made if this is the common case */
     return pool_add_elements(pool, 1);
 }
 
+int
+pool_alloc_range(pool_reference *pool,
+                 const size_t n,
+                 global_reference *first)
+{
+    global_reference ref = pool_add_elements(pool, n);
+    if (NULL_REF == ref)
+        return 1;
+
+    *first = ref;
+    return 0;
+}
+
+size_t
+pool_range_next(pool_range_cursor *cursor, global_reference *segment)
+{
+    if (0 == cursor->remaining)
+        return 0;
+
+    reference_struct ref = {.raw_val = cursor->next};
+    size_t index = GET_GLOBAL_INDEX_OF_REF(ref);
+    size_t length = ((size_t) 1 << GET_SUB_POOL_SHIFT(ref)) -
+                    GET_INDEX_IN_SUB_POOL(ref, index);
+    if (length > cursor->remaining)
+        length = cursor->remaining;
+
+    size_t next_index = index + length;
+
+    *segment = cursor->next;
+    cursor->remaining -= length;
+
+    /* Segments end on a subpool, and so on the last object of a window */
+    if (ref.is_extended && next_index == (size_t) 1 << GET_WINDOW_SHIFT(ref)) {
+        ref.pool_id++;
+        next_index = 0;
+    }
+
+    ref.sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(next_index);
+    ref.index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(next_index);
+    cursor->next = ref.raw_val;
+
+    return length;
+}
+
+global_reference
+pool_alloc_shared(pool_reference *pool, pool_tlab *tlab)
+{
+    if (0 == tlab->range.remaining && 0 != pool_claim(pool, &tlab->range))
+        return NULL_REF;
+
+    reference_struct next = {.raw_val = tlab->range.next};
+    global_reference ref = next.raw_val;
+    if (0 == ++next.index)
+        next.sub_pool_id++;
+
+    tlab->range.next = next.raw_val;
+    tlab->range.remaining--;
+
+    return ref;
+}
+
+int
+pool_free(const global_reference reference)
+{
+    reference_struct ref = {.raw_val = reference};
+    struct pool_meta *meta = &pool_meta_table[ref.pool_id];
+
+    /* Slots are only ever reused from the last window of a large pool */
+    if (ref.is_extended)
+        return 1;
+
+    /* Also rejects references into pools that have been destroyed */
+    size_t index = GET_GLOBAL_INDEX_OF_REF(ref);
+    if (index >= __atomic_load_n(&meta->size, __ATOMIC_ACQUIRE))
+        return 1;
+
+    if (0 != liveness_reserve(meta, ref.sub_pool_id))
+        return 1;
+
+    uint64_t *bitmap = pool_to_array(meta->liveness);
+    uint64_t bit = 1llu << (index & 63);
+
+    if (bitmap[index >> 6] & bit)
+        return 2;   /* Freed twice */
+
+    /* The stack is never shrunk, it stays at its high water mark */
+    pool_struct stack = {.raw_val = meta->free_slots};
+    if (meta->free_depth == GET_SIZE_OF_POOL(stack) &&
+        NULL_REF == pool_alloc(&meta->free_slots))
+        return 1;
+
+    uint64_t *free_slots = pool_to_array(meta->free_slots);
+    free_slots[meta->free_depth++] = index;
+
+    /*
+     * Long references held by the element are removed from the global table,
+     * and all fields are cleared so that a reused slot looks exactly like a
+     * freshly allocated one.
+     */
+    size_t field_count = type_table[ref.type_id].field_count;
+    Field_offsets field_offsets = type_table[ref.type_id].field_offsets;
+    for (size_t i = 0 ; i < field_count ; ++i) {
+        char *field = get_field(reference, i);
+
+        if (LOCAL_REF_TYPE == type_table[field_offsets[i].type_id].type_class) {
+            local_reference_struct loc_ref = {.raw_val = *((uint16_t*)field)};
+            if (loc_ref.is_long_ref) {
+                reference_tag tag = {.raw_val = reference};
+                tag.local_ref = loc_ref.raw_val;
+                delete_reference(tag);
+            }
+        }
+
+        memset(field, 0, field_offsets[i].field_size);
+    }
+
+    bitmap[index >> 6] |= bit;
+    meta->free_count++;
+
+    return 0;
+}
+
 int
 pool_grow(pool_reference *pool, const size_t num_elements)
 {
@@ -141,14 +788,24 @@ pool_shrink(pool_reference *pool, const size_t num_elements)
 {
     struct pool_reference *p_ref = (struct pool_reference*) pool;
 
+    if (p_ref->is_extended)
+        return pool_shrink_large(pool, num_elements);
+
+    /* Freed slots that are shrunk away are no longer holes in the pool */
+    struct pool_meta *meta = &pool_meta_table[p_ref->pool_id];
+    size_t old_size = GET_SIZE_OF_POOL(*p_ref);
+    if (meta->free_count > 0) {
+        size_t new_size = num_elements < old_size ? old_size - num_elements : 0;
+        liveness_clear_range(meta, new_size, old_size);
+    }
+
     if (num_elements < p_ref->full*PAGE_SIZE + p_ref->index) {
         /* Simple case, can't deallocate sub-pool */
         p_ref->index -= num_elements;
         p_ref->full = 0;
-        return 0;
+        return pool_shrink_clear(p_ref, old_size);
     }
 
-    size_t s_pool_size = type_table[p_ref->type_id].type_size*PAGE_SIZE;
     size_t s_pools_to_remove = 1 + ((num_elements -1) / PAGE_SIZE);
 
     /*The last subpool is never removed*/
@@ -156,22 +813,123 @@ pool_shrink(pool_reference *pool, const size_t num_elements)
         s_pools_to_remove = p_ref->sub_pool_id;
     }
 
+    /* Only the first subpool is left, and it is emptied */
+    if (0 == s_pools_to_remove) {
+        p_ref->index = 0;
+        p_ref->full = 0;
+        return pool_shrink_clear(p_ref, old_size);
+    }
+
     size_t index_change = num_elements - s_pools_to_remove*PAGE_SIZE;
-    size_t remove_size = s_pool_size*s_pools_to_remove;
     size_t new_sub_pool_id = p_ref->sub_pool_id - s_pools_to_remove;
 
-
-    uintptr_t pool_start_addr = POOL_IDX_TO_ADDR(p_ref->pool_id);
-    uintptr_t unmap_addr =  pool_start_addr + (new_sub_pool_id+1)*s_pool_size;
-
-    if (0 != munmap((void*)unmap_addr, remove_size))
-        return errno;
+    int err = pool_decommit(p_ref,
+                            (new_sub_pool_id + 1)*PAGE_SIZE,
+                            (new_sub_pool_id + 1 + s_pools_to_remove)*PAGE_SIZE);
+    if (0 != err)
+        return err;
 
     p_ref->sub_pool_id = new_sub_pool_id;
     p_ref->index -= index_change;
     if (p_ref->index == 0 && index_change < PAGE_SIZE)
         p_ref->full = 1;
 
+    return pool_shrink_clear(p_ref, old_size);
+}
+
+/* Slots past the new end of the pool that stay mapped are cleared */
+static int
+pool_shrink_clear(const struct pool_reference *p_ref, size_t old_size)
+{
+    size_t new_size = GET_SIZE_OF_POOL(*p_ref);
+    size_t mapped = GET_SUB_POOLS_FOR(*p_ref, (p_ref->sub_pool_id + 1)*PAGE_SIZE)
+                    << GET_SUB_POOL_SHIFT(*p_ref);
+
+    pool_clear_range(p_ref, new_size, old_size < mapped ? old_size : mapped);
+    pool_meta_table[p_ref->pool_id].size = new_size;
+
+    return 0;
+}
+
+static void
+pool_clear_range(const struct pool_reference *p_ref, size_t from, size_t to)
+{
+    const type_descriptor *desc = GET_TYPE_DESCRIPTOR(*p_ref);
+    size_t run = (size_t) 1 << desc->sub_pool_shift;
+
+    /* Field arrays are contiguous within a subpool, unless they are grouped */
+    for (size_t i = from ; i < to ; ) {
+        size_t n = run - GET_INDEX_IN_SUB_POOL(*p_ref, i);
+        n = n < to - i ? n : to - i;
+
+        for (size_t f = 0 ; f < desc->field_count ; ++f) {
+            const field_descriptor *field = &desc->fields[f];
+            char *addr = (char*) GET_FIELD_ADDR_OF_INDEX(*p_ref, i, f);
+            size_t stride = SCALE_BY_FIELD_STRIDE(*field, 1);
+
+            if (stride == field->size) {
+                memset(addr, 0, n*field->size);
+                continue;
+            }
+
+            for (size_t k = 0 ; k < n ; ++k)
+                memset(addr + k*stride, 0, field->size);
+        }
+
+        i += n;
+    }
+}
+
+static int
+pool_shrink_large(pool_reference *pool, const size_t num_elements)
+{
+    struct pool_reference *p_ref = (struct pool_reference*) pool;
+
+    uint16_t base = GET_EXTENT_BASE(*p_ref);
+    unsigned shift = GET_WINDOW_SHIFT(*p_ref);
+    size_t old_size = GET_SIZE_OF_LARGE_POOL(*p_ref);
+    size_t new_size = num_elements < old_size ? old_size - num_elements : 0;
+
+    /* A window that ends up exactly full stays the last one */
+    uint16_t last = base + (new_size > 0 ? (new_size - 1) >> shift : 0);
+    size_t size_in_last = new_size - ((size_t) (last - base) << shift);
+
+    /* Like ordinary pools, every window keeps its first block mapped */
+    for (uint16_t w = p_ref->pool_id ; w >= last ; --w) {
+        struct pool_reference window = *p_ref;
+        window.pool_id = w;
+
+        size_t keep = w == last ? size_in_last : 0;
+        size_t end = w == p_ref->pool_id ? GET_SIZE_OF_POOL(*p_ref) :
+                                           (size_t) 1 << shift;
+        keep = keep > PAGE_SIZE ? keep : PAGE_SIZE;
+
+        int err = pool_decommit(&window,
+                                ROUND_UP_TO_PAGE(keep, PAGE_SIZE),
+                                ROUND_UP_TO_PAGE(end, PAGE_SIZE));
+        if (0 != err)
+            return err;
+
+        /* What is left mapped past the new end is cleared */
+        size_t mapped = GET_SUB_POOLS_FOR(window,
+                                          ROUND_UP_TO_PAGE(keep, PAGE_SIZE))
+                        << GET_SUB_POOL_SHIFT(window);
+        pool_clear_range(&window,
+                         w == last ? size_in_last : 0,
+                         end < mapped ? end : mapped);
+
+        if (w == last)
+            break;
+    }
+
+    size_t sub_pool_id = size_in_last > 0 ? (size_in_last - 1) / PAGE_SIZE : 0;
+    size_t index = size_in_last - sub_pool_id*PAGE_SIZE;
+
+    p_ref->pool_id = last;
+    p_ref->sub_pool_id = sub_pool_id;
+    p_ref->index = index % PAGE_SIZE;
+    p_ref->full = index == PAGE_SIZE;
+
     return 0;
 }
 
@@ -179,12 +937,8 @@ void*
 get_field(const global_reference reference, const size_t field_nr)
 {
     struct global_reference ref = {.raw_val = reference };
-    assert(ref.is_extended == 0);
 
-    return (void*) (GET_POOL_ADDR(ref) +
-                    GET_SUB_POOL_SIZE(ref)*ref.sub_pool_id +
-                    GET_FIELD_OFFSET(ref, field_nr) +
-                    GET_FIELD_SIZE(ref, field_nr)*ref.index);
+    return (void*) GET_FIELD_ADDR(ref, field_nr);
 }
 
 int
@@ -198,10 +952,7 @@ set_field(const global_reference reference,
 
 
 
-    void *f_ptr = (void*) ( GET_POOL_ADDR(ref) +
-                            GET_SUB_POOL_SIZE(ref)*ref.sub_pool_id +
-                            GET_FIELD_OFFSET(ref, field_nr) +
-                            ref.index*field_size );
+    void *f_ptr = (void*) GET_FIELD_ADDR(ref, field_nr);
 
 
     switch (field_size) {
@@ -223,6 +974,101 @@ set_field(const global_reference reference,
     return 0;
 }
 
+/*
+ * Copies a field between n objects and an array of values, prefetching the
+ * field of the object FIELD_BATCH_DISTANCE references ahead. Addresses are
+ * computed once, when they are prefetched, and kept in a ring until used.
+ * Called with a constant size, so that each width gets its own loop.
+ */
+static inline __attribute__((always_inline)) void
+field_batch_copy(const global_reference *refs,
+                 const size_t n,
+                 const size_t field_nr,
+                 char *values,
+                 const size_t size,
+                 const int store)
+{
+    uintptr_t ring[FIELD_BATCH_DISTANCE];
+
+    size_t ahead = n < FIELD_BATCH_DISTANCE ? n : FIELD_BATCH_DISTANCE;
+    for (size_t i = 0 ; i < ahead ; ++i) {
+        reference_struct ref = {.raw_val = refs[i]};
+        ring[i] = GET_FIELD_ADDR(ref, field_nr);
+        FIELD_BATCH_PREFETCH(ring[i], store);
+    }
+
+    for (size_t i = 0 ; i < n ; ++i) {
+        char *field = (char*) ring[i % FIELD_BATCH_DISTANCE];
+
+        if (i + FIELD_BATCH_DISTANCE < n) {
+            reference_struct ref = {.raw_val = refs[i + FIELD_BATCH_DISTANCE]};
+            uintptr_t addr = GET_FIELD_ADDR(ref, field_nr);
+            ring[i % FIELD_BATCH_DISTANCE] = addr;
+            FIELD_BATCH_PREFETCH(addr, store);
+        }
+
+        if (store)
+            memcpy(field, values + i*size, size);
+        else
+            memcpy(values + i*size, field, size);
+    }
+}
+
+static int
+field_batch(const global_reference *refs,
+            const size_t n,
+            const size_t field_nr,
+            char *values,
+            const int store)
+{
+    if (0 == n)
+        return 0;
+
+    if (NULL == refs || NULL == values)
+        return 1;
+
+    reference_struct first = {.raw_val = refs[0]};
+    size_t size = GET_FIELD_SIZE(first, field_nr);
+
+    switch (size) {
+        case 1: field_batch_copy(refs, n, field_nr, values, 1, store);
+                break;
+        case 2: field_batch_copy(refs, n, field_nr, values, 2, store);
+                break;
+        case 4: field_batch_copy(refs, n, field_nr, values, 4, store);
+                break;
+        case 8: field_batch_copy(refs, n, field_nr, values, 8, store);
+                break;
+        case 16: field_batch_copy(refs, n, field_nr, values, 16, store);
+                break;
+
+        default:
+                field_batch_copy(refs, n, field_nr, values, size, store);
+                break;
+    }
+
+    return 0;
+}
+
+int
+get_field_batch(const global_reference *refs,
+                const size_t n,
+                const size_t field_nr,
+                void *out)
+{
+    return field_batch(refs, n, field_nr, out, 0);
+}
+
+int
+set_field_batch(const global_reference *refs,
+                const size_t n,
+                const size_t field_nr,
+                const void *in)
+{
+    /* Only read from when storing */
+    return field_batch(refs, n, field_nr, (char*) (uintptr_t) in, 1);
+}
+
 int
 set_field_reference(const global_reference this_ref,
                     const size_t field_nr,
@@ -232,21 +1078,18 @@ set_field_reference(const global_reference this_ref,
     reference_struct this = {.raw_val = this_ref};
     reference_struct that = {.raw_val = that_ref};
 
-    uint16_t *that_local_ref_ptr = ((uint16_t*)
-                                   (GET_POOL_ADDR(this) +
-                                    GET_SUB_POOL_SIZE(this)*this.sub_pool_id +
-                                    GET_FIELD_OFFSET(this,field_nr))) +
-                                    this.index;
+    uint16_t *that_local_ref_ptr = (uint16_t*) GET_FIELD_ADDR(this, field_nr);
 
     if (that_ref == NULL_REF) {
         *that_local_ref_ptr = 0;
         return 0;
     }
 
-    assert(this.pool_id == that.pool_id);
+    assert(this.pool_id == that.pool_id ||
+           (this.is_extended && GET_EXTENT_BASE(this) == GET_EXTENT_BASE(that)));
 
-    size_t this_index = GET_GLOBAL_INDEX_OF_REF(this);
-    size_t that_index = GET_GLOBAL_INDEX_OF_REF(that);
+    size_t this_index = GET_LARGE_INDEX_OF_REF(this);
+    size_t that_index = GET_LARGE_INDEX_OF_REF(that);
     int64_t difference = that_index - this_index;
     local_reference_struct old_ref = {.raw_val = *that_local_ref_ptr};
 
@@ -282,11 +1125,7 @@ get_field_reference(const global_reference this_ref,
                     const size_t field_nr)
 {
     reference_struct this = {.raw_val = this_ref};
-    uint16_t *that_local_ref_ptr = ((uint16_t*)
-                                    (GET_POOL_ADDR(this) +
-                                     GET_SUB_POOL_SIZE(this)*this.sub_pool_id +
-                                     GET_FIELD_OFFSET(this, field_nr))) +
-                                     this.index;
+    uint16_t *that_local_ref_ptr = (uint16_t*) GET_FIELD_ADDR(this, field_nr);
 
     if (0 == *that_local_ref_ptr)
         return NULL_REF;
@@ -303,13 +1142,15 @@ get_field_reference(const global_reference this_ref,
             return NULL_REF;
     } else {
 
-        size_t this_index = GET_GLOBAL_INDEX_OF_REF(this);
+        size_t this_index = GET_LARGE_INDEX_OF_REF(this);
         that_index = this_index + that_local_ref.index;
     }
 
     reference_struct that = {.raw_val = this_ref};
-    that.sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(that_index);
-    that.index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(that_index);
+    size_t index_in_window = GET_INDEX_IN_WINDOW(this, that_index);
+    that.pool_id = GET_WINDOW_OF_INDEX(this, that_index);
+    that.sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(index_in_window);
+    that.index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(index_in_window);
 
     return that.raw_val;
 }
@@ -319,5 +1160,684 @@ void*
 pool_to_array(const pool_reference pool)
 {
     struct pool_reference p_ref = {.raw_val = pool};
-    return (void*) POOL_IDX_TO_ADDR(p_ref.pool_id);
+    uint16_t pool_id = p_ref.is_extended ? GET_EXTENT_BASE(p_ref) :
+                                           p_ref.pool_id;
+    return (void*) (POOL_IDX_TO_ADDR(pool_id) + GET_POOL_COLOR(p_ref, pool_id));
+}
+
+
+int
+pool_set_provisioning(const pool_reference pool, size_t watermark)
+{
+    struct pool_reference p_ref = {.raw_val = pool};
+
+    size_t block = (size_t) 1 << GET_SUB_POOL_SHIFT(p_ref);
+    block = block > PAGE_SIZE ? block : PAGE_SIZE;
+    watermark = watermark < block ? watermark : block;
+
+    if (0 != watermark) {
+        pthread_once(&provisioner.once, provisioner_start);
+        if (!provisioner.running)
+            return 1;
+    }
+
+    uint16_t first = p_ref.is_extended ? GET_EXTENT_BASE(p_ref) : p_ref.pool_id;
+    size_t windows = p_ref.is_extended ?
+                     pool_meta_table[p_ref.pool_id].extent_windows : 1;
+
+    /* Windows of a large pool ahead of its end are still empty */
+    for (size_t w = 0 ; w < windows ; ++w) {
+        struct pool_meta *meta = &pool_meta_table[first + w];
+        size_t filled = first + w == p_ref.pool_id ?
+                        GET_SIZE_OF_POOL(p_ref) & ~(block - 1) : 0;
+
+        provision_wait(meta);
+        meta->provision_watermark = watermark;
+        meta->provision_at = 0 != watermark ? filled + watermark : 0;
+    }
+
+    return 0;
+}
+
+#ifndef __RELEASE__
+size_t
+pool_syscall_count(void)
+{
+    return __atomic_load_n(&pool_syscalls, __ATOMIC_RELAXED);
+}
+
+unsigned
+pool_set_max_window_shift(unsigned shift)
+{
+    return __atomic_exchange_n(&pool_max_window_shift, shift, __ATOMIC_RELAXED);
+}
+#endif
+
+/* Helper functions */
+
+static int
+pool_commit(const struct pool_reference *p_ref, size_t from, size_t to)
+{
+    struct pool_meta *meta = &pool_meta_table[p_ref->pool_id];
+
+    if (GET_SUB_POOLS_FOR(*p_ref, from) >= GET_SUB_POOLS_FOR(*p_ref, to))
+        return 0;
+
+    /* Everything below provisioned has been mapped ahead of time */
+    provision_wait(meta);
+    size_t provisioned = meta->provisioned;
+
+    return pool_commit_range(p_ref, from > provisioned ? from : provisioned, to);
+}
+
+static int
+pool_commit_range(const struct pool_reference *p_ref, size_t from, size_t to)
+{
+    struct pool_meta *meta = &pool_meta_table[p_ref->pool_id];
+    size_t sub_pool_size = GET_SUB_POOL_SIZE(*p_ref);
+    uintptr_t pool_start = POOL_IDX_TO_ADDR(p_ref->pool_id);
+
+    /* Subpools that already hold objects below from are mapped */
+    size_t first = GET_SUB_POOLS_FOR(*p_ref, from);
+    size_t last = GET_SUB_POOLS_FOR(*p_ref, to);
+
+    if (POOL_MAP_OVERCOMMIT == meta->map_mode || first >= last)
+        return 0;
+
+    if (POOL_MAP_RESERVE == meta->map_mode) {
+        size_t end = last*sub_pool_size;
+        size_t committed = __atomic_load_n(&meta->committed, __ATOMIC_ACQUIRE);
+        if (end <= committed)
+            return 0;
+
+        /*
+         * Commit at least as much again as is already committed, so that the
+         * number of calls grows logarithmically with the size of the pool.
+         * Commits always end on a page boundary, which huge pages require.
+         */
+        size_t target = 2*committed < POOL_WINDOW_SIZE ? 2*committed :
+                                                         POOL_WINDOW_SIZE;
+        target = target > end ? target : end;
+        target = ROUND_UP_TO_PAGE(target, meta->page_size);
+
+        __atomic_fetch_add(&pool_syscalls, 1, __ATOMIC_RELAXED);
+        if (NULL != meta->header) {
+            /* Only ever grows the file, so racing commits are harmless */
+            int err = posix_fallocate(meta->fd,
+                                      SMALL_PAGE_SIZE + committed,
+                                      target - committed);
+            if (0 != err)
+                return err;
+        } else if (0 != mprotect((void*) (pool_start + committed),
+                                 target - committed,
+                                 PROT_READ | PROT_WRITE)) {
+            return errno;
+        }
+
+        /*
+         * Threads sharing the pool may commit concurrently. mprotect is
+         * idempotent, so only the high-water mark has to be raised with care.
+         */
+        while (committed < target &&
+               !__atomic_compare_exchange_n(&meta->committed,
+                                            &committed,
+                                            target,
+                                            false,
+                                            __ATOMIC_RELEASE,
+                                            __ATOMIC_ACQUIRE))
+            ;
+        return 0;
+    }
+
+    void *new_addr = (void*) (pool_start + first*sub_pool_size);
+
+    __atomic_fetch_add(&pool_syscalls, 1, __ATOMIC_RELAXED);
+    void *mapped_addr = mmap(new_addr,
+                             (last - first)*sub_pool_size,
+                             PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED,
+                             0, 0);
+
+    return mapped_addr == new_addr ? 0 : 1;
+}
+
+static int
+pool_decommit(const struct pool_reference *p_ref, size_t from, size_t to)
+{
+    struct pool_meta *meta = &pool_meta_table[p_ref->pool_id];
+    uintptr_t pool_start = POOL_IDX_TO_ADDR(p_ref->pool_id);
+
+    /* Blocks mapped ahead by the provisioner go as well */
+    provision_wait(meta);
+    size_t provisioned = meta->provisioned;
+    to = to > provisioned ? to : provisioned;
+
+    /* A subpool that still holds objects below from is kept */
+    size_t first = GET_SUB_POOLS_FOR(*p_ref, from);
+    size_t last = GET_SUB_POOLS_FOR(*p_ref, to);
+
+    if (first >= last)
+        return 0;
+
+    if (provisioned > first << GET_SUB_POOL_SHIFT(*p_ref)) {
+        provisioned = first << GET_SUB_POOL_SHIFT(*p_ref);
+        meta->provisioned = provisioned;
+    }
+
+    /* The next request is due when the pool has grown back past the mark */
+    if (0 != meta->provision_at) {
+        size_t block = (size_t) 1 << GET_SUB_POOL_SHIFT(*p_ref);
+        block = block > PAGE_SIZE ? block : PAGE_SIZE;
+        meta->provision_at = (from & ~(block - 1)) + meta->provision_watermark;
+    }
+
+    from = first*GET_SUB_POOL_SIZE(*p_ref);
+    to = last*GET_SUB_POOL_SIZE(*p_ref);
+    size_t end = to;
+
+    if (POOL_MAP_EAGER == meta->map_mode) {
+        __atomic_fetch_add(&pool_syscalls, 1, __ATOMIC_RELAXED);
+        return 0 == munmap((void*) (pool_start + from), to - from) ? 0 : errno;
+    }
+
+    /*
+     * Mapping fresh pages over the range releases the old ones, and keeps the
+     * range reserved. In RESERVE mode anything committed ahead is dropped too.
+     */
+    int prot = PROT_READ | PROT_WRITE;
+    if (POOL_MAP_RESERVE == meta->map_mode) {
+        if (from >= meta->committed)
+            return 0;
+
+        prot = PROT_NONE;
+        to = meta->committed;
+    }
+
+    /*
+     * Only whole pages can be released. What is kept of the first page is
+     * cleared instead, so that the pool grows back into zeroed memory.
+     */
+    size_t page_from = ROUND_UP_TO_PAGE(from, meta->page_size);
+    size_t page_to   = ROUND_UP_TO_PAGE(to, meta->page_size);
+
+    if (page_from > from)
+        memset((void*) (pool_start + from), 0,
+               (page_from < end ? page_from : end) - from);
+
+    if (POOL_MAP_RESERVE == meta->map_mode)
+        meta->committed = page_from;
+
+    if (NULL != meta->header) {
+        __atomic_fetch_add(&pool_syscalls, 1, __ATOMIC_RELAXED);
+        return 0 == ftruncate(meta->fd, SMALL_PAGE_SIZE + page_from) ? 0 : errno;
+    }
+
+    if (page_from >= page_to)
+        return 0;
+
+    void *addr = (void*) (pool_start + page_from);
+
+    __atomic_fetch_add(&pool_syscalls, 1, __ATOMIC_RELAXED);
+    void *mapped_addr = mmap(addr,
+                             page_to - page_from,
+                             prot,
+                             pool_map_flags(meta),
+                             0, 0);
+
+    return mapped_addr == addr ? 0 : errno;
+}
+
+static int
+pool_map_flags(const struct pool_meta *meta)
+{
+    int flags = MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE;
+
+    switch (meta->page_mode) {
+    case POOL_PAGES_HUGETLB:
+        return flags | MAP_PRIVATE | MAP_HUGETLB;
+    case POOL_PAGES_HUGE:
+        /* Transparent huge pages are only given to private memory */
+        return flags | MAP_PRIVATE;
+    default:
+        return flags | MAP_SHARED;
+    }
+}
+
+static int
+pool_claim(pool_reference *pool, pool_range_cursor *range)
+{
+    struct pool_reference old = {.raw_val = __atomic_load_n(pool,
+                                                             __ATOMIC_ACQUIRE)};
+    struct pool_reference new;
+
+    size_t start, end;
+
+    /* Claims would have to move on to the next window of a large pool */
+    if (old.is_extended)
+        return 1;
+
+    /*
+     * Claims run to the end of the current block of PAGE_SIZE objects, or of
+     * the current subpool if subpools are larger than that. The rest of a
+     * block that is partly used has been mapped by whoever created it.
+     * Otherwise a whole new block is claimed, and nobody else touches it
+     * until the claiming thread has mapped it.
+     */
+    size_t block = (size_t) 1 << GET_SUB_POOL_SHIFT(old);
+    block = block > PAGE_SIZE ? block : PAGE_SIZE;
+
+    do {
+        start = GET_SIZE_OF_POOL(old);
+        end = (start + block) & ~(block - 1);
+        if (end > ((size_t) UINT16_MAX + 1)*PAGE_SIZE)
+            return 1;
+
+        new = old;
+        new.sub_pool_id = end/PAGE_SIZE - 1;
+        new.index = 0;
+        new.full = 1;
+    } while (!__atomic_compare_exchange_n(pool,
+                                          &old.raw_val,
+                                          new.raw_val,
+                                          true,
+                                          __ATOMIC_ACQ_REL,
+                                          __ATOMIC_ACQUIRE));
+
+    if (0 != pool_commit(&new, (old.sub_pool_id + 1)*PAGE_SIZE, end))
+        return 1;
+
+    /* Claims can be committed out of order, the size only ever goes up */
+    struct pool_meta *meta = &pool_meta_table[new.pool_id];
+    size_t size = __atomic_load_n(&meta->size, __ATOMIC_RELAXED);
+    while (size < end &&
+           !__atomic_compare_exchange_n(&meta->size, &size, end, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    struct global_reference first = {.raw_val = new.raw_val};
+    first.reserved = 0;
+    first.sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(start);
+    first.index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(start);
+
+    range->next = first.raw_val;
+    range->remaining = end - start;
+
+    return 0;
+}
+
+static uint16_t
+pool_id_claim(void)
+{
+    size_t start = __atomic_load_n(&pool_id_hint, __ATOMIC_RELAXED);
+
+    for (size_t n = 0 ; n < POOL_ID_WORDS ; ++n) {
+        size_t w = start + n < POOL_ID_WORDS ? start + n :
+                                               start + n - POOL_ID_WORDS;
+        uint64_t used = __atomic_load_n(&pool_id_map[w], __ATOMIC_RELAXED);
+
+        while (~used) {
+            uint64_t bit = 1llu << __builtin_ctzll(~used);
+            if (__atomic_compare_exchange_n(&pool_id_map[w],
+                                            &used,
+                                            used | bit,
+                                            false,
+                                            __ATOMIC_ACQUIRE,
+                                            __ATOMIC_RELAXED)) {
+                __atomic_store_n(&pool_id_hint, w, __ATOMIC_RELAXED);
+                return w*64 + __builtin_ctzll(bit);
+            }
+        }
+    }
+
+    return 0;   /* Out of pool ids */
+}
+
+static uint16_t
+pool_id_claim_run(size_t n)
+{
+    /*
+     * Large pools are rare, so a linear search that claims ids one at a time
+     * and backs off when another thread got one first is good enough.
+     */
+    for (size_t start = 1 ; start + n <= POOL_ID_COUNT ; ++start) {
+        size_t claimed = 0;
+        while (claimed < n && pool_id_claim_at(start + claimed))
+            claimed++;
+
+        if (claimed == n)
+            return start;
+
+        for (size_t i = 0 ; i < claimed ; ++i)
+            pool_id_release(start + i);
+        start += claimed;
+    }
+
+    return 0;   /* No run of n free ids */
+}
+
+static bool
+pool_id_claim_at(uint16_t pool_id)
+{
+    uint64_t bit = 1llu << (pool_id & 63);
+    uint64_t used = __atomic_fetch_or(&pool_id_map[pool_id >> 6],
+                                      bit,
+                                      __ATOMIC_ACQUIRE);
+    return !(used & bit);
+}
+
+static void
+pool_id_release(uint16_t pool_id)
+{
+    __atomic_fetch_and(&pool_id_map[pool_id >> 6],
+                       ~(1llu << (pool_id & 63)),
+                       __ATOMIC_RELEASE);
+    __atomic_store_n(&pool_id_hint, pool_id >> 6, __ATOMIC_RELAXED);
+}
+
+static int
+liveness_reserve(struct pool_meta *meta, size_t sub_pool_id)
+{
+    if (NULL_POOL == meta->liveness) {
+        meta->liveness = pool_create(LONG_TYPE_ID);
+        meta->free_slots = pool_create(LONG_TYPE_ID);
+
+        if (NULL_POOL == meta->liveness || NULL_POOL == meta->free_slots) {
+            liveness_release(meta);
+            return 1;
+        }
+    }
+
+    pool_struct bitmap = {.raw_val = meta->liveness};
+    size_t words_needed = (sub_pool_id + 1)*LIVENESS_WORDS_PER_SUBPOOL;
+    size_t words = GET_SIZE_OF_POOL(bitmap);
+
+    if (words < words_needed)
+        return pool_grow(&meta->liveness, words_needed - words);
+
+    return 0;
+}
+
+static void
+liveness_clear_range(struct pool_meta *meta, size_t from, size_t to)
+{
+    if (NULL_POOL == meta->liveness)
+        return;
+
+    pool_struct bitmap_pool = {.raw_val = meta->liveness};
+    size_t bits = GET_SIZE_OF_POOL(bitmap_pool)*64;
+    uint64_t *bitmap = pool_to_array(meta->liveness);
+
+    to = to < bits ? to : bits;
+    for (size_t i = from ; i < to ; ) {
+        size_t bit = i & 63;
+        size_t n = 64 - bit < to - i ? 64 - bit : to - i;
+        uint64_t mask = (n == 64 ? ~0llu : ((1llu << n) - 1)) << bit;
+
+        meta->free_count -= __builtin_popcountll(bitmap[i >> 6] & mask);
+        bitmap[i >> 6] &= ~mask;
+        i += n;
+    }
+
+    /* Everything left on the stack is stale */
+    if (meta->free_count == 0)
+        meta->free_depth = 0;
+}
+
+static void
+liveness_release(struct pool_meta *meta)
+{
+    if (NULL_POOL != meta->liveness)
+        pool_destroy(&meta->liveness);
+
+    if (NULL_POOL != meta->free_slots)
+        pool_destroy(&meta->free_slots);
+
+    meta->free_depth = 0;
+    meta->free_count = 0;
+}
+
+static global_reference
+pool_reuse_slot(pool_reference *pool)
+{
+    pool_struct p_ref = {.raw_val = *pool};
+    struct pool_meta *meta = &pool_meta_table[p_ref.pool_id];
+
+    uint64_t *bitmap = pool_to_array(meta->liveness);
+    uint64_t *free_slots = pool_to_array(meta->free_slots);
+    size_t pool_size = GET_SIZE_OF_POOL(p_ref);
+
+    while (meta->free_depth > 0 && meta->free_count > 0) {
+        size_t index = free_slots[--meta->free_depth];
+
+        /* Stale entry, the slot was shrunk away or has been reused */
+        if (index >= pool_size || !(bitmap[index >> 6] & (1llu << (index & 63))))
+            continue;
+
+        bitmap[index >> 6] &= ~(1llu << (index & 63));
+        if (--meta->free_count == 0)
+            meta->free_depth = 0;
+
+        reference_struct ref = {.raw_val = *pool};
+        ref.sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(index);
+        ref.raw_index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(index);
+        return ref.raw_val;
+    }
+
+    return NULL_REF;
+}
+
+static int
+pool_map_file(const struct pool_reference *p_ref, int fd, size_t committed)
+{
+    struct pool_meta *meta = &pool_meta_table[p_ref->pool_id];
+    void *addr = (void*) POOL_IDX_TO_ADDR(p_ref->pool_id);
+
+    struct pool_file_header *header = mmap(NULL,
+                                           SMALL_PAGE_SIZE,
+                                           PROT_READ | PROT_WRITE,
+                                           MAP_SHARED,
+                                           fd, 0);
+    if (MAP_FAILED == header)
+        return errno;
+
+    /* Accesses past the end of the file fault, as in a reserved window */
+    __atomic_fetch_add(&pool_syscalls, 1, __ATOMIC_RELAXED);
+    if (addr != mmap(addr,
+                     POOL_WINDOW_SIZE,
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_FIXED,
+                     fd, SMALL_PAGE_SIZE)) {
+        int err = errno;
+        munmap(header, SMALL_PAGE_SIZE);
+        return err;
+    }
+
+    meta->map_mode  = POOL_MAP_RESERVE;
+    meta->page_mode = POOL_PAGES_SMALL;
+    meta->page_size = SMALL_PAGE_SIZE;
+    meta->committed = committed;
+    meta->size      = GET_SIZE_OF_POOL(*p_ref);
+    meta->header    = header;
+    meta->fd        = fd;
+
+    return 0;
+}
+
+static void
+pool_unmap_file(struct pool_meta *meta, const pool_reference pool)
+{
+    if (NULL_POOL != pool)
+        meta->header->pool = pool;
+
+    munmap(meta->header, SMALL_PAGE_SIZE);
+    close(meta->fd);
+
+    meta->header = NULL;
+    meta->fd = -1;
+}
+
+static void
+provisioner_start(void)
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    if (0 != pthread_attr_init(&attr))
+        return;
+
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    provisioner.running = 0 == pthread_create(&thread, &attr,
+                                              provisioner_main, NULL);
+    pthread_attr_destroy(&attr);
+}
+
+static void*
+provisioner_main(void *arg)
+{
+    (void) arg;
+
+    /*
+     * Yield to the owners of pools, but not so far that an owner waiting for
+     * a request is held up behind every other thread on the machine.
+     */
+    setpriority(PRIO_PROCESS, 0, PROVISIONER_NICE);
+
+    for (;;) {
+        pthread_mutex_lock(&provisioner.lock);
+        while (provisioner.head == provisioner.tail)
+            pthread_cond_wait(&provisioner.wake, &provisioner.lock);
+
+        struct provision_request req =
+            provisioner.queue[provisioner.head++ % PROVISION_QUEUE_LENGTH];
+        pthread_mutex_unlock(&provisioner.lock);
+
+        /* The owner may have taken the request back in the meantime */
+        struct pool_meta *meta = &pool_meta_table[req.pool.pool_id];
+        uint64_t posted = req.state;
+        if (!__atomic_compare_exchange_n(&meta->provision_state,
+                                         &posted,
+                                         PROVISION_STATE(req.state,
+                                                         PROVISION_RUNNING),
+                                         false,
+                                         __ATOMIC_ACQUIRE,
+                                         __ATOMIC_RELAXED))
+            continue;
+
+        /*
+         * Fault every page in, so that the owner never has to. The pages are
+         * past the end of the pool, but an atomic no-op keeps whatever an
+         * owner that raced ahead in OVERCOMMIT mode might have written.
+         */
+        if (0 == pool_commit_range(&req.pool, req.from, req.to)) {
+            size_t sub_pool_size = GET_SUB_POOL_SIZE(req.pool);
+            uintptr_t pool_start = POOL_IDX_TO_ADDR(req.pool.pool_id);
+            uintptr_t start = pool_start +
+                GET_SUB_POOLS_FOR(req.pool, req.from)*sub_pool_size;
+            uintptr_t end = pool_start +
+                GET_SUB_POOLS_FOR(req.pool, req.to)*sub_pool_size;
+
+            for (uintptr_t page = start ; page < end ; page += SMALL_PAGE_SIZE)
+                __atomic_fetch_or((char*) page, 0, __ATOMIC_RELAXED);
+
+            meta->provisioned = req.to;
+        }
+
+        /* Otherwise the owner maps the block itself when it gets there */
+        __atomic_store_n(&meta->provision_state,
+                         PROVISION_STATE(req.state, PROVISION_IDLE),
+                         __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&provisioner.lock);
+        pthread_cond_broadcast(&provisioner.done);
+        pthread_mutex_unlock(&provisioner.lock);
+    }
+
+    return NULL;
+}
+
+static void
+provision_post(const struct pool_reference *p_ref)
+{
+    struct pool_meta *meta = &pool_meta_table[p_ref->pool_id];
+
+    /* The previous request is still pending */
+    uint64_t state = __atomic_load_n(&meta->provision_state, __ATOMIC_ACQUIRE);
+    if (PROVISION_IDLE != PROVISION_PHASE(state))
+        return;
+
+    size_t block = (size_t) 1 << GET_SUB_POOL_SHIFT(*p_ref);
+    block = block > PAGE_SIZE ? block : PAGE_SIZE;
+
+    size_t size = GET_SIZE_OF_POOL(*p_ref);
+    size_t mapped = ROUND_UP_TO_PAGE(size > 0 ? size : 1, block);
+    mapped = mapped > meta->provisioned ? mapped : meta->provisioned;
+    size_t end = mapped + block;
+
+    /* The block has to fit in the window, and be addressable from it */
+    size_t limit = p_ref->is_extended ? (size_t) 1 << GET_WINDOW_SHIFT(*p_ref) :
+                                        ((size_t) UINT16_MAX + 1)*PAGE_SIZE;
+    if (end > limit ||
+        GET_SUB_POOLS_FOR(*p_ref, end)*GET_SUB_POOL_SIZE(*p_ref) >
+        POOL_WINDOW_SIZE) {
+        meta->provision_at = limit + 1;
+        return;
+    }
+
+    /* Threads sharing the pool race to post, only one of them wins */
+    uint64_t posted = PROVISION_STATE(state + PROVISION_TICKET,
+                                      PROVISION_POSTED);
+    if (!__atomic_compare_exchange_n(&meta->provision_state,
+                                     &state,
+                                     posted,
+                                     false,
+                                     __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE))
+        return;
+
+    meta->provision_at = mapped + meta->provision_watermark;
+
+    pthread_mutex_lock(&provisioner.lock);
+    if (provisioner.tail - provisioner.head < PROVISION_QUEUE_LENGTH) {
+        provisioner.queue[provisioner.tail++ % PROVISION_QUEUE_LENGTH] =
+            (struct provision_request) {.pool   = *p_ref,
+                                        .from   = mapped,
+                                        .to     = end,
+                                        .state  = posted };
+        pthread_cond_signal(&provisioner.wake);
+    } else {
+        __atomic_store_n(&meta->provision_state,
+                         PROVISION_STATE(posted, PROVISION_IDLE),
+                         __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&provisioner.lock);
+}
+
+static void
+provision_wait(struct pool_meta *meta)
+{
+    for (;;) {
+        uint64_t state = __atomic_load_n(&meta->provision_state,
+                                         __ATOMIC_ACQUIRE);
+
+        if (PROVISION_IDLE == PROVISION_PHASE(state))
+            return;
+
+        /* A request that has not been started yet is cheaper to take back */
+        if (PROVISION_POSTED == PROVISION_PHASE(state) &&
+            __atomic_compare_exchange_n(&meta->provision_state,
+                                        &state,
+                                        PROVISION_STATE(state, PROVISION_IDLE),
+                                        false,
+                                        __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+            return;
+
+        /* The provisioner broadcasts after it has left RUNNING */
+        pthread_mutex_lock(&provisioner.lock);
+        while (PROVISION_RUNNING ==
+               PROVISION_PHASE(__atomic_load_n(&meta->provision_state,
+                                               __ATOMIC_ACQUIRE)))
+            pthread_cond_wait(&provisioner.done, &provisioner.lock);
+        pthread_mutex_unlock(&provisioner.lock);
+    }
 }
@@ -17,6 +17,7 @@
 #include "type_info.h"
 
 extern Type_table type_table;
+extern struct pool_meta pool_meta_table[];
 
 /* Gets the number of local references a type has */
 static inline size_t
@@ -34,19 +35,28 @@ iterator_btree_next(complex_iterator_struct *cis, pool_iterator iter);
 static inline pool_iterator
 iterator_ntree_next(complex_iterator_struct *cis, pool_iterator iter);
 
+/* Moves a reference or iterator to another absolute index in its pool */
+static inline uint64_t
+move_to_index(uint64_t reference, size_t index);
+
 INLINED global_reference
 pool_get_ref(pool_reference pool, size_t index)
 {
-    uint64_t sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(index);
-    uint16_t elem_index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(index);
+    reference_struct ref = {.raw_val = pool};
 
-    /* TODO Support for larger pools */
-    assert(!(sub_pool_id >> 16));
+    uint16_t window = GET_WINDOW_OF_INDEX(ref, index);
+    size_t index_in_window = GET_INDEX_IN_WINDOW(ref, index);
+    uint64_t sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(index_in_window);
+    uint16_t elem_index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(index_in_window);
 
+    /* Pools larger than this are created with pool_create_large */
+    assert(!(sub_pool_id >> 16));
 
-    reference_struct ref = {.raw_val = pool};
+    unsigned is_extended = ref.is_extended;
+    ref.pool_id = window;
     ref.sub_pool_id = sub_pool_id;
     ref.raw_index = elem_index;
+    ref.is_extended = is_extended;
 
     return ref.raw_val;
 }
@@ -57,6 +67,15 @@ iterator_simple_next(pool_reference pool_ref, pool_iterator iterator)
     reference_struct ref = {.raw_val = iterator};
     pool_struct pool = {.raw_val = pool_ref };
 
+    /* The end of a large pool may lie in a later window */
+    if (ref.is_extended) {
+        size_t next = GET_LARGE_INDEX_OF_REF(ref) + 1;
+        if (next < GET_SIZE_OF_LARGE_POOL(pool))
+            return move_to_index(iterator, next);
+
+        return ITERATOR_END;
+    }
+
     uint16_t index = ref.index + 1;
     uint16_t sub_pool_id = ref.sub_pool_id + GLOBAL_INDEX_TO_SUBPOOL_ID(index);
 
@@ -80,10 +99,7 @@ iterator_list_next(pool_iterator iterator)
 
     /* Current invariant of lists: reference is first field -> easy field
      * offset */
-    uint16_t *next_raw_val = ((uint16_t*)
-                               (GET_POOL_ADDR(itr) +
-                                GET_SUB_POOL_SIZE(itr)*itr.sub_pool_id)) +
-                                itr.index;
+    uint16_t *next_raw_val = (uint16_t*) GET_FIELD_ADDR(itr, 0);
     local_reference_struct next = {.raw_val = *next_raw_val};
 
     /* Not yet supported! */
@@ -92,6 +108,9 @@ iterator_list_next(pool_iterator iterator)
     if (0 == next.index)
         return ITERATOR_END;
 
+    if (itr.is_extended)
+        return move_to_index(iterator, GET_LARGE_INDEX_OF_REF(itr) + next.index);
+
     size_t global_index = GET_GLOBAL_INDEX_OF_REF(itr);
     global_index += next.index; 
 
@@ -155,8 +174,8 @@ iterator_new(pool_reference *pool, global_reference *root)
 
         cis->cursor = REF_BEGIN;
         cis->prev = REF_BEGIN;
-        cis->next = GET_GLOBAL_INDEX_OF_REF(((reference_struct) 
-                                            {.raw_val = *root}));
+        cis->next = GET_LARGE_INDEX_OF_REF(((reference_struct)
+                                           {.raw_val = *root}));
 
         itr.raw_val = (uint64_t) cis;
         assert(!itr.iterator_type);
@@ -238,6 +257,9 @@ iterator_prev(pool_iterator iterator)
         return itr.raw_val;
     }
 
+    if (itr.is_extended && itr.pool_id > GET_EXTENT_BASE(itr))
+        return move_to_index(iterator, GET_LARGE_INDEX_OF_REF(itr) - 1);
+
     return ITERATOR_END;
 }
 
@@ -317,13 +339,7 @@ iterator_list_remove(pool_iterator iterator)
 static inline size_t
 get_reference_count(uint16_t type_id)
 {
-    size_t i = 0;
-    for ( ; i < type_table[type_id].field_count ; ++i) {
-        uint16_t field_type_id = type_table[type_id].field_offsets[i].type_id;
-        if (type_table[field_type_id].type_class != LOCAL_REF_TYPE)
-            break;
-    }
-    return i;
+    return TYPE_DESCRIPTOR_OF_ID(type_id)->local_ref_count;
 }
 
 static inline pool_iterator
@@ -345,26 +361,48 @@ iterator_common(struct pool_iterator itr)
     return itr.raw_val;
 }
 
-static inline size_t
-get_field_ref(complex_iterator_struct *cis, size_t elem, size_t field_no)
+static inline uint64_t
+move_to_index(uint64_t reference, size_t index)
 {
-    uint16_t subpool = GLOBAL_INDEX_TO_SUBPOOL_ID(elem);
-    uint16_t index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(elem);
+    reference_struct ref = {.raw_val = reference};
+    size_t index_in_window = GET_INDEX_IN_WINDOW(ref, index);
 
-    uint16_t *loc_ref_ptr = ((uint16_t*)
-                            (((char *)cis->pool_start) +
-                            cis->elem_size*PAGE_SIZE * subpool)) +
-                            PAGE_SIZE*field_no + index;
+    ref.pool_id = GET_WINDOW_OF_INDEX(ref, index);
+    ref.sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(index_in_window);
+    ref.index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(index_in_window);
+
+    return ref.raw_val;
+}
+
+/* Kept out of line, long references are the rare case */
+static size_t
+get_long_field_ref(complex_iterator_struct *cis,
+                   size_t elem,
+                   local_reference_struct loc_ref)
+{
+    reference_struct elem_ref = {.raw_val = move_to_index(*cis->root, elem)};
+    elem_ref.reserved = 0;
+    elem_ref.gc_state = 0;
+
+    reference_tag t = { .raw_val = elem_ref.raw_val };
+    t.local_ref = loc_ref.raw_val;
+    return expand_local_reference(t);
+}
+
+/* Grew past what GCC inlines on its own once windows got their colors */
+static inline __attribute__((always_inline)) size_t
+get_field_ref(complex_iterator_struct *cis, size_t elem, size_t field_no)
+{
+    pool_struct pool = {.raw_val = *cis->pool};
+    uint16_t *loc_ref_ptr = (uint16_t*) GET_FIELD_ADDR_OF_LARGE_INDEX(pool,
+                                                                      elem,
+                                                                      field_no);
 
     local_reference_struct loc_ref = {.raw_val = *loc_ref_ptr};
 
-    if (loc_ref.is_long_ref) {
-        reference_tag t = { .raw_val = *cis->root };
-        t.sub_pool_id = subpool;
-        t.index = index;
-        t.local_ref = loc_ref.raw_val;
-        return expand_local_reference(t);
-    }
+    if (loc_ref.is_long_ref)
+        return get_long_field_ref(cis, elem, loc_ref);
+
     if (loc_ref.index == 0)
         return REF_END;
 
@@ -6,7 +6,10 @@
  * @date January 2015
  *
  */
-#include <omp.h>
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "basic_types.h"
 #include "pool_private.h"
@@ -16,48 +19,1469 @@
 #include "pool_map.h"
 
 extern Type_table type_table;
+extern struct pool_meta pool_meta_table[];
+
+/*
+ * The kernels of field_op_map are plain loops over contiguous field arrays,
+ * left to the vectorizer. On x86-64 each is compiled once for AVX-512, once
+ * for AVX2 and FMA and once for the baseline, and the loader picks the best
+ * one the CPU supports when the library is loaded.
+ */
+#if defined(__x86_64__)
+#define FIELD_KERNEL \
+    __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", \
+                                 "default")))
+#else
+#define FIELD_KERNEL
+#endif
+
+typedef void (*field_kernel) (const void *restrict src,
+                              void *restrict dst,
+                              size_t n,
+                              const field_op *op);
+
+typedef void (*zip_kernel) (const void *const *src,
+                            void *dst,
+                            size_t n);
+
+typedef size_t (*select_kernel) (const void *restrict src,
+                                 size_t n,
+                                 const field_op *op,
+                                 uint64_t *restrict bits);
+
+typedef void (*reduce_kernel) (const void *restrict src,
+                               size_t n,
+                               const field_reduce_op *op,
+                               field_scalar *partial,
+                               uint64_t *histogram);
+
+/*
+ * The element types: enum, name, type for arithmetic, type for comparisons
+ * and conversions, type products are taken in, operand member, type sums are
+ * taken in, and the smallest and largest values. Integer arithmetic is
+ * unsigned and never promoted to int, so that it wraps.
+ */
+#define FIELD_ELEM_TYPES(X) \
+    X(FIELD_INT8,   int8,   uint8_t,  int8_t,  uint32_t, i, uint64_t, \
+      INT8_MIN, INT8_MAX) \
+    X(FIELD_INT16,  int16,  uint16_t, int16_t, uint32_t, i, uint64_t, \
+      INT16_MIN, INT16_MAX) \
+    X(FIELD_INT32,  int32,  uint32_t, int32_t, uint32_t, i, uint64_t, \
+      INT32_MIN, INT32_MAX) \
+    X(FIELD_INT64,  int64,  uint64_t, int64_t, uint64_t, i, uint64_t, \
+      INT64_MIN, INT64_MAX) \
+    X(FIELD_FLOAT,  float,  float,    float,   float,    d, double, \
+      -INFINITY, INFINITY) \
+    X(FIELD_DOUBLE, double, double,   double,  double,   d, double, \
+      -INFINITY, INFINITY)
+
+#define OP_ADD(a, x, y)     ((a) + (x))
+#define OP_MUL(a, x, y)     ((a) * (x))
+#define OP_FMA(a, x, y)     ((a) * (x) + (y))
+#define OP_SQUARE(a, x, y)  ((a) * (a))
+#define OP_LT(a, x, y)      ((a) < (x))
+#define OP_EQ(a, x, y)      ((a) == (x))
+#define OP_GT(a, x, y)      ((a) > (x))
+#define OP_IN_RANGE(a, x, y) (((a) >= (x)) & ((a) < (y)))
+
+/* b = OP(a, x, y), for n elements of type T, computed in type S */
+#define ARITH_KERNEL(name, T, S, member, OP) \
+FIELD_KERNEL static void \
+name(const void *restrict src, void *restrict dst, size_t n, \
+     const field_op *op) \
+{ \
+    const T *a = src; \
+    T *b = dst; \
+    const S x __attribute__((unused)) = (T) op->x.member; \
+    const S y __attribute__((unused)) = (T) op->y.member; \
+    for (size_t i = 0 ; i < n ; ++i) \
+        b[i] = (T) OP((S) a[i], x, y); \
+}
+
+/* b = OP(a, x, y) ? 1 : 0, for n elements of type T */
+#define COMPARE_KERNEL(name, T, member, OP) \
+FIELD_KERNEL static void \
+name(const void *restrict src, void *restrict dst, size_t n, \
+     const field_op *op) \
+{ \
+    const T *a = src; \
+    T *b = dst; \
+    const T x = (T) op->x.member; \
+    const T y __attribute__((unused)) = (T) op->y.member; \
+    for (size_t i = 0 ; i < n ; ++i) \
+        b[i] = (T) OP(a[i], x, y); \
+}
+
+/*
+ * d = OP(a, b, c), for n elements of type T, computed in type S, where a, b
+ * and c are the arrays src[0], src[1] and src[2]. Operations that read fewer
+ * inputs ignore the others. d may be one of the inputs, so none of them are
+ * restrict, and the vectorizer checks for overlap when the loop starts.
+ */
+#define ZIP_KERNEL(name, T, S, OP) \
+FIELD_KERNEL static void \
+name(const void *const *src, void *dst, size_t n) \
+{ \
+    const T *a = src[0]; \
+    const T *b __attribute__((unused)) = src[1]; \
+    const T *c __attribute__((unused)) = src[2]; \
+    T *d = dst; \
+    for (size_t i = 0 ; i < n ; ++i) \
+        d[i] = (T) OP((S) a[i], (S) b[i], (S) c[i]); \
+}
+
+/*
+ * Sets bit i of the bitmap bits if OP(a[i], x, y), for n elements of type T,
+ * and returns the number of bits set. Each word is written whole.
+ */
+#define SELECT_KERNEL(name, T, member, OP) \
+FIELD_KERNEL static size_t \
+name(const void *restrict src, size_t n, const field_op *op, \
+     uint64_t *restrict bits) \
+{ \
+    const T *a = src; \
+    const T x = (T) op->x.member; \
+    const T y __attribute__((unused)) = (T) op->y.member; \
+    size_t count = 0; \
+    for (size_t w = 0 ; w*64 < n ; ++w) { \
+        size_t m = n - w*64 < 64 ? n - w*64 : 64; \
+        uint64_t word = 0; \
+        for (size_t i = 0 ; i < m ; ++i) \
+            word |= (uint64_t) OP(a[w*64 + i], x, y) << i; \
+        bits[w] = word; \
+        count += __builtin_popcountll(word); \
+    } \
+    return count; \
+}
+
+/* b = (D) a, for n elements */
+#define CONVERT_KERNEL(name, T, D) \
+FIELD_KERNEL static void \
+name(const void *restrict src, void *restrict dst, size_t n, \
+     const field_op *op) \
+{ \
+    const T *a = src; \
+    D *b = dst; \
+    (void) op; \
+    for (size_t i = 0 ; i < n ; ++i) \
+        b[i] = (D) a[i]; \
+}
+
+/*
+ * Reductions of n elements of type T into partial. The loops are marked as
+ * OpenMP SIMD reductions, which lets the vectorizer reorder sums of floating
+ * point values.
+ */
+#define SIMD_PRAGMA(text) _Pragma(#text)
+
+#define SUM_KERNEL(name, T, R, member) \
+FIELD_KERNEL static void \
+name(const void *restrict src, size_t n, const field_reduce_op *op, \
+     field_scalar *partial, uint64_t *histogram) \
+{ \
+    const T *a = src; \
+    R sum = 0; \
+    (void) op; \
+    (void) histogram; \
+    SIMD_PRAGMA(omp simd reduction(+:sum)) \
+    for (size_t i = 0 ; i < n ; ++i) \
+        sum += (R) a[i]; \
+    partial->member = sum; \
+}
+
+#define EXTREME_KERNEL(name, T, member, start, BETTER, omp_op) \
+FIELD_KERNEL static void \
+name(const void *restrict src, size_t n, const field_reduce_op *op, \
+     field_scalar *partial, uint64_t *histogram) \
+{ \
+    const T *a = src; \
+    T extreme = start; \
+    (void) op; \
+    (void) histogram; \
+    SIMD_PRAGMA(omp simd reduction(omp_op:extreme)) \
+    for (size_t i = 0 ; i < n ; ++i) \
+        extreme = BETTER(a[i], extreme); \
+    partial->member = extreme; \
+}
+
+#define REDUCE_MIN(a, b)    ((a) < (b) ? (a) : (b))
+#define REDUCE_MAX(a, b)    ((a) > (b) ? (a) : (b))
+
+#define COUNT_KERNEL(name, T, member) \
+FIELD_KERNEL static void \
+name(const void *restrict src, size_t n, const field_reduce_op *op, \
+     field_scalar *partial, uint64_t *histogram) \
+{ \
+    const T *a = src; \
+    const T lo = (T) op->lo.member; \
+    const T hi = (T) op->hi.member; \
+    uint64_t count = 0; \
+    (void) histogram; \
+    SIMD_PRAGMA(omp simd reduction(+:count)) \
+    for (size_t i = 0 ; i < n ; ++i) \
+        count += (a[i] >= lo) & (a[i] < hi); \
+    partial->i = count; \
+}
+
+/*
+ * Histograms are not vectorized. The bin of an integer is found with a
+ * division by the width of the bins, that of a real with a multiplication.
+ */
+#define HISTOGRAM_SCALE_i(op) \
+    (((uint64_t) (op)->hi.i - (uint64_t) (op)->lo.i + (op)->bins - 1) / \
+     (op)->bins)
+#define HISTOGRAM_BIN_i(a, lo, scale) \
+    (((uint64_t) (a) - (uint64_t) (lo)) / (scale))
+#define HISTOGRAM_SCALE_d(op) \
+    ((op)->bins / ((op)->hi.d - (op)->lo.d))
+#define HISTOGRAM_BIN_d(a, lo, scale) \
+    ((size_t) (((a) - (lo)) * (scale)))
+
+#define HISTOGRAM_KERNEL(name, T, member) \
+static void \
+name(const void *restrict src, size_t n, const field_reduce_op *op, \
+     field_scalar *partial, uint64_t *histogram) \
+{ \
+    const T *a = src; \
+    const T lo = (T) op->lo.member; \
+    const T hi = (T) op->hi.member; \
+    const __typeof__(HISTOGRAM_SCALE_##member(op)) scale = \
+        HISTOGRAM_SCALE_##member(op); \
+    uint64_t count = 0; \
+    for (size_t i = 0 ; i < n ; ++i) { \
+        if (a[i] >= lo && a[i] < hi) { \
+            size_t bin = HISTOGRAM_BIN_##member(a[i], lo, scale); \
+            ++histogram[bin < op->bins ? bin : op->bins - 1]; \
+            ++count; \
+        } \
+    } \
+    partial->i = count; \
+}
+
+#define DEFINE_KERNELS(e, name, A, C, S, member, R, lowest, highest) \
+    ARITH_KERNEL(name##_add, A, S, member, OP_ADD) \
+    ARITH_KERNEL(name##_mul, A, S, member, OP_MUL) \
+    ARITH_KERNEL(name##_fma, A, S, member, OP_FMA) \
+    ARITH_KERNEL(name##_square, A, S, member, OP_SQUARE) \
+    COMPARE_KERNEL(name##_lt, C, member, OP_LT) \
+    COMPARE_KERNEL(name##_eq, C, member, OP_EQ) \
+    COMPARE_KERNEL(name##_gt, C, member, OP_GT) \
+    COMPARE_KERNEL(name##_in_range, C, member, OP_IN_RANGE) \
+    ZIP_KERNEL(name##_zip_add, A, S, OP_ADD) \
+    ZIP_KERNEL(name##_zip_mul, A, S, OP_MUL) \
+    ZIP_KERNEL(name##_zip_fma, A, S, OP_FMA) \
+    ZIP_KERNEL(name##_zip_square, A, S, OP_SQUARE) \
+    ZIP_KERNEL(name##_zip_lt, C, C, OP_LT) \
+    ZIP_KERNEL(name##_zip_eq, C, C, OP_EQ) \
+    ZIP_KERNEL(name##_zip_gt, C, C, OP_GT) \
+    ZIP_KERNEL(name##_zip_in_range, C, C, OP_IN_RANGE) \
+    SELECT_KERNEL(name##_select_lt, C, member, OP_LT) \
+    SELECT_KERNEL(name##_select_eq, C, member, OP_EQ) \
+    SELECT_KERNEL(name##_select_gt, C, member, OP_GT) \
+    SELECT_KERNEL(name##_select_in_range, C, member, OP_IN_RANGE) \
+    CONVERT_KERNEL(name##_to_int8, C, int8_t) \
+    CONVERT_KERNEL(name##_to_int16, C, int16_t) \
+    CONVERT_KERNEL(name##_to_int32, C, int32_t) \
+    CONVERT_KERNEL(name##_to_int64, C, int64_t) \
+    CONVERT_KERNEL(name##_to_float, C, float) \
+    CONVERT_KERNEL(name##_to_double, C, double) \
+    SUM_KERNEL(name##_sum, C, R, member) \
+    EXTREME_KERNEL(name##_min, C, member, highest, REDUCE_MIN, min) \
+    EXTREME_KERNEL(name##_max, C, member, lowest, REDUCE_MAX, max) \
+    COUNT_KERNEL(name##_count, C, member) \
+    HISTOGRAM_KERNEL(name##_histogram, C, member)
+
+FIELD_ELEM_TYPES(DEFINE_KERNELS)
+
+#define KERNEL_ENTRY(e, name, A, C, S, member, R, lowest, highest) \
+    [e] = { \
+        [FIELD_OP_ADD] = name##_add, \
+        [FIELD_OP_MUL] = name##_mul, \
+        [FIELD_OP_FMA] = name##_fma, \
+        [FIELD_OP_SQUARE] = name##_square, \
+        [FIELD_OP_LT] = name##_lt, \
+        [FIELD_OP_EQ] = name##_eq, \
+        [FIELD_OP_GT] = name##_gt, \
+        [FIELD_OP_IN_RANGE] = name##_in_range, \
+    },
+
+static const field_kernel field_kernels[FIELD_ELEM_TYPE_COUNT][FIELD_OP_COUNT] = {
+    FIELD_ELEM_TYPES(KERNEL_ENTRY)
+};
+
+#define CONVERT_ENTRY(e, name, A, C, S, member, R, lowest, highest) \
+    [e] = { \
+        [FIELD_INT8] = name##_to_int8, \
+        [FIELD_INT16] = name##_to_int16, \
+        [FIELD_INT32] = name##_to_int32, \
+        [FIELD_INT64] = name##_to_int64, \
+        [FIELD_FLOAT] = name##_to_float, \
+        [FIELD_DOUBLE] = name##_to_double, \
+    },
+
+static const field_kernel
+convert_kernels[FIELD_ELEM_TYPE_COUNT][FIELD_ELEM_TYPE_COUNT] = {
+    FIELD_ELEM_TYPES(CONVERT_ENTRY)
+};
+
+#define REDUCE_ENTRY(e, name, A, C, S, member, R, lowest, highest) \
+    [e] = { \
+        [FIELD_REDUCE_SUM] = name##_sum, \
+        [FIELD_REDUCE_MIN] = name##_min, \
+        [FIELD_REDUCE_MAX] = name##_max, \
+        [FIELD_REDUCE_COUNT] = name##_count, \
+        [FIELD_REDUCE_HISTOGRAM] = name##_histogram, \
+    },
+
+static const reduce_kernel
+reduce_kernels[FIELD_ELEM_TYPE_COUNT][FIELD_REDUCE_CODE_COUNT] = {
+    FIELD_ELEM_TYPES(REDUCE_ENTRY)
+};
+
+#define ZIP_ENTRY(e, name, A, C, S, member, R, lowest, highest) \
+    [e] = { \
+        [FIELD_OP_ADD] = name##_zip_add, \
+        [FIELD_OP_MUL] = name##_zip_mul, \
+        [FIELD_OP_FMA] = name##_zip_fma, \
+        [FIELD_OP_SQUARE] = name##_zip_square, \
+        [FIELD_OP_LT] = name##_zip_lt, \
+        [FIELD_OP_EQ] = name##_zip_eq, \
+        [FIELD_OP_GT] = name##_zip_gt, \
+        [FIELD_OP_IN_RANGE] = name##_zip_in_range, \
+    },
+
+static const zip_kernel zip_kernels[FIELD_ELEM_TYPE_COUNT][FIELD_OP_COUNT] = {
+    FIELD_ELEM_TYPES(ZIP_ENTRY)
+};
+
+/* The number of fields each operation of field_zip_op_map reads */
+static const size_t zip_op_inputs[FIELD_OP_COUNT] = {
+    [FIELD_OP_ADD] = 2,
+    [FIELD_OP_MUL] = 2,
+    [FIELD_OP_FMA] = 3,
+    [FIELD_OP_SQUARE] = 1,
+    [FIELD_OP_LT] = 2,
+    [FIELD_OP_EQ] = 2,
+    [FIELD_OP_GT] = 2,
+    [FIELD_OP_IN_RANGE] = 3,
+};
+
+#define SELECT_ENTRY(e, name, A, C, S, member, R, lowest, highest) \
+    [e] = { \
+        [FIELD_OP_LT] = name##_select_lt, \
+        [FIELD_OP_EQ] = name##_select_eq, \
+        [FIELD_OP_GT] = name##_select_gt, \
+        [FIELD_OP_IN_RANGE] = name##_select_in_range, \
+    },
+
+static const select_kernel
+select_kernels[FIELD_ELEM_TYPE_COUNT][FIELD_OP_COUNT] = {
+    FIELD_ELEM_TYPES(SELECT_ENTRY)
+};
+
+static const size_t field_elem_sizes[FIELD_ELEM_TYPE_COUNT] = {
+    [FIELD_INT8] = 1,
+    [FIELD_INT16] = 2,
+    [FIELD_INT32] = 4,
+    [FIELD_INT64] = 8,
+    [FIELD_FLOAT] = sizeof(float),
+    [FIELD_DOUBLE] = sizeof(double),
+};
+
+/*
+ * The workers of the parallel maps are started when first needed, one per
+ * online CPU but the caller unless map_set_thread_count() asks for more, and
+ * live as long as the process. Work is split into chunks that the caller and
+ * the workers claim one at a time, so that a slow thread holds up at most one
+ * chunk. There is one job at a time, and the caller returns when every
+ * thread that joined it has left.
+ */
+#define MAP_MAX_WORKERS 255
+
+struct map_job {
+    void                (*run) (void *arg, size_t chunk);
+    void                *arg;
+    size_t              chunks;
+    size_t              next;           /* The next chunk to claim */
+};
+
+static struct {
+    pthread_mutex_t     lock;
+    pthread_cond_t      wake;           /* Workers wait for a job here */
+    pthread_cond_t      left;           /* The caller waits for workers here */
+    pthread_mutex_t     submit;         /* Held by the caller of the job */
+    unsigned            workers;
+    unsigned            threads;        /* Per job, 0 for all */
+    unsigned            helpers;        /* Workers that may still join */
+    unsigned            active;         /* Workers in the current job */
+    uint64_t            generation;
+    struct map_job      *job;
+} map_workers = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .left = PTHREAD_COND_INITIALIZER,
+    .submit = PTHREAD_MUTEX_INITIALIZER
+};
+
+static void
+map_job_run(struct map_job *job)
+{
+    for (;;) {
+        size_t chunk = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (chunk >= job->chunks)
+            return;
+        job->run(job->arg, chunk);
+    }
+}
+
+static void*
+map_worker_main(void *arg)
+{
+    (void) arg;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&map_workers.lock);
+    for (;;) {
+        while (NULL == map_workers.job ||
+               seen == map_workers.generation ||
+               0 == map_workers.helpers)
+            pthread_cond_wait(&map_workers.wake, &map_workers.lock);
+
+        seen = map_workers.generation;
+        struct map_job *job = map_workers.job;
+        --map_workers.helpers;
+        ++map_workers.active;
+        pthread_mutex_unlock(&map_workers.lock);
+
+        map_job_run(job);
+
+        pthread_mutex_lock(&map_workers.lock);
+        if (0 == --map_workers.active)
+            pthread_cond_signal(&map_workers.left);
+    }
+
+    return NULL;
+}
+
+/* Starts workers until there are wanted of them, with submit held */
+static unsigned
+map_workers_reserve(unsigned wanted)
+{
+    if (map_workers.workers >= wanted)
+        return wanted;
+
+    pthread_attr_t attr;
+    if (0 != pthread_attr_init(&attr))
+        return map_workers.workers;
+
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    while (map_workers.workers < wanted) {
+        pthread_t thread;
+        if (0 != pthread_create(&thread, &attr, map_worker_main, NULL))
+            break;
+        ++map_workers.workers;
+    }
+    pthread_attr_destroy(&attr);
+
+    return map_workers.workers;
+}
+
+/*
+ * Calls run(arg, chunk) for every chunk below chunks, on the caller and as
+ * many workers as map_set_thread_count() allows, and returns when all are
+ * done. Without workers it all runs on the caller.
+ */
+static void
+map_parallel_for(size_t chunks, void (*run) (void *arg, size_t chunk),
+                 void *arg)
+{
+    struct map_job job = {.run = run, .arg = arg, .chunks = chunks};
+
+    pthread_mutex_lock(&map_workers.submit);
+    size_t threads = map_workers.threads;
+    if (0 == threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (size_t) cpus : 1;
+    }
+    threads = threads < chunks ? threads : chunks;
+    threads = threads < MAP_MAX_WORKERS + 1 ? threads : MAP_MAX_WORKERS + 1;
+    unsigned helpers = threads > 1 ? map_workers_reserve(threads - 1) : 0;
+
+    pthread_mutex_lock(&map_workers.lock);
+    if (0 != helpers) {
+        map_workers.job = &job;
+        map_workers.helpers = helpers;
+        ++map_workers.generation;
+        pthread_cond_broadcast(&map_workers.wake);
+    }
+    pthread_mutex_unlock(&map_workers.lock);
+
+    map_job_run(&job);
+
+    /* Every chunk is claimed, wait for those that are still running */
+    pthread_mutex_lock(&map_workers.lock);
+    map_workers.job = NULL;
+    map_workers.helpers = 0;
+    while (0 != map_workers.active)
+        pthread_cond_wait(&map_workers.left, &map_workers.lock);
+    pthread_mutex_unlock(&map_workers.lock);
+    pthread_mutex_unlock(&map_workers.submit);
+}
+
+unsigned
+map_set_thread_count(unsigned threads)
+{
+    pthread_mutex_lock(&map_workers.submit);
+    unsigned old = map_workers.threads;
+    map_workers.threads = threads;
+    pthread_mutex_unlock(&map_workers.submit);
+    return old;
+}
+
+struct field_map_args {
+    pool_struct         src_pool;
+    pool_struct         dst_pool;
+    size_t              field_no;
+    field_descriptor    src_field;
+    field_descriptor    dst_field;
+    size_t              size;
+    size_t              run;
+    map_function_type   f;
+    const uint64_t      *freed;         /* Liveness bitmap, or NULL */
+    size_t              freed_words;
+};
+
+/*
+ * Grows B to the size of A and fills in the arguments of field_map_chunk.
+ * Subpool lengths are powers of two, so runs as long as the shorter of the
+ * two never cross a subpool boundary in either pool. Windows of large pools
+ * hold a whole number of subpools, so runs never cross those either.
+ */
+static int
+field_map_prepare(const pool_reference A,
+                  pool_reference *B,
+                  size_t field_no,
+                  map_function_type f,
+                  struct field_map_args *args)
+{
+    args->src_pool.raw_val = A;
+    args->dst_pool.raw_val = *B;
+    args->field_no = field_no;
+    args->src_field = GET_TYPE_DESCRIPTOR(args->src_pool)->fields[field_no];
+    args->dst_field = GET_TYPE_DESCRIPTOR(args->dst_pool)->fields[0];
+    args->size = GET_SIZE_OF_LARGE_POOL(args->src_pool);
+    args->f = f;
+    args->freed = NULL;
+    args->freed_words = 0;
+
+    if (pool_grow(B, args->size) != 0)
+        return 1;
+
+    args->run = (size_t) 1 << GET_SUB_POOL_SHIFT(args->src_pool);
+    if (args->run > ((size_t) 1 << GET_SUB_POOL_SHIFT(args->dst_pool)))
+        args->run = (size_t) 1 << GET_SUB_POOL_SHIFT(args->dst_pool);
+
+    return 0;
+}
+
+/* Maps run number chunk, the last of which may be short */
+static void
+field_map_chunk(void *arg, size_t chunk)
+{
+    const struct field_map_args *args = arg;
+
+    size_t i = chunk*args->run;
+    size_t n = args->size - i < args->run ? args->size - i : args->run;
+    char *a = (char*) GET_FIELD_ADDR_OF_LARGE_INDEX(args->src_pool, i,
+                                                    args->field_no);
+    char *b = (char*) GET_FIELD_ADDR_OF_LARGE_INDEX(args->dst_pool, i, 0);
+    for (size_t j = 0 ; j < n ; ++j) {
+        args->f(a + SCALE_BY_FIELD_STRIDE(args->src_field, j),
+                b + SCALE_BY_FIELD_STRIDE(args->dst_field, j));
+    }
+}
 
 int
 field_map(const pool_reference A,
           pool_reference *B,
           size_t field_no,
           map_function_type f)
+{
+    struct field_map_args args;
+    if (field_map_prepare(A, B, field_no, f, &args) != 0)
+        return 1;
+
+    for (size_t chunk = 0 ; chunk*args.run < args.size ; ++chunk)
+        field_map_chunk(&args, chunk);
+
+    return 0;
+}
+
+/*
+ * Finds the liveness bitmap of a pool, where a set bit marks a slot freed with
+ * pool_free(), or returns NULL if no slot is free. Elements past the end of
+ * the bitmap are live. Large pools never free slots.
+ */
+static const uint64_t*
+pool_freed_slots(pool_struct pool, size_t *words)
+{
+    const struct pool_meta *meta = &pool_meta_table[pool.pool_id];
+    if (pool.is_extended || 0 == meta->free_count)
+        return NULL;
+
+    pool_struct bitmap = {.raw_val = meta->liveness};
+    *words = GET_SIZE_OF_POOL(bitmap);
+    return pool_to_array(meta->liveness);
+}
+
+/* The live elements among 64*w to 64*w + 63 */
+static inline uint64_t
+live_word(const uint64_t *freed, size_t words, size_t w)
+{
+    return w < words ? ~freed[w] : ~0llu;
+}
+
+/*
+ * Maps the live elements of run number chunk. A word of the bitmap covers 64
+ * elements, whole words of live ones are done in a straight loop and the
+ * others one set bit at a time.
+ */
+static void
+field_map_live_chunk(void *arg, size_t chunk)
+{
+    const struct field_map_args *args = arg;
+
+    size_t i = chunk*args->run;
+    size_t n = args->size - i < args->run ? args->size - i : args->run;
+    char *a = (char*) GET_FIELD_ADDR_OF_LARGE_INDEX(args->src_pool, i,
+                                                    args->field_no);
+    char *b = (char*) GET_FIELD_ADDR_OF_LARGE_INDEX(args->dst_pool, i, 0);
+    for (size_t j = 0 ; j < n ; ) {
+        size_t bit = (i + j) & 63;
+        size_t m = 64 - bit < n - j ? 64 - bit : n - j;
+        uint64_t all = m == 64 ? ~0llu : ((1llu << m) - 1);
+        uint64_t live = (live_word(args->freed, args->freed_words,
+                                   (i + j) >> 6) >> bit) & all;
+
+        if (live == all) {
+            for (size_t k = j ; k < j + m ; ++k)
+                args->f(a + SCALE_BY_FIELD_STRIDE(args->src_field, k),
+                        b + SCALE_BY_FIELD_STRIDE(args->dst_field, k));
+        } else {
+            for ( ; live != 0 ; live &= live - 1) {
+                size_t k = j + __builtin_ctzll(live);
+                args->f(a + SCALE_BY_FIELD_STRIDE(args->src_field, k),
+                        b + SCALE_BY_FIELD_STRIDE(args->dst_field, k));
+            }
+        }
+        j += m;
+    }
+}
+
+int
+field_map_live(const pool_reference A,
+               pool_reference *B,
+               size_t field_no,
+               map_function_type f)
+{
+    struct field_map_args args;
+    if (field_map_prepare(A, B, field_no, f, &args) != 0)
+        return 1;
+
+    args.freed = pool_freed_slots(args.src_pool, &args.freed_words);
+    for (size_t chunk = 0 ; chunk*args.run < args.size ; ++chunk) {
+        if (NULL == args.freed)
+            field_map_chunk(&args, chunk);
+        else
+            field_map_live_chunk(&args, chunk);
+    }
+
+    return 0;
+}
+
+int
+field_map_parallel(const pool_reference A,
+                   pool_reference *B,
+                   size_t field_no,
+                   map_function_type f)
+{
+    struct field_map_args args;
+    if (field_map_prepare(A, B, field_no, f, &args) != 0)
+        return 1;
+
+    map_parallel_for((args.size + args.run - 1) / args.run,
+                     field_map_chunk, &args);
+
+    return 0;
+}
+
+int
+field_op_map(const pool_reference A,
+             pool_reference *B,
+             size_t field_no,
+             const field_op *op)
 {
     pool_struct src_pool = {.raw_val = A};
     pool_struct dst_pool = {.raw_val = *B};
 
-    size_t pool_size = GET_SIZE_OF_POOL(src_pool);
-    size_t full_subpools = pool_size / PAGE_SIZE;
-    size_t remainder = pool_size % PAGE_SIZE;
+    if (op->code >= FIELD_OP_COUNT ||
+        op->src_type >= FIELD_ELEM_TYPE_COUNT ||
+        op->dst_type >= FIELD_ELEM_TYPE_COUNT)
+        return 1;
+    if (op->code != FIELD_OP_CONVERT && op->src_type != op->dst_type)
+        return 1;
+    if (field_no >= GET_TYPE_DESCRIPTOR(src_pool)->field_count)
+        return 1;
+
+    const field_descriptor src_field =
+        GET_TYPE_DESCRIPTOR(src_pool)->fields[field_no];
+    const field_descriptor dst_field = GET_TYPE_DESCRIPTOR(dst_pool)->fields[0];
+    if (src_field.size != field_elem_sizes[op->src_type] ||
+        dst_field.size != field_elem_sizes[op->dst_type])
+        return 1;
 
-    size_t field_size = GET_FIELD_SIZE(src_pool, field_no);
-    size_t sub_pool_size = GET_SUB_POOL_SIZE(src_pool);
-    size_t field_offset = GET_FIELD_OFFSET(src_pool, field_no);
+    field_kernel kernel = op->code == FIELD_OP_CONVERT ?
+        convert_kernels[op->src_type][op->dst_type] :
+        field_kernels[op->src_type][op->code];
 
-    size_t target_field_size = GET_FIELD_SIZE(dst_pool, 0);
-    size_t target_sub_pool_size = GET_SUB_POOL_SIZE(dst_pool);
+    /* Fields in interleaved groups have a stride larger than their size */
+    int contiguous = SCALE_BY_FIELD_STRIDE(src_field, 1) == src_field.size &&
+                     SCALE_BY_FIELD_STRIDE(dst_field, 1) == dst_field.size;
 
+    size_t pool_size = GET_SIZE_OF_LARGE_POOL(src_pool);
     if (pool_grow(B, pool_size) != 0)
         return 1;
 
-    char *a_base = (char *) GET_POOL_ADDR(src_pool) + field_offset;
-    char *b_base = (char *) GET_POOL_ADDR(dst_pool);
+    /* Runs never cross a subpool boundary, as in field_map */
+    size_t run = (size_t) 1 << GET_SUB_POOL_SHIFT(src_pool);
+    if (run > ((size_t) 1 << GET_SUB_POOL_SHIFT(dst_pool)))
+        run = (size_t) 1 << GET_SUB_POOL_SHIFT(dst_pool);
 
+    for (size_t i = 0 ; i < pool_size ; i += run) {
+        size_t n = pool_size - i < run ? pool_size - i : run;
+        const char *a =
+            (const char*) GET_FIELD_ADDR_OF_LARGE_INDEX(src_pool, i, field_no);
+        char *b = (char*) GET_FIELD_ADDR_OF_LARGE_INDEX(dst_pool, i, 0);
+        if (contiguous) {
+            kernel(a, b, n, op);
+        } else {
+            for (size_t j = 0 ; j < n ; ++j)
+                kernel(a + SCALE_BY_FIELD_STRIDE(src_field, j),
+                       b + SCALE_BY_FIELD_STRIDE(dst_field, j), 1, op);
+        }
+    }
 
-//    #pragma omp parallel for
-    for (size_t i = 0 ; i < full_subpools ; ++i) {
-        char *a = a_base + i*sub_pool_size;
-        char *b = b_base + i*target_sub_pool_size;
-        for (size_t j = 0 ; j < PAGE_SIZE ; ++j) {
-            f(a+j*field_size, b+j*target_field_size);
+    return 0;
+}
+
+struct field_zip_args {
+    pool_struct         src_pool;
+    pool_struct         dst_pool;
+    size_t              inputs;
+    size_t              field_nos[FIELD_ZIP_MAX_INPUTS];
+    field_descriptor    src_fields[FIELD_ZIP_MAX_INPUTS];
+    size_t              dst_field_no;
+    field_descriptor    dst_field;
+    size_t              size;
+    size_t              run;
+};
+
+/*
+ * Checks the fields, grows B to the size of A unless it is that long already,
+ * and fills in the arguments of a zip. Runs are as in field_map_prepare().
+ */
+static int
+field_zip_prepare(const pool_reference A,
+                  const size_t *field_nos,
+                  size_t inputs,
+                  pool_reference *B,
+                  size_t dst_field_no,
+                  struct field_zip_args *args)
+{
+    if (0 == inputs || inputs > FIELD_ZIP_MAX_INPUTS)
+        return 1;
+
+    args->src_pool.raw_val = A;
+    args->dst_pool.raw_val = *B;
+    const type_descriptor *src_type = GET_TYPE_DESCRIPTOR(args->src_pool);
+    const type_descriptor *dst_type = GET_TYPE_DESCRIPTOR(args->dst_pool);
+
+    args->inputs = inputs;
+    for (size_t k = 0 ; k < inputs ; ++k) {
+        if (field_nos[k] >= src_type->field_count)
+            return 1;
+        args->field_nos[k] = field_nos[k];
+        args->src_fields[k] = src_type->fields[field_nos[k]];
+    }
+    if (dst_field_no >= dst_type->field_count)
+        return 1;
+    args->dst_field_no = dst_field_no;
+    args->dst_field = dst_type->fields[dst_field_no];
+
+    args->size = GET_SIZE_OF_LARGE_POOL(args->src_pool);
+    size_t dst_size = GET_SIZE_OF_LARGE_POOL(args->dst_pool);
+    if (dst_size < args->size) {
+        if (pool_grow(B, args->size - dst_size) != 0)
+            return 1;
+        args->dst_pool.raw_val = *B;
+    }
+
+    args->run = (size_t) 1 << GET_SUB_POOL_SHIFT(args->src_pool);
+    if (args->run > ((size_t) 1 << GET_SUB_POOL_SHIFT(args->dst_pool)))
+        args->run = (size_t) 1 << GET_SUB_POOL_SHIFT(args->dst_pool);
+
+    return 0;
+}
+
+int
+field_zip_map(const pool_reference A,
+              const size_t *field_nos,
+              size_t inputs,
+              pool_reference *B,
+              size_t dst_field_no,
+              zip_function_type f)
+{
+    struct field_zip_args args;
+    if (field_zip_prepare(A, field_nos, inputs, B, dst_field_no, &args) != 0)
+        return 1;
+
+    char *a[FIELD_ZIP_MAX_INPUTS];
+    void *srcs[FIELD_ZIP_MAX_INPUTS];
+    for (size_t i = 0 ; i < args.size ; i += args.run) {
+        size_t n = args.size - i < args.run ? args.size - i : args.run;
+        for (size_t k = 0 ; k < args.inputs ; ++k)
+            a[k] = (char*) GET_FIELD_ADDR_OF_LARGE_INDEX(args.src_pool, i,
+                                                         args.field_nos[k]);
+        char *b = (char*) GET_FIELD_ADDR_OF_LARGE_INDEX(args.dst_pool, i,
+                                                        args.dst_field_no);
+        for (size_t j = 0 ; j < n ; ++j) {
+            for (size_t k = 0 ; k < args.inputs ; ++k)
+                srcs[k] = a[k] + SCALE_BY_FIELD_STRIDE(args.src_fields[k], j);
+            f(srcs, b + SCALE_BY_FIELD_STRIDE(args.dst_field, j));
         }
     }
 
-    for (size_t i = 0 ; i < remainder ; ++i) {
-        char *a = a_base + full_subpools*sub_pool_size + i*field_size;
-        char *b = b_base + full_subpools*target_sub_pool_size +
-                  i*target_field_size;
-        f(a, b);
+    return 0;
+}
+
+int
+field_zip_op_map(const pool_reference A,
+                 const size_t *field_nos,
+                 pool_reference *B,
+                 size_t dst_field_no,
+                 const field_op *op)
+{
+    if (op->code >= FIELD_OP_COUNT ||
+        op->src_type >= FIELD_ELEM_TYPE_COUNT ||
+        op->src_type != op->dst_type ||
+        0 == zip_op_inputs[op->code])
+        return 1;
+
+    size_t inputs = zip_op_inputs[op->code];
+    struct field_zip_args args;
+    if (field_zip_prepare(A, field_nos, inputs, B, dst_field_no, &args) != 0)
+        return 1;
+
+    size_t elem_size = field_elem_sizes[op->src_type];
+    int contiguous = SCALE_BY_FIELD_STRIDE(args.dst_field, 1) == elem_size;
+    if (args.dst_field.size != elem_size)
+        return 1;
+    for (size_t k = 0 ; k < inputs ; ++k) {
+        if (args.src_fields[k].size != elem_size)
+            return 1;
+        contiguous &= SCALE_BY_FIELD_STRIDE(args.src_fields[k], 1) ==
+                      elem_size;
+    }
+
+    zip_kernel kernel = zip_kernels[op->src_type][op->code];
+
+    /* Inputs the operation does not read point at the first one */
+    const void *a[3];
+    const void *srcs[3];
+    for (size_t i = 0 ; i < args.size ; i += args.run) {
+        size_t n = args.size - i < args.run ? args.size - i : args.run;
+        for (size_t k = 0 ; k < 3 ; ++k)
+            a[k] = (const void*) GET_FIELD_ADDR_OF_LARGE_INDEX(
+                args.src_pool, i, args.field_nos[k < inputs ? k : 0]);
+        char *b = (char*) GET_FIELD_ADDR_OF_LARGE_INDEX(args.dst_pool, i,
+                                                        args.dst_field_no);
+        if (contiguous) {
+            kernel(a, b, n);
+        } else {
+            for (size_t j = 0 ; j < n ; ++j) {
+                for (size_t k = 0 ; k < 3 ; ++k)
+                    srcs[k] = (const char*) a[k] + SCALE_BY_FIELD_STRIDE(
+                        args.src_fields[k < inputs ? k : 0], j);
+                kernel(srcs, b + SCALE_BY_FIELD_STRIDE(args.dst_field, j), 1);
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * The vector loops do freed slots along with the rest, which is cheaper than
+ * breaking them up, since pool_free() clears every field of a freed slot. The
+ * results for those slots are cleared afterwards.
+ */
+int
+field_op_map_live(const pool_reference A,
+                  pool_reference *B,
+                  size_t field_no,
+                  const field_op *op)
+{
+    if (field_op_map(A, B, field_no, op) != 0)
+        return 1;
+
+    pool_struct src_pool = {.raw_val = A};
+    pool_struct dst_pool = {.raw_val = *B};
+    size_t words = 0;
+    const uint64_t *freed = pool_freed_slots(src_pool, &words);
+    if (NULL == freed)
+        return 0;
+
+    size_t pool_size = GET_SIZE_OF_LARGE_POOL(src_pool);
+    size_t dst_size = field_elem_sizes[op->dst_type];
+    for (size_t w = 0 ; w < words && w*64 < pool_size ; ++w) {
+        for (uint64_t dead = freed[w] ; dead != 0 ; dead &= dead - 1) {
+            size_t i = w*64 + __builtin_ctzll(dead);
+            if (i < pool_size)
+                memset((void*) GET_FIELD_ADDR_OF_LARGE_INDEX(dst_pool, i, 0),
+                       0, dst_size);
+        }
+    }
+
+    return 0;
+}
+
+/* Runs of this many elements are reduced by one thread at a time */
+#define REDUCE_CHUNK_LENGTH ((size_t) 1 << 16)
+
+/* Values of a list are reduced in batches this long */
+#define REDUCE_BUFFER_LENGTH 256
+
+static int
+reduce_op_check(const field_reduce_op *op, size_t field_size)
+{
+    if (op->code >= FIELD_REDUCE_CODE_COUNT ||
+        op->type >= FIELD_ELEM_TYPE_COUNT ||
+        field_size != field_elem_sizes[op->type])
+        return 1;
+
+    if (FIELD_REDUCE_HISTOGRAM == op->code &&
+        (0 == op->bins || NULL == op->histogram ||
+         (op->type < FIELD_FLOAT ? op->hi.i <= op->lo.i :
+                                   !(op->hi.d > op->lo.d))))
+        return 1;
+
+    return 0;
+}
+
+#define LOWEST_ENTRY(e, name, A, C, S, member, R, lowest, highest) \
+    [e] = {.member = lowest},
+#define HIGHEST_ENTRY(e, name, A, C, S, member, R, lowest, highest) \
+    [e] = {.member = highest},
+
+/* The result of a reduction over no elements */
+static field_scalar
+reduce_identity(const field_reduce_op *op)
+{
+    static const field_scalar lowest[FIELD_ELEM_TYPE_COUNT] = {
+        FIELD_ELEM_TYPES(LOWEST_ENTRY)
+    };
+    static const field_scalar highest[FIELD_ELEM_TYPE_COUNT] = {
+        FIELD_ELEM_TYPES(HIGHEST_ENTRY)
+    };
+
+    switch (op->code) {
+    case FIELD_REDUCE_MIN:
+        return highest[op->type];
+    case FIELD_REDUCE_MAX:
+        return lowest[op->type];
+    case FIELD_REDUCE_SUM:
+        if (op->type >= FIELD_FLOAT)
+            return (field_scalar) {.d = 0.0};
+        /* fall through */
+    default:
+        return (field_scalar) {.i = 0};
+    }
+}
+
+/* Folds a partial result into acc */
+static void
+reduce_combine(const field_reduce_op *op, field_scalar *acc,
+               field_scalar partial)
+{
+    int real = op->type >= FIELD_FLOAT;
+
+    switch (op->code) {
+    case FIELD_REDUCE_SUM:
+        if (real)
+            acc->d += partial.d;
+        else
+            acc->i = (int64_t) ((uint64_t) acc->i + (uint64_t) partial.i);
+        break;
+    case FIELD_REDUCE_MIN:
+        if (real ? partial.d < acc->d : partial.i < acc->i)
+            *acc = partial;
+        break;
+    case FIELD_REDUCE_MAX:
+        if (real ? partial.d > acc->d : partial.i > acc->i)
+            *acc = partial;
+        break;
+    default:
+        acc->i += partial.i;
+        break;
+    }
+}
+
+struct field_reduce_args {
+    pool_struct             pool;
+    size_t                  field_no;
+    field_descriptor        field;
+    size_t                  size;
+    size_t                  run;
+    size_t                  chunk_length;
+    const field_reduce_op   *op;
+    reduce_kernel           kernel;
+    field_scalar            *partials;
+    int                     failed;
+};
+
+/*
+ * Reduces n elements of a field array with the given stride, gathering them
+ * into a buffer first if they are not contiguous.
+ */
+static void
+reduce_strided(const struct field_reduce_args *args, const char *a, size_t n,
+               field_scalar *acc, uint64_t *histogram)
+{
+    size_t size = args->field.size;
+    field_scalar partial;
+
+    if (SCALE_BY_FIELD_STRIDE(args->field, 1) == size) {
+        args->kernel(a, n, args->op, &partial, histogram);
+        reduce_combine(args->op, acc, partial);
+        return;
+    }
+
+    uint64_t buffer[REDUCE_BUFFER_LENGTH];
+    for (size_t i = 0 ; i < n ; i += REDUCE_BUFFER_LENGTH) {
+        size_t batch = n - i < REDUCE_BUFFER_LENGTH ? n - i :
+                                                      REDUCE_BUFFER_LENGTH;
+        for (size_t j = 0 ; j < batch ; ++j)
+            memcpy((char*) buffer + j*size,
+                   a + SCALE_BY_FIELD_STRIDE(args->field, i + j), size);
+        args->kernel(buffer, batch, args->op, &partial, histogram);
+        reduce_combine(args->op, acc, partial);
+    }
+}
+
+/* Reduces chunk number chunk, one subpool run at a time, into its partial */
+static void
+field_reduce_chunk(void *arg, size_t chunk)
+{
+    struct field_reduce_args *args = arg;
+
+    /* Each chunk counts into a histogram of its own, added in at the end */
+    uint64_t *histogram = NULL;
+    if (FIELD_REDUCE_HISTOGRAM == args->op->code) {
+        histogram = calloc(args->op->bins, sizeof(uint64_t));
+        if (NULL == histogram) {
+            args->partials[chunk] = reduce_identity(args->op);
+            __atomic_store_n(&args->failed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    field_scalar acc = reduce_identity(args->op);
+    size_t start = chunk*args->chunk_length;
+    size_t end = args->size - start < args->chunk_length ?
+                 args->size : start + args->chunk_length;
+
+    for (size_t i = start ; i < end ; i += args->run) {
+        size_t n = end - i < args->run ? end - i : args->run;
+        const char *a = (const char*)
+            GET_FIELD_ADDR_OF_LARGE_INDEX(args->pool, i, args->field_no);
+        reduce_strided(args, a, n, &acc, histogram);
+    }
+
+    args->partials[chunk] = acc;
+
+    if (histogram) {
+        for (size_t b = 0 ; b < args->op->bins ; ++b) {
+            if (histogram[b])
+                __atomic_fetch_add(&args->op->histogram[b], histogram[b],
+                                   __ATOMIC_RELAXED);
+        }
+        free(histogram);
+    }
+}
+
+int
+field_reduce(const pool_reference A,
+             size_t field_no,
+             const field_reduce_op *op,
+             field_scalar *result)
+{
+    struct field_reduce_args args = {.pool = {.raw_val = A},
+                                     .field_no = field_no,
+                                     .op = op};
+
+    if (field_no >= GET_TYPE_DESCRIPTOR(args.pool)->field_count)
+        return 1;
+
+    args.field = GET_TYPE_DESCRIPTOR(args.pool)->fields[field_no];
+    if (reduce_op_check(op, args.field.size) != 0)
+        return 1;
+
+    args.kernel = reduce_kernels[op->type][op->code];
+    args.size = GET_SIZE_OF_LARGE_POOL(args.pool);
+    args.run = (size_t) 1 << GET_SUB_POOL_SHIFT(args.pool);
+    args.chunk_length = args.run > REDUCE_CHUNK_LENGTH ? args.run :
+                                                         REDUCE_CHUNK_LENGTH;
+
+    size_t chunks = (args.size + args.chunk_length - 1) / args.chunk_length;
+    args.partials = malloc((chunks > 0 ? chunks : 1)*sizeof(field_scalar));
+    if (NULL == args.partials)
+        return 1;
+
+    if (FIELD_REDUCE_HISTOGRAM == op->code)
+        memset(op->histogram, 0, op->bins*sizeof(uint64_t));
+
+    map_parallel_for(chunks, field_reduce_chunk, &args);
+
+    /* In the order of the pool, whatever thread did which chunk */
+    *result = reduce_identity(op);
+    for (size_t c = 0 ; c < chunks ; ++c)
+        reduce_combine(op, result, args.partials[c]);
+
+    free(args.partials);
+    return args.failed;
+}
+
+/* Runs of this many elements are filtered by one thread at a time */
+#define FILTER_CHUNK_LENGTH ((size_t) 1 << 16)
+
+/* Elements that are not in contiguous runs of 64 are tested in batches */
+#define FILTER_BUFFER_LENGTH 256
+
+struct field_filter_args {
+    pool_struct             src_pool;
+    pool_struct             dst_pool;
+    size_t                  field_no;
+    field_descriptor        field;
+    size_t                  size;
+    size_t                  run;
+    size_t                  chunk_length;
+    const field_op          *predicate;
+    select_kernel           kernel;
+    uint64_t                *selection;
+    size_t                  *counts;    /* Selected per chunk, then before it */
+    size_t                  dst_start;  /* Size of B before the filter */
+};
+
+/* Tests chunk number chunk, and writes its part of the selection */
+static void
+field_filter_chunk(void *arg, size_t chunk)
+{
+    const struct field_filter_args *args = arg;
+
+    size_t start = chunk*args->chunk_length;
+    size_t end = args->size - start < args->chunk_length ?
+                 args->size : start + args->chunk_length;
+    size_t count = 0;
+
+    /* Subpool runs of a multiple of 64 elements fill whole words */
+    if (SCALE_BY_FIELD_STRIDE(args->field, 1) == args->field.size &&
+        0 == args->run % 64) {
+        for (size_t i = start ; i < end ; i += args->run) {
+            size_t n = end - i < args->run ? end - i : args->run;
+            const char *a = (const char*)
+                GET_FIELD_ADDR_OF_LARGE_INDEX(args->src_pool, i,
+                                              args->field_no);
+            count += args->kernel(a, n, args->predicate,
+                                  args->selection + i/64);
+        }
+    } else {
+        uint64_t buffer[FILTER_BUFFER_LENGTH];
+        size_t size = args->field.size;
+        for (size_t i = start ; i < end ; i += FILTER_BUFFER_LENGTH) {
+            size_t n = end - i < FILTER_BUFFER_LENGTH ? end - i :
+                                                        FILTER_BUFFER_LENGTH;
+            for (size_t j = 0 ; j < n ; ++j)
+                memcpy((char*) buffer + j*size,
+                       (void*) GET_FIELD_ADDR_OF_LARGE_INDEX(args->src_pool,
+                                                             i + j,
+                                                             args->field_no),
+                       size);
+            count += args->kernel(buffer, n, args->predicate,
+                                  args->selection + i/64);
+        }
+    }
+
+    args->counts[chunk] = count;
+}
+
+/* Copies every field of the selected elements of chunk number chunk to B */
+static void
+field_filter_copy_chunk(void *arg, size_t chunk)
+{
+    const struct field_filter_args *args = arg;
+    const type_descriptor *desc = GET_TYPE_DESCRIPTOR(args->src_pool);
+
+    size_t start = chunk*args->chunk_length;
+    size_t end = args->size - start < args->chunk_length ?
+                 args->size : start + args->chunk_length;
+
+    for (size_t f = 0 ; f < desc->field_count ; ++f) {
+        size_t size = desc->fields[f].size;
+        size_t j = args->dst_start + args->counts[chunk];
+
+        for (size_t w = start/64 ; w*64 < end ; ++w) {
+            for (uint64_t word = args->selection[w] ;
+                 word != 0 ;
+                 word &= word - 1) {
+                size_t i = w*64 + __builtin_ctzll(word);
+                memcpy((void*) GET_FIELD_ADDR_OF_LARGE_INDEX(args->dst_pool,
+                                                             j, f),
+                       (void*) GET_FIELD_ADDR_OF_LARGE_INDEX(args->src_pool,
+                                                             i, f),
+                       size);
+                ++j;
+            }
+        }
+    }
+}
+
+int
+field_filter(const pool_reference A,
+             size_t field_no,
+             const field_op *predicate,
+             uint64_t *selection,
+             pool_reference *B,
+             size_t *selected)
+{
+    struct field_filter_args args = {.src_pool = {.raw_val = A},
+                                     .field_no = field_no,
+                                     .predicate = predicate,
+                                     .selection = selection};
+
+    if (field_no >= GET_TYPE_DESCRIPTOR(args.src_pool)->field_count)
+        return 1;
+
+    args.field = GET_TYPE_DESCRIPTOR(args.src_pool)->fields[field_no];
+    if (predicate->code < FIELD_OP_LT || predicate->code > FIELD_OP_IN_RANGE ||
+        predicate->src_type >= FIELD_ELEM_TYPE_COUNT ||
+        args.field.size != field_elem_sizes[predicate->src_type])
+        return 1;
+
+    if (NULL != B) {
+        args.dst_pool.raw_val = *B;
+        if (args.dst_pool.type_id != args.src_pool.type_id ||
+            GET_LOCAL_REF_COUNT(args.src_pool) > 0)
+            return 1;
+        args.dst_start = GET_SIZE_OF_LARGE_POOL(args.dst_pool);
+    }
+
+    args.kernel = select_kernels[predicate->src_type][predicate->code];
+    args.size = GET_SIZE_OF_LARGE_POOL(args.src_pool);
+    args.run = (size_t) 1 << GET_SUB_POOL_SHIFT(args.src_pool);
+    args.chunk_length = args.run > FILTER_CHUNK_LENGTH ? args.run :
+                                                         FILTER_CHUNK_LENGTH;
+
+    size_t chunks = (args.size + args.chunk_length - 1) / args.chunk_length;
+    size_t words = (args.size + 63) / 64;
+    args.counts = malloc((chunks > 0 ? chunks : 1)*sizeof(size_t));
+    if (NULL == args.selection)
+        args.selection = malloc((words > 0 ? words : 1)*sizeof(uint64_t));
+    if (NULL == args.counts || NULL == args.selection) {
+        free(args.counts);
+        if (args.selection != selection)
+            free(args.selection);
+        return 1;
+    }
+
+    map_parallel_for(chunks, field_filter_chunk, &args);
+
+    /* Where the selection of each chunk goes in B */
+    size_t total = 0;
+    for (size_t c = 0 ; c < chunks ; ++c) {
+        size_t count = args.counts[c];
+        args.counts[c] = total;
+        total += count;
+    }
+
+    int ret = 0;
+    if (NULL != B && 0 != total) {
+        if (pool_grow(B, total) != 0) {
+            ret = 1;
+        } else {
+            args.dst_pool.raw_val = *B;
+            map_parallel_for(chunks, field_filter_copy_chunk, &args);
+        }
+    }
+
+    if (NULL != selected)
+        *selected = total;
+
+    free(args.counts);
+    if (args.selection != selection)
+        free(args.selection);
+    return ret;
+}
+
+/* The index of the node after the one at idx in a list, or REF_END */
+static size_t
+list_next_index(reference_struct src_ref, size_t idx)
+{
+    uint16_t *next_loc_ref =
+        (uint16_t*) GET_FIELD_ADDR_OF_LARGE_INDEX(src_ref, idx, 0);
+
+    local_reference_struct next = {.raw_val = *next_loc_ref};
+
+    if (next.is_long_ref) {
+        size_t index_in_window = GET_INDEX_IN_WINDOW(src_ref, idx);
+        reference_struct node = src_ref;
+        node.pool_id = GET_WINDOW_OF_INDEX(src_ref, idx);
+        node.sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(index_in_window);
+        node.index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(index_in_window);
+
+        reference_tag t = {.raw_val = node.raw_val};
+        t.local_ref = next.raw_val;
+        return expand_local_reference(t);
+    } else if (next.index == 0) {
+        return REF_END;
+    } else {
+        return idx + next.index;
+    }
+}
+
+/*
+ * A link is a short local reference to the next element of the pool when its
+ * index is 1 and it is not long, whatever its GC bits, which is how move_list
+ * lays lists out after a collection.
+ */
+#define LIST_LINK_MASK      0x3fff
+#define LIST_ONE_STEP       1
+
+/* Links are compared this many at a time, without branches */
+#define LIST_RUN_BLOCK      32
+
+/*
+ * The number of nodes, from the one at idx on, that follow each other in the
+ * pool and in the list. All of them but the last link to the next element.
+ * Runs end at the end of the subpool of idx, where the field arrays do, and
+ * run is the length of a subpool.
+ */
+static size_t
+list_run_length(reference_struct src_ref, field_descriptor link_field,
+                size_t run, size_t idx)
+{
+    size_t n = ((idx | (run - 1)) + 1) - idx;
+    const char *links =
+        (const char*) GET_FIELD_ADDR_OF_LARGE_INDEX(src_ref, idx, 0);
+    size_t j = 0;
+
+    if (SCALE_BY_FIELD_STRIDE(link_field, 1) == sizeof(uint16_t)) {
+        const uint16_t *l = (const uint16_t*) links;
+        for ( ; j + LIST_RUN_BLOCK <= n ; j += LIST_RUN_BLOCK) {
+            uint16_t miss = 0;
+            for (size_t k = 0 ; k < LIST_RUN_BLOCK ; ++k)
+                miss |= (l[j + k] & LIST_LINK_MASK) ^ LIST_ONE_STEP;
+            if (miss != 0)
+                break;
+        }
+        for ( ; j < n ; ++j) {
+            if ((l[j] & LIST_LINK_MASK) != LIST_ONE_STEP)
+                return j + 1;
+        }
+    } else {
+        for ( ; j < n ; ++j) {
+            uint16_t l = *(const uint16_t*) (links +
+                                             SCALE_BY_FIELD_STRIDE(link_field, j));
+            if ((l & LIST_LINK_MASK) != LIST_ONE_STEP)
+                return j + 1;
+        }
+    }
+
+    return n;
+}
+
+/* Grows B by n elements and returns the index of the first, or REF_END */
+static size_t
+list_map_grow(pool_reference *B, size_t n)
+{
+    pool_struct dst_pool = {.raw_val = *B};
+    size_t start = GET_SIZE_OF_LARGE_POOL(dst_pool);
+    return pool_grow(B, n) == 0 ? start : REF_END;
+}
+
+int
+field_list_reduce(const global_reference A,
+                  size_t field_no,
+                  const field_reduce_op *op,
+                  field_scalar *result)
+{
+    reference_struct src_ref = {.raw_val = A};
+
+    size_t size = GET_FIELD_SIZE(src_ref, field_no);
+    if (reduce_op_check(op, size) != 0)
+        return 1;
+
+    reduce_kernel kernel = reduce_kernels[op->type][op->code];
+    if (FIELD_REDUCE_HISTOGRAM == op->code)
+        memset(op->histogram, 0, op->bins*sizeof(uint64_t));
+
+    const type_descriptor *type = GET_TYPE_DESCRIPTOR(src_ref);
+    const field_descriptor field = type->fields[field_no];
+    int contiguous = SCALE_BY_FIELD_STRIDE(field, 1) == size;
+    size_t run = (size_t) 1 << type->sub_pool_shift;
+
+    uint64_t buffer[REDUCE_BUFFER_LENGTH];
+    size_t batch = 0;
+    field_scalar partial;
+
+    /*
+     * Long runs of nodes that follow each other in the pool are reduced
+     * where they are, the rest is gathered. Partial results are combined in
+     * the order of the list either way.
+     */
+    *result = reduce_identity(op);
+    size_t idx = GET_LARGE_INDEX_OF_REF(src_ref);
+    while (idx != REF_END) {
+        size_t n = list_run_length(src_ref, type->fields[0], run, idx);
+        const char *a =
+            (const char*) GET_FIELD_ADDR_OF_LARGE_INDEX(src_ref, idx, field_no);
+
+        if (contiguous && n >= REDUCE_BUFFER_LENGTH) {
+            if (batch > 0) {
+                kernel(buffer, batch, op, &partial, op->histogram);
+                reduce_combine(op, result, partial);
+                batch = 0;
+            }
+            kernel(a, n, op, &partial, op->histogram);
+            reduce_combine(op, result, partial);
+        } else {
+            for (size_t j = 0 ; j < n ; ++j) {
+                memcpy((char*) buffer + batch*size,
+                       a + SCALE_BY_FIELD_STRIDE(field, j), size);
+
+                if (++batch == REDUCE_BUFFER_LENGTH) {
+                    kernel(buffer, batch, op, &partial, op->histogram);
+                    reduce_combine(op, result, partial);
+                    batch = 0;
+                }
+            }
+        }
+
+        idx = list_next_index(src_ref, idx + n - 1);
+    }
+
+    if (batch > 0) {
+        kernel(buffer, batch, op, &partial, op->histogram);
+        reduce_combine(op, result, partial);
     }
 
     return 0;
@@ -72,50 +1496,295 @@ field_list_map(const global_reference A,
     reference_struct src_ref = {.raw_val = A};
     pool_struct dst_pool = {.raw_val = *B};
 
-    size_t sub_pool_size = GET_SUB_POOL_SIZE(src_ref);
-    size_t field_size = GET_FIELD_SIZE(src_ref, field_no);
-    size_t field_offset = GET_FIELD_OFFSET(src_ref, field_no);
-    size_t target_field_size = GET_FIELD_SIZE(dst_pool, 0);
+    const type_descriptor *type = GET_TYPE_DESCRIPTOR(src_ref);
+    const field_descriptor src_field = type->fields[field_no];
+    const field_descriptor dst_field = GET_TYPE_DESCRIPTOR(dst_pool)->fields[0];
+    size_t run = (size_t) 1 << type->sub_pool_shift;
+    size_t dst_run = (size_t) 1 << GET_SUB_POOL_SHIFT(dst_pool);
 
-    uintptr_t a_pool_start = GET_POOL_ADDR(src_ref);
-    uintptr_t a_field_start = a_pool_start + field_offset;
-    char *b = (char *) GET_POOL_ADDR(dst_pool);
+    /*
+     * Runs of nodes that follow each other in the pool, as they do after a
+     * collection, are mapped as slices of the field arrays, with their links
+     * compared a block at a time. A run is split where B starts a subpool.
+     */
+    size_t idx = GET_LARGE_INDEX_OF_REF(src_ref);
+    while (idx != REF_END) {
+        size_t n = list_run_length(src_ref, type->fields[0], run, idx);
+        size_t start = list_map_grow(B, n);
+        if (REF_END == start)
+            return 1;
+        dst_pool.raw_val = *B;
 
-	size_t idx = GET_GLOBAL_INDEX_OF_REF(src_ref);
+        for (size_t j = 0 ; j < n ; ) {
+            size_t d = start + j;
+            size_t m = dst_run - (d & (dst_run - 1));
+            m = m < n - j ? m : n - j;
+            char *a = (char*) GET_FIELD_ADDR_OF_LARGE_INDEX(src_ref, idx + j,
+                                                            field_no);
+            char *b = (char*) GET_FIELD_ADDR_OF_LARGE_INDEX(dst_pool, d, 0);
+            for (size_t k = 0 ; k < m ; ++k)
+                f(a + SCALE_BY_FIELD_STRIDE(src_field, k),
+                  b + SCALE_BY_FIELD_STRIDE(dst_field, k));
+            j += m;
+        }
 
+        idx = list_next_index(src_ref, idx + n - 1);
+    }
+
+    return 0;
+}
+
+int
+field_list_op_map(const global_reference A,
+                  pool_reference *B,
+                  size_t field_no,
+                  const field_op *op)
+{
+    reference_struct src_ref = {.raw_val = A};
+    pool_struct dst_pool = {.raw_val = *B};
+
+    if (op->code >= FIELD_OP_COUNT ||
+        op->src_type >= FIELD_ELEM_TYPE_COUNT ||
+        op->dst_type >= FIELD_ELEM_TYPE_COUNT)
+        return 1;
+    if (op->code != FIELD_OP_CONVERT && op->src_type != op->dst_type)
+        return 1;
+
+    const type_descriptor *type = GET_TYPE_DESCRIPTOR(src_ref);
+    const field_descriptor src_field = type->fields[field_no];
+    const field_descriptor dst_field = GET_TYPE_DESCRIPTOR(dst_pool)->fields[0];
+    if (src_field.size != field_elem_sizes[op->src_type] ||
+        dst_field.size != field_elem_sizes[op->dst_type])
+        return 1;
+
+    field_kernel kernel = op->code == FIELD_OP_CONVERT ?
+        convert_kernels[op->src_type][op->dst_type] :
+        field_kernels[op->src_type][op->code];
+
+    int contiguous = SCALE_BY_FIELD_STRIDE(src_field, 1) == src_field.size &&
+                     SCALE_BY_FIELD_STRIDE(dst_field, 1) == dst_field.size;
+    size_t run = (size_t) 1 << type->sub_pool_shift;
+    size_t dst_run = (size_t) 1 << GET_SUB_POOL_SHIFT(dst_pool);
+
+    /* Runs are found and split as in field_list_map */
+    size_t idx = GET_LARGE_INDEX_OF_REF(src_ref);
     while (idx != REF_END) {
-        if (NULL_REF == pool_alloc(B))
+        size_t n = list_run_length(src_ref, type->fields[0], run, idx);
+        size_t start = list_map_grow(B, n);
+        if (REF_END == start)
             return 1;
+        dst_pool.raw_val = *B;
+
+        for (size_t j = 0 ; j < n ; ) {
+            size_t d = start + j;
+            size_t m = dst_run - (d & (dst_run - 1));
+            m = m < n - j ? m : n - j;
+            const char *a = (const char*)
+                GET_FIELD_ADDR_OF_LARGE_INDEX(src_ref, idx + j, field_no);
+            char *b = (char*) GET_FIELD_ADDR_OF_LARGE_INDEX(dst_pool, d, 0);
+            if (contiguous) {
+                kernel(a, b, m, op);
+            } else {
+                for (size_t k = 0 ; k < m ; ++k)
+                    kernel(a + SCALE_BY_FIELD_STRIDE(src_field, k),
+                           b + SCALE_BY_FIELD_STRIDE(dst_field, k), 1, op);
+            }
+            j += m;
+        }
+
+        idx = list_next_index(src_ref, idx + n - 1);
+    }
 
-        void *a = (void*) ( a_field_start +  
-                  sub_pool_size*GLOBAL_INDEX_TO_SUBPOOL_ID(idx) +
-                  field_size*GLOBAL_INDEX_TO_SUBPOOL_OFFSET(idx) );
+    return 0;
+}
 
-        f(a, b);
-                  
+/*
+ * Parallel list ranking, with a sparse ruling set. Rulers are the head and
+ * every stride-th element of the pool, whatever list it is on. Each ruler
+ * claims nodes along the list from its element until it meets a node that is
+ * already claimed or the end, and the claims make the segments. A serial pass
+ * over the segments, from the one that holds the head, then gives each the
+ * position in the list where it is entered, and the segments are mapped in
+ * parallel. Elements that are not on the list form segments, or the first
+ * parts of segments, that the list never enters.
+ */
+#define RANK_STRIDE         512
+#define RANK_SEGMENTS_PER_CHUNK 64
 
-        uint16_t *next_loc_ref = 
-            ((uint16_t*) (a_pool_start +
-            sub_pool_size*GLOBAL_INDEX_TO_SUBPOOL_ID(idx) )) +
-            GLOBAL_INDEX_TO_SUBPOOL_OFFSET(idx);
+/* A claim is the segment number plus one over the offset in the segment */
+#define RANK_OFFSET_BITS    40
+#define RANK_MAX_SEGMENTS   (((size_t) 1 << (64 - RANK_OFFSET_BITS)) - 1)
+#define RANK_CLAIM(segment, offset) \
+    ((((uint64_t) (segment) + 1) << RANK_OFFSET_BITS) | (offset))
+#define RANK_CLAIM_SEGMENT(claim)   (((claim) >> RANK_OFFSET_BITS) - 1)
+#define RANK_CLAIM_OFFSET(claim) \
+    ((claim) & (((uint64_t) 1 << RANK_OFFSET_BITS) - 1))
 
-        local_reference_struct next = {.raw_val = *next_loc_ref};
+struct rank_segment {
+    size_t              start;      /* The element of the ruler */
+    size_t              length;     /* Nodes claimed */
+    uint64_t            next;       /* Claim of the node after, or 0 at end */
+    size_t              entry;      /* Offset the list enters at, or REF_END */
+    size_t              position;   /* In the list, of the node at entry */
+};
 
-        if (next.is_long_ref) {
-            reference_tag t = {.raw_val = A};
-            t.sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(idx);
-            t.index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(idx);
-            t.local_ref = next.raw_val;
-            idx = expand_local_reference(t);
-        } else if (next.index == 0) {
-            idx = REF_END;
-        } else {
-            idx += next.index;
+struct list_rank_args {
+    reference_struct    src_ref;
+    pool_struct         dst_pool;
+    size_t              field_no;
+    size_t              dst_start;
+    map_function_type   f;
+    size_t              pool_size;
+    uint64_t            *claims;    /* One per element of the pool */
+    struct rank_segment *segments;
+    size_t              segment_count;
+};
+
+/* Claims the nodes of segments from chunk on, as far as they go */
+static void
+list_rank_claim_chunk(void *arg, size_t chunk)
+{
+    struct list_rank_args *args = arg;
+
+    size_t last = (chunk + 1)*RANK_SEGMENTS_PER_CHUNK;
+    last = last < args->segment_count ? last : args->segment_count;
+    for (size_t s = chunk*RANK_SEGMENTS_PER_CHUNK ; s < last ; ++s) {
+        struct rank_segment *segment = &args->segments[s];
+        size_t idx = segment->start;
+        uint64_t seen = 0;
+
+        segment->length = 0;
+        segment->next = 0;
+        segment->entry = REF_END;
+        if (!__atomic_compare_exchange_n(&args->claims[idx], &seen,
+                                         RANK_CLAIM(s, 0), 0,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            continue;
+
+        for (size_t offset = 1 ; ; ++offset) {
+            idx = list_next_index(args->src_ref, idx);
+            seen = 0;
+            if (REF_END == idx || idx >= args->pool_size ||
+                !__atomic_compare_exchange_n(&args->claims[idx], &seen,
+                                             RANK_CLAIM(s, offset), 0,
+                                             __ATOMIC_RELAXED,
+                                             __ATOMIC_RELAXED)) {
+                segment->length = offset;
+                segment->next = seen;
+                break;
+            }
         }
+    }
+}
 
+/* Maps the nodes of the segments from chunk on that the list enters */
+static void
+list_rank_map_chunk(void *arg, size_t chunk)
+{
+    const struct list_rank_args *args = arg;
 
-        b += target_field_size;
+    size_t last = (chunk + 1)*RANK_SEGMENTS_PER_CHUNK;
+    last = last < args->segment_count ? last : args->segment_count;
+    for (size_t s = chunk*RANK_SEGMENTS_PER_CHUNK ; s < last ; ++s) {
+        const struct rank_segment *segment = &args->segments[s];
+        if (REF_END == segment->entry)
+            continue;
+
+        size_t idx = segment->start;
+        for (size_t offset = 0 ; offset < segment->length ; ++offset) {
+            if (offset >= segment->entry) {
+                size_t d = args->dst_start + segment->position +
+                           (offset - segment->entry);
+                args->f((void*) GET_FIELD_ADDR_OF_LARGE_INDEX(args->src_ref,
+                                                             idx,
+                                                             args->field_no),
+                        (void*) GET_FIELD_ADDR_OF_LARGE_INDEX(args->dst_pool,
+                                                             d, 0));
+            }
+            if (offset + 1 < segment->length)
+                idx = list_next_index(args->src_ref, idx);
+        }
     }
-    
-    return 0;
+}
+
+/*
+ * Follows the list through the segments from the one that holds the head,
+ * and sets where each is entered. Returns the length of the list, or REF_END
+ * if the list runs into a segment twice, which only a cycle can do.
+ */
+static size_t
+list_rank_segments(struct list_rank_args *args, size_t head)
+{
+    size_t position = 0;
+    uint64_t claim = args->claims[head];
+
+    while (0 != claim) {
+        struct rank_segment *segment =
+            &args->segments[RANK_CLAIM_SEGMENT(claim)];
+        if (REF_END != segment->entry)
+            return REF_END;
+
+        segment->entry = RANK_CLAIM_OFFSET(claim);
+        segment->position = position;
+        position += segment->length - segment->entry;
+        claim = segment->next;
+    }
+
+    return position;
+}
+
+int
+field_list_map_parallel(const pool_reference P,
+                        const global_reference A,
+                        pool_reference *B,
+                        size_t field_no,
+                        map_function_type f)
+{
+    struct list_rank_args args = {.src_ref.raw_val = A,
+                                  .dst_pool.raw_val = *B,
+                                  .field_no = field_no,
+                                  .f = f};
+
+    pool_struct src_pool = {.raw_val = P};
+    size_t pool_size = GET_SIZE_OF_LARGE_POOL(src_pool);
+    size_t head = GET_LARGE_INDEX_OF_REF(args.src_ref);
+    if (src_pool.type_id != args.src_ref.type_id || head >= pool_size)
+        return 1;
+
+    args.pool_size = pool_size;
+    size_t stride = RANK_STRIDE;
+    while (pool_size / stride + 1 > RANK_MAX_SEGMENTS)
+        stride *= 2;
+
+    args.segment_count = (pool_size + stride - 1) / stride + 1;
+    args.claims = calloc(pool_size, sizeof(uint64_t));
+    args.segments = malloc(args.segment_count*sizeof(struct rank_segment));
+    int ret = 1;
+    if (NULL == args.claims || NULL == args.segments)
+        goto out;
+
+    args.segments[0].start = head;
+    for (size_t s = 1 ; s < args.segment_count ; ++s)
+        args.segments[s].start = (s - 1)*stride;
+
+    size_t chunks = (args.segment_count + RANK_SEGMENTS_PER_CHUNK - 1) /
+                    RANK_SEGMENTS_PER_CHUNK;
+    map_parallel_for(chunks, list_rank_claim_chunk, &args);
+
+    size_t length = list_rank_segments(&args, head);
+    if (REF_END == length)
+        goto out;
+
+    args.dst_start = GET_SIZE_OF_LARGE_POOL(args.dst_pool);
+    if (pool_grow(B, length) != 0)
+        goto out;
+    args.dst_pool.raw_val = *B;
+
+    map_parallel_for(chunks, list_rank_map_chunk, &args);
+    ret = 0;
+
+out:
+    free(args.claims);
+    free(args.segments);
+    return ret;
 }
@@ -158,6 +158,11 @@ delete_all_for_pool(pool_reference pool)
 
     if (0 == pool_id)
         return 1;
+
+    /* Every pool that is destroyed ends up here, most hold no long references */
+    if (0 == hash_table_value_count)
+        return 0;
+
     /* 
      * The fact that a hash table is used makes calling this function quite
      * expensive. If this becomes a problem it might be worthwhile adding a
@@ -0,0 +1,414 @@
+/**
+ * @brief Generates a header of specialized accessors and loops for each type.
+ *
+ * pool.h and pool_map.h recommend custom functions following the field_map
+ * pattern over the generic accessors. This tool writes them: it registers the
+ * types of the program, exactly as the program itself does, and then emits a
+ * header per requested type from the resulting type table. Every offset, size
+ * and shift is a constant in the generated code, so its loops do no type table
+ * lookups and call through no function pointers.
+ *
+ * Usage: type_gen <output directory> <name>=<type id name> ...
+ *
+ * Types are named by their TYPE_ID constant in basic_types.h, such as
+ * LIST_TYPE_ID, so the headers follow the enum when it is renumbered. For each
+ * name, <output directory>/<name>_pool.h is written, which contains
+ *  - NAME_POOL_TYPE, NAME_POOL_FIELD_<k>_OFFSET, NAME_POOL_FIELD_<k>_SIZE,
+ *    NAME_POOL_FIELD_<k>_STRIDE and friends,
+ *  - name_check(), that tells whether the header matches the type table,
+ *  - name_field_<k>(), name_get_<k>() and name_set_<k>() for every field,
+ *    where local reference fields are read and written as global references,
+ *  - NAME_POOL_MAP_<k>(pool, idx, x, ...), which runs its body for every
+ *    object of a pool, with idx set to its index and x pointing to field k,
+ *  - NAME_POOL_WALK_<k>(head, node, ...), which runs its body for every node
+ *    of a list linked through local reference field k.
+ *
+ * Types are registered with add_basic_types(). A program with other types
+ * links its own definition of it in place of basic_types.o.
+ *
+ * @file type_gen.c
+ * @author Martin Hagelin
+ * @date March, 2015
+ */
+
+#include <stdio.h>
+#include <ctype.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pool.h"
+#include "basic_types.h"
+#include "type_info.h"
+#include "field_info.h"
+#include "pool_private.h"
+#include "pool_inline.h"
+
+/* Defined in pool.c */
+extern Type_table type_table;
+
+/* The number of types known to the type table */
+static size_t type_count;
+
+/* The constants of basic_types.h, by name */
+#define TYPE_NAME(id) { #id, id },
+
+static const struct type_name {
+    const char *name;
+    TYPE_ID     type_id;
+} type_names[] = {
+    BASIC_TYPES(TYPE_NAME)
+};
+
+static int
+find_type_id(const char *type_name, unsigned *type_id);
+
+static int
+print_usage(const char *program_name);
+
+static int
+emit_header(FILE *out, const char *name, uint16_t type_id);
+
+static const char*
+field_c_type(uint16_t type_id, size_t field_nr);
+
+int
+main(int argc, char *argv[])
+{
+    if (argc < 3)
+        return print_usage(argv[0]);
+
+    if (0 != add_basic_types()) {
+        fprintf(stderr, "%s: could not register the types\n", argv[0]);
+        return 1;
+    }
+
+    /* Registered types all have a primitive or composite type class */
+    while (type_count < UINT16_MAX &&
+           NULL != get_type_descriptor(type_count))
+        ++type_count;
+
+    for (int i = 2 ; i < argc ; ++i) {
+        char name[64];
+        char type_name[64];
+        unsigned type_id;
+
+        if (2 != sscanf(argv[i], "%63[a-z0-9_]=%63[A-Z0-9_]", name, type_name))
+            return print_usage(argv[0]);
+
+        if (0 != find_type_id(type_name, &type_id) || type_id >= type_count) {
+            fprintf(stderr, "%s: there is no type %s\n", argv[0], type_name);
+            return 1;
+        }
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s_pool.h", argv[1], name);
+        FILE *out = fopen(path, "w");
+        if (NULL == out) {
+            fprintf(stderr, "%s: %s: %s\n", argv[0], path, strerror(errno));
+            return 1;
+        }
+
+        int err = emit_header(out, name, type_id);
+        if (0 != fclose(out) || 0 != err) {
+            fprintf(stderr, "%s: failed to write %s\n", argv[0], path);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int
+print_usage(const char *program_name)
+{
+    fprintf(stderr, "USAGE: %s <output directory> <name>=<type id name> ...\n",
+            program_name);
+    return 1;
+}
+
+static int
+find_type_id(const char *type_name, unsigned *type_id)
+{
+    for (size_t i = 0 ; i < sizeof(type_names) / sizeof(type_names[0]) ; ++i) {
+        if (0 == strcmp(type_names[i].name, type_name)) {
+            *type_id = type_names[i].type_id;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* The type of a pointer to a field, opaque fields are reached as bytes */
+static const char*
+field_c_type(uint16_t type_id, size_t field_nr)
+{
+    const struct field_offset *field = &type_table[type_id].field_offsets[field_nr];
+
+    switch (type_table[field->type_id].type_class) {
+        case LOCAL_REF_TYPE:
+            return "uint16_t";
+        case GLOBAL_REF_TYPE:
+            return "global_reference";
+        default:
+            break;
+    }
+
+    switch (field->field_size) {
+        case 1: return "uint8_t";
+        case 2: return "uint16_t";
+        case 4: return "uint32_t";
+        case 8: return "uint64_t";
+        default: return "char";
+    }
+}
+
+static int
+emit_header(FILE *out, const char *name, uint16_t type_id)
+{
+    const struct type_offsets *type = &type_table[type_id];
+    const type_descriptor *desc = get_type_descriptor(type_id);
+
+    /* Macros are prefixed with NAME_POOL, to stay clear of the type ids */
+    char upper[80];
+    size_t len = strlen(name);
+    for (size_t i = 0 ; i < len ; ++i)
+        upper[i] = toupper((unsigned char) name[i]);
+    strcpy(&upper[len], "_POOL");
+
+    fprintf(out,
+        "/**\n"
+        " * @brief Accessors and loops for objects of type %u.\n"
+        " *\n"
+        " * Generated by type_gen from the type table, do not edit. Regenerate\n"
+        " * the header whenever a type changes, %s_check() tells if it is stale.\n"
+        " *\n"
+        " * @file %s_pool.h\n"
+        " */\n"
+        "\n"
+        "#ifndef __%s_H__\n"
+        "#define __%s_H__\n"
+        "\n"
+        "#include <stdint.h>\n"
+        "#include <string.h>\n"
+        "\n"
+        "#include \"pool.h\"\n"
+        "#include \"type_info.h\"\n"
+        "#include \"pool_private.h\"\n"
+        "\n"
+        "extern struct pool_meta pool_meta_table[];\n"
+        "\n",
+        type_id, name, name, upper, upper);
+
+    fprintf(out,
+        "#define %s_TYPE %u\n"
+        "#define %s_FINGERPRINT 0x%016llxllu\n"
+        "#define %s_SUB_POOL_SHIFT %u\n"
+        "#define %s_SUB_POOL_LENGTH ((size_t) 1 << %s_SUB_POOL_SHIFT)\n"
+        "#define %s_SUB_POOL_SIZE (((size_t) %zu << %s_SUB_POOL_SHIFT) + %zu)\n"
+        "#define %s_POOL_COLOR_MASK %u\n"
+        "#define %s_FIELD_COUNT %zu\n",
+        upper, type_id,
+        upper, (unsigned long long) type_table_fingerprint(),
+        upper, type->sub_pool_shift,
+        upper, upper,
+        upper, type->type_size, upper,
+        desc->sub_pool_size - (type->type_size << type->sub_pool_shift),
+        upper, desc->pool_color_mask,
+        upper, type->field_count);
+
+    /*
+     * The array of a field, or of its interleaved group, is scaled by the
+     * subpool shift. The offset into a group and the color are added to it.
+     */
+    for (size_t f = 0 ; f < type->field_count ; ++f) {
+        const struct field_offset *field = &type->field_offsets[f];
+        size_t array = field->offset - field->group_offset;
+        size_t stride = 0 != field->group_size ? field->group_size :
+                                                 field->field_size;
+        fprintf(out,
+            "#define %s_FIELD_%zu_OFFSET (((size_t) %zu << %s_SUB_POOL_SHIFT) + %zu)\n"
+            "#define %s_FIELD_%zu_SIZE ((size_t) %zu)\n"
+            "#define %s_FIELD_%zu_STRIDE ((size_t) %zu)\n",
+            upper, f, array, upper,
+            desc->fields[f].offset - (array << type->sub_pool_shift),
+            upper, f, field->field_size,
+            upper, f, stride);
+    }
+
+    fprintf(out,
+        "\n"
+        "/* 0 if the header was generated from the type table in use */\n"
+        "static inline int\n"
+        "%s_check(void)\n"
+        "{\n"
+        "    return %s_FINGERPRINT == type_table_fingerprint() ? 0 : 1;\n"
+        "}\n"
+        "\n"
+        "/* The start of the subpool that holds object idx of a pool */\n"
+        "static inline uintptr_t\n"
+        "%s_sub_pool_addr(const pool_struct *pool, size_t idx)\n"
+        "{\n"
+        "    size_t in_window = GET_INDEX_IN_WINDOW(*pool, idx);\n"
+        "    uintptr_t window = GET_WINDOW_OF_INDEX(*pool, idx);\n"
+        "    return POOL_IDX_TO_ADDR(window) +\n"
+        "           ((window & %s_POOL_COLOR_MASK) << CACHE_LINE_SHIFT) +\n"
+        "           (in_window >> %s_SUB_POOL_SHIFT)*%s_SUB_POOL_SIZE;\n"
+        "}\n"
+        "\n"
+        "/* The address of a field of the object a reference points to */\n"
+        "static inline uintptr_t\n"
+        "%s_field_addr(global_reference reference, size_t offset, size_t stride)\n"
+        "{\n"
+        "    reference_struct ref = {.raw_val = reference};\n"
+        "    size_t idx = GET_GLOBAL_INDEX_OF_REF(ref);\n"
+        "    return GET_POOL_ADDR(ref) +\n"
+        "           (((uintptr_t) ref.pool_id & %s_POOL_COLOR_MASK) <<\n"
+        "            CACHE_LINE_SHIFT) +\n"
+        "           (idx >> %s_SUB_POOL_SHIFT)*%s_SUB_POOL_SIZE + offset +\n"
+        "           stride*(idx & (%s_SUB_POOL_LENGTH - 1));\n"
+        "}\n",
+        name, upper,
+        name, upper, upper, upper,
+        name, upper, upper, upper, upper);
+
+    for (size_t f = 0 ; f < type->field_count ; ++f) {
+        const char *c_type = field_c_type(type_id, f);
+        const struct field_offset *field = &type->field_offsets[f];
+        bool is_local_ref =
+            LOCAL_REF_TYPE == type_table[field->type_id].type_class;
+        bool is_opaque = 0 == strcmp(c_type, "char");
+
+        fprintf(out,
+            "\n"
+            "/* Field %zu */\n"
+            "static inline %s*\n"
+            "%s_field_%zu(global_reference ref)\n"
+            "{\n"
+            "    return (%s*) %s_field_addr(ref,\n"
+            "                               %s_FIELD_%zu_OFFSET,\n"
+            "                               %s_FIELD_%zu_STRIDE);\n"
+            "}\n"
+            "\n"
+            "static inline %s*\n"
+            "%s_field_%zu_at(pool_reference pool, size_t idx)\n"
+            "{\n"
+            "    pool_struct p = {.raw_val = pool};\n"
+            "    return (%s*) (%s_sub_pool_addr(&p, idx) +\n"
+            "                   %s_FIELD_%zu_OFFSET +\n"
+            "                   %s_FIELD_%zu_STRIDE*(idx & (%s_SUB_POOL_LENGTH - 1)));\n"
+            "}\n",
+            f,
+            c_type, name, f,
+            c_type, name, upper, f, upper, f,
+            c_type, name, f,
+            c_type, name, upper, f, upper, f, upper);
+
+        if (is_local_ref) {
+            fprintf(out,
+                "\n"
+                "static inline global_reference\n"
+                "%s_get_%zu(global_reference ref)\n"
+                "{\n"
+                "    reference_struct this = {.raw_val = ref};\n"
+                "    local_reference_struct local = {.raw_val = *%s_field_%zu(ref)};\n"
+                "\n"
+                "    if (0 == local.raw_val)\n"
+                "        return NULL_REF;\n"
+                "\n"
+                "    /* Long references live in the reference table */\n"
+                "    if (local.is_long_ref || this.is_extended)\n"
+                "        return get_field_reference(ref, %zu);\n"
+                "\n"
+                "    size_t idx = GET_GLOBAL_INDEX_OF_REF(this) + local.index;\n"
+                "    this.sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(idx);\n"
+                "    this.index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(idx);\n"
+                "    return this.raw_val;\n"
+                "}\n"
+                "\n"
+                "static inline int\n"
+                "%s_set_%zu(global_reference ref, global_reference that)\n"
+                "{\n"
+                "    return set_field_reference(ref, %zu, that);\n"
+                "}\n"
+                "\n"
+                "#define %s_WALK_%zu(head, node, ...) \\\n"
+                "    for (global_reference node = (head) ; \\\n"
+                "         NULL_REF != node ; \\\n"
+                "         node = %s_get_%zu(node)) { \\\n"
+                "        __VA_ARGS__ \\\n"
+                "    }\n",
+                name, f, name, f, f,
+                name, f, f,
+                upper, f, name, f);
+        } else if (is_opaque) {
+            fprintf(out,
+                "\n"
+                "static inline void\n"
+                "%s_get_%zu(global_reference ref, void *value)\n"
+                "{\n"
+                "    memcpy(value, %s_field_%zu(ref), %s_FIELD_%zu_SIZE);\n"
+                "}\n"
+                "\n"
+                "static inline void\n"
+                "%s_set_%zu(global_reference ref, const void *value)\n"
+                "{\n"
+                "    memcpy(%s_field_%zu(ref), value, %s_FIELD_%zu_SIZE);\n"
+                "}\n",
+                name, f, name, f, upper, f,
+                name, f, name, f, upper, f);
+        } else {
+            fprintf(out,
+                "\n"
+                "static inline %s\n"
+                "%s_get_%zu(global_reference ref)\n"
+                "{\n"
+                "    return *%s_field_%zu(ref);\n"
+                "}\n"
+                "\n"
+                "static inline void\n"
+                "%s_set_%zu(global_reference ref, %s value)\n"
+                "{\n"
+                "    *%s_field_%zu(ref) = value;\n"
+                "}\n",
+                c_type, name, f, name, f,
+                name, f, c_type, name, f);
+        }
+
+        /* Runs never cross a subpool, nor the window of a large pool */
+        fprintf(out,
+            "\n"
+            "#define %s_MAP_%zu(pool, idx, x, ...) do { \\\n"
+            "    pool_struct %s_pool_ = {.raw_val = (pool)}; \\\n"
+            "    size_t %s_size_ = GET_SIZE_OF_LARGE_POOL(%s_pool_); \\\n"
+            "    for (size_t %s_run_ = 0 ; %s_run_ < %s_size_ ; \\\n"
+            "         %s_run_ += %s_SUB_POOL_LENGTH) { \\\n"
+            "        char *%s_base_ = (char*) %s_sub_pool_addr(&%s_pool_, %s_run_) + \\\n"
+            "            %s_FIELD_%zu_OFFSET; \\\n"
+            "        size_t %s_end_ = %s_size_ - %s_run_ < %s_SUB_POOL_LENGTH ? \\\n"
+            "            %s_size_ : %s_run_ + %s_SUB_POOL_LENGTH; \\\n"
+            "        for (size_t idx = %s_run_ ; idx < %s_end_ ; ++idx) { \\\n"
+            "            %s *x = (%s*) (%s_base_ + \\\n"
+            "                (idx - %s_run_)*%s_FIELD_%zu_STRIDE); \\\n"
+            "            __VA_ARGS__ \\\n"
+            "        } \\\n"
+            "    } \\\n"
+            "} while (0)\n",
+            upper, f,
+            name,
+            name, name,
+            name, name, name,
+            name, upper,
+            name, name, name, name,
+            upper, f,
+            name, name, name, upper,
+            name, name, upper,
+            name, name,
+            c_type, c_type, name,
+            name, upper, f);
+    }
+
+    fprintf(out, "\n#endif\n");
+
+    return ferror(out) ? 1 : 0;
+}
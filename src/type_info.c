@@ -19,6 +19,7 @@
 #include "field_info.h"
 #include "pool.h"
 #include "pool_private.h"
+#include "pool_inline.h"
 
 
 typedef uint16_t local_reference;
@@ -26,6 +27,36 @@ typedef uint16_t local_reference;
 /* Defined in pool.c */
 extern Type_table type_table;
 
+static uint64_t fingerprint;
+
+/* See field_info.h */
+const char *type_descriptors;
+unsigned type_descriptor_shift;
+
+static size_t descriptor_count;
+
+/* FNV-1a, folding in one 64 bit word at a time */
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325llu
+#define FNV_PRIME 0x100000001b3llu
+
+static uint64_t
+fingerprint_add(uint64_t hash, uint64_t value);
+
+static int
+build_type_descriptors(Type_table tt, size_t type_count);
+
+static size_t
+max_field_size(Type_info type);
+
+static size_t
+round_up_pow2(size_t size);
+
+static void
+interleave_group(Field_offsets offsets,
+                 size_t field_count,
+                 size_t group_start,
+                 size_t *base_offset);
+
 PRIVATE size_t
 fill_in_offsets(Field_offsets offsets, Type_info type, size_t *base_offset)
 {
@@ -44,16 +75,25 @@ fill_in_offsets(Field_offsets offsets, Type_info type, size_t *base_offset)
             break;
         case COMPOSITE_TYPE: 
             {
+                size_t group_start = *base_offset;
                 size_t field_count = 0u;
                 for (unsigned i = 0 ; i < type->field_count ; ++i ) {
                 field_count += fill_in_offsets( &offsets[field_count], 
                                                 type->fields[i], 
                                                 base_offset);
                 }
+
+                if (type->interleaved)
+                    interleave_group(offsets,
+                                     field_count,
+                                     group_start,
+                                     base_offset);
                 return field_count;
             }
     }
 
+    offsets->group_size = 0;
+    offsets->group_offset = 0;
     offsets->offset = *base_offset;
     *base_offset += offsets->field_size;
     return 1u; /* Primitive types have a field count of 1 */
@@ -87,6 +127,9 @@ get_size_and_field_count(Type_info type, size_t *size, size_t *count)
         *size  += fs;
         *count += fc;
     }
+
+    if (type->interleaved)
+        *size = round_up_pow2(*size);
 }
 
 int
@@ -94,6 +137,33 @@ init_type_table(int type_count, Type_info type_infos[])
 {
     assert(type_count < (1<<16));
 
+    for (int i = 0 ; i < type_count ; ++i) {
+        size_t size, count;
+        unsigned shift = type_infos[i]->sub_pool_shift;
+        get_size_and_field_count(type_infos[i], &size, &count);
+
+        if (0 != shift && (shift > MAX_SUB_POOL_SHIFT ||
+                           0 != (size << shift) % SMALL_PAGE_SIZE))
+            return EINVAL;
+
+        if (size > UINT32_MAX || max_field_size(type_infos[i]) > MAX_FIELD_SIZE)
+            return EINVAL;
+
+        /*
+         * Field offsets within a subpool are 32 bits, and a new pool maps the
+         * subpools of its first PAGE_SIZE objects, which have to fit in its
+         * window.
+         */
+        shift = 0 != shift ? shift : DEFAULT_SUB_POOL_SHIFT;
+        size_t sub_pool_size = size << shift;
+        if (type_infos[i]->cache_colored)
+            sub_pool_size += SMALL_PAGE_SIZE;
+        size_t sub_pools = shift < 12 ? PAGE_SIZE >> shift : 1;
+        if (sub_pool_size > UINT32_MAX ||
+            sub_pools*sub_pool_size > POOL_WINDOW_SIZE)
+            return EINVAL;
+    }
+
     size_t table_size = type_count*sizeof(struct type_offsets);
     Type_table tt = mmap(0, 
                          table_size, 
@@ -111,6 +181,10 @@ init_type_table(int type_count, Type_info type_infos[])
         tt[i].type_size = size;
         tt[i].field_count = count;
         tt[i].type_class = type_infos[i]->type_class;
+        tt[i].sub_pool_shift = type_infos[i]->sub_pool_shift ?
+                               type_infos[i]->sub_pool_shift :
+                               DEFAULT_SUB_POOL_SHIFT;
+        tt[i].cache_colored = !!type_infos[i]->cache_colored;
 
         if (LOCAL_REF_TYPE == tt[i].type_class ||
             GLOBAL_REF_TYPE == tt[i].type_class ) {
@@ -145,8 +219,181 @@ init_type_table(int type_count, Type_info type_infos[])
     if (0 != mprotect(offsets, field_offset_table_size, PROT_READ))
         return errno;
 
+    uint64_t hash = fingerprint_add(FNV_OFFSET_BASIS, type_count);
+    for (int i = 0 ; i < type_count ; ++i) {
+        hash = fingerprint_add(hash, tt[i].type_class);
+        hash = fingerprint_add(hash, tt[i].referee_type_id);
+        hash = fingerprint_add(hash, tt[i].sub_pool_shift);
+        hash = fingerprint_add(hash, tt[i].cache_colored);
+        hash = fingerprint_add(hash, tt[i].type_size);
+        hash = fingerprint_add(hash, tt[i].field_count);
+        for (size_t f = 0 ; f < tt[i].field_count ; ++f) {
+            hash = fingerprint_add(hash, tt[i].field_offsets[f].type_id);
+            hash = fingerprint_add(hash, tt[i].field_offsets[f].field_size);
+            hash = fingerprint_add(hash, tt[i].field_offsets[f].offset);
+            hash = fingerprint_add(hash, tt[i].field_offsets[f].group_size);
+            hash = fingerprint_add(hash, tt[i].field_offsets[f].group_offset);
+        }
+    }
+
+    int err = build_type_descriptors(tt, type_count);
+    if (0 != err)
+        return err;
+
     type_table = tt;
+    fingerprint = hash;
 
     return 0;
 }
 
+const type_descriptor*
+get_type_descriptor(uint16_t type_id)
+{
+    return type_id < descriptor_count ? TYPE_DESCRIPTOR_OF_ID(type_id) : NULL;
+}
+
+/*
+ * Gives every descriptor the same power of two number of cache lines, so that
+ * the accessors find one with a shift rather than through a table of
+ * pointers. The header and the first few fields of a type share a cache line.
+ */
+static int
+build_type_descriptors(Type_table tt, size_t type_count)
+{
+    unsigned shift = CACHE_LINE_SHIFT;
+    for (size_t i = 0 ; i < type_count ; ++i)
+        while (((size_t) 1 << shift) < sizeof(type_descriptor) +
+                                        tt[i].field_count*sizeof(field_descriptor))
+            shift++;
+
+    size_t table_size = type_count << shift;
+    char *table = mmap(0,
+                       table_size,
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS,
+                       0, 0);
+
+    if (table == MAP_FAILED)
+        return errno;
+
+    for (size_t i = 0 ; i < type_count ; ++i) {
+        type_descriptor *desc = (type_descriptor*) (table + (i << shift));
+        desc->type_id = i;
+        desc->type_class = tt[i].type_class;
+        desc->sub_pool_shift = tt[i].sub_pool_shift;
+        desc->type_size = tt[i].type_size;
+        desc->field_count = tt[i].field_count;
+        desc->sub_pool_size = tt[i].type_size << tt[i].sub_pool_shift;
+        desc->pool_color_mask = 0;
+
+        /* Room for the largest field and pool colors, see FIELD_COLORS */
+        if (tt[i].cache_colored) {
+            desc->sub_pool_size += SMALL_PAGE_SIZE;
+            desc->pool_color_mask = POOL_COLORS - 1;
+        }
+
+        /* The same count the iterators and the collector look for */
+        desc->local_ref_count = 0;
+        while (desc->local_ref_count < tt[i].field_count &&
+               LOCAL_REF_TYPE ==
+               tt[tt[i].field_offsets[desc->local_ref_count].type_id].type_class)
+            desc->local_ref_count++;
+
+        size_t array = 0;
+        for (size_t f = 0 ; f < tt[i].field_count ; ++f) {
+            const struct field_offset *field = &tt[i].field_offsets[f];
+            size_t size = field->field_size;
+
+            /* Grouped fields sit in, and share the color of, their group */
+            if (f > 0 && (0 == field->group_size || 0 == field->group_offset))
+                array++;
+
+            desc->fields[f].offset =
+                ((field->offset - field->group_offset) <<
+                 tt[i].sub_pool_shift) + field->group_offset;
+            if (tt[i].cache_colored)
+                desc->fields[f].offset +=
+                    (array % FIELD_COLORS) << CACHE_LINE_SHIFT;
+            desc->fields[f].size = size;
+            desc->fields[f].stride_shift = FIELD_SIZE_NOT_POW2;
+            if (0 != field->group_size)
+                desc->fields[f].stride_shift = __builtin_ctzl(field->group_size);
+            else if (0 != size && 0 == (size & (size - 1)))
+                desc->fields[f].stride_shift = __builtin_ctzl(size);
+        }
+    }
+
+    if (0 != mprotect(table, table_size, PROT_READ))
+        return errno;
+
+    type_descriptors = table;
+    type_descriptor_shift = shift;
+    descriptor_count = type_count;
+
+    return 0;
+}
+
+/* The size of the largest primitive a type is flattened into */
+static size_t
+max_field_size(Type_info type)
+{
+    if (COMPOSITE_TYPE != type->type_class) {
+        size_t size, count;
+        get_size_and_field_count(type, &size, &count);
+        return size;
+    }
+
+    size_t max = 0;
+    for (unsigned i = 0 ; i < type->field_count ; ++i) {
+        size_t size = max_field_size(type->fields[i]);
+        max = size > max ? size : max;
+    }
+    return max;
+}
+
+static size_t
+round_up_pow2(size_t size)
+{
+    size_t pow2 = 1;
+    while (pow2 < size)
+        pow2 <<= 1;
+    return size > 0 ? pow2 : 0;
+}
+
+/*
+ * Pads the fields that were just laid out from group_start into a group, and
+ * records where in it each of them is. An interleaved composite nested in
+ * another is subsumed by the outer group.
+ */
+static void
+interleave_group(Field_offsets offsets,
+                 size_t field_count,
+                 size_t group_start,
+                 size_t *base_offset)
+{
+    size_t group_size = round_up_pow2(*base_offset - group_start);
+
+    for (size_t f = 0 ; f < field_count ; ++f) {
+        offsets[f].group_size = group_size;
+        offsets[f].group_offset = offsets[f].offset - group_start;
+    }
+
+    *base_offset = group_start + group_size;
+}
+
+uint64_t
+type_table_fingerprint(void)
+{
+    return fingerprint;
+}
+
+static uint64_t
+fingerprint_add(uint64_t hash, uint64_t value)
+{
+    for (int i = 0 ; i < 8 ; ++i) {
+        hash ^= (value >> 8*i) & 0xff;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
@@ -182,3 +182,43 @@ t_collect_ntree_pool(void)
     pool_destroy(&otree_pool);
 }
 
+
+void
+t_collect_grouped_list_pool(void)
+{
+    pool_reference list_pool = pool_create(GROUPED_LIST_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+
+    /* Every other node is garbage, the nodes are interleaved in groups */
+    global_reference head = pool_alloc(&list_pool);
+    global_reference node = head;
+    for (uint64_t i = 0 ; i < 6000 ; ++i) {
+        uint64_t y = ~i;
+        set_field(node, 1, &i);
+        set_field(node, 2, &y);
+        pool_alloc(&list_pool);
+
+        global_reference next = i + 1 < 6000 ? pool_alloc(&list_pool) : NULL_REF;
+        set_field_reference(node, 0, next);
+        node = next;
+    }
+
+    CU_ASSERT_EQUAL(push_root(&head), 0);
+    CU_ASSERT_EQUAL(collect_pool(&list_pool), 0);
+
+    pool_struct pool = {.raw_val = list_pool};
+    CU_ASSERT_EQUAL(GET_SIZE_OF_POOL(pool), 6000);
+
+    int get_errors = 0;
+    node = head;
+    for (uint64_t i = 0 ; i < 6000 ; ++i) {
+        get_errors += node != pool_get_ref(list_pool, i);
+        get_errors += *(uint64_t*) get_field(node, 1) != i;
+        get_errors += *(uint64_t*) get_field(node, 2) != ~i;
+        node = get_field_reference(node, 0);
+    }
+    CU_ASSERT_EQUAL(get_errors, 0);
+    CU_ASSERT_EQUAL(node, NULL_REF);
+
+    pool_destroy(&list_pool);
+}
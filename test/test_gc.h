@@ -17,4 +17,7 @@ t_collect_btree_pool(void);
 void
 t_collect_ntree_pool(void);
 
+void
+t_collect_grouped_list_pool(void);
+
 #endif
@@ -326,3 +326,57 @@ t_iterator_ntree(void)
     iterator_destroy(&itr);
     pool_destroy(&otree_pool);
 }
+
+void
+t_iterator_large_pool(void)
+{
+    const size_t window = 1 << 14;
+    unsigned old_shift = pool_set_max_window_shift(14);
+
+    /* Simple iterators walk across windows in both directions */
+    pool_reference pool = pool_create_large(LONG_TYPE_ID, 3*window);
+    CU_ASSERT_NOT_EQUAL_FATAL(pool, NULL_POOL);
+    CU_ASSERT_EQUAL(pool_grow(&pool, 2*window + 10), 0);
+
+    pool_iterator it = iterator_from_pool(pool);
+    pool_iterator last = it;
+    long long count = 0;
+    for ( ; it != ITERATOR_END ; it = iterator_next(pool, it)) {
+        iterator_set_field(it, 0, &count);
+        last = it;
+        count++;
+    }
+    CU_ASSERT_EQUAL(count, 2*window + 10);
+
+    int error_count = 0;
+    for (it = last ; it != ITERATOR_END ; it = iterator_prev(it))
+        error_count += *(long long*) iterator_get_field(it, 0) != --count;
+    CU_ASSERT_EQUAL(error_count, 0);
+    CU_ASSERT_EQUAL(count, 0);
+
+    pool_destroy(&pool);
+
+    /* Lists step over window boundaries with local references */
+    pool_reference list_pool = pool_create_large(LIST_TYPE_ID, 2*window);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+
+    global_reference head = NULL_REF;
+    for (uint64_t i = 0 ; i < 2*window ; ++i) {
+        global_reference tmp = pool_alloc(&list_pool);
+        set_field(tmp, 1, &i);
+        set_field_reference(tmp, 0, head);
+        head = tmp;
+    }
+
+    pool_iterator itr = iterator_from_reference(head);
+    int get_errors = 0;
+    for (uint64_t i = 2*window ; i-- > 0 ; ) {
+        get_errors += *(uint64_t*) iterator_get_field(itr, 1) != i;
+        itr = iterator_next(list_pool, itr);
+    }
+    CU_ASSERT_EQUAL(get_errors, 0);
+    CU_ASSERT_EQUAL(itr, ITERATOR_END);
+
+    pool_destroy(&list_pool);
+    pool_set_max_window_shift(old_shift);
+}
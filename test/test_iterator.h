@@ -28,4 +28,7 @@ t_iterator_btree(void);
 void
 t_iterator_ntree(void);
 
+void
+t_iterator_large_pool(void);
+
 #endif
@@ -0,0 +1,135 @@
+#include <utility>
+
+#include "ohmm_pool.h"
+#include "test_ohmm_pool.h"
+
+extern "C" {
+#include "CUnit/Basic.h"
+#include "basic_types.h"
+#include "pool_iterator.h"
+}
+
+/* The basic types of basic_types.c, as seen from C++ */
+typedef ohmm::pool<ohmm::local_ref, ohmm::local_ref,
+                   uint64_t, uint64_t> btree;
+typedef ohmm::pool<ohmm::local_ref, uint64_t, uint64_t> list;
+typedef ohmm::pool<uint64_t, char, char, char, uint64_t,
+                   char, char, char, uint64_t> composite;
+typedef ohmm::basic_pool<9, uint64_t, uint64_t> pair;
+typedef ohmm::pool<uint64_t, uint64_t> long_pair;
+typedef ohmm::pool<uint64_t, uint64_t, uint64_t, uint64_t,
+                   uint64_t, uint64_t, uint64_t, uint64_t> wide;
+
+/* Subpools hold 4096 objects unless a type asks otherwise */
+static const size_t sub_pool_length = 4096;
+
+/* The layout is known at compile time */
+static_assert(btree::type_size == 20, "btree size");
+static_assert(btree::local_ref_count == 2, "btree local references");
+static_assert(btree::offset<2>() == 4 << 12, "btree offset");
+static_assert(composite::offset<4>() == 11 << 12, "composite offset");
+static_assert(pair::sub_pool_size == 16 << 9, "pair subpool");
+static_assert(std::is_same<btree::value_type<0>, global_reference>::value,
+              "local references read as global references");
+static_assert(std::is_same<composite::storage_type<1>, char>::value,
+              "fields are stored as declared");
+
+void
+t_ohmm_pool_layout(void)
+{
+    CU_ASSERT(btree::describes(BTREE_TYPE_ID));
+    CU_ASSERT(list::describes(LIST_TYPE_ID));
+    CU_ASSERT(composite::describes(COMPOSITE_TYPE_2_ID));
+    CU_ASSERT(pair::describes(PAIR_TYPE_ID));
+
+    /* Same fields, different shift or order */
+    CU_ASSERT(!long_pair::describes(PAIR_TYPE_ID));
+    CU_ASSERT(!btree::describes(LIST_TYPE_ID));
+    CU_ASSERT(!btree::describes(UINT16_MAX));
+
+    /* Pools are only created for types laid out like the class */
+    long_pair wrong_shift(PAIR_TYPE_ID);
+    CU_ASSERT(!wrong_shift.valid());
+    btree wrong_fields(LIST_TYPE_ID);
+    CU_ASSERT(!wrong_fields.valid());
+    wide colored(WIDE_COLORED_TYPE_ID);
+    CU_ASSERT(!colored.valid());
+    wide plain(WIDE_TYPE_ID);
+    CU_ASSERT(plain.valid());
+}
+
+void
+t_ohmm_pool_access(void)
+{
+    /* Addresses agree with the C library, across subpools */
+    composite c(COMPOSITE_TYPE_2_ID);
+    CU_ASSERT_FATAL(c.valid());
+    CU_ASSERT_EQUAL(c.grow(sub_pool_length + 3), 0);
+
+    int addr_errors = 0;
+    for (size_t i = 0 ; i < sub_pool_length + 3 ; i += 11) {
+        global_reference ref = pool_get_ref(c.reference(), i);
+        addr_errors += (void*) composite::address<0>(ref) != get_field(ref, 0);
+        addr_errors += (void*) composite::address<3>(ref) != get_field(ref, 3);
+        addr_errors += (void*) composite::address<8>(ref) != get_field(ref, 8);
+    }
+    CU_ASSERT_EQUAL(addr_errors, 0);
+
+    pair p(PAIR_TYPE_ID);
+    CU_ASSERT_FATAL(p.valid());
+    const size_t n = 3*512 + 5;
+    CU_ASSERT_EQUAL(p.grow(n), 0);
+
+    for (size_t i = 0 ; i < n ; ++i) {
+        global_reference ref = pool_get_ref(p.reference(), i);
+        pair::set<0>(ref, i);
+        pair::set<1>(ref, 3*i);
+    }
+
+    int value_errors = 0;
+    for (size_t i = 0 ; i < n ; ++i) {
+        global_reference ref = pool_get_ref(p.reference(), i);
+        value_errors += *(uint64_t*) get_field(ref, 0) != i;
+        value_errors += *(uint64_t*) get_field(ref, 1) != 3*i;
+        value_errors += pair::get<1>(ref) != 3*i;
+    }
+    CU_ASSERT_EQUAL(value_errors, 0);
+
+    /* Ownership moves with the pool */
+    pair moved(std::move(p));
+    CU_ASSERT(!p.valid());
+    CU_ASSERT(moved.valid());
+    CU_ASSERT_EQUAL(pair::get<0>(pool_get_ref(moved.reference(), n - 1)),
+                    n - 1);
+}
+
+void
+t_ohmm_pool_references(void)
+{
+    btree tree(BTREE_TYPE_ID);
+    CU_ASSERT_FATAL(tree.valid());
+
+    global_reference root = tree.alloc();
+    global_reference left = tree.alloc();
+    CU_ASSERT_EQUAL(tree.grow(5000), 0);
+    global_reference far = pool_get_ref(tree.reference(), 5000);
+
+    CU_ASSERT_EQUAL(btree::get<0>(root), NULL_REF);
+
+    /* Short references both ways, and a long one */
+    CU_ASSERT_EQUAL(btree::set<0>(root, left), 0);
+    CU_ASSERT_EQUAL(btree::set<1>(left, root), 0);
+    CU_ASSERT_EQUAL(btree::set<1>(root, far), 0);
+    CU_ASSERT_EQUAL(btree::set<0>(far, root), 0);
+
+    CU_ASSERT_EQUAL(btree::get<0>(root), left);
+    CU_ASSERT_EQUAL(btree::get<1>(left), root);
+    CU_ASSERT_EQUAL(btree::get<1>(root), far);
+    CU_ASSERT_EQUAL(btree::get<0>(far), root);
+    CU_ASSERT_EQUAL(btree::get<0>(root), get_field_reference(root, 0));
+
+    /* References cross into C and back unchanged */
+    CU_ASSERT_EQUAL(btree::set<2>(left, 17), 0);
+    CU_ASSERT_EQUAL(*(uint64_t*) get_field(get_field_reference(root, 0), 2),
+                    17);
+}
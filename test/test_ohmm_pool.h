@@ -0,0 +1,22 @@
+#ifndef __TEST_OHMM_POOL_H__
+#define __TEST_OHMM_POOL_H__
+
+/* The tests are written in C++, and registered from C */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void
+t_ohmm_pool_layout(void);
+
+void
+t_ohmm_pool_access(void);
+
+void
+t_ohmm_pool_references(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,11 +2,18 @@
 #include <stdio.h>
 #include <signal.h>
 #include <setjmp.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "test_pool.h"
 
 /* For pool_get_ref TODO: see if that func should be moved */
 #include "pool_iterator.h"
+#include "reference_table.h"
+#include "pool_inline.h"
 
 /* 
  * These test-functions assume that a type table has been initialized with the
@@ -23,6 +30,8 @@
 
 #define UNUSED(x) ((void)x)
 
+extern struct pool_meta pool_meta_table[];
+
 static sigjmp_buf context;
 static void 
 segv_handler(int sig_num)
@@ -290,6 +299,49 @@ t_pool_shrink(void)
     }
 
     (void) signal(SIGSEGV, old_handler);
+
+    /* Objects allocated over shrunk ones are zeroed, in every map mode */
+    const POOL_MAP_MODE modes[] = { POOL_MAP_EAGER,
+                                    POOL_MAP_RESERVE,
+                                    POOL_MAP_OVERCOMMIT };
+    const uint16_t types[] = { LIST_TYPE_ID, KV_TREE_TYPE_ID };
+    const size_t n = 2*PAGE_SIZE + 10;
+    int value_errors = 0;
+
+    for (size_t m = 0 ; m < sizeof(modes) / sizeof(modes[0]) ; ++m) {
+        POOL_MAP_MODE old_mode = pool_set_map_mode(modes[m]);
+
+        for (size_t t = 0 ; t < sizeof(types) / sizeof(types[0]) ; ++t) {
+            pool_reference pool = pool_create(types[t]);
+            CU_ASSERT_NOT_EQUAL_FATAL(pool, NULL_POOL);
+
+            const type_descriptor *desc = get_type_descriptor(types[t]);
+            global_reference first;
+            CU_ASSERT_EQUAL_FATAL(pool_alloc_range(&pool, n, &first), 0);
+            for (size_t i = 0 ; i < n ; ++i)
+                for (size_t f = 0 ; f < desc->field_count ; ++f)
+                    memset(get_field(pool_get_ref(pool, i), f), 0xff,
+                           desc->fields[f].size);
+
+            /* Across a subpool, then within one */
+            CU_ASSERT_EQUAL(pool_shrink(&pool, PAGE_SIZE + 20), 0);
+            CU_ASSERT_EQUAL(pool_shrink(&pool, 5), 0);
+
+            for (size_t i = n - PAGE_SIZE - 25 ; i < n ; ++i) {
+                global_reference ref = pool_alloc(&pool);
+                for (size_t f = 0 ; f < desc->field_count ; ++f) {
+                    const unsigned char *field = get_field(ref, f);
+                    for (size_t b = 0 ; b < desc->fields[f].size ; ++b)
+                        value_errors += 0 != field[b];
+                }
+            }
+
+            pool_destroy(&pool);
+        }
+
+        pool_set_map_mode(old_mode);
+    }
+    CU_ASSERT_EQUAL(value_errors, 0);
 }
 
 void
@@ -343,3 +395,1027 @@ t_set_and_get_field_reference(void)
     pool_destroy(&list_pool);
 }
 
+
+void
+t_pool_free(void)
+{
+    pool_reference list_pool = pool_create(LIST_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+
+    const size_t n = PAGE_SIZE*3;
+    global_reference refs[n];
+    for (uint64_t i = 0 ; i < n ; ++i) {
+        refs[i] = pool_alloc(&list_pool);
+        set_field(refs[i], 1, &i);
+    }
+
+    /* A long reference owned by a freed object should be removed */
+    CU_ASSERT_EQUAL(set_field_reference(refs[1], 0, refs[n - 2]), 0);
+    reference_tag tag = {.raw_val = refs[1]};
+    tag.local_ref = *((uint16_t*) get_field(refs[1], 0));
+    CU_ASSERT_NOT_EQUAL(expand_local_reference(tag), REF_NOT_FOUND);
+
+    pool_struct p = {.raw_val = list_pool};
+    const size_t size = GET_SIZE_OF_POOL(p);
+
+    int free_errors = 0;
+    for (size_t i = 1 ; i < n ; i += 2)
+        free_errors += pool_free(refs[i]);
+    CU_ASSERT_EQUAL(free_errors, 0);
+    CU_ASSERT_EQUAL(pool_free(refs[1]), 2);
+    CU_ASSERT_EQUAL(expand_local_reference(tag), REF_NOT_FOUND);
+
+    /* All holes should be refilled before the pool is grown */
+    int reuse_errors = 0;
+    int value_errors = 0;
+    for (size_t i = 1 ; i < n ; i += 2) {
+        reference_struct ref = {.raw_val = pool_alloc(&list_pool)};
+        size_t idx = GET_GLOBAL_INDEX_OF_REF(ref);
+        reuse_errors += idx >= n || !(idx & 1);
+        value_errors += *((uint64_t*) get_field(ref.raw_val, 1)) != 0;
+        value_errors += *((uint16_t*) get_field(ref.raw_val, 0)) != 0;
+    }
+    CU_ASSERT_EQUAL(reuse_errors, 0);
+    CU_ASSERT_EQUAL(value_errors, 0);
+
+    p.raw_val = list_pool;
+    CU_ASSERT_EQUAL(GET_SIZE_OF_POOL(p), size);
+
+    /* Once the holes are used up the pool grows as usual */
+    reference_struct ref = {.raw_val = pool_alloc(&list_pool)};
+    CU_ASSERT_EQUAL(GET_GLOBAL_INDEX_OF_REF(ref), n);
+
+    /* A freed slot that is shrunk away is not handed out twice */
+    CU_ASSERT_EQUAL(pool_free(refs[n - 1]), 0);
+    CU_ASSERT_EQUAL(pool_shrink(&list_pool, 2), 0);
+    ref.raw_val = pool_alloc(&list_pool);
+    CU_ASSERT_EQUAL(GET_GLOBAL_INDEX_OF_REF(ref), n - 1);
+    ref.raw_val = pool_alloc(&list_pool);
+    CU_ASSERT_EQUAL(GET_GLOBAL_INDEX_OF_REF(ref), n);
+
+    /* Slots past the end are not marked, and are handed out as usual later */
+    reference_struct past = ref;
+    past.sub_pool_id = GLOBAL_INDEX_TO_SUBPOOL_ID(n + 1);
+    past.index = GLOBAL_INDEX_TO_SUBPOOL_OFFSET(n + 1);
+    CU_ASSERT_EQUAL(pool_free(past.raw_val), 1);
+    ref.raw_val = pool_alloc(&list_pool);
+    CU_ASSERT_EQUAL(GET_GLOBAL_INDEX_OF_REF(ref), n + 1);
+    CU_ASSERT_EQUAL(pool_free(ref.raw_val), 0);
+
+    CU_ASSERT_EQUAL(pool_destroy(&list_pool), 0);
+
+    /* As are references into a pool that has been destroyed */
+    CU_ASSERT_EQUAL(pool_free(refs[0]), 1);
+}
+
+void
+t_pool_id_reuse(void)
+{
+    /* Churn through many more pools than there are pool ids */
+    int create_errors = 0;
+    for (size_t i = 0 ; i < 4*POOL_ID_COUNT ; ++i) {
+        pool_reference pool = pool_create(CHAR_TYPE_ID);
+        pool_struct p = {.raw_val = pool};
+        create_errors += pool == NULL_POOL || p.pool_id >= POOL_ID_COUNT;
+        pool_destroy(&pool);
+    }
+    CU_ASSERT_EQUAL(create_errors, 0);
+
+    /* The freshly released id and its window are handed out again */
+    pool_reference pool = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(pool, NULL_POOL);
+    pool_struct first = {.raw_val = pool};
+    pool_destroy(&pool);
+
+    pool = pool_create(LONG_TYPE_ID);
+    pool_struct second = {.raw_val = pool};
+    CU_ASSERT_EQUAL(first.pool_id, second.pool_id);
+
+    uint64_t *data = pool_to_array(pool);
+    CU_ASSERT_EQUAL(data[0], 0);
+    pool_destroy(&pool);
+
+    /* Long references are removed along with the pool that holds them */
+    extern size_t hash_table_value_count;
+    size_t table_count = hash_table_value_count;
+
+    pool = pool_create(LIST_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(pool, NULL_POOL);
+    global_reference head = NULL_REF;
+    CU_ASSERT_EQUAL_FATAL(pool_alloc_range(&pool, PAGE_SIZE + 2, &head), 0);
+    CU_ASSERT_EQUAL(set_field_reference(head,
+                                        0,
+                                        pool_get_ref(pool, PAGE_SIZE + 1)), 0);
+    CU_ASSERT_EQUAL(hash_table_value_count, table_count + 1);
+
+    reference_tag tag = {.raw_val = head};
+    tag.local_ref = *((uint16_t*) get_field(head, 0));
+    first.raw_val = pool;
+    pool_destroy(&pool);
+    CU_ASSERT_EQUAL(hash_table_value_count, table_count);
+    CU_ASSERT_EQUAL(expand_local_reference(tag), REF_NOT_FOUND);
+
+    /* A field that still holds the old local reference finds nothing */
+    pool = pool_create(LIST_TYPE_ID);
+    second.raw_val = pool;
+    CU_ASSERT_EQUAL(first.pool_id, second.pool_id);
+    CU_ASSERT_EQUAL_FATAL(pool_alloc_range(&pool, PAGE_SIZE + 2, &head), 0);
+    *((uint16_t*) get_field(head, 0)) = tag.local_ref;
+    CU_ASSERT_EQUAL(get_field_reference(head, 0), NULL_REF);
+    pool_destroy(&pool);
+
+    /* Running out of ids fails instead of mapping past POOL_STOP */
+    static pool_reference pools[POOL_ID_COUNT];
+    size_t n = 0;
+    while (n < POOL_ID_COUNT &&
+           NULL_POOL != (pools[n] = pool_create(CHAR_TYPE_ID)))
+        n++;
+
+    CU_ASSERT(n < POOL_ID_COUNT);
+
+    for (size_t i = 0 ; i < n ; ++i)
+        pool_destroy(&pools[i]);
+}
+
+void
+t_pool_map_mode(void)
+{
+    void (*old_handler)(int) = signal(SIGSEGV, segv_handler);
+    const size_t sub_pool_size = sizeof(uint64_t)*PAGE_SIZE;
+
+    /* A reserved pool commits its window as it grows */
+    CU_ASSERT_EQUAL(pool_set_map_mode(POOL_MAP_RESERVE), POOL_MAP_EAGER);
+    pool_reference pool = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(pool, NULL_POOL);
+    char *addr = pool_to_array(pool);
+
+    if (sigsetjmp(context, 1) == 0) {
+        addr[sub_pool_size] = 0xff;
+        CU_FAIL("Reserved memory was accessible before it was committed");
+    } else {
+        CU_PASS("Reserved memory was protected");
+    }
+
+    size_t calls = pool_syscall_count();
+    for (size_t i = 0 ; i < 64*PAGE_SIZE ; ++i)
+        pool_alloc(&pool);
+
+    /* Committing doubles every time, 1 -> 64 subpools takes 6 calls */
+    CU_ASSERT_EQUAL(pool_syscall_count() - calls, 6);
+
+    if (sigsetjmp(context, 1) == 0) {
+        memset(addr, 0xff, 64*sub_pool_size);
+        CU_PASS("Write to committed memory ok");
+    } else {
+        CU_FAIL("Memory access to committed memory segfaulted");
+    }
+
+    /* Shrinking decommits, and memory committed again is zeroed */
+    CU_ASSERT_EQUAL(pool_shrink(&pool, 32*PAGE_SIZE), 0);
+
+    if (sigsetjmp(context, 1) == 0) {
+        addr[40*sub_pool_size] = 0xff;
+        CU_FAIL("Memory wasn't decommitted after shrink");
+    } else {
+        CU_PASS("Memory was decommitted after shrink");
+    }
+
+    CU_ASSERT_EQUAL(pool_grow(&pool, 32*PAGE_SIZE), 0);
+    CU_ASSERT_EQUAL(((uint64_t*) addr)[40*PAGE_SIZE], 0);
+    CU_ASSERT_EQUAL(pool_destroy(&pool), 0);
+
+    /* An overcommitted pool makes no calls at all when it grows */
+    CU_ASSERT_EQUAL(pool_set_map_mode(POOL_MAP_OVERCOMMIT), POOL_MAP_RESERVE);
+    pool = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(pool, NULL_POOL);
+    addr = pool_to_array(pool);
+
+    calls = pool_syscall_count();
+    CU_ASSERT_EQUAL(pool_grow(&pool, 64*PAGE_SIZE), 0);
+    for (size_t i = 0 ; i < PAGE_SIZE ; ++i)
+        pool_alloc(&pool);
+    CU_ASSERT_EQUAL(pool_syscall_count(), calls);
+
+    if (sigsetjmp(context, 1) == 0) {
+        memset(addr, 0xff, 65*sub_pool_size);
+        CU_PASS("Write to allocated memory ok");
+    } else {
+        CU_FAIL("Memory access to allocated memory segfaulted");
+    }
+
+    CU_ASSERT_EQUAL(pool_destroy(&pool), 0);
+
+    if (sigsetjmp(context, 1) == 0) {
+        addr[0] = 0xff;
+        CU_FAIL("Deallocated window wasn't reclaimed");
+    } else {
+        CU_PASS("Deallocated window was reclaimed");
+    }
+
+    CU_ASSERT_EQUAL(pool_set_map_mode(POOL_MAP_EAGER), POOL_MAP_OVERCOMMIT);
+    (void) signal(SIGSEGV, old_handler);
+}
+
+void
+t_pool_alloc_range(void)
+{
+    pool_reference list_pool = pool_create(LIST_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+
+    /* Start the range in the middle of a subpool */
+    pool_alloc(&list_pool);
+    pool_alloc(&list_pool);
+    pool_alloc(&list_pool);
+
+    const size_t n = 10000;
+    global_reference first = NULL_REF;
+    CU_ASSERT_EQUAL(pool_alloc_range(&list_pool, n, &first), 0);
+    CU_ASSERT_EQUAL(first, pool_get_ref(list_pool, 3));
+
+    pool_struct p = {.raw_val = list_pool};
+    CU_ASSERT_EQUAL(GET_SIZE_OF_POOL(p), n + 3);
+
+    uint64_t values[n];
+    for (uint64_t i = 0 ; i < n ; ++i)
+        values[i] = 0xdeadbeef00000000 + i;
+
+    /* Fill in the field one subpool at a time */
+    pool_range_cursor cursor = {.next = first, .remaining = n};
+    global_reference segment;
+    size_t length;
+    size_t copied = 0;
+    size_t segments = 0;
+    while ((length = pool_range_next(&cursor, &segment)) > 0) {
+        memcpy(get_field(segment, 1), &values[copied], length*sizeof(uint64_t));
+        copied += length;
+        segments++;
+    }
+    CU_ASSERT_EQUAL(copied, n);
+    CU_ASSERT_EQUAL(segments, 3);
+
+    int value_errors = 0;
+    for (size_t i = 0 ; i < n ; ++i) {
+        uint64_t *v = get_field(pool_get_ref(list_pool, i + 3), 1);
+        value_errors += *v != values[i];
+    }
+    CU_ASSERT_EQUAL(value_errors, 0);
+
+    /* Ranges that overflow the window are rejected, and leave the pool be */
+    CU_ASSERT_EQUAL(pool_alloc_range(&list_pool, (size_t) 1 << 29, &first), 1);
+    p.raw_val = list_pool;
+    CU_ASSERT_EQUAL(GET_SIZE_OF_POOL(p), n + 3);
+
+    pool_destroy(&list_pool);
+
+    /* A pool of longs fills up at 1 << 28 objects, which fit its window */
+    POOL_MAP_MODE old_mode = pool_set_map_mode(POOL_MAP_OVERCOMMIT);
+    pool_reference long_pool = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(long_pool, NULL_POOL);
+
+    size_t max = (size_t) 1 << 28;
+    CU_ASSERT_EQUAL(pool_alloc_range(&long_pool, max + 1, &first), 1);
+    CU_ASSERT_EQUAL(pool_alloc_range(&long_pool, max, &first), 0);
+    CU_ASSERT_EQUAL(pool_alloc(&long_pool), NULL_REF);
+    p.raw_val = long_pool;
+    CU_ASSERT_EQUAL(GET_SIZE_OF_POOL(p), max);
+
+    pool_destroy(&long_pool);
+
+    /* Lists are larger, and fill up their window first */
+    list_pool = pool_create(LIST_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+
+    p.raw_val = list_pool;
+    max = POOL_WINDOW_SIZE / GET_SUB_POOL_SIZE(p) * PAGE_SIZE;
+    CU_ASSERT_EQUAL(pool_alloc_range(&list_pool, max + 1, &first), 1);
+    CU_ASSERT_EQUAL(pool_alloc_range(&list_pool, max, &first), 0);
+    CU_ASSERT_EQUAL(pool_alloc(&list_pool), NULL_REF);
+    p.raw_val = list_pool;
+    CU_ASSERT_EQUAL(GET_SIZE_OF_POOL(p), max);
+
+    pool_destroy(&list_pool);
+    pool_set_map_mode(old_mode);
+}
+
+#define SHARED_THREADS 4
+#define SHARED_ALLOCS  20000
+
+struct shared_alloc_args {
+    pool_reference     *pool;
+    uint64_t            tag;
+    size_t              failures;
+};
+
+static void*
+shared_alloc_worker(void *arg)
+{
+    struct shared_alloc_args *args = arg;
+    pool_tlab tlab = {0};
+
+    for (uint64_t i = 0 ; i < SHARED_ALLOCS ; ++i) {
+        global_reference ref = pool_alloc_shared(args->pool, &tlab);
+        if (NULL_REF == ref) {
+            args->failures++;
+            continue;
+        }
+
+        uint64_t *v = get_field(ref, 1);
+        args->failures += *v != 0;
+        *v = args->tag | i;
+    }
+
+    return NULL;
+}
+
+void
+t_pool_alloc_shared(void)
+{
+    pool_reference list_pool = pool_create(LIST_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+
+    /* The first claim takes the rest of a partly used subpool */
+    pool_alloc(&list_pool);
+    pool_alloc(&list_pool);
+
+    pthread_t threads[SHARED_THREADS];
+    struct shared_alloc_args args[SHARED_THREADS];
+    for (size_t t = 0 ; t < SHARED_THREADS ; ++t) {
+        args[t] = (struct shared_alloc_args) {.pool     = &list_pool,
+                                              .tag      = (t + 1) << 32,
+                                              .failures = 0 };
+        CU_ASSERT_EQUAL_FATAL(pthread_create(&threads[t], NULL,
+                                             shared_alloc_worker, &args[t]), 0);
+    }
+
+    size_t failures = 0;
+    for (size_t t = 0 ; t < SHARED_THREADS ; ++t) {
+        pthread_join(threads[t], NULL);
+        failures += args[t].failures;
+    }
+    CU_ASSERT_EQUAL(failures, 0);
+
+    /* The tail counts every claimed object, at most a buffer per thread more */
+    pool_struct p = {.raw_val = list_pool};
+    size_t size = GET_SIZE_OF_POOL(p);
+    CU_ASSERT(size >= 2 + SHARED_THREADS*SHARED_ALLOCS);
+    CU_ASSERT(size < 2 + SHARED_THREADS*(SHARED_ALLOCS + PAGE_SIZE));
+
+    /* Every object was handed out to exactly one thread, in order */
+    size_t counts[SHARED_THREADS] = {0};
+    size_t order_errors = 0;
+    for (size_t i = 2 ; i < size ; ++i) {
+        uint64_t v = *(uint64_t*) get_field(pool_get_ref(list_pool, i), 1);
+        if (0 == v)
+            continue;
+
+        size_t t = (v >> 32) - 1;
+        if (t >= SHARED_THREADS || (v & 0xffffffff) != counts[t]) {
+            order_errors++;
+            continue;
+        }
+        counts[t]++;
+    }
+    CU_ASSERT_EQUAL(order_errors, 0);
+    for (size_t t = 0 ; t < SHARED_THREADS ; ++t)
+        CU_ASSERT_EQUAL(counts[t], SHARED_ALLOCS);
+
+    pool_destroy(&list_pool);
+}
+
+void
+t_pool_page_mode(void)
+{
+    void (*old_handler)(int) = signal(SIGSEGV, segv_handler);
+    const size_t sub_pool_size = sizeof(uint64_t)*PAGE_SIZE;
+    const size_t per_huge_page = HUGE_PAGE_SIZE / sub_pool_size;
+
+    CU_ASSERT_EQUAL(pool_set_page_mode(POOL_PAGES_HUGE), POOL_PAGES_SMALL);
+    pool_reference pool = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_EQUAL(pool_set_page_mode(POOL_PAGES_SMALL), POOL_PAGES_HUGE);
+    CU_ASSERT_NOT_EQUAL_FATAL(pool, NULL_POOL);
+    uint64_t *array = pool_to_array(pool);
+
+    /* The first commit covers a whole huge page */
+    size_t calls = pool_syscall_count();
+    CU_ASSERT_EQUAL(pool_grow(&pool, per_huge_page*PAGE_SIZE - 1), 0);
+    CU_ASSERT_EQUAL(pool_syscall_count(), calls);
+
+    if (sigsetjmp(context, 1) == 0) {
+        array[per_huge_page*PAGE_SIZE] = 0xff;
+        CU_FAIL("Memory past the first huge page was committed");
+    } else {
+        CU_PASS("Memory past the first huge page was protected");
+    }
+
+    CU_ASSERT_EQUAL(pool_grow(&pool, 2*per_huge_page*PAGE_SIZE), 0);
+    for (size_t i = 0 ; i < 3*per_huge_page*PAGE_SIZE - 1 ; ++i)
+        array[i] = i + 1;
+
+    /* Shrinking into the middle of a huge page keeps it, but clears the rest */
+    CU_ASSERT_EQUAL(pool_shrink(&pool, (2*per_huge_page + per_huge_page/2)*
+                                       PAGE_SIZE), 0);
+
+    if (sigsetjmp(context, 1) == 0) {
+        array[per_huge_page*PAGE_SIZE] = 0xff;
+        CU_FAIL("Whole huge pages weren't decommitted after shrink");
+    } else {
+        CU_PASS("Whole huge pages were decommitted after shrink");
+    }
+
+    CU_ASSERT_EQUAL(pool_grow(&pool, per_huge_page*PAGE_SIZE), 0);
+
+    int value_errors = 0;
+    for (size_t i = 0 ; i < per_huge_page*PAGE_SIZE/2 - 1 ; ++i)
+        value_errors += array[i] != i + 1;
+    for (size_t i = per_huge_page*PAGE_SIZE/2 - 1 ;
+         i < per_huge_page*PAGE_SIZE ; ++i)
+        value_errors += array[i] != 0;
+    CU_ASSERT_EQUAL(value_errors, 0);
+
+    CU_ASSERT_EQUAL(pool_destroy(&pool), 0);
+    (void) signal(SIGSEGV, old_handler);
+}
+
+void
+t_pool_file(void)
+{
+    char path[] = "/tmp/test_pool_file_XXXXXX";
+    int fd = mkstemp(path);
+    CU_ASSERT_FATAL(fd >= 0);
+    close(fd);
+
+    pool_reference pool = pool_create_file(LIST_TYPE_ID, path);
+    CU_ASSERT_NOT_EQUAL_FATAL(pool, NULL_POOL);
+
+    const size_t n = 3*PAGE_SIZE + 17;
+    for (uint64_t i = 0 ; i < n ; ++i) {
+        global_reference ref = pool_alloc(&pool);
+        set_field(ref, 1, &i);
+    }
+    global_reference last = pool_get_ref(pool, n - 1);
+    CU_ASSERT_EQUAL(pool_sync(pool), 0);
+
+    /* The pool id is still taken while the pool is attached */
+    CU_ASSERT_EQUAL(pool_attach_file(path), NULL_POOL);
+    CU_ASSERT_EQUAL(errno, EBUSY);
+
+    pool_reference before = pool;
+    CU_ASSERT_EQUAL(pool_destroy(&pool), 0);
+    CU_ASSERT_EQUAL(pool, NULL_POOL);
+
+    /* It comes back at the same window, with the same size and contents */
+    pool = pool_attach_file(path);
+    CU_ASSERT_EQUAL_FATAL(pool, before);
+    CU_ASSERT_EQUAL(pool_get_ref(pool, n - 1), last);
+
+    int value_errors = 0;
+    for (size_t i = 0 ; i < n ; ++i)
+        value_errors += *(uint64_t*) get_field(pool_get_ref(pool, i), 1) != i;
+    CU_ASSERT_EQUAL(value_errors, 0);
+
+    /* Growing and shrinking changes the file */
+    CU_ASSERT_EQUAL(pool_grow(&pool, 8*PAGE_SIZE), 0);
+    *(uint64_t*) get_field(pool_get_ref(pool, n + 8*PAGE_SIZE - 1), 1) = 42;
+    CU_ASSERT_EQUAL(pool_shrink(&pool, 8*PAGE_SIZE), 0);
+    CU_ASSERT_EQUAL(pool_destroy(&pool), 0);
+
+    pool = pool_attach_file(path);
+    CU_ASSERT_NOT_EQUAL_FATAL(pool, NULL_POOL);
+    pool_struct p = {.raw_val = pool};
+    CU_ASSERT_EQUAL(GET_SIZE_OF_POOL(p), n);
+    CU_ASSERT_EQUAL(pool_grow(&pool, 8*PAGE_SIZE), 0);
+    CU_ASSERT_EQUAL(*(uint64_t*) get_field(pool_get_ref(pool,
+                                                        n + 8*PAGE_SIZE - 1),
+                                           1), 0);
+    CU_ASSERT_EQUAL(pool_destroy(&pool), 0);
+
+    /* Files written with another type table are refused */
+    uint64_t fingerprint = ~type_table_fingerprint();
+    fd = open(path, O_RDWR);
+    CU_ASSERT_EQUAL(pwrite(fd, &fingerprint, sizeof(fingerprint),
+                           offsetof(struct pool_file_header, fingerprint)),
+                    sizeof(fingerprint));
+    close(fd);
+
+    CU_ASSERT_EQUAL(pool_attach_file(path), NULL_POOL);
+    CU_ASSERT_EQUAL(errno, EINVAL);
+
+    /* Ordinary pools have no file to sync */
+    pool_reference anon = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_EQUAL(pool_sync(anon), EINVAL);
+    pool_destroy(&anon);
+
+    unlink(path);
+}
+
+void
+t_pool_sub_pool_shift(void)
+{
+    const size_t column_length = 1 << 16;
+    pool_reference column = pool_create(LONG_COLUMN_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(column, NULL_POOL);
+
+    /* Ranges are split at physical subpool boundaries, not logical ones */
+    const size_t n = 2*column_length + 100;
+    global_reference first = NULL_REF;
+    CU_ASSERT_EQUAL(pool_alloc_range(&column, n, &first), 0);
+
+    pool_range_cursor cursor = {.next = first, .remaining = n};
+    global_reference segment;
+    size_t length;
+    size_t lengths[4] = {0};
+    size_t segments = 0;
+    while ((length = pool_range_next(&cursor, &segment)) > 0) {
+        uint64_t *column_data = get_field(segment, 0);
+        for (size_t i = 0 ; i < length ; ++i)
+            column_data[i] = segments*column_length + i;
+        if (segments < 4)
+            lengths[segments] = length;
+        segments++;
+    }
+    CU_ASSERT_EQUAL(segments, 3);
+    CU_ASSERT_EQUAL(lengths[0], column_length);
+    CU_ASSERT_EQUAL(lengths[1], column_length);
+    CU_ASSERT_EQUAL(lengths[2], 100);
+
+    int value_errors = 0;
+    for (size_t i = 0 ; i < n ; ++i)
+        value_errors += *(uint64_t*) get_field(pool_get_ref(column, i), 0) != i;
+    CU_ASSERT_EQUAL(value_errors, 0);
+
+    /* Shrinking and growing keep the prefix */
+    CU_ASSERT_EQUAL(pool_shrink(&column, 100), 0);
+    CU_ASSERT_EQUAL(pool_shrink(&column, column_length), 0);
+    CU_ASSERT_EQUAL(pool_grow(&column, column_length), 0);
+    value_errors = 0;
+    for (size_t i = 0 ; i < 2*column_length ; ++i) {
+        uint64_t expected = i < column_length ? i : 0;
+        value_errors += *(uint64_t*) get_field(pool_get_ref(column, i), 0) !=
+                        expected;
+    }
+    CU_ASSERT_EQUAL(value_errors, 0);
+    CU_ASSERT_EQUAL(pool_destroy(&column), 0);
+
+    /* Fields of a composite type are laid out one short subpool at a time */
+    pool_reference pairs = pool_create(PAIR_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(pairs, NULL_POOL);
+    for (uint64_t i = 0 ; i < 3*PAGE_SIZE ; ++i) {
+        global_reference ref = pool_alloc(&pairs);
+        uint64_t twice = 2*i;
+        set_field(ref, 0, &i);
+        set_field(ref, 1, &twice);
+    }
+
+    char *base = get_field(pool_get_ref(pairs, 0), 0);
+    CU_ASSERT_EQUAL(get_field(pool_get_ref(pairs, 0), 1), base + 512*8);
+    CU_ASSERT_EQUAL(get_field(pool_get_ref(pairs, 511), 0), base + 511*8);
+    CU_ASSERT_EQUAL(get_field(pool_get_ref(pairs, 512), 0), base + 512*16);
+    CU_ASSERT_EQUAL(get_field(pool_get_ref(pairs, PAGE_SIZE), 1),
+                    base + PAGE_SIZE*16 + 512*8);
+
+    value_errors = 0;
+    for (size_t i = 0 ; i < 3*PAGE_SIZE ; ++i) {
+        global_reference ref = pool_get_ref(pairs, i);
+        value_errors += *(uint64_t*) get_field(ref, 0) != i;
+        value_errors += *(uint64_t*) get_field(ref, 1) != 2*i;
+    }
+    CU_ASSERT_EQUAL(value_errors, 0);
+    CU_ASSERT_EQUAL(pool_destroy(&pairs), 0);
+
+    /* Thread local buffers claim whole physical subpools */
+    column = pool_create(LONG_COLUMN_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(column, NULL_POOL);
+    pool_tlab tlab = {0};
+    size_t failures = 0;
+    for (uint64_t i = 0 ; i < column_length + 1 ; ++i) {
+        global_reference ref = pool_alloc_shared(&column, &tlab);
+        if (NULL_REF == ref) {
+            failures++;
+            continue;
+        }
+        set_field(ref, 0, &i);
+    }
+    CU_ASSERT_EQUAL(failures, 0);
+    pool_struct p = {.raw_val = column};
+    CU_ASSERT_EQUAL(GET_SIZE_OF_POOL(p), 2*column_length);
+    CU_ASSERT_EQUAL(*(uint64_t*) get_field(pool_get_ref(column, column_length),
+                                           0), column_length);
+    CU_ASSERT_EQUAL(pool_destroy(&column), 0);
+}
+
+void
+t_pool_create_large(void)
+{
+    const size_t window = 1 << 14;
+    unsigned old_shift = pool_set_max_window_shift(14);
+
+    pool_reference pool = pool_create_large(LONG_TYPE_ID, 3*window + 5);
+    CU_ASSERT_NOT_EQUAL_FATAL(pool, NULL_POOL);
+    pool_struct p = {.raw_val = pool};
+    CU_ASSERT_EQUAL(p.is_extended, 1);
+    uint16_t base = p.pool_id;
+
+    /* Ranges are handed out one subpool at a time, across windows */
+    const size_t n = 2*window + 100;
+    global_reference first = NULL_REF;
+    CU_ASSERT_EQUAL(pool_alloc_range(&pool, n, &first), 0);
+    CU_ASSERT_EQUAL(first, pool_get_ref(pool, 0));
+
+    pool_range_cursor cursor = {.next = first, .remaining = n};
+    global_reference segment;
+    size_t length;
+    size_t copied = 0;
+    size_t segments = 0;
+    while ((length = pool_range_next(&cursor, &segment)) > 0) {
+        uint64_t *values = get_field(segment, 0);
+        for (size_t i = 0 ; i < length ; ++i)
+            values[i] = copied + i;
+        copied += length;
+        segments++;
+    }
+    CU_ASSERT_EQUAL(copied, n);
+    CU_ASSERT_EQUAL(segments, 9);
+
+    p.raw_val = pool;
+    CU_ASSERT_EQUAL(p.pool_id, base + 2);
+    CU_ASSERT_EQUAL(GET_SIZE_OF_LARGE_POOL(p), n);
+
+    int value_errors = 0;
+    for (size_t i = 0 ; i < n ; ++i) {
+        reference_struct ref = {.raw_val = pool_get_ref(pool, i)};
+        value_errors += ref.pool_id != base + i / window;
+        value_errors += GET_LARGE_INDEX_OF_REF(ref) != i;
+        value_errors += *(uint64_t*) get_field(ref.raw_val, 0) != i;
+    }
+    CU_ASSERT_EQUAL(value_errors, 0);
+
+    /* Growing past the last window fails, filling it exactly doesn't */
+    CU_ASSERT_NOT_EQUAL(pool_grow(&pool, 2*window), 0);
+    CU_ASSERT_EQUAL(pool_grow(&pool, 2*window - 100), 0);
+    p.raw_val = pool;
+    CU_ASSERT_EQUAL(p.pool_id, base + 3);
+    CU_ASSERT_EQUAL(GET_SIZE_OF_LARGE_POOL(p), 4*window);
+    CU_ASSERT_EQUAL(pool_alloc(&pool), NULL_REF);
+
+    /* Shrinking moves the end back into an earlier window */
+    CU_ASSERT_EQUAL(pool_shrink(&pool, 2*window), 0);
+    p.raw_val = pool;
+    CU_ASSERT_EQUAL(p.pool_id, base + 1);
+    CU_ASSERT_EQUAL(GET_SIZE_OF_LARGE_POOL(p), 2*window);
+    CU_ASSERT_EQUAL(pool_shrink(&pool, window + 1), 0);
+    p.raw_val = pool;
+    CU_ASSERT_EQUAL(p.pool_id, base);
+    CU_ASSERT_EQUAL(GET_SIZE_OF_LARGE_POOL(p), window - 1);
+
+    global_reference ref = pool_alloc(&pool);
+    CU_ASSERT_EQUAL(ref, pool_get_ref(pool, window - 1));
+    ref = pool_alloc(&pool);
+    CU_ASSERT_EQUAL(ref, pool_get_ref(pool, window));
+    CU_ASSERT_EQUAL(*(uint64_t*) get_field(pool_get_ref(pool, window - 2), 0),
+                    window - 2);
+
+    /* Freeing and sharing are left to ordinary pools */
+    CU_ASSERT_EQUAL(pool_free(ref), 1);
+    pool_tlab tlab = {0};
+    CU_ASSERT_EQUAL(pool_alloc_shared(&pool, &tlab), NULL_REF);
+
+    CU_ASSERT_EQUAL(pool_destroy(&pool), 0);
+    CU_ASSERT_EQUAL(pool, NULL_POOL);
+
+    /* Local and long references work between windows */
+    pool_reference list_pool = pool_create_large(LIST_TYPE_ID, 2*window);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+    CU_ASSERT_EQUAL(pool_grow(&list_pool, 2*window), 0);
+
+    global_reference last = pool_get_ref(list_pool, window - 1);
+    global_reference next = pool_get_ref(list_pool, window);
+    global_reference far = pool_get_ref(list_pool, 2*window - 1);
+    first = pool_get_ref(list_pool, 0);
+    CU_ASSERT_EQUAL(set_field_reference(last, 0, next), 0);
+    CU_ASSERT_EQUAL(set_field_reference(next, 0, last), 0);
+    CU_ASSERT_EQUAL(set_field_reference(first, 0, far), 0);
+    CU_ASSERT_EQUAL(get_field_reference(last, 0), next);
+    CU_ASSERT_EQUAL(get_field_reference(next, 0), last);
+    CU_ASSERT_EQUAL(get_field_reference(first, 0), far);
+
+    CU_ASSERT_EQUAL(pool_destroy(&list_pool), 0);
+
+    /* A window has to hold at least PAGE_SIZE objects */
+    pool_set_max_window_shift(11);
+    CU_ASSERT_EQUAL(pool_create_large(LONG_TYPE_ID, 1), NULL_POOL);
+
+    pool_set_max_window_shift(old_shift);
+}
+
+/* Gives the provisioner up to a second to map the pool up to the given size */
+static size_t
+wait_for_provisioner(pool_reference pool, size_t size)
+{
+    pool_struct p = {.raw_val = pool};
+    struct pool_meta *meta = &pool_meta_table[p.pool_id];
+
+    for (int i = 0 ; i < 1000 &&
+                     __atomic_load_n(&meta->provisioned, __ATOMIC_ACQUIRE) < size ;
+         ++i)
+        usleep(1000);
+
+    return __atomic_load_n(&meta->provisioned, __ATOMIC_ACQUIRE);
+}
+
+void
+t_pool_provisioning(void)
+{
+    POOL_MAP_MODE old_mode = pool_set_map_mode(POOL_MAP_EAGER);
+    pool_reference pool = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(pool, NULL_POOL);
+    CU_ASSERT_EQUAL(pool_set_provisioning(pool, PAGE_SIZE / 2), 0);
+
+    /* Nothing is posted before the watermark */
+    for (size_t i = 0 ; i < PAGE_SIZE / 2 - 1 ; ++i)
+        pool_alloc(&pool);
+    CU_ASSERT_EQUAL(wait_for_provisioner(pool, 1), 0);
+
+    pool_alloc(&pool);
+    CU_ASSERT_EQUAL(wait_for_provisioner(pool, 2*PAGE_SIZE), 2*PAGE_SIZE);
+
+    /* Crossing into the provisioned block maps nothing */
+    size_t calls = pool_syscall_count();
+    for (size_t i = PAGE_SIZE / 2 ; i < PAGE_SIZE + 1 ; ++i)
+        pool_alloc(&pool);
+    CU_ASSERT_EQUAL(pool_syscall_count(), calls);
+    global_reference ref = pool_get_ref(pool, PAGE_SIZE);
+    uint64_t value = 42;
+    set_field(ref, 0, &value);
+    CU_ASSERT_EQUAL(*(uint64_t*) get_field(ref, 0), value);
+
+    /* The next block is posted at the watermark of the current one */
+    for (size_t i = PAGE_SIZE + 1 ; i < PAGE_SIZE + PAGE_SIZE / 2 ; ++i)
+        pool_alloc(&pool);
+    CU_ASSERT_EQUAL(wait_for_provisioner(pool, 3*PAGE_SIZE), 3*PAGE_SIZE);
+
+    /* Shrinking gives back what was mapped ahead, growing maps it again */
+    CU_ASSERT_EQUAL(pool_shrink(&pool, PAGE_SIZE), 0);
+    pool_struct p = {.raw_val = pool};
+    CU_ASSERT_EQUAL(pool_meta_table[p.pool_id].provisioned, PAGE_SIZE);
+    CU_ASSERT_EQUAL(pool_grow(&pool, PAGE_SIZE), 0);
+    ref = pool_get_ref(pool, PAGE_SIZE + 1);
+    value = 43;
+    set_field(ref, 0, &value);
+    CU_ASSERT_EQUAL(*(uint64_t*) get_field(ref, 0), value);
+
+    /* Turned off, the pool maps its subpools itself */
+    CU_ASSERT_EQUAL(pool_set_provisioning(pool, 0), 0);
+    calls = pool_syscall_count();
+    CU_ASSERT_EQUAL(pool_grow(&pool, 4*PAGE_SIZE), 0);
+    CU_ASSERT_NOT_EQUAL(pool_syscall_count(), calls);
+
+    CU_ASSERT_EQUAL(pool_destroy(&pool), 0);
+    pool_set_map_mode(old_mode);
+}
+
+void
+t_field_inline(void)
+{
+    CU_ASSERT_EQUAL(get_type_descriptor(UINT16_MAX), NULL);
+
+    /* Every field of every object agrees with the library, across subpools */
+    const TYPE_ID types[] = {COMPOSITE_TYPE_2_ID, PAIR_TYPE_ID};
+    for (size_t t = 0 ; t < sizeof(types) / sizeof(types[0]) ; ++t) {
+        const type_descriptor *desc = get_type_descriptor(types[t]);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(desc);
+        CU_ASSERT_EQUAL(desc->type_id, types[t]);
+
+        pool_reference pool = pool_create(types[t]);
+        CU_ASSERT_EQUAL(pool_grow(&pool, 2*PAGE_SIZE + 3), 0);
+
+        int addr_errors = 0;
+        int value_errors = 0;
+        for (size_t i = 0 ; i < 2*PAGE_SIZE + 3 ; i += 7) {
+            global_reference ref = pool_get_ref(pool, i);
+            for (size_t f = 0 ; f < desc->field_count ; ++f) {
+                addr_errors += get_field_inline(desc, ref, f) !=
+                               get_field(ref, f);
+
+                uint64_t value = i*desc->field_count + f;
+                set_field_inline(desc, ref, f, &value);
+                uint64_t read = 0;
+                memcpy(&read, get_field(ref, f), desc->fields[f].size);
+                value_errors += read != (value & (desc->fields[f].size < 8 ?
+                    ((uint64_t) 1 << 8*desc->fields[f].size) - 1 : ~0llu));
+            }
+        }
+        CU_ASSERT_EQUAL(addr_errors, 0);
+        CU_ASSERT_EQUAL(value_errors, 0);
+
+        pool_destroy(&pool);
+    }
+
+    /* Short, long and null references */
+    const type_descriptor *desc = get_type_descriptor(LIST_TYPE_ID);
+    pool_reference list_pool = pool_create(LIST_TYPE_ID);
+    pool_grow(&list_pool, 5001);
+    global_reference ref_0 = pool_get_ref(list_pool, 0);
+    global_reference ref_1 = pool_get_ref(list_pool, 1);
+    global_reference ref_2 = pool_get_ref(list_pool, 2);
+    global_reference remote_ref = pool_get_ref(list_pool, 5000);
+
+    CU_ASSERT_EQUAL(get_field_reference_inline(desc, ref_0, 0), NULL_REF);
+    set_field_reference(ref_0, 0, ref_2);
+    set_field_reference(ref_2, 0, ref_0);
+    set_field_reference(ref_1, 0, remote_ref);
+    set_field_reference(remote_ref, 0, ref_1);
+    CU_ASSERT_EQUAL(get_field_reference_inline(desc, ref_0, 0), ref_2);
+    CU_ASSERT_EQUAL(get_field_reference_inline(desc, ref_2, 0), ref_0);
+    CU_ASSERT_EQUAL(get_field_reference_inline(desc, ref_1, 0), remote_ref);
+    CU_ASSERT_EQUAL(get_field_reference_inline(desc, remote_ref, 0), ref_1);
+
+    pool_destroy(&list_pool);
+}
+
+void
+t_field_batch(void)
+{
+    const size_t count = 3*PAGE_SIZE;
+    const size_t n = 1000;
+
+    pool_reference pool = pool_create(COMPOSITE_TYPE_2_ID);
+    CU_ASSERT_EQUAL_FATAL(pool_grow(&pool, count), 0);
+
+    global_reference refs[n];
+    srandom(7);
+    for (size_t i = 0 ; i < n ; ++i)
+        refs[i] = pool_get_ref(pool, (size_t) random() % count);
+
+    /* Nothing to do */
+    CU_ASSERT_EQUAL(get_field_batch(refs, 0, 0, NULL), 0);
+    CU_ASSERT_NOT_EQUAL(get_field_batch(NULL, n, 0, NULL), 0);
+
+    /* 8 byte and 1 byte fields, read back one at a time and in a batch */
+    uint64_t longs[n];
+    uint64_t long_out[n];
+    char chars[n];
+    char char_out[n];
+    for (size_t i = 0 ; i < n ; ++i) {
+        longs[i] = refs[i] ^ 0x5555;
+        chars[i] = (char) refs[i];
+    }
+
+    CU_ASSERT_EQUAL(set_field_batch(refs, n, 4, longs), 0);
+    CU_ASSERT_EQUAL(set_field_batch(refs, n, 5, chars), 0);
+    CU_ASSERT_EQUAL(get_field_batch(refs, n, 4, long_out), 0);
+    CU_ASSERT_EQUAL(get_field_batch(refs, n, 5, char_out), 0);
+
+    /* Values depend only on the reference, so repeated ones agree */
+    int errors = 0;
+    for (size_t i = 0 ; i < n ; ++i) {
+        errors += long_out[i] != longs[i];
+        errors += char_out[i] != chars[i];
+        errors += *(uint64_t*) get_field(refs[i], 4) != longs[i];
+        errors += *(char*) get_field(refs[i], 5) != chars[i];
+    }
+    CU_ASSERT_EQUAL(errors, 0);
+
+    /* Fewer references than are prefetched ahead */
+    uint64_t few[3] = {1, 2, 3};
+    CU_ASSERT_EQUAL(set_field_batch(refs, 3, 0, few), 0);
+    CU_ASSERT_EQUAL(get_field_batch(refs, 3, 0, long_out), 0);
+    CU_ASSERT_EQUAL(long_out[2], 3);
+
+    /* The last value for a repeated reference wins */
+    global_reference same[2] = {refs[0], refs[0]};
+    CU_ASSERT_EQUAL(set_field_batch(same, 2, 0, few), 0);
+    CU_ASSERT_EQUAL(*(uint64_t*) get_field(refs[0], 0), 2);
+
+    pool_destroy(&pool);
+}
+
+void
+t_pool_cache_colored(void)
+{
+    const size_t count = 3*PAGE_SIZE + 17;
+
+    pool_reference a = pool_create(WIDE_COLORED_TYPE_ID);
+    pool_reference b = pool_create(WIDE_COLORED_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(a, NULL_POOL);
+    CU_ASSERT_NOT_EQUAL_FATAL(b, NULL_POOL);
+    CU_ASSERT_EQUAL_FATAL(pool_grow(&a, count), 0);
+    CU_ASSERT_EQUAL_FATAL(pool_grow(&b, count), 0);
+
+    /* Every field of an element, and every pool, is on its own cache set */
+    pool_struct pa = {.raw_val = a};
+    pool_struct pb = {.raw_val = b};
+    global_reference ra = pool_get_ref(a, 5);
+    global_reference rb = pool_get_ref(b, 5);
+    for (size_t f = 0 ; f < 8 ; ++f) {
+        uintptr_t addr = (uintptr_t) get_field(ra, f);
+        CU_ASSERT_EQUAL(addr % PAGE_SIZE,
+                        (f + (pa.pool_id & (POOL_COLORS - 1)))*64 + 5*8);
+        CU_ASSERT_EQUAL((uintptr_t) get_field(rb, f) % PAGE_SIZE,
+                        (f + (pb.pool_id & (POOL_COLORS - 1)))*64 + 5*8);
+    }
+    CU_ASSERT_PTR_EQUAL(pool_to_array(a), get_field(pool_get_ref(a, 0), 0));
+
+    /* Fields do not overlap, within or across subpools */
+    for (size_t i = 0 ; i < count ; ++i) {
+        global_reference ref = pool_get_ref(a, i);
+        for (uint64_t f = 0 ; f < 8 ; ++f) {
+            uint64_t value = i*8 + f;
+            set_field(ref, f, &value);
+        }
+    }
+
+    const type_descriptor *desc = get_type_descriptor(WIDE_COLORED_TYPE_ID);
+    int errors = 0;
+    for (size_t i = 0 ; i < count ; ++i) {
+        global_reference ref = pool_get_ref(a, i);
+        for (size_t f = 0 ; f < 8 ; ++f) {
+            errors += *(uint64_t*) get_field(ref, f) != i*8 + f;
+            errors += *(uint64_t*) get_field_inline(desc, ref, f) != i*8 + f;
+        }
+    }
+    CU_ASSERT_EQUAL(errors, 0);
+
+    pool_destroy(&a);
+    pool_destroy(&b);
+
+    /* Each window of a large pool has its own color */
+    const size_t window = 1 << 14;
+    unsigned old_shift = pool_set_max_window_shift(14);
+    pool_reference large = pool_create_large(WIDE_COLORED_TYPE_ID, 2*window);
+    CU_ASSERT_NOT_EQUAL_FATAL(large, NULL_POOL);
+    CU_ASSERT_EQUAL(pool_grow(&large, 2*window), 0);
+
+    for (size_t i = 0 ; i < 2*window ; i += 1000) {
+        uint64_t value = i;
+        set_field(pool_get_ref(large, i), 7, &value);
+    }
+    errors = 0;
+    for (size_t i = 0 ; i < 2*window ; i += 1000)
+        errors += *(uint64_t*) get_field(pool_get_ref(large, i), 7) != i;
+    CU_ASSERT_EQUAL(errors, 0);
+
+    pool_destroy(&large);
+    pool_set_max_window_shift(old_shift);
+}
+
+void
+t_pool_interleaved(void)
+{
+    const size_t count = 2*PAGE_SIZE + 9;
+
+    pool_reference pool = pool_create(KV_TREE_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(pool, NULL_POOL);
+    CU_ASSERT_EQUAL_FATAL(pool_grow(&pool, count), 0);
+
+    /* A key and its value share a cache line, the references do not */
+    global_reference ref = pool_get_ref(pool, PAGE_SIZE + 3);
+    char *key = get_field(ref, 2);
+    char *value = get_field(ref, 3);
+    CU_ASSERT_PTR_EQUAL(value, key + 8);
+    CU_ASSERT_EQUAL((uintptr_t) key / 64, (uintptr_t) (value + 7) / 64);
+    CU_ASSERT_PTR_EQUAL(get_field(pool_get_ref(pool, PAGE_SIZE + 4), 2),
+                        key + 16);
+    CU_ASSERT_PTR_EQUAL(get_field(pool_get_ref(pool, PAGE_SIZE + 4), 1),
+                        (char*) get_field(ref, 1) + 2);
+
+    for (size_t i = 0 ; i < count ; ++i) {
+        uint64_t k = i;
+        uint64_t v = ~i;
+        ref = pool_get_ref(pool, i);
+        set_field(ref, 2, &k);
+        set_field(ref, 3, &v);
+        set_field_reference(ref, 0, pool_get_ref(pool, (i + 1) % count));
+    }
+
+    const type_descriptor *desc = get_type_descriptor(KV_TREE_TYPE_ID);
+    int errors = 0;
+    for (size_t i = 0 ; i < count ; ++i) {
+        ref = pool_get_ref(pool, i);
+        errors += *(uint64_t*) get_field(ref, 2) != i;
+        errors += *(uint64_t*) get_field(ref, 3) != ~i;
+        errors += *(uint64_t*) get_field_inline(desc, ref, 3) != ~i;
+        errors += get_field_reference(ref, 0) !=
+                  pool_get_ref(pool, (i + 1) % count);
+    }
+    CU_ASSERT_EQUAL(errors, 0);
+
+    /* Freeing clears the whole group, and nothing around it */
+    ref = pool_get_ref(pool, 7);
+    CU_ASSERT_EQUAL(pool_free(ref), 0);
+    CU_ASSERT_EQUAL(*(uint64_t*) get_field(ref, 2), 0);
+    CU_ASSERT_EQUAL(*(uint64_t*) get_field(ref, 3), 0);
+    CU_ASSERT_EQUAL(*(uint64_t*) get_field(pool_get_ref(pool, 6), 3), ~6llu);
+    CU_ASSERT_EQUAL(*(uint64_t*) get_field(pool_get_ref(pool, 8), 2), 8);
+
+    /* Batches stride over the group */
+    global_reference refs[3] = {
+        pool_get_ref(pool, 1), pool_get_ref(pool, PAGE_SIZE), pool_get_ref(pool, 2)
+    };
+    uint64_t values[3];
+    CU_ASSERT_EQUAL(get_field_batch(refs, 3, 3, values), 0);
+    CU_ASSERT_EQUAL(values[0], ~1llu);
+    CU_ASSERT_EQUAL(values[1], ~(uint64_t) PAGE_SIZE);
+    CU_ASSERT_EQUAL(values[2], ~2llu);
+
+    pool_destroy(&pool);
+}
@@ -30,4 +30,46 @@ t_pool_shrink(void);
 void
 t_pool_destroy(void);
 
+void
+t_pool_free(void);
+
+void
+t_pool_id_reuse(void);
+
+void
+t_pool_map_mode(void);
+
+void
+t_pool_alloc_range(void);
+
+void
+t_pool_alloc_shared(void);
+
+void
+t_pool_page_mode(void);
+
+void
+t_pool_file(void);
+
+void
+t_pool_sub_pool_shift(void);
+
+void
+t_pool_create_large(void);
+
+void
+t_pool_provisioning(void);
+
+void
+t_field_inline(void);
+
+void
+t_field_batch(void);
+
+void
+t_pool_cache_colored(void);
+
+void
+t_pool_interleaved(void);
+
 #endif
@@ -1,4 +1,6 @@
 
+#include <string.h>
+
 #include "test_pool_map.h"
 
 static void 
@@ -7,6 +9,22 @@ square(void *x, void *y)
     *((uint64_t*) y) = (*((uint64_t*)x)) * (*((uint64_t*)x));
 }
 
+static void
+weighted_sum(void **x, void *y)
+{
+    *((int64_t*) y) = *((int64_t*) x[0]) + 2 * *((int64_t*) x[1]) +
+                      3 * *((int64_t*) x[2]);
+}
+
+static size_t live_calls;
+
+static void
+count_and_square(void *x, void *y)
+{
+    ++live_calls;
+    square(x, y);
+}
+
 void
 t_field_map(void)
 {
@@ -79,3 +97,908 @@ t_field_list_map(void)
     pool_destroy(&list_pool);
 
 }
+
+void
+t_field_map_sub_pool_shift(void)
+{
+    /* Source and destination subpools end at different indices */
+    pool_reference pairs = pool_create(PAIR_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(pairs, NULL_POOL);
+
+    size_t pool_size = (1 << 16) + 3*PAGE_SIZE + 7;
+    for (uint64_t i = 0 ; i < pool_size ; ++i)
+        set_field(pool_alloc(&pairs), 1, &i);
+
+    pool_reference column = pool_create(LONG_COLUMN_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(column, NULL_POOL);
+    CU_ASSERT_EQUAL(field_map(pairs, &column, 1, square), 0);
+
+    int cmp_error_count = 0;
+    for (size_t i = 0 ; i < pool_size ; ++i)
+        cmp_error_count += i*i != *(uint64_t*) get_field(pool_get_ref(column, i),
+                                                         0);
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    /* And back again, into a pool with the default geometry */
+    pool_reference long_pool = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(long_pool, NULL_POOL);
+    CU_ASSERT_EQUAL(field_map(column, &long_pool, 0, square), 0);
+
+    uint64_t *result = pool_to_array(long_pool);
+    cmp_error_count = 0;
+    for (size_t i = 0 ; i < pool_size ; ++i)
+        cmp_error_count += i*i*i*i != result[i];
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    pool_destroy(&long_pool);
+    pool_destroy(&column);
+    pool_destroy(&pairs);
+}
+
+void
+t_field_map_large_pool(void)
+{
+    const size_t window = 1 << 14;
+    unsigned old_shift = pool_set_max_window_shift(14);
+
+    pool_reference list_pool = pool_create_large(LIST_TYPE_ID, 3*window);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+
+    size_t list_size = 2*window + 100;
+    global_reference head = NULL_REF;
+    for (uint64_t i = 0 ; i < list_size ; ++i) {
+        global_reference tmp = pool_alloc(&list_pool);
+        set_field(tmp, 1, &i);
+        set_field_reference(tmp, 0, head);
+        head = tmp;
+    }
+
+    /* From a large pool into a large pool and into an ordinary one */
+    pool_reference large_longs = pool_create_large(LONG_TYPE_ID, list_size);
+    CU_ASSERT_NOT_EQUAL_FATAL(large_longs, NULL_POOL);
+    CU_ASSERT_EQUAL(field_map(list_pool, &large_longs, 1, square), 0);
+
+    pool_reference long_pool = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(long_pool, NULL_POOL);
+    CU_ASSERT_EQUAL(field_map(large_longs, &long_pool, 0, square), 0);
+
+    uint64_t *result = pool_to_array(long_pool);
+    int cmp_error_count = 0;
+    for (size_t i = 0 ; i < list_size ; ++i) {
+        uint64_t *square_i = get_field(pool_get_ref(large_longs, i), 0);
+        cmp_error_count += i*i != *square_i;
+        cmp_error_count += i*i*i*i != result[i];
+    }
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+    pool_destroy(&long_pool);
+
+    /* Walking the list, newest first */
+    long_pool = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(long_pool, NULL_POOL);
+    CU_ASSERT_EQUAL(field_list_map(head, &long_pool, 1, square), 0);
+
+    result = pool_to_array(long_pool);
+    cmp_error_count = 0;
+    for (size_t i = 0 ; i < list_size ; ++i) {
+        size_t value = list_size - 1 - i;
+        cmp_error_count += value*value != result[i];
+    }
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    pool_destroy(&long_pool);
+    pool_destroy(&large_longs);
+    pool_destroy(&list_pool);
+    pool_set_max_window_shift(old_shift);
+}
+
+void
+t_field_op_map(void)
+{
+    pool_reference list_pool = pool_create(LIST_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+
+    /* Not a whole number of subpools, so the kernels have a tail */
+    size_t pool_size = 10000 + 3;
+    for (int64_t i = 0 ; i < (int64_t) pool_size ; ++i) {
+        int64_t value = i - 100;
+        set_field(pool_alloc(&list_pool), 1, &value);
+    }
+
+    /* The same as field_map with a function */
+    field_op op = {.code = FIELD_OP_SQUARE,
+                   .src_type = FIELD_INT64, .dst_type = FIELD_INT64};
+    pool_reference squares = pool_create(LONG_TYPE_ID);
+    pool_reference expected = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_EQUAL(field_op_map(list_pool, &squares, 1, &op), 0);
+    CU_ASSERT_EQUAL(field_map(list_pool, &expected, 1, square), 0);
+    CU_ASSERT_EQUAL(memcmp(pool_to_array(squares), pool_to_array(expected),
+                           pool_size*sizeof(uint64_t)), 0);
+
+    /* Comparisons give 1 or 0 */
+    op.code = FIELD_OP_GT;
+    op.x.i = 50;
+    pool_reference flags = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_EQUAL(field_op_map(list_pool, &flags, 1, &op), 0);
+    int64_t *result = pool_to_array(flags);
+    int cmp_error_count = 0;
+    for (int64_t i = 0 ; i < (int64_t) pool_size ; ++i)
+        cmp_error_count += (i - 100 > 50) != result[i];
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    /* To bytes, which wraps, and from there to doubles */
+    op.code = FIELD_OP_CONVERT;
+    op.dst_type = FIELD_INT8;
+    pool_reference bytes = pool_create(CHAR_TYPE_ID);
+    CU_ASSERT_EQUAL(field_op_map(list_pool, &bytes, 1, &op), 0);
+
+    op.src_type = FIELD_INT8;
+    op.dst_type = FIELD_DOUBLE;
+    pool_reference doubles = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_EQUAL(field_op_map(bytes, &doubles, 0, &op), 0);
+
+    /* And a fused multiply add on the doubles */
+    op.code = FIELD_OP_FMA;
+    op.src_type = FIELD_DOUBLE;
+    op.x.d = 2.0;
+    op.y.d = 0.5;
+    pool_reference fma = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_EQUAL(field_op_map(doubles, &fma, 0, &op), 0);
+
+    int8_t *byte_result = pool_to_array(bytes);
+    double *double_result = pool_to_array(fma);
+    cmp_error_count = 0;
+    for (int64_t i = 0 ; i < (int64_t) pool_size ; ++i) {
+        int8_t byte = (int8_t) (i - 100);
+        cmp_error_count += byte != byte_result[i];
+        cmp_error_count += byte*2.0 + 0.5 != double_result[i];
+    }
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    /* Operations that do not match the fields are refused */
+    pool_reference refused = pool_create(LONG_TYPE_ID);
+    op.src_type = FIELD_INT32;
+    op.dst_type = FIELD_INT32;
+    CU_ASSERT_EQUAL(field_op_map(list_pool, &refused, 1, &op), 1);
+    op.code = FIELD_OP_ADD;
+    op.src_type = FIELD_INT64;
+    op.dst_type = FIELD_DOUBLE;
+    CU_ASSERT_EQUAL(field_op_map(list_pool, &refused, 1, &op), 1);
+    op.dst_type = FIELD_INT64;
+    CU_ASSERT_EQUAL(field_op_map(list_pool, &refused, 99, &op), 1);
+    pool_struct refused_pool = {.raw_val = refused};
+    CU_ASSERT_EQUAL(GET_SIZE_OF_POOL(refused_pool), 0u);
+
+    pool_destroy(&refused);
+    pool_destroy(&fma);
+    pool_destroy(&doubles);
+    pool_destroy(&bytes);
+    pool_destroy(&flags);
+    pool_destroy(&expected);
+    pool_destroy(&squares);
+    pool_destroy(&list_pool);
+}
+
+void
+t_field_op_map_interleaved(void)
+{
+    /* The values of a kv share a group, so neither is contiguous */
+    pool_reference kvs = pool_create(KV_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(kvs, NULL_POOL);
+
+    size_t pool_size = 5000;
+    for (uint64_t i = 0 ; i < pool_size ; ++i) {
+        global_reference ref = pool_alloc(&kvs);
+        uint64_t key = 3*i;
+        set_field(ref, 0, &key);
+        set_field(ref, 1, &i);
+    }
+
+    field_op op = {.code = FIELD_OP_ADD,
+                   .src_type = FIELD_INT64, .dst_type = FIELD_INT64,
+                   .x.i = 7};
+    pool_reference sums = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_EQUAL(field_op_map(kvs, &sums, 1, &op), 0);
+
+    /* And back, into the first field of a group */
+    op.x.i = -7;
+    pool_reference pairs = pool_create(KV_TYPE_ID);
+    CU_ASSERT_EQUAL(field_op_map(sums, &pairs, 0, &op), 0);
+
+    uint64_t *result = pool_to_array(sums);
+    int cmp_error_count = 0;
+    for (uint64_t i = 0 ; i < pool_size ; ++i) {
+        cmp_error_count += i + 7 != result[i];
+        cmp_error_count += i != *(uint64_t*) get_field(pool_get_ref(pairs, i),
+                                                        0);
+    }
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    pool_destroy(&pairs);
+    pool_destroy(&sums);
+    pool_destroy(&kvs);
+}
+
+void
+t_field_map_parallel(void)
+{
+    const size_t window = 1 << 14;
+    unsigned old_shift = pool_set_max_window_shift(14);
+
+    /* A large pool, with a short last run in the last window */
+    size_t pool_size = 3*window + PAGE_SIZE + 5;
+    pool_reference list_pool = pool_create_large(LIST_TYPE_ID, pool_size);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+    for (uint64_t i = 0 ; i < pool_size ; ++i)
+        set_field(pool_alloc(&list_pool), 1, &i);
+
+    unsigned thread_counts[] = {0, 1, 3};
+    unsigned old_threads = map_set_thread_count(0);
+    for (size_t t = 0 ; t < sizeof(thread_counts) / sizeof(unsigned) ; ++t) {
+        CU_ASSERT_EQUAL(map_set_thread_count(thread_counts[t]),
+                        t > 0 ? thread_counts[t - 1] : 0);
+
+        pool_reference long_pool = pool_create(LONG_TYPE_ID);
+        CU_ASSERT_NOT_EQUAL_FATAL(long_pool, NULL_POOL);
+        CU_ASSERT_EQUAL(field_map_parallel(list_pool, &long_pool, 1, square),
+                        0);
+
+        pool_struct p = {.raw_val = long_pool};
+        CU_ASSERT_EQUAL(GET_SIZE_OF_POOL(p), pool_size);
+
+        uint64_t *result = pool_to_array(long_pool);
+        int cmp_error_count = 0;
+        for (size_t i = 0 ; i < pool_size ; ++i)
+            cmp_error_count += i*i != result[i];
+        CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+        pool_destroy(&long_pool);
+    }
+    map_set_thread_count(old_threads);
+
+    pool_destroy(&list_pool);
+    pool_set_max_window_shift(old_shift);
+}
+
+void
+t_field_reduce(void)
+{
+    /* Several chunks, and a short last run */
+    size_t pool_size = 200003;
+    pool_reference longs = pool_create(LONG_TYPE_ID);
+    pool_reference doubles = pool_create(LONG_TYPE_ID);
+    pool_reference bytes = pool_create(CHAR_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(longs, NULL_POOL);
+    CU_ASSERT_NOT_EQUAL_FATAL(doubles, NULL_POOL);
+    CU_ASSERT_NOT_EQUAL_FATAL(bytes, NULL_POOL);
+
+    int64_t sum = 0;
+    int64_t byte_sum = 0;
+    for (int64_t i = 0 ; i < (int64_t) pool_size ; ++i) {
+        int64_t value = i - 100000;
+        double half = 0.5*i;
+        int8_t byte = (int8_t) i;
+        set_field(pool_alloc(&longs), 0, &value);
+        set_field(pool_alloc(&doubles), 0, &half);
+        set_field(pool_alloc(&bytes), 0, &byte);
+        sum += value;
+        byte_sum += byte;
+    }
+
+    uint64_t histogram[10];
+    field_reduce_op op = {.type = FIELD_INT64,
+                          .lo.i = -50000, .hi.i = 50000,
+                          .bins = 10, .histogram = histogram};
+    field_scalar result;
+
+    unsigned thread_counts[] = {3, 1};
+    unsigned old_threads = map_set_thread_count(0);
+    for (size_t t = 0 ; t < sizeof(thread_counts) / sizeof(unsigned) ; ++t) {
+        map_set_thread_count(thread_counts[t]);
+
+        op.code = FIELD_REDUCE_SUM;
+        CU_ASSERT_EQUAL(field_reduce(longs, 0, &op, &result), 0);
+        CU_ASSERT_EQUAL(result.i, sum);
+
+        op.code = FIELD_REDUCE_MIN;
+        CU_ASSERT_EQUAL(field_reduce(longs, 0, &op, &result), 0);
+        CU_ASSERT_EQUAL(result.i, -100000);
+
+        op.code = FIELD_REDUCE_MAX;
+        CU_ASSERT_EQUAL(field_reduce(longs, 0, &op, &result), 0);
+        CU_ASSERT_EQUAL(result.i, (int64_t) pool_size - 100001);
+
+        op.code = FIELD_REDUCE_COUNT;
+        CU_ASSERT_EQUAL(field_reduce(longs, 0, &op, &result), 0);
+        CU_ASSERT_EQUAL(result.i, 100000);
+
+        op.code = FIELD_REDUCE_HISTOGRAM;
+        memset(histogram, 0xff, sizeof(histogram));
+        CU_ASSERT_EQUAL(field_reduce(longs, 0, &op, &result), 0);
+        CU_ASSERT_EQUAL(result.i, 100000);
+        int cmp_error_count = 0;
+        for (size_t b = 0 ; b < 10 ; ++b)
+            cmp_error_count += histogram[b] != 10000;
+        CU_ASSERT_EQUAL(cmp_error_count, 0);
+    }
+    map_set_thread_count(old_threads);
+
+    /* Halves sum exactly, and bytes are signed */
+    op.type = FIELD_DOUBLE;
+    op.code = FIELD_REDUCE_SUM;
+    CU_ASSERT_EQUAL(field_reduce(doubles, 0, &op, &result), 0);
+    CU_ASSERT_EQUAL(result.d, 0.25*(pool_size - 1)*pool_size);
+    op.code = FIELD_REDUCE_MIN;
+    CU_ASSERT_EQUAL(field_reduce(doubles, 0, &op, &result), 0);
+    CU_ASSERT_EQUAL(result.d, 0.0);
+
+    op.type = FIELD_INT8;
+    op.code = FIELD_REDUCE_SUM;
+    CU_ASSERT_EQUAL(field_reduce(bytes, 0, &op, &result), 0);
+    CU_ASSERT_EQUAL(result.i, byte_sum);
+    op.code = FIELD_REDUCE_MIN;
+    CU_ASSERT_EQUAL(field_reduce(bytes, 0, &op, &result), 0);
+    CU_ASSERT_EQUAL(result.i, INT8_MIN);
+
+    /* Operations that do not match the field are refused */
+    CU_ASSERT_EQUAL(field_reduce(longs, 0, &op, &result), 1);
+    op.type = FIELD_INT64;
+    op.code = FIELD_REDUCE_HISTOGRAM;
+    op.bins = 0;
+    CU_ASSERT_EQUAL(field_reduce(longs, 0, &op, &result), 1);
+    op.code = FIELD_REDUCE_SUM;
+    CU_ASSERT_EQUAL(field_reduce(longs, 1, &op, &result), 1);
+
+    /* An empty pool */
+    pool_reference empty = pool_create(LONG_TYPE_ID);
+    op.code = FIELD_REDUCE_MIN;
+    CU_ASSERT_EQUAL(field_reduce(empty, 0, &op, &result), 0);
+    CU_ASSERT_EQUAL(result.i, INT64_MAX);
+
+    pool_destroy(&empty);
+    pool_destroy(&bytes);
+    pool_destroy(&doubles);
+    pool_destroy(&longs);
+}
+
+void
+t_field_reduce_interleaved(void)
+{
+    pool_reference kvs = pool_create(KV_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(kvs, NULL_POOL);
+
+    size_t pool_size = 5000;
+    for (int64_t i = 0 ; i < (int64_t) pool_size ; ++i) {
+        global_reference ref = pool_alloc(&kvs);
+        int64_t key = -i;
+        set_field(ref, 0, &key);
+        set_field(ref, 1, &i);
+    }
+
+    field_reduce_op op = {.code = FIELD_REDUCE_MAX, .type = FIELD_INT64};
+    field_scalar result;
+    CU_ASSERT_EQUAL(field_reduce(kvs, 1, &op, &result), 0);
+    CU_ASSERT_EQUAL(result.i, (int64_t) pool_size - 1);
+    CU_ASSERT_EQUAL(field_reduce(kvs, 0, &op, &result), 0);
+    CU_ASSERT_EQUAL(result.i, 0);
+
+    op.code = FIELD_REDUCE_SUM;
+    CU_ASSERT_EQUAL(field_reduce(kvs, 0, &op, &result), 0);
+    CU_ASSERT_EQUAL(result.i, -(int64_t) ((pool_size - 1)*pool_size / 2));
+
+    pool_destroy(&kvs);
+}
+
+void
+t_field_list_reduce(void)
+{
+    pool_reference list_pool = pool_create(LIST_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+
+    global_reference head = pool_alloc(&list_pool);
+    pool_iterator itr = iterator_new(&list_pool, &head);
+
+    /* Not a whole number of batches */
+    size_t list_size = 10001;
+    for (size_t i = 0 ; i < list_size ; ++i) {
+        iterator_set_field(itr, 1, &i);
+        if (i + 1 < list_size) {
+            iterator_list_insert(itr, pool_alloc(&list_pool));
+            itr = iterator_next(list_pool, itr);
+        }
+        uint64_t deleted = 1000000;
+        set_field(pool_alloc(&list_pool), 1, &deleted);
+    }
+
+    field_reduce_op op = {.code = FIELD_REDUCE_SUM, .type = FIELD_INT64};
+    field_scalar result;
+    CU_ASSERT_EQUAL(field_list_reduce(head, 1, &op, &result), 0);
+    CU_ASSERT_EQUAL(result.i, (int64_t) ((list_size - 1)*list_size / 2));
+
+    op.code = FIELD_REDUCE_MAX;
+    CU_ASSERT_EQUAL(field_list_reduce(head, 1, &op, &result), 0);
+    CU_ASSERT_EQUAL(result.i, (int64_t) list_size - 1);
+
+    uint64_t histogram[4];
+    op.code = FIELD_REDUCE_HISTOGRAM;
+    op.lo.i = 0;
+    op.hi.i = 10000;
+    op.bins = 4;
+    op.histogram = histogram;
+    CU_ASSERT_EQUAL(field_list_reduce(head, 1, &op, &result), 0);
+    CU_ASSERT_EQUAL(result.i, 10000);
+    for (size_t b = 0 ; b < 4 ; ++b)
+        CU_ASSERT_EQUAL(histogram[b], 2500u);
+
+    op.type = FIELD_INT32;
+    CU_ASSERT_EQUAL(field_list_reduce(head, 1, &op, &result), 1);
+
+    iterator_destroy(&itr);
+    pool_destroy(&list_pool);
+}
+
+void
+t_field_filter(void)
+{
+    /* Subpools of 512, several chunks and a short last run */
+    size_t pool_size = 150007;
+    pool_reference pairs = pool_create(PAIR_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(pairs, NULL_POOL);
+    for (int64_t i = 0 ; i < (int64_t) pool_size ; ++i) {
+        global_reference ref = pool_alloc(&pairs);
+        int64_t twice = 2*i;
+        set_field(ref, 0, &twice);
+        set_field(ref, 1, &i);
+    }
+
+    /* The selection is appended after what B already has */
+    pool_reference selected_pairs = pool_create(PAIR_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(selected_pairs, NULL_POOL);
+    for (int64_t i = 0 ; i < 5 ; ++i)
+        set_field(pool_alloc(&selected_pairs), 1, &i);
+
+    size_t words = (pool_size + 63) / 64;
+    uint64_t *selection = malloc(words*sizeof(uint64_t));
+    field_op predicate = {.code = FIELD_OP_IN_RANGE,
+                          .src_type = FIELD_INT64,
+                          .x.i = 1000, .y.i = 140000};
+    size_t selected = 0;
+
+    unsigned old_threads = map_set_thread_count(3);
+    CU_ASSERT_EQUAL(field_filter(pairs, 1, &predicate, selection,
+                                 &selected_pairs, &selected), 0);
+    map_set_thread_count(old_threads);
+    CU_ASSERT_EQUAL(selected, 139000u);
+
+    int cmp_error_count = 0;
+    for (size_t i = 0 ; i < pool_size ; ++i) {
+        int bit = (selection[i / 64] >> (i % 64)) & 1;
+        cmp_error_count += bit != (i >= 1000 && i < 140000);
+    }
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    pool_struct p = {.raw_val = selected_pairs};
+    CU_ASSERT_EQUAL(GET_SIZE_OF_POOL(p), 5 + selected);
+    cmp_error_count = 0;
+    for (size_t i = 0 ; i < selected ; ++i) {
+        global_reference ref = pool_get_ref(selected_pairs, 5 + i);
+        cmp_error_count += *(int64_t*) get_field(ref, 1) != (int64_t) i + 1000;
+        cmp_error_count += *(int64_t*) get_field(ref, 0) != 2*((int64_t) i + 1000);
+    }
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+    CU_ASSERT_EQUAL(*(int64_t*) get_field(pool_get_ref(selected_pairs, 4), 1),
+                    4);
+
+    /* Just the count */
+    predicate.code = FIELD_OP_GT;
+    predicate.x.i = 150000;
+    CU_ASSERT_EQUAL(field_filter(pairs, 0, &predicate, NULL, NULL, &selected),
+                    0);
+    CU_ASSERT_EQUAL(selected, pool_size - 75001);
+
+    /* Predicates that are not comparisons, and pools of other types */
+    pool_reference longs = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_EQUAL(field_filter(pairs, 0, &predicate, NULL, &longs, NULL), 1);
+    predicate.code = FIELD_OP_ADD;
+    CU_ASSERT_EQUAL(field_filter(pairs, 0, &predicate, NULL, NULL, NULL), 1);
+    predicate.code = FIELD_OP_LT;
+    CU_ASSERT_EQUAL(field_filter(pairs, 99, &predicate, NULL, NULL, NULL), 1);
+
+    /* Lists can be tested, but not copied away from their local references */
+    pool_reference list_pool = pool_create(LIST_TYPE_ID);
+    pool_reference selected_nodes = pool_create(LIST_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+    CU_ASSERT_NOT_EQUAL_FATAL(selected_nodes, NULL_POOL);
+    global_reference prev = NULL_REF;
+    for (int64_t i = 0 ; i < 100 ; ++i) {
+        global_reference node = pool_alloc(&list_pool);
+        set_field(node, 1, &i);
+        if (NULL_REF != prev)
+            set_field_reference(prev, 0, node);
+        prev = node;
+    }
+
+    predicate.src_type = FIELD_INT64;
+    predicate.x.i = 50;
+    CU_ASSERT_EQUAL(field_filter(list_pool, 1, &predicate, NULL,
+                                 &selected_nodes, NULL), 1);
+    pool_struct selected_pool = {.raw_val = selected_nodes};
+    CU_ASSERT_EQUAL(GET_SIZE_OF_POOL(selected_pool), 0u);
+    CU_ASSERT_EQUAL(field_filter(list_pool, 1, &predicate, NULL, NULL,
+                                 &selected), 0);
+    CU_ASSERT_EQUAL(selected, 50u);
+
+    pool_destroy(&selected_nodes);
+    pool_destroy(&list_pool);
+    pool_destroy(&longs);
+    free(selection);
+    pool_destroy(&selected_pairs);
+    pool_destroy(&pairs);
+}
+
+void
+t_field_filter_interleaved(void)
+{
+    /* The values of a kv are not contiguous, so they are gathered */
+    pool_reference kvs = pool_create(KV_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(kvs, NULL_POOL);
+
+    size_t pool_size = 1000;
+    for (int64_t i = 0 ; i < (int64_t) pool_size ; ++i) {
+        global_reference ref = pool_alloc(&kvs);
+        int64_t key = i;
+        int64_t value = i % 7;
+        set_field(ref, 0, &key);
+        set_field(ref, 1, &value);
+    }
+
+    field_op predicate = {.code = FIELD_OP_EQ,
+                          .src_type = FIELD_INT64,
+                          .x.i = 3};
+    pool_reference sevens = pool_create(KV_TYPE_ID);
+    size_t selected = 0;
+    CU_ASSERT_EQUAL(field_filter(kvs, 1, &predicate, NULL, &sevens,
+                                 &selected), 0);
+    CU_ASSERT_EQUAL(selected, (pool_size - 3 + 6) / 7);
+
+    int cmp_error_count = 0;
+    for (size_t i = 0 ; i < selected ; ++i) {
+        global_reference ref = pool_get_ref(sevens, i);
+        cmp_error_count += *(int64_t*) get_field(ref, 0) != 7*(int64_t) i + 3;
+        cmp_error_count += *(int64_t*) get_field(ref, 1) != 3;
+    }
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    pool_destroy(&sevens);
+    pool_destroy(&kvs);
+}
+
+void
+t_field_zip_map(void)
+{
+    pool_reference wides = pool_create(WIDE_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(wides, NULL_POOL);
+
+    /* Several subpools and a short last one */
+    size_t pool_size = 10000;
+    CU_ASSERT_EQUAL_FATAL(pool_grow(&wides, pool_size), 0);
+    for (int64_t i = 0 ; i < (int64_t) pool_size ; ++i) {
+        global_reference ref = pool_get_ref(wides, i);
+        int64_t values[3] = {i, i - 5000, 7};
+        double reals[2] = {0.5 * i, 2.0};
+        for (size_t k = 0 ; k < 3 ; ++k)
+            set_field(ref, k, &values[k]);
+        set_field(ref, 3, &reals[0]);
+        set_field(ref, 4, &reals[1]);
+    }
+
+    /* In place, from three fields into a fourth */
+    const size_t sum_fields[3] = {0, 1, 2};
+    CU_ASSERT_EQUAL(field_zip_map(wides, sum_fields, 3, &wides, 5,
+                                  weighted_sum), 0);
+
+    /* Into a field that is also an input */
+    const size_t mul_fields[2] = {1, 0};
+    const field_op mul = {.code = FIELD_OP_MUL,
+                          .src_type = FIELD_INT64,
+                          .dst_type = FIELD_INT64};
+    CU_ASSERT_EQUAL(field_zip_op_map(wides, mul_fields, &wides, 1, &mul), 0);
+
+    const size_t fma_fields[3] = {3, 4, 3};
+    const field_op fma = {.code = FIELD_OP_FMA,
+                          .src_type = FIELD_DOUBLE,
+                          .dst_type = FIELD_DOUBLE};
+    CU_ASSERT_EQUAL(field_zip_op_map(wides, fma_fields, &wides, 6, &fma), 0);
+
+    /* Into an empty pool, which grows */
+    pool_reference in_range = pool_create(LONG_TYPE_ID);
+    const size_t range_fields[3] = {0, 2, 5};
+    const field_op range = {.code = FIELD_OP_IN_RANGE,
+                            .src_type = FIELD_INT64,
+                            .dst_type = FIELD_INT64};
+    CU_ASSERT_EQUAL(field_zip_op_map(wides, range_fields, &in_range, 0,
+                                     &range), 0);
+    pool_struct p = {.raw_val = in_range};
+    CU_ASSERT_EQUAL_FATAL(GET_SIZE_OF_POOL(p), pool_size);
+    int64_t *flags = pool_to_array(in_range);
+
+    int cmp_error_count = 0;
+    for (int64_t i = 0 ; i < (int64_t) pool_size ; ++i) {
+        global_reference ref = pool_get_ref(wides, i);
+        int64_t sum = i + 2 * (i - 5000) + 21;
+        cmp_error_count += *(int64_t*) get_field(ref, 5) != sum;
+        cmp_error_count += *(int64_t*) get_field(ref, 1) != i * (i - 5000);
+        cmp_error_count += *(int64_t*) get_field(ref, 0) != i;
+        cmp_error_count += *(double*) get_field(ref, 6) != 1.5 * i;
+        cmp_error_count += flags[i] != (i >= 7 && i < sum);
+    }
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    /* Missing fields and operations that do not zip */
+    const size_t missing_fields[2] = {0, 8};
+    CU_ASSERT_EQUAL(field_zip_op_map(wides, missing_fields, &wides, 1, &mul),
+                    1);
+    CU_ASSERT_EQUAL(field_zip_map(wides, sum_fields, 0, &wides, 5,
+                                  weighted_sum), 1);
+    const field_op convert = {.code = FIELD_OP_CONVERT,
+                              .src_type = FIELD_INT64,
+                              .dst_type = FIELD_INT64};
+    CU_ASSERT_EQUAL(field_zip_op_map(wides, mul_fields, &wides, 1, &convert),
+                    1);
+
+    pool_destroy(&in_range);
+    pool_destroy(&wides);
+}
+
+void
+t_field_zip_map_interleaved(void)
+{
+    pool_reference kvs = pool_create(KV_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(kvs, NULL_POOL);
+
+    size_t pool_size = 1000;
+    for (int64_t i = 0 ; i < (int64_t) pool_size ; ++i) {
+        global_reference ref = pool_alloc(&kvs);
+        int64_t value = 3;
+        set_field(ref, 0, &i);
+        set_field(ref, 1, &value);
+    }
+
+    /* Fields in a group are done one element at a time */
+    const size_t fields[2] = {0, 1};
+    const field_op add = {.code = FIELD_OP_ADD,
+                          .src_type = FIELD_INT64,
+                          .dst_type = FIELD_INT64};
+    CU_ASSERT_EQUAL(field_zip_op_map(kvs, fields, &kvs, 1, &add), 0);
+
+    int cmp_error_count = 0;
+    for (int64_t i = 0 ; i < (int64_t) pool_size ; ++i) {
+        global_reference ref = pool_get_ref(kvs, i);
+        cmp_error_count += *(int64_t*) get_field(ref, 0) != i;
+        cmp_error_count += *(int64_t*) get_field(ref, 1) != i + 3;
+    }
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    pool_destroy(&kvs);
+}
+
+void
+t_field_map_live(void)
+{
+    pool_reference longs = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(longs, NULL_POOL);
+
+    /* Two subpools and a short last word */
+    size_t pool_size = 4096 + 1000;
+    global_reference *refs = malloc(pool_size*sizeof(global_reference));
+    for (uint64_t i = 0 ; i < pool_size ; ++i) {
+        refs[i] = pool_alloc(&longs);
+        set_field(refs[i], 0, &i);
+    }
+
+    /* Nothing freed is mapped as field_map does */
+    pool_reference squares = pool_create(LONG_TYPE_ID);
+    live_calls = 0;
+    CU_ASSERT_EQUAL(field_map_live(longs, &squares, 0, count_and_square), 0);
+    CU_ASSERT_EQUAL(live_calls, pool_size);
+    pool_destroy(&squares);
+
+    /* Every seventh, a whole word, and the last element */
+    size_t freed = 0;
+    int free_error_count = 0;
+    for (size_t i = 0 ; i < pool_size ; ++i) {
+        if (i % 7 == 3 || (i >= 128 && i < 192) || i == pool_size - 1) {
+            free_error_count += pool_free(refs[i]) != 0;
+            ++freed;
+        }
+    }
+    CU_ASSERT_EQUAL(free_error_count, 0);
+
+    squares = pool_create(LONG_TYPE_ID);
+    live_calls = 0;
+    CU_ASSERT_EQUAL(field_map_live(longs, &squares, 0, count_and_square), 0);
+    CU_ASSERT_EQUAL(live_calls, pool_size - freed);
+
+    pool_reference sums = pool_create(LONG_TYPE_ID);
+    const field_op add = {.code = FIELD_OP_ADD,
+                          .src_type = FIELD_INT64,
+                          .dst_type = FIELD_INT64,
+                          .x.i = 1};
+    CU_ASSERT_EQUAL(field_op_map_live(longs, &sums, 0, &add), 0);
+
+    pool_struct p = {.raw_val = squares};
+    CU_ASSERT_EQUAL_FATAL(GET_SIZE_OF_POOL(p), pool_size);
+    p.raw_val = sums;
+    CU_ASSERT_EQUAL_FATAL(GET_SIZE_OF_POOL(p), pool_size);
+    uint64_t *square_result = pool_to_array(squares);
+    uint64_t *sum_result = pool_to_array(sums);
+
+    int cmp_error_count = 0;
+    for (uint64_t i = 0 ; i < pool_size ; ++i) {
+        int dead = i % 7 == 3 || (i >= 128 && i < 192) || i == pool_size - 1;
+        cmp_error_count += square_result[i] != (dead ? 0 : i*i);
+        cmp_error_count += sum_result[i] != (dead ? 0 : i + 1);
+    }
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    /* A reused slot is live again */
+    global_reference reused = pool_alloc(&longs);
+    CU_ASSERT_NOT_EQUAL(reused, NULL_REF);
+    pool_destroy(&squares);
+    squares = pool_create(LONG_TYPE_ID);
+    live_calls = 0;
+    CU_ASSERT_EQUAL(field_map_live(longs, &squares, 0, count_and_square), 0);
+    CU_ASSERT_EQUAL(live_calls, pool_size - freed + 1);
+
+    pool_destroy(&sums);
+    pool_destroy(&squares);
+    pool_destroy(&longs);
+    free(refs);
+}
+
+void
+t_field_list_op_map(void)
+{
+    pool_reference list_pool = pool_create(LIST_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+
+    global_reference head = pool_alloc(&list_pool);
+    pool_iterator itr = iterator_new(&list_pool, &head);
+
+    /* Nodes follow each other in the pool, but for a few that are unlinked */
+    size_t list_size = 20000;
+    for (size_t i = 0 ; i < list_size ; ++i) {
+        iterator_set_field(itr, 1, &i);
+        if (i + 1 < list_size)
+            iterator_list_insert(itr, pool_alloc(&list_pool));
+        itr = iterator_next(list_pool, itr);
+    }
+
+    itr = iterator_from_reference(head);
+    for (size_t i = 0 ; i < list_size ; ++i) {
+        if (i % 5000 == 4000) {
+            iterator_list_remove(itr);
+            ++i;
+        }
+        itr = iterator_next(list_pool, itr);
+    }
+
+    /* B starts part way into a subpool, so runs are split */
+    pool_reference long_pool = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_EQUAL_FATAL(pool_grow(&long_pool, 100), 0);
+
+    const field_op add = {.code = FIELD_OP_ADD,
+                          .src_type = FIELD_INT64,
+                          .dst_type = FIELD_INT64,
+                          .x.i = 3};
+    CU_ASSERT_EQUAL(field_list_op_map(head, &long_pool, 1, &add), 0);
+
+    pool_struct p = {.raw_val = long_pool};
+    size_t mapped = GET_SIZE_OF_POOL(p) - 100;
+    CU_ASSERT_EQUAL(mapped, list_size - 4);
+
+    uint64_t *result = pool_to_array(long_pool);
+    uint64_t expected_sum = 0;
+    int cmp_error_count = 0;
+    size_t k = 100;
+    for (size_t i = 0 ; i < list_size && k < GET_SIZE_OF_POOL(p) ; ++i) {
+        if (i % 5000 == 4001)
+            continue;
+        cmp_error_count += result[k++] != i + 3;
+        expected_sum += i;
+    }
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    /* The same runs are reduced in place */
+    const field_reduce_op sum = {.code = FIELD_REDUCE_SUM,
+                                 .type = FIELD_INT64};
+    field_scalar total;
+    CU_ASSERT_EQUAL(field_list_reduce(head, 1, &sum, &total), 0);
+    CU_ASSERT_EQUAL((uint64_t) total.i, expected_sum);
+
+    /* And mapped with a function */
+    pool_reference squares = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_EQUAL(field_list_map(head, &squares, 1, square), 0);
+    p.raw_val = squares;
+    CU_ASSERT_EQUAL_FATAL(GET_SIZE_OF_POOL(p), list_size - 4);
+    result = pool_to_array(squares);
+    cmp_error_count = 0;
+    k = 0;
+    for (uint64_t i = 0 ; i < list_size ; ++i) {
+        if (i % 5000 == 4001)
+            continue;
+        cmp_error_count += result[k++] != i*i;
+    }
+    CU_ASSERT_EQUAL(cmp_error_count, 0);
+
+    pool_destroy(&squares);
+    pool_destroy(&long_pool);
+    pool_destroy(&list_pool);
+}
+
+void
+t_field_list_map_parallel(void)
+{
+    pool_reference list_pool = pool_create(LIST_TYPE_ID);
+    CU_ASSERT_NOT_EQUAL_FATAL(list_pool, NULL_POOL);
+
+    /* Nodes in a scattered order, with many links too long to be short */
+    size_t list_size = 30000;
+    global_reference *refs = malloc(list_size*sizeof(global_reference));
+    for (size_t i = 0 ; i < list_size ; ++i)
+        refs[i] = pool_alloc(&list_pool);
+
+    /* Node k of the list, linked directly as iterators can not follow it */
+#define SCATTERED_NODE(k) refs[((k)*7919) % list_size]
+    int link_error_count = 0;
+    for (uint64_t k = 0 ; k < list_size ; ++k) {
+        set_field(SCATTERED_NODE(k), 1, &k);
+        if (k + 1 < list_size)
+            link_error_count += set_field_reference(SCATTERED_NODE(k), 0,
+                                                    SCATTERED_NODE(k + 1));
+    }
+
+    /* Unlinked nodes still point into the list */
+    for (size_t k = 500 ; k + 2 < list_size ; k += 1000)
+        link_error_count += set_field_reference(SCATTERED_NODE(k), 0,
+                                                SCATTERED_NODE(k + 2));
+    CU_ASSERT_EQUAL(link_error_count, 0);
+
+    pool_reference serial = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_EQUAL(field_list_map(refs[0], &serial, 1, square), 0);
+
+    unsigned thread_counts[] = {0, 1, 3};
+    for (size_t t = 0 ; t < sizeof(thread_counts)/sizeof(*thread_counts) ; ++t) {
+        unsigned old_threads = map_set_thread_count(thread_counts[t]);
+
+        pool_reference parallel = pool_create(LONG_TYPE_ID);
+        CU_ASSERT_EQUAL(field_list_map_parallel(list_pool, refs[0],
+                                                &parallel, 1, square), 0);
+        map_set_thread_count(old_threads);
+
+        pool_struct p = {.raw_val = parallel};
+        CU_ASSERT_EQUAL_FATAL(GET_SIZE_OF_POOL(p), list_size - 30);
+        CU_ASSERT_EQUAL(memcmp(pool_to_array(parallel), pool_to_array(serial),
+                               (list_size - 30)*sizeof(uint64_t)), 0);
+        pool_destroy(&parallel);
+    }
+
+    /* A list that starts part way along */
+    pool_reference tail = pool_create(LONG_TYPE_ID);
+    CU_ASSERT_EQUAL(field_list_map_parallel(list_pool, SCATTERED_NODE(20000),
+                                            &tail, 1, square), 0);
+#undef SCATTERED_NODE
+    pool_struct p = {.raw_val = tail};
+    CU_ASSERT_EQUAL_FATAL(GET_SIZE_OF_POOL(p), 10000 - 10);
+    CU_ASSERT_EQUAL(memcmp(pool_to_array(tail),
+                           (uint64_t*) pool_to_array(serial) + 20000 - 20,
+                           (10000 - 10)*sizeof(uint64_t)), 0);
+
+    /* A list in another pool */
+    CU_ASSERT_EQUAL(field_list_map_parallel(serial, refs[0], &tail, 1,
+                                            square), 1);
+
+    pool_destroy(&tail);
+    pool_destroy(&serial);
+    pool_destroy(&list_pool);
+    free(refs);
+}
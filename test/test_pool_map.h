@@ -14,5 +14,50 @@ t_field_map(void);
 void
 t_field_list_map(void);
 
+void
+t_field_map_sub_pool_shift(void);
+
+void
+t_field_map_large_pool(void);
+
+void
+t_field_op_map(void);
+
+void
+t_field_op_map_interleaved(void);
+
+void
+t_field_map_parallel(void);
+
+void
+t_field_reduce(void);
+
+void
+t_field_reduce_interleaved(void);
+
+void
+t_field_list_reduce(void);
+
+void
+t_field_filter(void);
+
+void
+t_field_filter_interleaved(void);
+
+void
+t_field_zip_map(void);
+
+void
+t_field_zip_map_interleaved(void);
+
+void
+t_field_map_live(void);
+
+void
+t_field_list_op_map(void);
+
+void
+t_field_list_map_parallel(void);
+
 #endif
 
@@ -7,19 +7,23 @@
 #include "test_reference_table.h"
 #include "test_gc.h"
 #include "test_pool_map.h"
+#include "test_type_gen.h"
+#include "test_ohmm_pool.h"
 
 #define DIE(msg) do { fprintf(stderr, "Failed to add test %s\n", msg) ; goto cleanup;} while (0)
 
 const char const * const type_info_names[] = {
     "get_size_and_field_count",
     "fill_in_offsets",
-    "init_type_table"
+    "init_type_table",
+    "type descriptors"
 };
 
 void (* const type_info_tests[]) (void) = {
     t_get_size_and_field_count,
     t_fill_in_offsets,
-    t_init_type_table
+    t_init_type_table,
+    t_type_descriptors
 };
 
 const char const * const pool_names[] = {
@@ -30,7 +34,21 @@ const char const * const pool_names[] = {
     "pool_grow",
     "pool_shrink",
     "pool_destroy",
-    "(set|get)_field_reference"
+    "(set|get)_field_reference",
+    "pool_free",
+    "pool id reuse",
+    "pool_set_map_mode",
+    "pool_alloc_range",
+    "pool_alloc_shared",
+    "pool_set_page_mode",
+    "pool_(create|attach)_file",
+    "sub_pool_shift",
+    "pool_create_large",
+    "pool_provisioning",
+    "(get|set)_field(_reference)?_inline",
+    "(get|set)_field_batch",
+    "cache colored types",
+    "interleaved field groups"
 };
 
 void (* const pool_tests[]) (void) = {
@@ -41,7 +59,21 @@ void (* const pool_tests[]) (void) = {
     t_pool_grow,
     t_pool_shrink,
     t_pool_destroy,
-    t_set_and_get_field_reference
+    t_set_and_get_field_reference,
+    t_pool_free,
+    t_pool_id_reuse,
+    t_pool_map_mode,
+    t_pool_alloc_range,
+    t_pool_alloc_shared,
+    t_pool_page_mode,
+    t_pool_file,
+    t_pool_sub_pool_shift,
+    t_pool_create_large,
+    t_pool_provisioning,
+    t_field_inline,
+    t_field_batch,
+    t_pool_cache_colored,
+    t_pool_interleaved
 };
 
 const char const * const iterator_names[] = {
@@ -51,7 +83,8 @@ const char const * const iterator_names[] = {
     "iterator_list_insert",
     "iterator_list_remove",
     "iterator_btree",
-    "iterator_ntree"
+    "iterator_ntree",
+    "iterator_large_pool"
 };
 
 void (* const iterator_tests[]) (void) = {
@@ -61,17 +94,48 @@ void (* const iterator_tests[]) (void) = {
     t_iterator_list_insert,
     t_iterator_list_remove,
     t_iterator_btree,
-    t_iterator_ntree
+    t_iterator_ntree,
+    t_iterator_large_pool
 };
 
 const char const * const map_names[] = {
     "t_field_map",
-    "t_field_list_map"
+    "t_field_list_map",
+    "t_field_map_sub_pool_shift",
+    "t_field_map_large_pool",
+    "t_field_op_map",
+    "t_field_op_map_interleaved",
+    "t_field_map_parallel",
+    "t_field_reduce",
+    "t_field_reduce_interleaved",
+    "t_field_list_reduce",
+    "t_field_filter",
+    "t_field_filter_interleaved",
+    "t_field_zip_map",
+    "t_field_zip_map_interleaved",
+    "t_field_map_live",
+    "t_field_list_op_map",
+    "t_field_list_map_parallel"
 };
 
 void (* const map_tests[]) (void) = {
     t_field_map,
-    t_field_list_map
+    t_field_list_map,
+    t_field_map_sub_pool_shift,
+    t_field_map_large_pool,
+    t_field_op_map,
+    t_field_op_map_interleaved,
+    t_field_map_parallel,
+    t_field_reduce,
+    t_field_reduce_interleaved,
+    t_field_list_reduce,
+    t_field_filter,
+    t_field_filter_interleaved,
+    t_field_zip_map,
+    t_field_zip_map_interleaved,
+    t_field_map_live,
+    t_field_list_op_map,
+    t_field_list_map_parallel
 };
 
 const char const * const reference_table_names[] = {
@@ -93,13 +157,39 @@ void (* const reference_table_tests[]) (void) = {
 const char const * const gc_names[] = {
     "t_collect_list_pool",
     "t_collect_btree_pool",
-    "t_collect_ntree_pool"
+    "t_collect_ntree_pool",
+    "t_collect_grouped_list_pool"
 };
 
 void (* const gc_tests[]) (void) = {
     t_collect_list_pool,
     t_collect_btree_pool,
-    t_collect_ntree_pool
+    t_collect_ntree_pool,
+    t_collect_grouped_list_pool
+};
+
+const char const * const type_gen_names[] = {
+    "generated accessors",
+    "generated map",
+    "generated walk"
+};
+
+void (* const type_gen_tests[]) (void) = {
+    t_generated_accessors,
+    t_generated_map,
+    t_generated_walk
+};
+
+const char const * const ohmm_pool_names[] = {
+    "ohmm::pool layout",
+    "ohmm::pool get and set",
+    "ohmm::pool references"
+};
+
+void (* const ohmm_pool_tests[]) (void) = {
+    t_ohmm_pool_layout,
+    t_ohmm_pool_access,
+    t_ohmm_pool_references
 };
 
 int
@@ -132,6 +222,14 @@ main(void)
     if (NULL == gc_suite)
         DIE("suite for garbage collection");
 
+    CU_pSuite type_gen_suite = CU_add_suite("Type Generator Suite", NULL, NULL);
+    if (NULL == type_gen_suite)
+        DIE("suite for type generator");
+
+    CU_pSuite ohmm_pool_suite = CU_add_suite("C++ Pool Suite", NULL, NULL);
+    if (NULL == ohmm_pool_suite)
+        DIE("suite for C++ pools");
+
     for (unsigned i = 0 ; i < sizeof(type_info_names) / sizeof(void*) ; ++i)
         if (NULL == CU_add_test(type_info_suite,
                                 type_info_names[i],
@@ -168,6 +266,18 @@ main(void)
                                 gc_tests[i]))
             DIE(gc_names[i]);
 
+    for (unsigned i = 0 ; i < sizeof(type_gen_names) / sizeof(void*); ++i)
+        if (NULL == CU_add_test(type_gen_suite,
+                                type_gen_names[i],
+                                type_gen_tests[i]))
+            DIE(type_gen_names[i]);
+
+    for (unsigned i = 0 ; i < sizeof(ohmm_pool_names) / sizeof(void*); ++i)
+        if (NULL == CU_add_test(ohmm_pool_suite,
+                                ohmm_pool_names[i],
+                                ohmm_pool_tests[i]))
+            DIE(ohmm_pool_names[i]);
+
     CU_basic_set_mode(CU_BRM_VERBOSE);
     CU_basic_run_tests();
 
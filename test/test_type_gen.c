@@ -0,0 +1,142 @@
+#include "test_type_gen.h"
+
+void
+t_generated_accessors(void)
+{
+    CU_ASSERT_EQUAL(btree_check(), 0);
+    CU_ASSERT_EQUAL(composite_check(), 0);
+    CU_ASSERT_EQUAL(BTREE_POOL_TYPE, BTREE_TYPE_ID);
+    CU_ASSERT_EQUAL(PAIR_POOL_SUB_POOL_SHIFT, 9);
+
+    /* Fields of every size, in the same place as the library puts them */
+    pool_reference pool = pool_create(COMPOSITE_TYPE_2_ID);
+    CU_ASSERT_EQUAL(pool_grow(&pool, PAGE_SIZE + 3), 0);
+
+    int addr_errors = 0;
+    for (size_t i = 0 ; i < PAGE_SIZE + 3 ; i += 11) {
+        global_reference ref = pool_get_ref(pool, i);
+        addr_errors += (void*) composite_field_0(ref) != get_field(ref, 0);
+        addr_errors += (void*) composite_field_3(ref) != get_field(ref, 3);
+        addr_errors += (void*) composite_field_4(ref) != get_field(ref, 4);
+        addr_errors += (void*) composite_field_8(ref) != get_field(ref, 8);
+        addr_errors += composite_field_5_at(pool, i) != composite_field_5(ref);
+    }
+    CU_ASSERT_EQUAL(addr_errors, 0);
+
+    global_reference ref = pool_get_ref(pool, PAGE_SIZE + 1);
+    composite_set_1(ref, 'a');
+    composite_set_4(ref, 42);
+    CU_ASSERT_EQUAL(*(char*) get_field(ref, 1), 'a');
+    CU_ASSERT_EQUAL(*(uint64_t*) get_field(ref, 4), 42);
+    CU_ASSERT_EQUAL(composite_get_4(ref), 42);
+    pool_destroy(&pool);
+
+    /* Subpools of 512 pairs */
+    pool = pool_create(PAIR_TYPE_ID);
+    CU_ASSERT_EQUAL(pool_grow(&pool, 3*512 + 5), 0);
+    addr_errors = 0;
+    for (size_t i = 0 ; i < 3*512 + 5 ; ++i) {
+        ref = pool_get_ref(pool, i);
+        addr_errors += (void*) pair_field_0(ref) != get_field(ref, 0);
+        addr_errors += (void*) pair_field_1(ref) != get_field(ref, 1);
+        addr_errors += pair_field_1_at(pool, i) != pair_field_1(ref);
+    }
+    CU_ASSERT_EQUAL(addr_errors, 0);
+    pool_destroy(&pool);
+
+    /* Keys and values interleaved in groups of 16 bytes */
+    CU_ASSERT_EQUAL(KV_TREE_POOL_FIELD_3_STRIDE, 16);
+    pool = pool_create(KV_TREE_TYPE_ID);
+    CU_ASSERT_EQUAL(pool_grow(&pool, PAGE_SIZE + 3), 0);
+    addr_errors = 0;
+    for (size_t i = 0 ; i < PAGE_SIZE + 3 ; i += 7) {
+        ref = pool_get_ref(pool, i);
+        addr_errors += (void*) kv_tree_field_1(ref) != get_field(ref, 1);
+        addr_errors += (void*) kv_tree_field_2(ref) != get_field(ref, 2);
+        addr_errors += (void*) kv_tree_field_3(ref) != get_field(ref, 3);
+        addr_errors += kv_tree_field_3_at(pool, i) != kv_tree_field_3(ref);
+    }
+    CU_ASSERT_EQUAL(addr_errors, 0);
+
+    KV_TREE_POOL_MAP_3(pool, i, v, *v = 3*i;);
+    int value_errors = 0;
+    for (size_t i = 0 ; i < PAGE_SIZE + 3 ; ++i)
+        value_errors += *(uint64_t*) get_field(pool_get_ref(pool, i), 3) != 3*i;
+    CU_ASSERT_EQUAL(value_errors, 0);
+    pool_destroy(&pool);
+}
+
+void
+t_generated_map(void)
+{
+    pool_reference pool = pool_create(PAIR_TYPE_ID);
+    const size_t n = 3*512 + 5;
+    CU_ASSERT_EQUAL(pool_grow(&pool, n), 0);
+
+    PAIR_POOL_MAP_0(pool, i, x, *x = i;);
+    PAIR_POOL_MAP_1(pool, i, y, *y = 2*i;);
+
+    int value_errors = 0;
+    for (size_t i = 0 ; i < n ; ++i) {
+        global_reference ref = pool_get_ref(pool, i);
+        value_errors += *(uint64_t*) get_field(ref, 0) != i;
+        value_errors += *(uint64_t*) get_field(ref, 1) != 2*i;
+    }
+    CU_ASSERT_EQUAL(value_errors, 0);
+
+    uint64_t sum = 0;
+    size_t count = 0;
+    PAIR_POOL_MAP_1(pool, i, y, sum += *y; count++;);
+    CU_ASSERT_EQUAL(count, n);
+    CU_ASSERT_EQUAL(sum, n*(n - 1));
+
+    /* An empty pool runs no iterations */
+    pool_reference empty = pool_create(PAIR_TYPE_ID);
+    count = 0;
+    PAIR_POOL_MAP_0(empty, i, x, count += *x + 1;);
+    CU_ASSERT_EQUAL(count, 0);
+
+    pool_destroy(&empty);
+    pool_destroy(&pool);
+}
+
+void
+t_generated_walk(void)
+{
+    pool_reference pool = pool_create(LIST_TYPE_ID);
+    const size_t n = 5000;
+    CU_ASSERT_EQUAL(pool_grow(&pool, n), 0);
+
+    /* Link every other node, backwards, with one long reference */
+    global_reference head = pool_get_ref(pool, n - 2);
+    int link_errors = 0;
+    for (size_t i = n - 2 ; i >= 2 ; i -= 2) {
+        global_reference node = pool_get_ref(pool, i);
+        list_set_1(node, i);
+        link_errors += list_set_0(node, pool_get_ref(pool, i - 2));
+    }
+    CU_ASSERT_EQUAL(link_errors, 0);
+    global_reference last = pool_get_ref(pool, 0);
+    list_set_1(last, 0);
+    CU_ASSERT_EQUAL(list_set_0(pool_get_ref(pool, n - 2), last), 0);
+    CU_ASSERT_EQUAL(list_get_0(head), last);
+
+    CU_ASSERT_EQUAL(list_get_0(last), NULL_REF);
+    CU_ASSERT_EQUAL(list_get_0(pool_get_ref(pool, 10)), pool_get_ref(pool, 8));
+
+    size_t count = 0;
+    uint64_t sum = 0;
+    LIST_POOL_WALK_0(head, node, count++; sum += list_get_1(node););
+    CU_ASSERT_EQUAL(count, 2);
+    CU_ASSERT_EQUAL(sum, n - 2);
+
+    /* Past the shortcut the walk visits every other node */
+    count = 0;
+    sum = 0;
+    LIST_POOL_WALK_0(pool_get_ref(pool, n - 4), node,
+                     count++; sum += list_get_1(node););
+    CU_ASSERT_EQUAL(count, (n - 4) / 2 + 1);
+    CU_ASSERT_EQUAL(sum, (n - 4)*((n - 4) / 2 + 1) / 2);
+
+    pool_destroy(&pool);
+}
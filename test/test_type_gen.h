@@ -0,0 +1,29 @@
+#ifndef __TEST_TYPE_GEN_H__
+#define __TEST_TYPE_GEN_H__
+
+#include "CUnit/Basic.h"
+#include "pool.h"
+#include "basic_types.h"
+#include "pool_iterator.h"
+#include "pool_private.h"
+
+/*
+ * The headers below are written by type_gen at build time, from the basic
+ * types in basic_types.c.
+ */
+#include "btree_pool.h"
+#include "list_pool.h"
+#include "pair_pool.h"
+#include "composite_pool.h"
+#include "kv_tree_pool.h"
+
+void
+t_generated_accessors(void);
+
+void
+t_generated_map(void);
+
+void
+t_generated_walk(void);
+
+#endif
@@ -1,132 +1,35 @@
+#include <errno.h>
+
 #include "test_type_info.h"
+#include "pool_private.h"
 
 
-static const struct type_info ti_primitive_0 = {
-    .type_id = CHAR_TYPE_ID,
+/* 11 << 8 bytes is not a whole number of pages */
+static const struct type_info ti_bad_shift = {
+    .type_id = 0,
     .type_class = PRIMITIVE_TYPE,
-    .primitive_size = 1
+    .sub_pool_shift = 8,
+    .primitive_size = 11
 };
 
-static const struct type_info ti_primitive_1 = {
-    .type_id = LONG_TYPE_ID,
+/* Field arrays of 4 GB or more, with a shift and with the default one */
+static const struct type_info ti_wide_shift = {
+    .type_id = 0,
     .type_class = PRIMITIVE_TYPE,
-    .primitive_size = 8
-};
-
-static const struct type_info ti_global_ref_0 = {
-    .type_id = CHAR_REF_TYPE_ID,
-    .type_class = GLOBAL_REF_TYPE,
-    .referee_type_id = CHAR_TYPE_ID 
-};
-
-static const struct composite_container_0 {
-    const struct type_info ti_composite_0;
-    Type_info        fields[4];
-} container_0 = {
-    .ti_composite_0 = { 
-        .type_id = COMPOSITE_TYPE_1_ID ,
-        .type_class = COMPOSITE_TYPE,
-        .field_count= 4},
-    .fields = { 
-        &ti_primitive_0,
-        &ti_primitive_0,
-        &ti_primitive_0,
-        &ti_primitive_1 }
-};
-
-static const struct composite_container_1 {
-    const struct type_info ti_composite_1;
-    Type_info        fields[3];
-} container_1 = {
-    .ti_composite_1 = { 
-        .type_id = COMPOSITE_TYPE_2_ID,
-        .type_class = COMPOSITE_TYPE,
-        .field_count= 3},
-    .fields = { 
-        &ti_primitive_1,
-        &container_0.ti_composite_0,
-        &container_0.ti_composite_0 }
-};
-
-static const struct type_info ti_list_global_ref = {
-    .type_id = LIST_GLOBAL_REF_TYPE_ID,
-    .type_class = GLOBAL_REF_TYPE,
-    .referee_type_id = LIST_TYPE_ID
+    .sub_pool_shift = 20,
+    .primitive_size = (size_t) 1 << 16
 };
 
-static const struct type_info ti_list_local_ref = {
-    .type_id = LIST_LOCAL_REF_TYPE_ID,
-    .type_class = LOCAL_REF_TYPE,
-    .referee_type_id = LIST_TYPE_ID
-};
-
-static const struct list_container {
-    const struct type_info ti_list;
-    Type_info    fields[3];
-} list_container = {
-    .ti_list = {
-        .type_id = LIST_TYPE_ID,
-        .type_class = COMPOSITE_TYPE,
-        .field_count = 3 },
-    .fields = {
-        &ti_list_local_ref,
-        &ti_primitive_1,
-        &ti_primitive_1,
-    }
-};
-
-static const struct type_info ti_btree_local_ref = {
-    .type_id = BTREE_LOCAL_REF_TYPE_ID,
-    .type_class = LOCAL_REF_TYPE,
-    .referee_type_id = BTREE_TYPE_ID
-};
-
-static const struct btree_container {
-    const struct type_info ti_btree;
-    Type_info    fields[4];
-} btree_container = {
-    .ti_btree = {
-        .type_id = BTREE_TYPE_ID,
-        .type_class = COMPOSITE_TYPE,
-        .field_count = 4 },
-    .fields = {
-        &ti_btree_local_ref,
-        &ti_btree_local_ref,
-	&ti_primitive_1,
-        &ti_primitive_1 }
-};
-
-static const struct type_info ti_otree_local_ref = {
-    .type_id = OTREE_LOCAL_REF_TYPE_ID,
-    .type_class = LOCAL_REF_TYPE,
-    .referee_type_id = OTREE_TYPE_ID
-};
-
-static const struct otree_container {
-    const struct type_info ti_otree;
-    Type_info fields[10];
-} otree_container = {
-    .ti_otree = {
-        .type_id = OTREE_TYPE_ID,
-        .type_class = COMPOSITE_TYPE,
-        .field_count = 10 },
-    .fields = {
-        &ti_otree_local_ref,
-        &ti_otree_local_ref,
-        &ti_otree_local_ref,
-        &ti_otree_local_ref,
-        &ti_otree_local_ref,
-        &ti_otree_local_ref,
-        &ti_otree_local_ref,
-        &ti_otree_local_ref,
-        &ti_primitive_1, 
-        &ti_primitive_1 }
+static const struct type_info ti_wide_default_shift = {
+    .type_id = 0,
+    .type_class = PRIMITIVE_TYPE,
+    .primitive_size = (size_t) 1 << 20
 };
 
-static const struct type_info ti_reference_table_entry = {
-    .type_id = REFERENCE_TABLE_ENTRY,
+static const struct type_info ti_huge_field = {
+    .type_id = 0,
     .type_class = PRIMITIVE_TYPE,
-    .primitive_size = 16
+    .primitive_size = (size_t) 1 << 24
 };
 
 void
@@ -139,7 +42,7 @@ t_get_size_and_field_count(void)
     size_t ti_primitive_0_size;
     size_t ti_primitive_0_field_count;
 
-    get_size_and_field_count(&ti_primitive_0, 
+    get_size_and_field_count(basic_type_info(CHAR_TYPE_ID), 
                              &ti_primitive_0_size, 
                              &ti_primitive_0_field_count);
 
@@ -150,7 +53,7 @@ t_get_size_and_field_count(void)
     size_t ti_primitive_1_size;
     size_t ti_primitive_1_field_count;
 
-    get_size_and_field_count(&ti_primitive_1, 
+    get_size_and_field_count(basic_type_info(LONG_TYPE_ID), 
                              &ti_primitive_1_size, 
                              &ti_primitive_1_field_count);
 
@@ -161,7 +64,7 @@ t_get_size_and_field_count(void)
     size_t ti_global_ref_0_size;
     size_t ti_global_ref_0_field_count;
 
-    get_size_and_field_count(&ti_global_ref_0,
+    get_size_and_field_count(basic_type_info(CHAR_REF_TYPE_ID),
                              &ti_global_ref_0_size,
                              &ti_global_ref_0_field_count);
 
@@ -172,7 +75,7 @@ t_get_size_and_field_count(void)
     size_t ti_composite_0_size;
     size_t ti_composite_0_field_count;
 
-    get_size_and_field_count(&container_0.ti_composite_0, 
+    get_size_and_field_count(basic_type_info(COMPOSITE_TYPE_1_ID), 
                              &ti_composite_0_size, 
                              &ti_composite_0_field_count);
 
@@ -183,7 +86,7 @@ t_get_size_and_field_count(void)
 
     size_t ti_composite_1_size;
     size_t ti_composite_1_field_count;
-    get_size_and_field_count(&container_1.ti_composite_1, 
+    get_size_and_field_count(basic_type_info(COMPOSITE_TYPE_2_ID), 
                              &ti_composite_1_size, 
                              &ti_composite_1_field_count);
 
@@ -196,20 +99,24 @@ t_fill_in_offsets(void)
 {
     /* First test a simple primitive type, a char */
     size_t base_offset = 0u;
-    struct field_offset fo_primitive_0 = {0xDEAD, 0xDEADBEEF, 0xBABEFACE};
+    struct field_offset fo_primitive_0 = {0xDEAD, 0xDEADBEEF, 0xBABEFACE,
+                                           0xDEAD, 0xBEEF};
     (void) fill_in_offsets(&fo_primitive_0,
-			   &ti_primitive_0,
+			   basic_type_info(CHAR_TYPE_ID),
 			   &base_offset);
 
     CU_ASSERT_EQUAL(base_offset, 1u);
     CU_ASSERT_EQUAL(fo_primitive_0.field_size, 1u);
     CU_ASSERT_EQUAL(fo_primitive_0.offset, 0u);
+    CU_ASSERT_EQUAL(fo_primitive_0.group_size, 0u);
+    CU_ASSERT_EQUAL(fo_primitive_0.group_offset, 0u);
 
     /* Test of another primitive (reference) type */
     base_offset = 10u;
-    struct field_offset fo_global_ref_0 = {0xDEAD, 0xDEADBEEF, 0xBABEFACE};
+    struct field_offset fo_global_ref_0 = {0xDEAD, 0xDEADBEEF, 0xBABEFACE,
+                                           0xDEAD, 0xBEEF};
     (void) fill_in_offsets(&fo_global_ref_0,
-			   &ti_global_ref_0,
+			   basic_type_info(CHAR_REF_TYPE_ID),
 			   &base_offset);
 
     CU_ASSERT_EQUAL(base_offset, 10u + 8u);
@@ -220,7 +127,7 @@ t_fill_in_offsets(void)
     base_offset = 0u;
     struct field_offset fo_composite_0[4];
     (void) fill_in_offsets(fo_composite_0,
-			   &container_0.ti_composite_0,
+			   basic_type_info(COMPOSITE_TYPE_1_ID),
 			   &base_offset);
 
     CU_ASSERT_EQUAL(base_offset, 11u);
@@ -237,7 +144,7 @@ t_fill_in_offsets(void)
     base_offset = 0u;
     struct field_offset fo_composite_1[9];
     (void) fill_in_offsets(fo_composite_1,
-			   &container_1.ti_composite_1,
+			   basic_type_info(COMPOSITE_TYPE_2_ID),
 			   &base_offset);
 
     CU_ASSERT_EQUAL(base_offset, 30u);
@@ -266,33 +173,47 @@ t_fill_in_offsets(void)
     CU_ASSERT_EQUAL(fo_composite_1[7].offset, 21);
     CU_ASSERT_EQUAL(fo_composite_1[8].field_size, 8);
     CU_ASSERT_EQUAL(fo_composite_1[8].offset, 22);
-}
+    CU_ASSERT_EQUAL(fo_composite_1[8].group_size, 0);
+
+    /* Interleaved groups are padded to a power of two */
+    base_offset = 0u;
+    struct field_offset fo_kv_tree[4];
+    (void) fill_in_offsets(fo_kv_tree,
+                           basic_type_info(KV_TREE_TYPE_ID),
+                           &base_offset);
+
+    CU_ASSERT_EQUAL(base_offset, 20u);
+    CU_ASSERT_EQUAL(fo_kv_tree[1].offset, 2);
+    CU_ASSERT_EQUAL(fo_kv_tree[1].group_size, 0);
+    CU_ASSERT_EQUAL(fo_kv_tree[2].offset, 4);
+    CU_ASSERT_EQUAL(fo_kv_tree[2].group_size, 16);
+    CU_ASSERT_EQUAL(fo_kv_tree[2].group_offset, 0);
+    CU_ASSERT_EQUAL(fo_kv_tree[3].offset, 12);
+    CU_ASSERT_EQUAL(fo_kv_tree[3].group_size, 16);
+    CU_ASSERT_EQUAL(fo_kv_tree[3].group_offset, 8);
 
-int 
-add_basic_types(void) {
-    Type_info type_infos[] = {
-        &ti_primitive_0,
-        &ti_primitive_1,
-        &ti_global_ref_0,
-        &container_0.ti_composite_0,
-        &container_1.ti_composite_1,
-        &ti_list_global_ref,
-        &ti_list_local_ref,
-        &list_container.ti_list,
-        &ti_btree_local_ref,
-        &btree_container.ti_btree,
-        &ti_otree_local_ref,
-        &otree_container.ti_otree,
-        &ti_reference_table_entry
-    };
-
-    return init_type_table(sizeof(type_infos) / sizeof(void*),
-			               type_infos);
+    base_offset = 0u;
+    struct field_offset fo_grouped_list[3];
+    (void) fill_in_offsets(fo_grouped_list,
+                           basic_type_info(GROUPED_LIST_TYPE_ID),
+                           &base_offset);
+
+    CU_ASSERT_EQUAL(base_offset, 32u);
+    CU_ASSERT_EQUAL(fo_grouped_list[2].offset, 10);
+    CU_ASSERT_EQUAL(fo_grouped_list[2].group_size, 32);
+    CU_ASSERT_EQUAL(fo_grouped_list[2].group_offset, 10);
 }
 
 void
 t_init_type_table(void)
 {
+    Type_info bad_types[] = { &ti_bad_shift };
+    CU_ASSERT_EQUAL(init_type_table(1, bad_types), EINVAL);
+    bad_types[0] = &ti_wide_shift;
+    CU_ASSERT_EQUAL(init_type_table(1, bad_types), EINVAL);
+    bad_types[0] = &ti_wide_default_shift;
+    CU_ASSERT_EQUAL(init_type_table(1, bad_types), EINVAL);
+
     int init_result = add_basic_types();
 
     CU_ASSERT_EQUAL(init_result, 0);
@@ -356,5 +277,85 @@ t_init_type_table(void)
     CU_ASSERT_EQUAL(type_table[4].field_offsets[6].offset, 20);
     CU_ASSERT_EQUAL(type_table[4].field_offsets[7].offset, 21);
     CU_ASSERT_EQUAL(type_table[4].field_offsets[8].offset, 22);
+
+    /* Subpool shifts */
+    CU_ASSERT_EQUAL(type_table[LONG_TYPE_ID].sub_pool_shift,
+                    DEFAULT_SUB_POOL_SHIFT);
+    CU_ASSERT_EQUAL(type_table[LONG_COLUMN_TYPE_ID].sub_pool_shift, 16);
+    CU_ASSERT_EQUAL(type_table[PAIR_TYPE_ID].sub_pool_shift, 9);
+    CU_ASSERT_EQUAL(type_table[PAIR_TYPE_ID].type_size, 16u);
+}
+
+void
+t_type_descriptors(void)
+{
+    Type_info huge_types[] = { &ti_huge_field };
+    CU_ASSERT_EQUAL(init_type_table(1, huge_types), EINVAL);
+
+    CU_ASSERT_EQUAL(add_basic_types(), 0);
+
+    CU_ASSERT_PTR_NULL(get_type_descriptor(GROUPED_LIST_TYPE_ID + 1));
+
+    /* Descriptors start on cache lines, at a fixed distance */
+    CU_ASSERT(type_descriptor_shift >= 6);
+    CU_ASSERT_EQUAL((uintptr_t) type_descriptors % 64, 0);
+    CU_ASSERT_PTR_EQUAL(get_type_descriptor(OTREE_TYPE_ID),
+                        type_descriptors +
+                        ((size_t) OTREE_TYPE_ID << type_descriptor_shift));
+
+    /* Five fields fit in a cache line along with the header */
+    CU_ASSERT(sizeof(type_descriptor) + 5*sizeof(field_descriptor) <= 64);
+
+    const type_descriptor *comp = get_type_descriptor(COMPOSITE_TYPE_2_ID);
+    CU_ASSERT_EQUAL(comp->type_id, COMPOSITE_TYPE_2_ID);
+    CU_ASSERT_EQUAL(comp->type_class, COMPOSITE_TYPE);
+    CU_ASSERT_EQUAL(comp->type_size, 30u);
+    CU_ASSERT_EQUAL(comp->field_count, 9u);
+    CU_ASSERT_EQUAL(comp->local_ref_count, 0);
+    CU_ASSERT_EQUAL(comp->sub_pool_size, (size_t) 30 << DEFAULT_SUB_POOL_SHIFT);
+    CU_ASSERT_EQUAL(comp->fields[4].offset, 11u << DEFAULT_SUB_POOL_SHIFT);
+    CU_ASSERT_EQUAL(comp->fields[4].size, 8u);
+    CU_ASSERT_EQUAL(comp->fields[4].stride_shift, 3u);
+    CU_ASSERT_EQUAL(comp->fields[5].stride_shift, 0u);
+
+    const type_descriptor *comp_1 = get_type_descriptor(COMPOSITE_TYPE_1_ID);
+    CU_ASSERT_EQUAL(comp_1->type_size, 11u);
+    CU_ASSERT_EQUAL(get_type_descriptor(CHAR_TYPE_ID)->fields[0].stride_shift, 0u);
+
+    /* Leading local references */
+    CU_ASSERT_EQUAL(get_type_descriptor(LIST_TYPE_ID)->local_ref_count, 1);
+    CU_ASSERT_EQUAL(get_type_descriptor(BTREE_TYPE_ID)->local_ref_count, 2);
+    CU_ASSERT_EQUAL(get_type_descriptor(OTREE_TYPE_ID)->local_ref_count, 8);
+    CU_ASSERT_EQUAL(get_type_descriptor(PAIR_TYPE_ID)->sub_pool_shift, 9);
+    CU_ASSERT_EQUAL(get_type_descriptor(PAIR_TYPE_ID)->sub_pool_size,
+                    16u << 9);
+
+    /* Colored types stagger their fields, and pad the subpool by a page */
+    const type_descriptor *wide = get_type_descriptor(WIDE_TYPE_ID);
+    const type_descriptor *colored = get_type_descriptor(WIDE_COLORED_TYPE_ID);
+    CU_ASSERT_EQUAL(wide->pool_color_mask, 0);
+    CU_ASSERT_EQUAL(colored->pool_color_mask, POOL_COLORS - 1);
+    CU_ASSERT_EQUAL(colored->sub_pool_size, wide->sub_pool_size + 4096);
+    for (size_t f = 0 ; f < 8 ; ++f) {
+        CU_ASSERT_EQUAL(wide->fields[f].offset % 4096, 0);
+        CU_ASSERT_EQUAL(colored->fields[f].offset,
+                        wide->fields[f].offset + 64*f);
+    }
+
+    /* Fields of a group share an array, strided by the group */
+    const type_descriptor *kv_tree = get_type_descriptor(KV_TREE_TYPE_ID);
+    CU_ASSERT_EQUAL(kv_tree->type_size, 20u);
+    CU_ASSERT_EQUAL(kv_tree->local_ref_count, 2);
+    CU_ASSERT_EQUAL(kv_tree->fields[1].offset, 2u << DEFAULT_SUB_POOL_SHIFT);
+    CU_ASSERT_EQUAL(kv_tree->fields[1].stride_shift, 1u);
+    CU_ASSERT_EQUAL(kv_tree->fields[2].offset, 4u << DEFAULT_SUB_POOL_SHIFT);
+    CU_ASSERT_EQUAL(kv_tree->fields[3].offset,
+                    (4u << DEFAULT_SUB_POOL_SHIFT) + 8);
+    CU_ASSERT_EQUAL(kv_tree->fields[3].size, 8u);
+    CU_ASSERT_EQUAL(kv_tree->fields[3].stride_shift, 4u);
+
+    const type_descriptor *kv = get_type_descriptor(KV_TYPE_ID);
+    CU_ASSERT_EQUAL(kv->fields[1].offset, 8u);
+    CU_ASSERT_EQUAL(kv->fields[1].stride_shift, 4u);
 }
 